@@ -36,6 +36,50 @@ typedef struct {
                                            // part of ACPI tables.
 } BLOB;
 
+//
+// A distinct address that QEMU_LOADER_ADD_POINTER commands point to. Each
+// such address is recorded once, in script order, while the commands are
+// processed; after the script has been processed completely, the recorded
+// addresses are checked for ACPI tables, and the tables are installed.
+//
+typedef struct {
+  UINT64    PointerValue;                  // The absolute address pointed to.
+                                           // This is the ordering / search
+                                           // key.
+  BLOB      *Blob;                         // The blob that PointerValue points
+                                           // into.
+  UINT32    ChecksumLength;                // Nonzero iff a
+                                           // QEMU_LOADER_ADD_CHECKSUM command
+                                           // has filled in the Checksum field
+                                           // of an EFI_ACPI_DESCRIPTION_HEADER
+                                           // at PointerValue, over a range of
+                                           // this many bytes.
+} POINTEE;
+
+//
+// A QEMU_LOADER_ADD_CHECKSUM command that has been validated, with its blob
+// looked up, but whose checksum has not been computed yet.
+//
+typedef struct {
+  CONST QEMU_LOADER_ADD_CHECKSUM    *AddChecksum;
+  BLOB                              *Blob;
+} PENDING_CHECKSUM;
+
+//
+// The state collected by the processing of the linker/loader script, and
+// consumed once the script has been processed completely.
+//
+typedef struct {
+  POINTEE               *Pointees;         // Distinct ADD_POINTER targets, in
+                                           // script order.
+  UINTN                 NumPointees;
+  ORDERED_COLLECTION    *PointeeIndex;     // Links the elements of Pointees,
+                                           // keyed by PointerValue.
+  PENDING_CHECKSUM      *Checksums;        // ADD_CHECKSUM commands, in script
+                                           // order.
+  UINTN                 NumChecksums;
+} LOADER_FIXUPS;
+
 /**
   Compare a standalone key against a user structure containing an embedded key.
 
@@ -92,39 +136,70 @@ BlobCompare (
 }
 
 /**
-  Comparator function for two opaque pointers, ordering on (unsigned) pointer
-  value itself.
-  Can be used as both Key and UserStruct comparator.
+  Compare a standalone POINTEE key against a POINTEE user structure.
 
-  @param[in] Pointer1  First pointer.
+  @param[in] StandaloneKey  Pointer to the bare UINT64 key (PointerValue).
 
-  @param[in] Pointer2  Second pointer.
+  @param[in] UserStruct     Pointer to the POINTEE user structure.
 
-  @retval <0  If Pointer1 compares less than Pointer2.
+  @retval <0  If StandaloneKey compares less than UserStruct's key.
 
-  @retval  0  If Pointer1 compares equal to Pointer2.
+  @retval  0  If StandaloneKey compares equal to UserStruct's key.
 
-  @retval >0  If Pointer1 compares greater than Pointer2.
+  @retval >0  If StandaloneKey compares greater than UserStruct's key.
 **/
 STATIC
 INTN
 EFIAPI
-PointerCompare (
-  IN CONST VOID  *Pointer1,
-  IN CONST VOID  *Pointer2
+PointeeKeyCompare (
+  IN CONST VOID  *StandaloneKey,
+  IN CONST VOID  *UserStruct
   )
 {
-  if (Pointer1 == Pointer2) {
+  UINT64         Key;
+  CONST POINTEE  *Pointee;
+
+  Key     = *(CONST UINT64 *)StandaloneKey;
+  Pointee = UserStruct;
+
+  if (Key == Pointee->PointerValue) {
     return 0;
   }
 
-  if ((UINTN)Pointer1 < (UINTN)Pointer2) {
+  if (Key < Pointee->PointerValue) {
     return -1;
   }
 
   return 1;
 }
 
+/**
+  Comparator function for two POINTEE user structures.
+
+  @param[in] UserStruct1  Pointer to the first POINTEE.
+
+  @param[in] UserStruct2  Pointer to the second POINTEE.
+
+  @retval <0  If UserStruct1 compares less than UserStruct2.
+
+  @retval  0  If UserStruct1 compares equal to UserStruct2.
+
+  @retval >0  If UserStruct1 compares greater than UserStruct2.
+**/
+STATIC
+INTN
+EFIAPI
+PointeeCompare (
+  IN CONST VOID  *UserStruct1,
+  IN CONST VOID  *UserStruct2
+  )
+{
+  CONST POINTEE  *Pointee1;
+
+  Pointee1 = UserStruct1;
+  return PointeeKeyCompare (&Pointee1->PointerValue, UserStruct2);
+}
+
 /**
   Comparator function for two ASCII strings. Can be used as both Key and
   UserStruct comparator.
@@ -275,6 +350,84 @@ RollBack:
   return Status;
 }
 
+/**
+  Release the LOADER_FIXUPS structure populated by InitLoaderFixups() and the
+  processing of the linker/loader script.
+
+  This function may be called by InitLoaderFixups() itself, on the error path.
+
+  @param[in,out] Fixups  The LOADER_FIXUPS structure to release.
+**/
+STATIC
+VOID
+ReleaseLoaderFixups (
+  IN OUT LOADER_FIXUPS  *Fixups
+  )
+{
+  ORDERED_COLLECTION_ENTRY  *Entry, *Entry2;
+
+  if (Fixups->PointeeIndex != NULL) {
+    for (Entry = OrderedCollectionMin (Fixups->PointeeIndex);
+         Entry != NULL;
+         Entry = Entry2)
+    {
+      Entry2 = OrderedCollectionNext (Entry);
+      OrderedCollectionDelete (Fixups->PointeeIndex, Entry, NULL);
+    }
+
+    OrderedCollectionUninit (Fixups->PointeeIndex);
+  }
+
+  if (Fixups->Checksums != NULL) {
+    FreePool (Fixups->Checksums);
+  }
+
+  if (Fixups->Pointees != NULL) {
+    FreePool (Fixups->Pointees);
+  }
+
+  ZeroMem (Fixups, sizeof *Fixups);
+}
+
+/**
+  Allocate the arrays and the index of a LOADER_FIXUPS structure.
+
+  No command can produce more than one element in either array, hence the
+  number of entries in the linker/loader script bounds both. (At least one
+  element is allocated, so that an empty script is not mistaken for an
+  allocation failure.)
+
+  @param[out] Fixups      The LOADER_FIXUPS structure to initialize.
+
+  @param[in]  NumEntries  The number of entries in the linker/loader script.
+
+  @retval EFI_SUCCESS           Fixups has been initialized.
+
+  @retval EFI_OUT_OF_RESOURCES  Memory allocation failed.
+**/
+STATIC
+EFI_STATUS
+InitLoaderFixups (
+  OUT LOADER_FIXUPS  *Fixups,
+  IN  UINTN          NumEntries
+  )
+{
+  ZeroMem (Fixups, sizeof *Fixups);
+
+  NumEntries           = MAX (NumEntries, 1);
+  Fixups->Pointees     = AllocatePool (NumEntries * sizeof *Fixups->Pointees);
+  Fixups->Checksums    = AllocatePool (NumEntries * sizeof *Fixups->Checksums);
+  Fixups->PointeeIndex = OrderedCollectionInit (PointeeCompare, PointeeKeyCompare);
+  if ((Fixups->Pointees == NULL) || (Fixups->Checksums == NULL) ||
+      (Fixups->PointeeIndex == NULL))
+  {
+    ReleaseLoaderFixups (Fixups);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  return EFI_SUCCESS;
+}
+
 /**
   Process a QEMU_LOADER_ALLOCATE command.
 
@@ -434,28 +587,37 @@ FreePages:
   @param[in] Tracker     The ORDERED_COLLECTION tracking the BLOB user
                          structures created thus far.
 
-  @retval EFI_PROTOCOL_ERROR  Malformed fw_cfg file name(s) have been found in
-                              AddPointer, or the AddPointer command references
-                              a file unknown to Tracker, or the pointer to
-                              relocate has invalid location, size, or value, or
-                              the relocated pointer value is not representable
-                              in the given pointer size.
-
-  @retval EFI_SUCCESS         The pointer field inside the pointer blob has
-                              been relocated.
+  @param[in,out] Fixups  The LOADER_FIXUPS structure. If the relocated pointer
+                         value has not been seen before, it is appended to
+                         Fixups->Pointees.
+
+  @retval EFI_PROTOCOL_ERROR    Malformed fw_cfg file name(s) have been found
+                                in AddPointer, or the AddPointer command
+                                references a file unknown to Tracker, or the
+                                pointer to relocate has invalid location, size,
+                                or value, or the relocated pointer value is not
+                                representable in the given pointer size.
+
+  @retval EFI_OUT_OF_RESOURCES  Memory allocation failed.
+
+  @retval EFI_SUCCESS           The pointer field inside the pointer blob has
+                                been relocated.
 **/
 STATIC
 EFI_STATUS
 EFIAPI
 ProcessCmdAddPointer (
   IN CONST QEMU_LOADER_ADD_POINTER  *AddPointer,
-  IN CONST ORDERED_COLLECTION       *Tracker
+  IN CONST ORDERED_COLLECTION       *Tracker,
+  IN OUT LOADER_FIXUPS              *Fixups
   )
 {
   ORDERED_COLLECTION_ENTRY  *TrackerEntry, *TrackerEntry2;
   BLOB                      *Blob, *Blob2;
   UINT8                     *PointerField;
   UINT64                    PointerValue;
+  POINTEE                   *Pointee;
+  EFI_STATUS                Status;
 
   if ((AddPointer->PointerFile[QEMU_LOADER_FNAME_SIZE - 1] != '\0') ||
       (AddPointer->PointeeFile[QEMU_LOADER_FNAME_SIZE - 1] != '\0'))
@@ -528,6 +690,22 @@ ProcessCmdAddPointer (
 
   CopyMem (PointerField, &PointerValue, AddPointer->PointerSize);
 
+  //
+  // Remember the target for ACPI table installation, unless another
+  // QEMU_LOADER_ADD_POINTER command has pointed to it already.
+  //
+  Pointee                 = &Fixups->Pointees[Fixups->NumPointees];
+  Pointee->PointerValue   = PointerValue;
+  Pointee->Blob           = Blob2;
+  Pointee->ChecksumLength = 0;
+
+  Status = OrderedCollectionInsert (Fixups->PointeeIndex, NULL, Pointee);
+  if (Status == RETURN_ALREADY_STARTED) {
+    Status = EFI_SUCCESS;
+  } else if (!EFI_ERROR (Status)) {
+    ++Fixups->NumPointees;
+  }
+
   DEBUG ((
     DEBUG_VERBOSE,
     "%a: PointerFile=\"%a\" PointeeFile=\"%a\" "
@@ -538,34 +716,43 @@ ProcessCmdAddPointer (
     AddPointer->PointerOffset,
     AddPointer->PointerSize
     ));
-  return EFI_SUCCESS;
+  return Status;
 }
 
 /**
   Process a QEMU_LOADER_ADD_CHECKSUM command.
 
+  The command is only validated here; the checksum itself is computed by
+  ApplyPendingChecksums(), after all pointers have been relocated. That way
+  each range is summed exactly once, over its final contents.
+
   @param[in] AddChecksum  The QEMU_LOADER_ADD_CHECKSUM command to process.
 
   @param[in] Tracker      The ORDERED_COLLECTION tracking the BLOB user
                           structures created thus far.
 
+  @param[in,out] Fixups   The LOADER_FIXUPS structure. The command is appended
+                          to Fixups->Checksums.
+
   @retval EFI_PROTOCOL_ERROR  Malformed fw_cfg file name has been found in
                               AddChecksum, or the AddChecksum command
                               references a file unknown to Tracker, or the
                               range to checksum is invalid.
 
-  @retval EFI_SUCCESS         The requested range has been checksummed.
+  @retval EFI_SUCCESS         The checksum request has been queued.
 **/
 STATIC
 EFI_STATUS
 EFIAPI
 ProcessCmdAddChecksum (
   IN CONST QEMU_LOADER_ADD_CHECKSUM  *AddChecksum,
-  IN CONST ORDERED_COLLECTION        *Tracker
+  IN CONST ORDERED_COLLECTION        *Tracker,
+  IN OUT LOADER_FIXUPS               *Fixups
   )
 {
   ORDERED_COLLECTION_ENTRY  *TrackerEntry;
   BLOB                      *Blob;
+  PENDING_CHECKSUM          *Pending;
 
   if (AddChecksum->File[QEMU_LOADER_FNAME_SIZE - 1] != '\0') {
     DEBUG ((DEBUG_ERROR, "%a: malformed file name\n", __FUNCTION__));
@@ -597,10 +784,10 @@ ProcessCmdAddChecksum (
     return EFI_PROTOCOL_ERROR;
   }
 
-  Blob->Base[AddChecksum->ResultOffset] = CalculateCheckSum8 (
-                                            Blob->Base + AddChecksum->Start,
-                                            AddChecksum->Length
-                                            );
+  Pending              = &Fixups->Checksums[Fixups->NumChecksums++];
+  Pending->AddChecksum = AddChecksum;
+  Pending->Blob        = Blob;
+
   DEBUG ((
     DEBUG_VERBOSE,
     "%a: File=\"%a\" ResultOffset=0x%x Start=0x%x "
@@ -614,6 +801,59 @@ ProcessCmdAddChecksum (
   return EFI_SUCCESS;
 }
 
+/**
+  Compute the checksums queued by ProcessCmdAddChecksum(), in script order.
+
+  QEMU emits each QEMU_LOADER_ADD_CHECKSUM command after all the commands that
+  modify the checksummed range, so deferring the computation until all
+  pointers have been relocated produces the same result as processing the
+  commands in place.
+
+  If a checksum fills in the Checksum field of an EFI_ACPI_DESCRIPTION_HEADER
+  that a QEMU_LOADER_ADD_POINTER command points to, the matching POINTEE is
+  marked, so that InstallPointeeTable() need not sum the table again.
+
+  @param[in,out] Fixups  The LOADER_FIXUPS structure populated by the
+                         processing of the linker/loader script.
+**/
+STATIC
+VOID
+ApplyPendingChecksums (
+  IN OUT LOADER_FIXUPS  *Fixups
+  )
+{
+  UINTN                           Index;
+  CONST QEMU_LOADER_ADD_CHECKSUM  *AddChecksum;
+  BLOB                            *Blob;
+  UINT64                          TableAddress;
+  ORDERED_COLLECTION_ENTRY        *PointeeEntry;
+  POINTEE                         *Pointee;
+
+  for (Index = 0; Index < Fixups->NumChecksums; ++Index) {
+    AddChecksum = Fixups->Checksums[Index].AddChecksum;
+    Blob        = Fixups->Checksums[Index].Blob;
+
+    Blob->Base[AddChecksum->ResultOffset] = CalculateCheckSum8 (
+                                              Blob->Base + AddChecksum->Start,
+                                              AddChecksum->Length
+                                              );
+
+    if ((AddChecksum->ResultOffset < AddChecksum->Start) ||
+        (AddChecksum->ResultOffset - AddChecksum->Start !=
+         OFFSET_OF (EFI_ACPI_DESCRIPTION_HEADER, Checksum)))
+    {
+      continue;
+    }
+
+    TableAddress = (UINT64)(UINTN)(Blob->Base + AddChecksum->Start);
+    PointeeEntry = OrderedCollectionFind (Fixups->PointeeIndex, &TableAddress);
+    if (PointeeEntry != NULL) {
+      Pointee                 = OrderedCollectionUserStruct (PointeeEntry);
+      Pointee->ChecksumLength = AddChecksum->Length;
+    }
+  }
+}
+
 /**
   Process a QEMU_LOADER_WRITE_POINTER command.
 
@@ -791,16 +1031,14 @@ UndoCmdWritePointer (
 #define INSTALLED_TABLES_MAX  128
 
 /**
-  Process a QEMU_LOADER_ADD_POINTER command in order to see if its target byte
-  array is an ACPI table, and if so, install it.
+  Check whether the target of QEMU_LOADER_ADD_POINTER commands is an ACPI
+  table, and if so, install it.
 
   This function assumes that the entire QEMU linker/loader command file has
-  been processed successfully in a prior first pass.
-
-  @param[in] AddPointer        The QEMU_LOADER_ADD_POINTER command to process.
+  been processed successfully, and that ApplyPendingChecksums() has been
+  called.
 
-  @param[in] Tracker           The ORDERED_COLLECTION tracking the BLOB user
-                               structures.
+  @param[in] Pointee           The POINTEE to check.
 
   @param[in] AcpiProtocol      The ACPI table protocol used to install tables.
 
@@ -808,65 +1046,46 @@ UndoCmdWritePointer (
                                elements, allocated by the caller. On output,
                                the function will have stored (appended) the
                                AcpiProtocol-internal key of the ACPI table that
-                               the function has installed, if the AddPointer
-                               command identified an ACPI table that is
-                               different from RSDT and XSDT.
+                               the function has installed, if Pointee
+                               identified an ACPI table that is different from
+                               RSDT and XSDT.
 
   @param[in,out] NumInstalled  On input, the number of entries already used in
                                InstalledKey; it must be in [0,
                                INSTALLED_TABLES_MAX] inclusive. On output, the
-                               parameter is incremented if the AddPointer
-                               command identified an ACPI table that is
-                               different from RSDT and XSDT.
-
-  @param[in,out] SeenPointers  The ORDERED_COLLECTION tracking the absolute
-                               target addresses that have been pointed-to by
-                               QEMU_LOADER_ADD_POINTER commands thus far. If a
-                               target address is encountered for the first
-                               time, and it identifies an ACPI table that is
-                               different from RDST and XSDT, the table is
-                               installed. If a target address is seen for the
-                               second or later times, it is skipped without
-                               taking any action.
+                               parameter is incremented if Pointee identified
+                               an ACPI table that is different from RSDT and
+                               XSDT.
 
   @retval EFI_INVALID_PARAMETER  NumInstalled was outside the allowed range on
                                  input.
 
-  @retval EFI_OUT_OF_RESOURCES   The AddPointer command identified an ACPI
-                                 table different from RSDT and XSDT, but there
-                                 was no more room in InstalledKey.
+  @retval EFI_OUT_OF_RESOURCES   Pointee identified an ACPI table different
+                                 from RSDT and XSDT, but there was no more room
+                                 in InstalledKey.
 
-  @retval EFI_SUCCESS            AddPointer has been processed. Either its
-                                 absolute target address has been encountered
-                                 before, or an ACPI table different from RSDT
-                                 and XSDT has been installed (reflected by
-                                 InstalledKey and NumInstalled), or RSDT or
-                                 XSDT has been identified but not installed, or
-                                 the fw_cfg blob pointed-into by AddPointer has
-                                 been marked as hosting something else than
-                                 just direct ACPI table contents.
+  @retval EFI_SUCCESS            Pointee has been processed. Either an ACPI
+                                 table different from RSDT and XSDT has been
+                                 installed (reflected by InstalledKey and
+                                 NumInstalled), or RSDT or XSDT has been
+                                 identified but not installed, or the fw_cfg
+                                 blob pointed-into by Pointee has been marked
+                                 as hosting something else than just direct
+                                 ACPI table contents.
 
   @return                        Error codes returned by
                                  AcpiProtocol->InstallAcpiTable().
 **/
 STATIC
 EFI_STATUS
-EFIAPI
-Process2ndPassCmdAddPointer (
-  IN     CONST QEMU_LOADER_ADD_POINTER  *AddPointer,
-  IN     CONST ORDERED_COLLECTION       *Tracker,
-  IN     EFI_ACPI_TABLE_PROTOCOL        *AcpiProtocol,
-  IN OUT UINTN                          InstalledKey[INSTALLED_TABLES_MAX],
-  IN OUT INT32                          *NumInstalled,
-  IN OUT ORDERED_COLLECTION             *SeenPointers
+InstallPointeeTable (
+  IN     CONST POINTEE            *Pointee,
+  IN     EFI_ACPI_TABLE_PROTOCOL  *AcpiProtocol,
+  IN OUT UINTN                    InstalledKey[INSTALLED_TABLES_MAX],
+  IN OUT INT32                    *NumInstalled
   )
 {
-  CONST ORDERED_COLLECTION_ENTRY                      *TrackerEntry;
-  CONST ORDERED_COLLECTION_ENTRY                      *TrackerEntry2;
-  ORDERED_COLLECTION_ENTRY                            *SeenPointerEntry;
-  CONST BLOB                                          *Blob;
   BLOB                                                *Blob2;
-  CONST UINT8                                         *PointerField;
   UINT64                                              PointerValue;
   UINTN                                               Blob2Remaining;
   UINTN                                               TableSize;
@@ -878,13 +1097,8 @@ Process2ndPassCmdAddPointer (
     return EFI_INVALID_PARAMETER;
   }
 
-  TrackerEntry  = OrderedCollectionFind (Tracker, AddPointer->PointerFile);
-  TrackerEntry2 = OrderedCollectionFind (Tracker, AddPointer->PointeeFile);
-  Blob          = OrderedCollectionUserStruct (TrackerEntry);
-  Blob2         = OrderedCollectionUserStruct (TrackerEntry2);
-  PointerField  = Blob->Base + AddPointer->PointerOffset;
-  PointerValue  = 0;
-  CopyMem (&PointerValue, PointerField, AddPointer->PointerSize);
+  Blob2        = Pointee->Blob;
+  PointerValue = Pointee->PointerValue;
 
   //
   // We assert that PointerValue falls inside Blob2's contents. This is ensured
@@ -895,35 +1109,13 @@ Process2ndPassCmdAddPointer (
   Blob2Remaining += Blob2->Size;
   ASSERT (PointerValue < Blob2Remaining);
 
-  Status = OrderedCollectionInsert (
-             SeenPointers,
-             &SeenPointerEntry, // for reverting insertion in error case
-             (VOID *)(UINTN)PointerValue
-             );
-  if (EFI_ERROR (Status)) {
-    if (Status == RETURN_ALREADY_STARTED) {
-      //
-      // Already seen this pointer, don't try to process it again.
-      //
-      DEBUG ((
-        DEBUG_VERBOSE,
-        "%a: PointerValue=0x%Lx already processed, skipping.\n",
-        __FUNCTION__,
-        PointerValue
-        ));
-      Status = EFI_SUCCESS;
-    }
-
-    return Status;
-  }
-
   Blob2Remaining -= (UINTN)PointerValue;
   DEBUG ((
     DEBUG_VERBOSE,
     "%a: checking for ACPI header in \"%a\" at 0x%Lx "
     "(remaining: 0x%Lx): ",
     __FUNCTION__,
-    AddPointer->PointeeFile,
+    Blob2->File,
     PointerValue,
     (UINT64)Blob2Remaining
     ));
@@ -957,9 +1149,14 @@ Process2ndPassCmdAddPointer (
   if ((TableSize == 0) && (sizeof *Header <= Blob2Remaining)) {
     Header = (EFI_ACPI_DESCRIPTION_HEADER *)(UINTN)PointerValue;
 
+    //
+    // If QEMU checksummed exactly this table, the checksum is known to be
+    // correct; only sum the table if that's not the case.
+    //
     if ((Header->Length >= sizeof *Header) &&
         (Header->Length <= Blob2Remaining) &&
-        (CalculateSum8 ((CONST UINT8 *)Header, Header->Length) == 0))
+        ((Pointee->ChecksumLength == Header->Length) ||
+         (CalculateSum8 ((CONST UINT8 *)Header, Header->Length) == 0)))
     {
       //
       // This looks very much like an ACPI table from QEMU:
@@ -1000,8 +1197,7 @@ Process2ndPassCmdAddPointer (
       __FUNCTION__,
       INSTALLED_TABLES_MAX
       ));
-    Status = EFI_OUT_OF_RESOURCES;
-    goto RollbackSeenPointer;
+    return EFI_OUT_OF_RESOURCES;
   }
 
   Status = AcpiProtocol->InstallAcpiTable (
@@ -1017,15 +1213,11 @@ Process2ndPassCmdAddPointer (
       __FUNCTION__,
       Status
       ));
-    goto RollbackSeenPointer;
+    return Status;
   }
 
   ++*NumInstalled;
   return EFI_SUCCESS;
-
-RollbackSeenPointer:
-  OrderedCollectionDelete (SeenPointers, SeenPointerEntry, NULL);
-  return Status;
 }
 
 /**
@@ -1069,8 +1261,8 @@ InstallQemuFwCfgTables (
   UINTN                     *InstalledKey;
   INT32                     Installed;
   ORDERED_COLLECTION_ENTRY  *TrackerEntry, *TrackerEntry2;
-  ORDERED_COLLECTION        *SeenPointers;
-  ORDERED_COLLECTION_ENTRY  *SeenPointerEntry, *SeenPointerEntry2;
+  LOADER_FIXUPS             Fixups;
+  UINTN                     Index;
 
   Status = QemuFwCfgFindFile ("etc/table-loader", &FwCfgItem, &FwCfgSize);
   if (EFI_ERROR (Status)) {
@@ -1114,14 +1306,22 @@ InstallQemuFwCfgTables (
     goto FreeAllocationsRestrictedTo32Bit;
   }
 
-  //
-  // first pass: process the commands
   //
   // "WritePointerSubsetEnd" points one past the last successful
-  // QEMU_LOADER_WRITE_POINTER command. Now when we're about to start the first
-  // pass, no such command has been encountered yet.
+  // QEMU_LOADER_WRITE_POINTER command. Now when we're about to start
+  // processing the script, no such command has been encountered yet.
   //
   WritePointerSubsetEnd = LoaderStart;
+
+  Status = InitLoaderFixups (&Fixups, (UINTN)(LoaderEnd - LoaderStart));
+  if (EFI_ERROR (Status)) {
+    goto RollbackWritePointersAndFreeTracker;
+  }
+
+  //
+  // Process the commands. Pointers are relocated in place, while checksums
+  // and the targets of pointers are collected in Fixups.
+  //
   for (LoaderEntry = LoaderStart; LoaderEntry < LoaderEnd; ++LoaderEntry) {
     switch (LoaderEntry->Type) {
       case QemuLoaderCmdAllocate:
@@ -1135,14 +1335,16 @@ InstallQemuFwCfgTables (
       case QemuLoaderCmdAddPointer:
         Status = ProcessCmdAddPointer (
                    &LoaderEntry->Command.AddPointer,
-                   Tracker
+                   Tracker,
+                   &Fixups
                    );
         break;
 
       case QemuLoaderCmdAddChecksum:
         Status = ProcessCmdAddChecksum (
                    &LoaderEntry->Command.AddChecksum,
-                   Tracker
+                   Tracker,
+                   &Fixups
                    );
         break;
 
@@ -1165,39 +1367,34 @@ InstallQemuFwCfgTables (
     }
 
     if (EFI_ERROR (Status)) {
-      goto RollbackWritePointersAndFreeTracker;
+      goto ReleaseFixups;
     }
   }
 
+  //
+  // All pointers are final now; compute each checksum once.
+  //
+  ApplyPendingChecksums (&Fixups);
+
   InstalledKey = AllocatePool (INSTALLED_TABLES_MAX * sizeof *InstalledKey);
   if (InstalledKey == NULL) {
     Status = EFI_OUT_OF_RESOURCES;
-    goto RollbackWritePointersAndFreeTracker;
-  }
-
-  SeenPointers = OrderedCollectionInit (PointerCompare, PointerCompare);
-  if (SeenPointers == NULL) {
-    Status = EFI_OUT_OF_RESOURCES;
-    goto FreeKeys;
+    goto ReleaseFixups;
   }
 
   //
-  // second pass: identify and install ACPI tables
+  // Identify and install ACPI tables, in the order they were first pointed to.
   //
   Installed = 0;
-  for (LoaderEntry = LoaderStart; LoaderEntry < LoaderEnd; ++LoaderEntry) {
-    if (LoaderEntry->Type == QemuLoaderCmdAddPointer) {
-      Status = Process2ndPassCmdAddPointer (
-                 &LoaderEntry->Command.AddPointer,
-                 Tracker,
-                 AcpiProtocol,
-                 InstalledKey,
-                 &Installed,
-                 SeenPointers
-                 );
-      if (EFI_ERROR (Status)) {
-        goto UninstallAcpiTables;
-      }
+  for (Index = 0; Index < Fixups.NumPointees; ++Index) {
+    Status = InstallPointeeTable (
+               &Fixups.Pointees[Index],
+               AcpiProtocol,
+               InstalledKey,
+               &Installed
+               );
+    if (EFI_ERROR (Status)) {
+      goto UninstallAcpiTables;
     }
   }
 
@@ -1211,22 +1408,21 @@ UninstallAcpiTables:
       AcpiProtocol->UninstallAcpiTable (AcpiProtocol, InstalledKey[Installed]);
     }
   } else {
-    DEBUG ((DEBUG_INFO, "%a: installed %d tables\n", __FUNCTION__, Installed));
-  }
-
-  for (SeenPointerEntry = OrderedCollectionMin (SeenPointers);
-       SeenPointerEntry != NULL;
-       SeenPointerEntry = SeenPointerEntry2)
-  {
-    SeenPointerEntry2 = OrderedCollectionNext (SeenPointerEntry);
-    OrderedCollectionDelete (SeenPointers, SeenPointerEntry, NULL);
+    DEBUG ((
+      DEBUG_INFO,
+      "%a: installed %d tables (%Lu pointer targets, %Lu checksums)\n",
+      __FUNCTION__,
+      Installed,
+      (UINT64)Fixups.NumPointees,
+      (UINT64)Fixups.NumChecksums
+      ));
   }
 
-  OrderedCollectionUninit (SeenPointers);
-
-FreeKeys:
   FreePool (InstalledKey);
 
+ReleaseFixups:
+  ReleaseLoaderFixups (&Fixups);
+
 RollbackWritePointersAndFreeTracker:
   //
   // In case of failure, revoke any allocation addresses that were communicated
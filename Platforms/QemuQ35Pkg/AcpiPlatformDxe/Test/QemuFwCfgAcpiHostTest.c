@@ -0,0 +1,1339 @@
+/** @file
+  Host-based unit test of the QEMU linker/loader script processing in
+  QemuFwCfgAcpi.c.
+
+  The test replays etc/table-loader scripts laid out like the ones that QEMU's
+  q35 and pc machine types produce, including QEMU_LOADER_ADD_POINTER,
+  QEMU_LOADER_ADD_CHECKSUM and QEMU_LOADER_WRITE_POINTER commands, against a
+  fake fw_cfg device, page allocator and ACPI table protocol. Every script is
+  processed both by InstallQemuFwCfgTables() and by the previous two-pass
+  implementation in QemuFwCfgAcpiReference.c, and the results are compared:
+  the return status, the ACPI tables installed, the patched contents of all
+  blobs, the blobs released, and the pointers written back to fw_cfg. The time
+  both implementations take is reported as well.
+
+  Copyright (c) Microsoft Corporation
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <time.h>                             // clock()
+
+#include <Uefi.h>
+#include <IndustryStandard/Acpi.h>            // EFI_ACPI_DESCRIPTION_HEADER
+#include <IndustryStandard/QemuLoader.h>      // QEMU_LOADER_ENTRY
+#include <Library/BaseLib.h>                  // AsciiStrCmp()
+#include <Library/BaseMemoryLib.h>            // CopyMem()
+#include <Library/DebugLib.h>                 // ASSERT()
+#include <Library/MemoryAllocationLib.h>      // AllocateZeroPool()
+#include <Library/QemuFwCfgLib.h>             // QemuFwCfgFindFile()
+#include <Library/UefiBootServicesTableLib.h> // gBS
+#include <Library/UnitTestLib.h>              // UT_ASSERT_EQUAL()
+
+#include "QemuFwCfgAcpiHostTest.h"
+
+#define UNIT_TEST_APP_NAME     "QEMU fw_cfg ACPI Table Loader Host Test"
+#define UNIT_TEST_APP_VERSION  "1.0"
+
+//
+// fw_cfg file selectors start here; see FW_CFG_FILE_FIRST in QEMU.
+//
+#define FAKE_FW_CFG_FILE_FIRST  0x20
+#define FAKE_FW_CFG_FILES_MAX   8
+
+#define LOADER_ENTRIES_MAX    64
+#define ARENA_PAGES           32
+#define FAKE_ACPI_TABLES_MAX  32
+
+//
+// Number of times each implementation processes a script for the timing
+// report.
+//
+#define TIMING_ITERATIONS  2000
+
+typedef struct {
+  CHAR8      Name[QEMU_LOADER_FNAME_SIZE];
+  UINT8      *Data;
+  UINTN      Size;
+  BOOLEAN    Writeable;         // receives QEMU_LOADER_WRITE_POINTER results
+} FAKE_FW_CFG_FILE;
+
+typedef struct {
+  UINT8      *Table;            // copy of the table, from AllocateCopyPool()
+  UINTN      Size;
+  BOOLEAN    Installed;         // FALSE once uninstalled
+} FAKE_ACPI_TABLE;
+
+//
+// Everything that processing a script leaves behind, captured after a run of
+// one of the implementations.
+//
+typedef struct {
+  EFI_STATUS         Status;
+  UINTN              NumTables;
+  FAKE_ACPI_TABLE    Tables[FAKE_ACPI_TABLES_MAX];
+  UINTN              ArenaPages;
+  UINT8              *Arena;
+  BOOLEAN            PageFreed[ARENA_PAGES];
+  UINTN              WriteableSize;
+  UINT8              *Writeable;
+} LOADER_RESULT;
+
+typedef
+EFI_STATUS
+(EFIAPI *INSTALL_QEMU_FW_CFG_TABLES)(
+  IN   EFI_ACPI_TABLE_PROTOCOL  *AcpiProtocol
+  );
+
+typedef
+VOID
+(*BUILD_SCRIPT)(
+  VOID
+  );
+
+typedef struct {
+  CONST CHAR8     *Name;
+  BUILD_SCRIPT    Build;
+  EFI_STATUS      ExpectedStatus;
+  UINTN           ExpectedTables; // tables left installed
+} REPLAY_CONTEXT;
+
+//
+// Fake fw_cfg device.
+//
+STATIC FAKE_FW_CFG_FILE  mFwCfgFiles[FAKE_FW_CFG_FILES_MAX];
+STATIC UINTN             mFwCfgFileCount;
+STATIC UINTN             mFwCfgSelected;
+STATIC UINTN             mFwCfgOffset;
+
+//
+// The etc/table-loader script under construction.
+//
+STATIC QEMU_LOADER_ENTRY  mScript[LOADER_ENTRIES_MAX];
+STATIC UINTN              mScriptCount;
+
+//
+// Fake page allocator. The ACPI tables contain 32-bit pointers, so the pages
+// are handed out from a static arena that the host test binary is linked to
+// place below 4GB.
+//
+STATIC UINT8    mArenaBuffer[EFI_PAGES_TO_SIZE (ARENA_PAGES + 1)];
+STATIC UINT8    *mArena;
+STATIC UINTN    mArenaPages;
+STATIC BOOLEAN  mPageFreed[ARENA_PAGES];
+
+//
+// Fake ACPI table protocol.
+//
+STATIC FAKE_ACPI_TABLE  mAcpiTables[FAKE_ACPI_TABLES_MAX];
+STATIC UINTN            mAcpiTableCount;
+
+STATIC UINT32  mRandomState;
+
+STATIC EFI_BOOT_SERVICES        mBootServices;
+STATIC EFI_ACPI_TABLE_PROTOCOL  mAcpiTableProtocol;
+
+/**
+  Find the configuration item corresponding to the firmware configuration file.
+
+  @param[in]  Name  Name of file to look up.
+  @param[out] Item  Configuration item corresponding to the file.
+  @param[out] Size  Number of bytes in the file.
+
+  @retval RETURN_SUCCESS    The file has been found.
+  @retval RETURN_NOT_FOUND  The fake device has no such file.
+**/
+RETURN_STATUS
+EFIAPI
+QemuFwCfgFindFile (
+  IN   CONST CHAR8           *Name,
+  OUT  FIRMWARE_CONFIG_ITEM  *Item,
+  OUT  UINTN                 *Size
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < mFwCfgFileCount; Index++) {
+    if (AsciiStrCmp (mFwCfgFiles[Index].Name, Name) == 0) {
+      *Item = (FIRMWARE_CONFIG_ITEM)(FAKE_FW_CFG_FILE_FIRST + Index);
+      *Size = mFwCfgFiles[Index].Size;
+      return RETURN_SUCCESS;
+    }
+  }
+
+  return RETURN_NOT_FOUND;
+}
+
+/**
+  Select a firmware configuration item of the fake device.
+
+  @param[in] QemuFwCfgItem  Firmware configuration item to select.
+**/
+VOID
+EFIAPI
+QemuFwCfgSelectItem (
+  IN FIRMWARE_CONFIG_ITEM  QemuFwCfgItem
+  )
+{
+  ASSERT ((UINTN)QemuFwCfgItem >= FAKE_FW_CFG_FILE_FIRST);
+  ASSERT ((UINTN)QemuFwCfgItem - FAKE_FW_CFG_FILE_FIRST < mFwCfgFileCount);
+
+  mFwCfgSelected = (UINTN)QemuFwCfgItem - FAKE_FW_CFG_FILE_FIRST;
+  mFwCfgOffset   = 0;
+}
+
+/**
+  Read bytes from the selected item of the fake device.
+
+  @param[in] Size    Number of bytes to read.
+  @param[in] Buffer  Buffer to read the data into.
+**/
+VOID
+EFIAPI
+QemuFwCfgReadBytes (
+  IN UINTN  Size,
+  IN VOID   *Buffer  OPTIONAL
+  )
+{
+  FAKE_FW_CFG_FILE  *File;
+
+  File = &mFwCfgFiles[mFwCfgSelected];
+  ASSERT (Size <= File->Size - mFwCfgOffset);
+
+  if (Buffer != NULL) {
+    CopyMem (Buffer, File->Data + mFwCfgOffset, Size);
+  }
+
+  mFwCfgOffset += Size;
+}
+
+/**
+  Write bytes to the selected item of the fake device.
+
+  @param[in] Size    Number of bytes to write.
+  @param[in] Buffer  Buffer to write the data from.
+**/
+VOID
+EFIAPI
+QemuFwCfgWriteBytes (
+  IN UINTN  Size,
+  IN VOID   *Buffer
+  )
+{
+  FAKE_FW_CFG_FILE  *File;
+
+  File = &mFwCfgFiles[mFwCfgSelected];
+  ASSERT (File->Writeable);
+  ASSERT (Size <= File->Size - mFwCfgOffset);
+
+  CopyMem (File->Data + mFwCfgOffset, Buffer, Size);
+  mFwCfgOffset += Size;
+}
+
+/**
+  Skip bytes in the selected item of the fake device.
+
+  @param[in] Size  Number of bytes to skip.
+**/
+VOID
+EFIAPI
+QemuFwCfgSkipBytes (
+  IN UINTN  Size
+  )
+{
+  ASSERT (Size <= mFwCfgFiles[mFwCfgSelected].Size - mFwCfgOffset);
+  mFwCfgOffset += Size;
+}
+
+/**
+  PCI decoding is not involved in fetching from the fake fw_cfg device.
+
+  @param[out] OriginalAttributes  Set to NULL.
+  @param[out] Count               Set to zero.
+**/
+VOID
+EnablePciDecoding (
+  OUT ORIGINAL_ATTRIBUTES  **OriginalAttributes,
+  OUT UINTN                *Count
+  )
+{
+  *OriginalAttributes = NULL;
+  *Count              = 0;
+}
+
+/**
+  PCI decoding is not involved in fetching from the fake fw_cfg device.
+
+  @param[in] OriginalAttributes  Ignored.
+  @param[in] Count               Ignored.
+**/
+VOID
+RestorePciDecoding (
+  IN ORIGINAL_ATTRIBUTES  *OriginalAttributes,
+  IN UINTN                Count
+  )
+{
+}
+
+/**
+  Allocate pages from the arena, in increasing address order.
+
+  @param[in]     Type        AllocateAnyPages or AllocateMaxAddress.
+  @param[in]     MemoryType  Ignored.
+  @param[in]     Pages       Number of pages to allocate.
+  @param[in,out] Memory      On input, the highest acceptable address for
+                             AllocateMaxAddress. On output, the address of the
+                             allocation.
+
+  @retval EFI_SUCCESS           The pages have been allocated.
+  @retval EFI_OUT_OF_RESOURCES  The arena is exhausted, or the next pages of
+                                the arena are above the requested address.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+FakeAllocatePages (
+  IN     EFI_ALLOCATE_TYPE     Type,
+  IN     EFI_MEMORY_TYPE       MemoryType,
+  IN     UINTN                 Pages,
+  IN OUT EFI_PHYSICAL_ADDRESS  *Memory
+  )
+{
+  EFI_PHYSICAL_ADDRESS  Address;
+
+  if (Pages > ARENA_PAGES - mArenaPages) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Address = (UINTN)mArena + EFI_PAGES_TO_SIZE (mArenaPages);
+  if ((Type == AllocateMaxAddress) &&
+      (Address + EFI_PAGES_TO_SIZE (Pages) - 1 > *Memory))
+  {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  mArenaPages += Pages;
+  *Memory      = Address;
+  return EFI_SUCCESS;
+}
+
+/**
+  Mark arena pages as freed. The contents are kept for comparison.
+
+  @param[in] Memory  The address of the first page to free.
+  @param[in] Pages   The number of pages to free.
+
+  @retval EFI_SUCCESS  The pages have been marked.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+FakeFreePages (
+  IN EFI_PHYSICAL_ADDRESS  Memory,
+  IN UINTN                 Pages
+  )
+{
+  UINTN  Page;
+
+  Page = (UINTN)(Memory - (UINTN)mArena) / EFI_PAGE_SIZE;
+  ASSERT (Page + Pages <= mArenaPages);
+
+  while (Pages > 0) {
+    ASSERT (!mPageFreed[Page]);
+    mPageFreed[Page++] = TRUE;
+    --Pages;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Record a copy of an ACPI table.
+
+  @param[in]  This                 Ignored.
+  @param[in]  AcpiTableBuffer      The table to install.
+  @param[in]  AcpiTableBufferSize  The size of the table.
+  @param[out] TableKey             The index of the copy in mAcpiTables.
+
+  @retval EFI_SUCCESS           The table has been recorded.
+  @retval EFI_OUT_OF_RESOURCES  Too many tables, or out of memory.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+FakeInstallAcpiTable (
+  IN   EFI_ACPI_TABLE_PROTOCOL  *This,
+  IN   VOID                     *AcpiTableBuffer,
+  IN   UINTN                    AcpiTableBufferSize,
+  OUT  UINTN                    *TableKey
+  )
+{
+  FAKE_ACPI_TABLE  *Table;
+
+  if (mAcpiTableCount == FAKE_ACPI_TABLES_MAX) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Table        = &mAcpiTables[mAcpiTableCount];
+  Table->Table = AllocateCopyPool (AcpiTableBufferSize, AcpiTableBuffer);
+  if (Table->Table == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Table->Size      = AcpiTableBufferSize;
+  Table->Installed = TRUE;
+  *TableKey        = mAcpiTableCount++;
+  return EFI_SUCCESS;
+}
+
+/**
+  Mark a recorded ACPI table as uninstalled.
+
+  @param[in] This      Ignored.
+  @param[in] TableKey  The key returned by FakeInstallAcpiTable().
+
+  @retval EFI_SUCCESS  The table has been marked.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+FakeUninstallAcpiTable (
+  IN  EFI_ACPI_TABLE_PROTOCOL  *This,
+  IN  UINTN                    TableKey
+  )
+{
+  ASSERT (TableKey < mAcpiTableCount);
+  ASSERT (mAcpiTables[TableKey].Installed);
+
+  mAcpiTables[TableKey].Installed = FALSE;
+  return EFI_SUCCESS;
+}
+
+/**
+  Release the fw_cfg files and the script of the previous replay.
+**/
+STATIC
+VOID
+ResetFwCfg (
+  VOID
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < mFwCfgFileCount; Index++) {
+    if (mFwCfgFiles[Index].Data != (UINT8 *)mScript) {
+      FreePool (mFwCfgFiles[Index].Data);
+    }
+  }
+
+  ZeroMem (mFwCfgFiles, sizeof mFwCfgFiles);
+  mFwCfgFileCount = 0;
+  ZeroMem (mScript, sizeof mScript);
+  mScriptCount = 0;
+  mRandomState = 0x5eed;
+}
+
+/**
+  Restore the fake page allocator, the ACPI table protocol, and the writeable
+  fw_cfg files to their state before a script is processed.
+**/
+STATIC
+VOID
+ResetRun (
+  VOID
+  )
+{
+  UINTN  Index;
+
+  ZeroMem (mArena, EFI_PAGES_TO_SIZE (ARENA_PAGES));
+  ZeroMem (mPageFreed, sizeof mPageFreed);
+  mArenaPages = 0;
+
+  for (Index = 0; Index < mAcpiTableCount; Index++) {
+    FreePool (mAcpiTables[Index].Table);
+  }
+
+  ZeroMem (mAcpiTables, sizeof mAcpiTables);
+  mAcpiTableCount = 0;
+
+  for (Index = 0; Index < mFwCfgFileCount; Index++) {
+    if (mFwCfgFiles[Index].Writeable) {
+      ZeroMem (mFwCfgFiles[Index].Data, mFwCfgFiles[Index].Size);
+    }
+  }
+}
+
+/**
+  Add a file to the fake fw_cfg device.
+
+  @param[in] Name       The name of the file.
+  @param[in] Size       The size of the file, in bytes.
+  @param[in] Writeable  TRUE for a file that receives QEMU_LOADER_WRITE_POINTER
+                        results.
+
+  @return  The zero-filled contents of the file.
+**/
+STATIC
+UINT8 *
+AddFwCfgFile (
+  IN CONST CHAR8  *Name,
+  IN UINTN        Size,
+  IN BOOLEAN      Writeable
+  )
+{
+  FAKE_FW_CFG_FILE  *File;
+
+  ASSERT (mFwCfgFileCount < FAKE_FW_CFG_FILES_MAX);
+  File = &mFwCfgFiles[mFwCfgFileCount++];
+
+  AsciiStrCpyS (File->Name, sizeof File->Name, Name);
+  File->Data = AllocateZeroPool (Size);
+  ASSERT (File->Data != NULL);
+  File->Size      = Size;
+  File->Writeable = Writeable;
+  return File->Data;
+}
+
+/**
+  Expose the script built so far as etc/table-loader.
+**/
+STATIC
+VOID
+PublishScript (
+  VOID
+  )
+{
+  FAKE_FW_CFG_FILE  *File;
+
+  ASSERT (mFwCfgFileCount < FAKE_FW_CFG_FILES_MAX);
+  File = &mFwCfgFiles[mFwCfgFileCount++];
+
+  AsciiStrCpyS (File->Name, sizeof File->Name, "etc/table-loader");
+  File->Data = (UINT8 *)mScript;
+  File->Size = mScriptCount * sizeof mScript[0];
+}
+
+/**
+  Look up the contents of a fw_cfg file added with AddFwCfgFile().
+
+  @param[in] Name  The name of the file.
+
+  @return  The contents of the file.
+**/
+STATIC
+UINT8 *
+FwCfgFileData (
+  IN CONST CHAR8  *Name
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < mFwCfgFileCount; Index++) {
+    if (AsciiStrCmp (mFwCfgFiles[Index].Name, Name) == 0) {
+      return mFwCfgFiles[Index].Data;
+    }
+  }
+
+  ASSERT (FALSE);
+  return NULL;
+}
+
+/**
+  Append a command to the script.
+
+  @param[in] Type  The QEMU_LOADER_COMMAND_TYPE of the command.
+
+  @return  The zero-filled command.
+**/
+STATIC
+QEMU_LOADER_ENTRY *
+AppendCommand (
+  IN UINT32  Type
+  )
+{
+  QEMU_LOADER_ENTRY  *Entry;
+
+  ASSERT (mScriptCount < LOADER_ENTRIES_MAX);
+  Entry       = &mScript[mScriptCount++];
+  Entry->Type = Type;
+  return Entry;
+}
+
+/**
+  Append a QEMU_LOADER_ALLOCATE command to the script.
+
+  @param[in] File       The blob to download.
+  @param[in] Alignment  The alignment of the blob.
+  @param[in] Zone       The QEMU_LOADER_ALLOC_ZONE of the blob.
+**/
+STATIC
+VOID
+LoaderAllocate (
+  IN CONST CHAR8  *File,
+  IN UINT32       Alignment,
+  IN UINT8        Zone
+  )
+{
+  QEMU_LOADER_ALLOCATE  *Allocate;
+
+  Allocate = &AppendCommand (QemuLoaderCmdAllocate)->Command.Allocate;
+  AsciiStrCpyS ((CHAR8 *)Allocate->File, sizeof Allocate->File, File);
+  Allocate->Alignment = Alignment;
+  Allocate->Zone      = Zone;
+}
+
+/**
+  Store a relative pointer in a blob, as QEMU does, and append the
+  QEMU_LOADER_ADD_POINTER command that relocates it.
+
+  @param[in] PointerFile    The blob containing the pointer.
+  @param[in] PointerOffset  The offset of the pointer in PointerFile.
+  @param[in] PointerSize    The size of the pointer, in bytes.
+  @param[in] PointeeFile    The blob pointed into.
+  @param[in] PointeeOffset  The offset pointed to in PointeeFile.
+**/
+STATIC
+VOID
+LoaderAddPointer (
+  IN CONST CHAR8  *PointerFile,
+  IN UINT32       PointerOffset,
+  IN UINT8        PointerSize,
+  IN CONST CHAR8  *PointeeFile,
+  IN UINT64       PointeeOffset
+  )
+{
+  QEMU_LOADER_ADD_POINTER  *AddPointer;
+
+  CopyMem (
+    FwCfgFileData (PointerFile) + PointerOffset,
+    &PointeeOffset,
+    PointerSize
+    );
+
+  AddPointer = &AppendCommand (QemuLoaderCmdAddPointer)->Command.AddPointer;
+  AsciiStrCpyS ((CHAR8 *)AddPointer->PointerFile, sizeof AddPointer->PointerFile, PointerFile);
+  AsciiStrCpyS ((CHAR8 *)AddPointer->PointeeFile, sizeof AddPointer->PointeeFile, PointeeFile);
+  AddPointer->PointerOffset = PointerOffset;
+  AddPointer->PointerSize   = PointerSize;
+}
+
+/**
+  Append a QEMU_LOADER_ADD_CHECKSUM command to the script.
+
+  @param[in] File          The blob to checksum.
+  @param[in] ResultOffset  The offset of the checksum in File.
+  @param[in] Start         The offset of the checksummed range in File.
+  @param[in] Length        The size of the checksummed range.
+**/
+STATIC
+VOID
+LoaderAddChecksum (
+  IN CONST CHAR8  *File,
+  IN UINT32       ResultOffset,
+  IN UINT32       Start,
+  IN UINT32       Length
+  )
+{
+  QEMU_LOADER_ADD_CHECKSUM  *AddChecksum;
+
+  AddChecksum = &AppendCommand (QemuLoaderCmdAddChecksum)->Command.AddChecksum;
+  AsciiStrCpyS ((CHAR8 *)AddChecksum->File, sizeof AddChecksum->File, File);
+  AddChecksum->ResultOffset = ResultOffset;
+  AddChecksum->Start        = Start;
+  AddChecksum->Length       = Length;
+}
+
+/**
+  Append a QEMU_LOADER_WRITE_POINTER command to the script.
+
+  @param[in] PointerFile    The writeable fw_cfg file to receive the pointer.
+  @param[in] PointerOffset  The offset of the pointer in PointerFile.
+  @param[in] PointerSize    The size of the pointer, in bytes.
+  @param[in] PointeeFile    The blob pointed into.
+  @param[in] PointeeOffset  The offset pointed to in PointeeFile.
+**/
+STATIC
+VOID
+LoaderWritePointer (
+  IN CONST CHAR8  *PointerFile,
+  IN UINT32       PointerOffset,
+  IN UINT8        PointerSize,
+  IN CONST CHAR8  *PointeeFile,
+  IN UINT32       PointeeOffset
+  )
+{
+  QEMU_LOADER_WRITE_POINTER  *WritePointer;
+
+  WritePointer = &AppendCommand (QemuLoaderCmdWritePointer)->Command.WritePointer;
+  AsciiStrCpyS ((CHAR8 *)WritePointer->PointerFile, sizeof WritePointer->PointerFile, PointerFile);
+  AsciiStrCpyS ((CHAR8 *)WritePointer->PointeeFile, sizeof WritePointer->PointeeFile, PointeeFile);
+  WritePointer->PointerOffset = PointerOffset;
+  WritePointer->PointeeOffset = PointeeOffset;
+  WritePointer->PointerSize   = PointerSize;
+}
+
+/**
+  Lay out an ACPI table with the given header, and deterministic pseudo-random
+  contents. The Checksum field is left zero, like QEMU leaves it for
+  QEMU_LOADER_ADD_CHECKSUM to fill in.
+
+  @param[in] Blob       The contents of the blob hosting the table.
+  @param[in] Offset     The offset of the table in Blob.
+  @param[in] Signature  The signature of the table.
+  @param[in] Length     The size of the table.
+  @param[in] Revision   The revision of the table.
+**/
+STATIC
+VOID
+FillTable (
+  IN UINT8   *Blob,
+  IN UINT32  Offset,
+  IN UINT32  Signature,
+  IN UINT32  Length,
+  IN UINT8   Revision
+  )
+{
+  EFI_ACPI_DESCRIPTION_HEADER  *Header;
+  UINT32                       Index;
+
+  for (Index = sizeof *Header; Index < Length; Index++) {
+    mRandomState         = mRandomState * 1103515245 + 12345;
+    Blob[Offset + Index] = (UINT8)(mRandomState >> 16);
+  }
+
+  Header            = (EFI_ACPI_DESCRIPTION_HEADER *)(Blob + Offset);
+  Header->Signature = Signature;
+  Header->Length    = Length;
+  Header->Revision  = Revision;
+  Header->Checksum  = 0;
+  CopyMem (Header->OemId, "BOCHS ", sizeof Header->OemId);
+  Header->OemTableId      = SIGNATURE_64 ('B', 'X', 'P', 'C', ' ', ' ', ' ', ' ');
+  Header->OemRevision     = 1;
+  Header->CreatorId       = SIGNATURE_32 ('B', 'X', 'P', 'C');
+  Header->CreatorRevision = 1;
+}
+
+/**
+  Append the QEMU_LOADER_ADD_CHECKSUM command for an ACPI table in
+  etc/acpi/tables.
+
+  @param[in] Offset  The offset of the table in etc/acpi/tables.
+  @param[in] Length  The size of the table.
+**/
+STATIC
+VOID
+ChecksumTable (
+  IN UINT32  Offset,
+  IN UINT32  Length
+  )
+{
+  LoaderAddChecksum (
+    "etc/acpi/tables",
+    Offset + OFFSET_OF (EFI_ACPI_DESCRIPTION_HEADER, Checksum),
+    Offset,
+    Length
+    );
+}
+
+/**
+  Build a script laid out like the one of a q35 machine with a VM generation
+  ID device: FACS, DSDT, FADT, MADT, HPET, MCFG, WAET and an SSDT in
+  etc/acpi/tables, referenced by both an RSDT and an XSDT, and a revision 2
+  RSDP. The SSDT points into etc/vmgenid_guid, whose address is also written
+  back to etc/vmgenid_addr.
+**/
+STATIC
+VOID
+BuildQ35Script (
+  VOID
+  )
+{
+  UINT8   *Tables;
+  UINT8   *Rsdp;
+  UINT32  Facs, Dsdt, Facp, Apic, Hpet, Mcfg, Waet, Ssdt, Rsdt, Xsdt, Size;
+  UINT32  Entries[6];
+  UINTN   Index;
+
+  Facs = 0;
+  Dsdt = Facs + sizeof (EFI_ACPI_1_0_FIRMWARE_ACPI_CONTROL_STRUCTURE);
+  Facp = Dsdt + 0x1f3a;
+  Apic = Facp + sizeof (EFI_ACPI_3_0_FIXED_ACPI_DESCRIPTION_TABLE);
+  Hpet = Apic + 0x78;
+  Mcfg = Hpet + 0x38;
+  Waet = Mcfg + 0x3c;
+  Ssdt = Waet + 0x28;
+  Rsdt = Ssdt + 0xca;
+  Xsdt = Rsdt + sizeof (EFI_ACPI_DESCRIPTION_HEADER) + sizeof Entries[0] * ARRAY_SIZE (Entries);
+  Size = Xsdt + sizeof (EFI_ACPI_DESCRIPTION_HEADER) + sizeof (UINT64) * ARRAY_SIZE (Entries);
+
+  Tables = AddFwCfgFile ("etc/acpi/tables", Size, FALSE);
+  AddFwCfgFile ("etc/vmgenid_guid", EFI_PAGE_SIZE, FALSE);
+  AddFwCfgFile ("etc/vmgenid_addr", sizeof (UINT64), TRUE);
+  Rsdp = AddFwCfgFile ("etc/acpi/rsdp", sizeof (EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER), FALSE);
+
+  LoaderAllocate ("etc/acpi/tables", 64, QemuLoaderAllocHigh);
+  LoaderAllocate ("etc/vmgenid_guid", EFI_PAGE_SIZE, QemuLoaderAllocHigh);
+
+  ((EFI_ACPI_1_0_FIRMWARE_ACPI_CONTROL_STRUCTURE *)(Tables + Facs))->Signature =
+    EFI_ACPI_1_0_FIRMWARE_ACPI_CONTROL_STRUCTURE_SIGNATURE;
+  ((EFI_ACPI_1_0_FIRMWARE_ACPI_CONTROL_STRUCTURE *)(Tables + Facs))->Length =
+    sizeof (EFI_ACPI_1_0_FIRMWARE_ACPI_CONTROL_STRUCTURE);
+
+  FillTable (Tables, Dsdt, SIGNATURE_32 ('D', 'S', 'D', 'T'), Facp - Dsdt, 1);
+  ChecksumTable (Dsdt, Facp - Dsdt);
+
+  FillTable (Tables, Facp, SIGNATURE_32 ('F', 'A', 'C', 'P'), Apic - Facp, 3);
+  LoaderAddPointer ("etc/acpi/tables", Facp + OFFSET_OF (EFI_ACPI_3_0_FIXED_ACPI_DESCRIPTION_TABLE, FirmwareCtrl), 4, "etc/acpi/tables", Facs);
+  LoaderAddPointer ("etc/acpi/tables", Facp + OFFSET_OF (EFI_ACPI_3_0_FIXED_ACPI_DESCRIPTION_TABLE, Dsdt), 4, "etc/acpi/tables", Dsdt);
+  LoaderAddPointer ("etc/acpi/tables", Facp + OFFSET_OF (EFI_ACPI_3_0_FIXED_ACPI_DESCRIPTION_TABLE, XDsdt), 8, "etc/acpi/tables", Dsdt);
+  ChecksumTable (Facp, Apic - Facp);
+
+  FillTable (Tables, Apic, SIGNATURE_32 ('A', 'P', 'I', 'C'), Hpet - Apic, 1);
+  ChecksumTable (Apic, Hpet - Apic);
+  FillTable (Tables, Hpet, SIGNATURE_32 ('H', 'P', 'E', 'T'), Mcfg - Hpet, 1);
+  ChecksumTable (Hpet, Mcfg - Hpet);
+  FillTable (Tables, Mcfg, SIGNATURE_32 ('M', 'C', 'F', 'G'), Waet - Mcfg, 1);
+  ChecksumTable (Mcfg, Waet - Mcfg);
+  FillTable (Tables, Waet, SIGNATURE_32 ('W', 'A', 'E', 'T'), Ssdt - Waet, 1);
+  ChecksumTable (Waet, Ssdt - Waet);
+
+  //
+  // The VGIA name in the SSDT holds the address of the GUID, which is also
+  // communicated to QEMU.
+  //
+  FillTable (Tables, Ssdt, SIGNATURE_32 ('S', 'S', 'D', 'T'), Rsdt - Ssdt, 1);
+  LoaderWritePointer ("etc/vmgenid_addr", 0, 8, "etc/vmgenid_guid", 40);
+  LoaderAddPointer ("etc/acpi/tables", Ssdt + 0x40, 8, "etc/vmgenid_guid", 40);
+  ChecksumTable (Ssdt, Rsdt - Ssdt);
+
+  Entries[0] = Facp;
+  Entries[1] = Apic;
+  Entries[2] = Hpet;
+  Entries[3] = Mcfg;
+  Entries[4] = Waet;
+  Entries[5] = Ssdt;
+
+  FillTable (Tables, Rsdt, EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_TABLE_SIGNATURE, Xsdt - Rsdt, 1);
+  for (Index = 0; Index < ARRAY_SIZE (Entries); Index++) {
+    LoaderAddPointer ("etc/acpi/tables", Rsdt + sizeof (EFI_ACPI_DESCRIPTION_HEADER) + (UINT32)Index * 4, 4, "etc/acpi/tables", Entries[Index]);
+  }
+
+  ChecksumTable (Rsdt, Xsdt - Rsdt);
+
+  FillTable (Tables, Xsdt, EFI_ACPI_2_0_EXTENDED_SYSTEM_DESCRIPTION_TABLE_SIGNATURE, Size - Xsdt, 1);
+  for (Index = 0; Index < ARRAY_SIZE (Entries); Index++) {
+    LoaderAddPointer ("etc/acpi/tables", Xsdt + sizeof (EFI_ACPI_DESCRIPTION_HEADER) + (UINT32)Index * 8, 8, "etc/acpi/tables", Entries[Index]);
+  }
+
+  ChecksumTable (Xsdt, Size - Xsdt);
+
+  LoaderAllocate ("etc/acpi/rsdp", 16, QemuLoaderAllocFSeg);
+  CopyMem (Rsdp, "RSD PTR ", 8);
+  CopyMem (Rsdp + OFFSET_OF (EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER, OemId), "BOCHS ", 6);
+  Rsdp[OFFSET_OF (EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER, Revision)] = 2;
+  Rsdp[OFFSET_OF (EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER, Length)]   = sizeof (EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER);
+  LoaderAddPointer ("etc/acpi/rsdp", OFFSET_OF (EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER, RsdtAddress), 4, "etc/acpi/tables", Rsdt);
+  LoaderAddPointer ("etc/acpi/rsdp", OFFSET_OF (EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER, XsdtAddress), 8, "etc/acpi/tables", Xsdt);
+  LoaderAddChecksum ("etc/acpi/rsdp", OFFSET_OF (EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER, Checksum), 0, sizeof (EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
+  LoaderAddChecksum ("etc/acpi/rsdp", OFFSET_OF (EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER, ExtendedChecksum), 0, sizeof (EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
+
+  PublishScript ();
+}
+
+/**
+  Build a script laid out like the one of a pc machine: FACS, DSDT, a
+  revision 1 FADT, MADT and HPET in etc/acpi/tables, referenced by an RSDT
+  only, and a revision 0 RSDP. The RSDT also references a table that no
+  QEMU_LOADER_ADD_CHECKSUM command covers, and whose checksum is wrong, so
+  it must not be installed, and etc/acpi/tables must be kept.
+**/
+STATIC
+VOID
+BuildPcScript (
+  VOID
+  )
+{
+  UINT8   *Tables;
+  UINT8   *Rsdp;
+  UINT32  Facs, Dsdt, Facp, Apic, Hpet, Oem1, Rsdt, Size;
+  UINT32  Entries[4];
+  UINTN   Index;
+
+  Facs = 0;
+  Dsdt = Facs + sizeof (EFI_ACPI_1_0_FIRMWARE_ACPI_CONTROL_STRUCTURE);
+  Facp = Dsdt + 0x1471;
+  Apic = Facp + sizeof (EFI_ACPI_1_0_FIXED_ACPI_DESCRIPTION_TABLE);
+  Hpet = Apic + 0x78;
+  Oem1 = Hpet + 0x38;
+  Rsdt = Oem1 + 0x30;
+  Size = Rsdt + sizeof (EFI_ACPI_DESCRIPTION_HEADER) + sizeof Entries[0] * ARRAY_SIZE (Entries);
+
+  Tables = AddFwCfgFile ("etc/acpi/tables", Size, FALSE);
+  Rsdp   = AddFwCfgFile ("etc/acpi/rsdp", sizeof (EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER), FALSE);
+
+  LoaderAllocate ("etc/acpi/tables", 64, QemuLoaderAllocHigh);
+
+  ((EFI_ACPI_1_0_FIRMWARE_ACPI_CONTROL_STRUCTURE *)(Tables + Facs))->Signature =
+    EFI_ACPI_1_0_FIRMWARE_ACPI_CONTROL_STRUCTURE_SIGNATURE;
+  ((EFI_ACPI_1_0_FIRMWARE_ACPI_CONTROL_STRUCTURE *)(Tables + Facs))->Length =
+    sizeof (EFI_ACPI_1_0_FIRMWARE_ACPI_CONTROL_STRUCTURE);
+
+  FillTable (Tables, Dsdt, SIGNATURE_32 ('D', 'S', 'D', 'T'), Facp - Dsdt, 1);
+  ChecksumTable (Dsdt, Facp - Dsdt);
+
+  FillTable (Tables, Facp, SIGNATURE_32 ('F', 'A', 'C', 'P'), Apic - Facp, 1);
+  LoaderAddPointer ("etc/acpi/tables", Facp + OFFSET_OF (EFI_ACPI_1_0_FIXED_ACPI_DESCRIPTION_TABLE, FirmwareCtrl), 4, "etc/acpi/tables", Facs);
+  LoaderAddPointer ("etc/acpi/tables", Facp + OFFSET_OF (EFI_ACPI_1_0_FIXED_ACPI_DESCRIPTION_TABLE, Dsdt), 4, "etc/acpi/tables", Dsdt);
+  ChecksumTable (Facp, Apic - Facp);
+
+  FillTable (Tables, Apic, SIGNATURE_32 ('A', 'P', 'I', 'C'), Hpet - Apic, 1);
+  ChecksumTable (Apic, Hpet - Apic);
+  FillTable (Tables, Hpet, SIGNATURE_32 ('H', 'P', 'E', 'T'), Oem1 - Hpet, 1);
+  ChecksumTable (Hpet, Oem1 - Hpet);
+
+  FillTable (Tables, Oem1, SIGNATURE_32 ('O', 'E', 'M', '1'), Rsdt - Oem1, 1);
+  Tables[Oem1 + OFFSET_OF (EFI_ACPI_DESCRIPTION_HEADER, Checksum)] =
+    (UINT8)(CalculateCheckSum8 (Tables + Oem1, Rsdt - Oem1) + 1);
+
+  Entries[0] = Facp;
+  Entries[1] = Apic;
+  Entries[2] = Hpet;
+  Entries[3] = Oem1;
+
+  FillTable (Tables, Rsdt, EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_TABLE_SIGNATURE, Size - Rsdt, 1);
+  for (Index = 0; Index < ARRAY_SIZE (Entries); Index++) {
+    LoaderAddPointer ("etc/acpi/tables", Rsdt + sizeof (EFI_ACPI_DESCRIPTION_HEADER) + (UINT32)Index * 4, 4, "etc/acpi/tables", Entries[Index]);
+  }
+
+  ChecksumTable (Rsdt, Size - Rsdt);
+
+  LoaderAllocate ("etc/acpi/rsdp", 16, QemuLoaderAllocFSeg);
+  CopyMem (Rsdp, "RSD PTR ", 8);
+  CopyMem (Rsdp + OFFSET_OF (EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER, OemId), "BOCHS ", 6);
+  LoaderAddPointer ("etc/acpi/rsdp", OFFSET_OF (EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER, RsdtAddress), 4, "etc/acpi/tables", Rsdt);
+  LoaderAddChecksum ("etc/acpi/rsdp", OFFSET_OF (EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER, Checksum), 0, sizeof (EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
+
+  PublishScript ();
+}
+
+/**
+  Build the q35 script, with the range of the last QEMU_LOADER_ADD_CHECKSUM
+  command running past the end of its blob. Processing must fail after the
+  QEMU_LOADER_WRITE_POINTER command has been carried out, so the pointer
+  written to etc/vmgenid_addr must be revoked.
+**/
+STATIC
+VOID
+BuildBrokenScript (
+  VOID
+  )
+{
+  BuildQ35Script ();
+
+  ASSERT (mScript[mScriptCount - 1].Type == QemuLoaderCmdAddChecksum);
+  mScript[mScriptCount - 1].Command.AddChecksum.Length++;
+}
+
+/**
+  Process the current script with one implementation, and capture the
+  results.
+
+  @param[in]  Install  The implementation.
+  @param[out] Result   The results. Release them with FreeResult().
+**/
+STATIC
+VOID
+RunScript (
+  IN  INSTALL_QEMU_FW_CFG_TABLES  Install,
+  OUT LOADER_RESULT               *Result
+  )
+{
+  UINTN  Index;
+  UINTN  Offset;
+
+  ResetRun ();
+  Result->Status = Install (&mAcpiTableProtocol);
+
+  //
+  // Take over the recorded tables.
+  //
+  Result->NumTables = mAcpiTableCount;
+  CopyMem (Result->Tables, mAcpiTables, sizeof mAcpiTables);
+  ZeroMem (mAcpiTables, sizeof mAcpiTables);
+  mAcpiTableCount = 0;
+
+  Result->ArenaPages = mArenaPages;
+  Result->Arena      = AllocateCopyPool (EFI_PAGES_TO_SIZE (ARENA_PAGES), mArena);
+  ASSERT (Result->Arena != NULL);
+  CopyMem (Result->PageFreed, mPageFreed, sizeof mPageFreed);
+
+  Result->WriteableSize = 0;
+  for (Index = 0; Index < mFwCfgFileCount; Index++) {
+    if (mFwCfgFiles[Index].Writeable) {
+      Result->WriteableSize += mFwCfgFiles[Index].Size;
+    }
+  }
+
+  Result->Writeable = AllocateZeroPool (Result->WriteableSize + 1);
+  ASSERT (Result->Writeable != NULL);
+  Offset = 0;
+  for (Index = 0; Index < mFwCfgFileCount; Index++) {
+    if (mFwCfgFiles[Index].Writeable) {
+      CopyMem (Result->Writeable + Offset, mFwCfgFiles[Index].Data, mFwCfgFiles[Index].Size);
+      Offset += mFwCfgFiles[Index].Size;
+    }
+  }
+}
+
+/**
+  Release the results captured by RunScript().
+
+  @param[in] Result  The results to release.
+**/
+STATIC
+VOID
+FreeResult (
+  IN LOADER_RESULT  *Result
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < Result->NumTables; Index++) {
+    FreePool (Result->Tables[Index].Table);
+  }
+
+  FreePool (Result->Arena);
+  FreePool (Result->Writeable);
+  ZeroMem (Result, sizeof *Result);
+}
+
+/**
+  Check that the single-pass implementation produces the same results as the
+  reference implementation.
+
+  @param[in] Expected  The results of the reference implementation.
+  @param[in] Actual    The results of the single-pass implementation.
+**/
+STATIC
+UNIT_TEST_STATUS
+CompareResults (
+  IN CONST LOADER_RESULT  *Expected,
+  IN CONST LOADER_RESULT  *Actual
+  )
+{
+  UINTN  Index;
+
+  UT_ASSERT_STATUS_EQUAL (Actual->Status, Expected->Status);
+
+  UT_ASSERT_EQUAL (Actual->NumTables, Expected->NumTables);
+  for (Index = 0; Index < Expected->NumTables; Index++) {
+    UT_ASSERT_EQUAL (Actual->Tables[Index].Installed, Expected->Tables[Index].Installed);
+    UT_ASSERT_EQUAL (Actual->Tables[Index].Size, Expected->Tables[Index].Size);
+    UT_ASSERT_MEM_EQUAL (Actual->Tables[Index].Table, Expected->Tables[Index].Table, Expected->Tables[Index].Size);
+  }
+
+  //
+  // The blobs must have been placed and released the same way. The contents of
+  // released blobs don't matter; the tables in them have been compared above.
+  //
+  UT_ASSERT_EQUAL (Actual->ArenaPages, Expected->ArenaPages);
+  UT_ASSERT_MEM_EQUAL (Actual->PageFreed, Expected->PageFreed, sizeof Expected->PageFreed);
+  for (Index = 0; Index < Expected->ArenaPages; Index++) {
+    if (!Expected->PageFreed[Index]) {
+      UT_ASSERT_MEM_EQUAL (
+        Actual->Arena + EFI_PAGES_TO_SIZE (Index),
+        Expected->Arena + EFI_PAGES_TO_SIZE (Index),
+        EFI_PAGE_SIZE
+        );
+    }
+  }
+
+  UT_ASSERT_EQUAL (Actual->WriteableSize, Expected->WriteableSize);
+  UT_ASSERT_MEM_EQUAL (Actual->Writeable, Expected->Writeable, Expected->WriteableSize);
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Check the results of the single-pass implementation on their own, so that
+  the test doesn't pass if both implementations regress the same way.
+
+  @param[in] Replay  The REPLAY_CONTEXT of the script.
+  @param[in] Result  The results of the single-pass implementation.
+**/
+STATIC
+UNIT_TEST_STATUS
+CheckResult (
+  IN CONST REPLAY_CONTEXT  *Replay,
+  IN CONST LOADER_RESULT   *Result
+  )
+{
+  UINTN                        Index;
+  UINTN                        Installed;
+  EFI_ACPI_DESCRIPTION_HEADER  *Header;
+  UINT64                       Address;
+
+  UT_ASSERT_STATUS_EQUAL (Result->Status, Replay->ExpectedStatus);
+
+  Installed = 0;
+  for (Index = 0; Index < Result->NumTables; Index++) {
+    if (!Result->Tables[Index].Installed) {
+      continue;
+    }
+
+    ++Installed;
+    Header = (EFI_ACPI_DESCRIPTION_HEADER *)Result->Tables[Index].Table;
+    if (Header->Signature == EFI_ACPI_1_0_FIRMWARE_ACPI_CONTROL_STRUCTURE_SIGNATURE) {
+      continue;
+    }
+
+    UT_ASSERT_EQUAL (Header->Length, Result->Tables[Index].Size);
+    UT_ASSERT_EQUAL (CalculateSum8 ((UINT8 *)Header, Header->Length), 0);
+  }
+
+  UT_ASSERT_EQUAL (Installed, Replay->ExpectedTables);
+
+  if ((Result->WriteableSize == sizeof (UINT64)) && !EFI_ERROR (Replay->ExpectedStatus)) {
+    //
+    // etc/vmgenid_addr must point 40 bytes into the page-aligned
+    // etc/vmgenid_guid blob, which must have been kept.
+    //
+    CopyMem (&Address, Result->Writeable, sizeof Address);
+    UT_ASSERT_TRUE (Address >= (UINTN)mArena + 40);
+    Address -= (UINTN)mArena + 40;
+    UT_ASSERT_EQUAL (Address % EFI_PAGE_SIZE, 0);
+    UT_ASSERT_TRUE (Address / EFI_PAGE_SIZE < Result->ArenaPages);
+    UT_ASSERT_FALSE (Result->PageFreed[Address / EFI_PAGE_SIZE]);
+  }
+
+  if (EFI_ERROR (Replay->ExpectedStatus)) {
+    //
+    // Everything must have been rolled back.
+    //
+    for (Index = 0; Index < Result->ArenaPages; Index++) {
+      UT_ASSERT_TRUE (Result->PageFreed[Index]);
+    }
+
+    for (Index = 0; Index < Result->WriteableSize; Index++) {
+      UT_ASSERT_EQUAL (Result->Writeable[Index], 0);
+    }
+  }
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Verify that the static arena is addressable with 32-bit pointers.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+ArenaBelow4Gb (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  if ((UINTN)mArena + EFI_PAGES_TO_SIZE (ARENA_PAGES) - 1 > MAX_UINT32) {
+    UT_LOG_WARNING ("The test binary is loaded above 4GB; ACPI tables can't be placed.\n");
+    return UNIT_TEST_SKIPPED;
+  }
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Replay a script through both implementations, and compare the results.
+
+  @param[in] Context  The REPLAY_CONTEXT of the script.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+ReplayMatchesReference (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  REPLAY_CONTEXT    *Replay;
+  LOADER_RESULT     Expected;
+  LOADER_RESULT     Actual;
+  UNIT_TEST_STATUS  Status;
+
+  Replay = Context;
+  ResetFwCfg ();
+  Replay->Build ();
+
+  RunScript (ReferenceInstallQemuFwCfgTables, &Expected);
+  RunScript (InstallQemuFwCfgTables, &Actual);
+
+  Status = CompareResults (&Expected, &Actual);
+  if (Status == UNIT_TEST_PASSED) {
+    Status = CheckResult (Replay, &Actual);
+  }
+
+  FreeResult (&Expected);
+  FreeResult (&Actual);
+  ResetRun ();
+  ResetFwCfg ();
+  return Status;
+}
+
+/**
+  Measure the time it takes one implementation to process the current script.
+
+  @param[in] Install  The implementation.
+
+  @return  The average processing time, in nanoseconds.
+**/
+STATIC
+UINT64
+TimeScript (
+  IN INSTALL_QEMU_FW_CFG_TABLES  Install
+  )
+{
+  UINTN    Iteration;
+  clock_t  Start;
+  clock_t  Total;
+
+  Total = 0;
+  for (Iteration = 0; Iteration < TIMING_ITERATIONS; Iteration++) {
+    ResetRun ();
+    Start  = clock ();
+    Install (&mAcpiTableProtocol);
+    Total += clock () - Start;
+  }
+
+  ResetRun ();
+  return DivU64x32 (
+           MultU64x32 ((UINT64)Total, 1000000000 / CLOCKS_PER_SEC),
+           TIMING_ITERATIONS
+           );
+}
+
+/**
+  Report the time both implementations take to process a script. There is no
+  pass / fail criterion, as host timings are too noisy for one.
+
+  @param[in] Context  The REPLAY_CONTEXT of the script.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+ReportReplayTime (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  REPLAY_CONTEXT  *Replay;
+  UINT64          ReferenceNs;
+  UINT64          SinglePassNs;
+
+  Replay = Context;
+  ResetFwCfg ();
+  Replay->Build ();
+
+  ReferenceNs  = TimeScript (ReferenceInstallQemuFwCfgTables);
+  SinglePassNs = TimeScript (InstallQemuFwCfgTables);
+
+  UT_LOG_INFO (
+    "%a: %u commands, two-pass %Lu ns, single-pass %Lu ns per run\n",
+    Replay->Name,
+    (UINT32)mScriptCount,
+    ReferenceNs,
+    SinglePassNs
+    );
+  //
+  // The unit test log only goes to the report; show the numbers on the console
+  // too. PcdDebugPrintErrorLevel is set to hide everything below DEBUG_ERROR,
+  // as the loader would print its DEBUG_INFO summary for every iteration.
+  //
+  DEBUG ((
+    DEBUG_ERROR,
+    "%a: %u commands, two-pass %Lu ns, single-pass %Lu ns per run\n",
+    Replay->Name,
+    (UINT32)mScriptCount,
+    ReferenceNs,
+    SinglePassNs
+    ));
+
+  ResetFwCfg ();
+  return UNIT_TEST_PASSED;
+}
+
+STATIC REPLAY_CONTEXT  mQ35Replay    = { "q35", BuildQ35Script, EFI_SUCCESS, 8 };
+STATIC REPLAY_CONTEXT  mPcReplay     = { "pc", BuildPcScript, EFI_SUCCESS, 5 };
+STATIC REPLAY_CONTEXT  mBrokenReplay = { "q35-broken", BuildBrokenScript, EFI_PROTOCOL_ERROR, 0 };
+
+/**
+  Initialize the unit test framework, suites, and test cases, and run them.
+
+  @retval EFI_SUCCESS  All test cases were dispatched.
+  @return              Error codes from the unit test framework.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+UefiTestMain (
+  VOID
+  )
+{
+  EFI_STATUS                  Status;
+  UNIT_TEST_FRAMEWORK_HANDLE  Framework;
+  UNIT_TEST_SUITE_HANDLE      ReplaySuite;
+  UNIT_TEST_SUITE_HANDLE      TimingSuite;
+
+  Framework = NULL;
+
+  DEBUG ((DEBUG_INFO, "%a v%a\n", UNIT_TEST_APP_NAME, UNIT_TEST_APP_VERSION));
+
+  mArena                                = ALIGN_POINTER (mArenaBuffer, EFI_PAGE_SIZE);
+  mBootServices.AllocatePages           = FakeAllocatePages;
+  mBootServices.FreePages               = FakeFreePages;
+  gBS                                   = &mBootServices;
+  mAcpiTableProtocol.InstallAcpiTable   = FakeInstallAcpiTable;
+  mAcpiTableProtocol.UninstallAcpiTable = FakeUninstallAcpiTable;
+
+  Status = InitUnitTestFramework (&Framework, UNIT_TEST_APP_NAME, gEfiCallerBaseName, UNIT_TEST_APP_VERSION);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in InitUnitTestFramework. Status = %r\n", Status));
+    goto EXIT;
+  }
+
+  Status = CreateUnitTestSuite (&ReplaySuite, Framework, "Table loader script replay", "QemuQ35Pkg.AcpiPlatformDxe.Replay", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in CreateUnitTestSuite for the replay suite\n"));
+    goto EXIT;
+  }
+
+  AddTestCase (ReplaySuite, "q35 script matches the two-pass implementation", "Q35", ReplayMatchesReference, ArenaBelow4Gb, NULL, &mQ35Replay);
+  AddTestCase (ReplaySuite, "pc script matches the two-pass implementation", "Pc", ReplayMatchesReference, ArenaBelow4Gb, NULL, &mPcReplay);
+  AddTestCase (ReplaySuite, "Failing script is rolled back like the two-pass implementation", "Broken", ReplayMatchesReference, ArenaBelow4Gb, NULL, &mBrokenReplay);
+
+  Status = CreateUnitTestSuite (&TimingSuite, Framework, "Table loader script timing", "QemuQ35Pkg.AcpiPlatformDxe.Timing", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in CreateUnitTestSuite for the timing suite\n"));
+    goto EXIT;
+  }
+
+  AddTestCase (TimingSuite, "q35 script processing time", "Q35", ReportReplayTime, ArenaBelow4Gb, NULL, &mQ35Replay);
+  AddTestCase (TimingSuite, "pc script processing time", "Pc", ReportReplayTime, ArenaBelow4Gb, NULL, &mPcReplay);
+
+  Status = RunAllTestSuites (Framework);
+
+EXIT:
+  if (Framework != NULL) {
+    FreeUnitTestFramework (Framework);
+  }
+
+  return Status;
+}
+
+/**
+  Standard POSIX C entry point for host based unit test execution.
+**/
+int
+main (
+  int   argc,
+  char  *argv[]
+  )
+{
+  return UefiTestMain ();
+}
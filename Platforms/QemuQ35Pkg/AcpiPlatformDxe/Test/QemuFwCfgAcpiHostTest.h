@@ -0,0 +1,30 @@
+/** @file
+  Declarations shared by the sources of QemuFwCfgAcpiHostTest.
+
+  Copyright (c) Microsoft Corporation
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef QEMU_FW_CFG_ACPI_HOST_TEST_H_
+#define QEMU_FW_CFG_ACPI_HOST_TEST_H_
+
+#include "../AcpiPlatform.h"
+
+/**
+  Download, process, and install ACPI table data from the QEMU loader
+  interface, with the two-pass implementation that QemuFwCfgAcpi.c used to
+  have. See QemuFwCfgAcpiReference.c.
+
+  @param[in] AcpiProtocol  The ACPI table protocol used to install tables.
+
+  @return  See InstallQemuFwCfgTables().
+**/
+EFI_STATUS
+EFIAPI
+ReferenceInstallQemuFwCfgTables (
+  IN   EFI_ACPI_TABLE_PROTOCOL  *AcpiProtocol
+  );
+
+#endif
@@ -0,0 +1,34 @@
+/** @file
+  GUID and layout of the HOB that caches the fw_cfg file directory.
+
+  The PEI instance of QemuFwCfgLib reads QemuFwCfgItemFileDir once, converts
+  the entries to CPU byte order, sorts them by name, and stores them in this
+  HOB, so that later lookups (in PEI and in DXE) need no fw_cfg transfers.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef __QEMU_FW_CFG_FILE_DIR_HOB_H__
+#define __QEMU_FW_CFG_FILE_DIR_HOB_H__
+
+#include <IndustryStandard/QemuFwCfg.h>
+
+#define QEMU_FW_CFG_FILE_DIR_HOB_GUID \
+{0x5f1b3a7e, 0x2c4d, 0x4e8a, {0x9b, 0x61, 0x0d, 0x37, 0xc2, 0x84, 0xa9, 0x5e}}
+
+//
+// Files[] holds Count entries, sorted by AsciiStrCmp() on Name. Unlike in the
+// fw_cfg item, Size and Select are in CPU byte order.
+//
+typedef struct {
+  UINT32         Count;
+  FW_CFG_FILE    Files[1];
+} QEMU_FW_CFG_FILE_DIR;
+
+#define QEMU_FW_CFG_FILE_DIR_SIZE(Count) \
+  (OFFSET_OF (QEMU_FW_CFG_FILE_DIR, Files) + (UINTN)(Count) * sizeof (FW_CFG_FILE))
+
+extern EFI_GUID  gQemuFwCfgFileDirHobGuid;
+
+#endif
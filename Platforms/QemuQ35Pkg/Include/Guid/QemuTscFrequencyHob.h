@@ -0,0 +1,25 @@
+/** @file
+  GUID and layout of the HOB that records the invariant TSC frequency.
+
+  The PEI instance of AcpiTimerLib determines the TSC frequency once, and
+  stores it in this HOB. Later instances (PEI, DXE and MM) read it from the
+  HOB instead of calibrating again.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef __QEMU_TSC_FREQUENCY_HOB_H__
+#define __QEMU_TSC_FREQUENCY_HOB_H__
+
+#define QEMU_TSC_FREQUENCY_HOB_GUID \
+{0x3c9b6f2d, 0x81a4, 0x4f57, {0xa6, 0x0e, 0x5d, 0x92, 0x1b, 0xc4, 0x73, 0xe8}}
+
+//
+// The HOB data is a single UINT64: the TSC frequency in Hz. Zero means that
+// the TSC is not invariant, or its frequency could not be determined; in
+// that case the ACPI PM timer is used.
+//
+extern EFI_GUID  gQemuTscFrequencyHobGuid;
+
+#endif
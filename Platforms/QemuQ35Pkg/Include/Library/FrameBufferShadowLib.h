@@ -0,0 +1,118 @@
+/** @file
+
+  Frame buffer shadow library
+
+  This library class keeps a copy of a linear frame buffer in RAM, performs
+  Graphics Output Protocol Blt() operations on the copy, and writes the
+  rectangle damaged by them to the real frame buffer at a bounded rate. Reads
+  (EfiBltVideoToBltBuffer, EfiBltVideoToVideo) never touch the real frame
+  buffer, which is slow to read when it is device memory, or when the VMM
+  tracks writes to it.
+
+  Pixels written to the frame buffer directly, rather than through Blt(), are
+  not seen by the shadow, and may be overwritten by later flushes.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+**/
+
+#ifndef FRAME_BUFFER_SHADOW_LIB_H_
+#define FRAME_BUFFER_SHADOW_LIB_H_
+
+#include <Protocol/GraphicsOutput.h>
+
+typedef struct FRAME_BUFFER_SHADOW FRAME_BUFFER_SHADOW;
+
+/**
+  Create the shadow of a frame buffer, or reconfigure it for a new mode.
+
+  The contents of the shadow are undefined afterwards; the caller is expected
+  to clear the screen with FrameBufferShadowBlt(). If no memory is available
+  for the shadow, Blt() operations are performed on the frame buffer directly.
+
+  @param[in]      FrameBuffer      Pointer to the start of the frame buffer.
+  @param[in]      FrameBufferInfo  Describes the frame buffer characteristics.
+  @param[in, out] Shadow           On input, the shadow to reconfigure, or
+                                   NULL to create one. On output, the shadow.
+
+  @retval RETURN_SUCCESS            The shadow was configured.
+  @retval RETURN_INVALID_PARAMETER  FrameBuffer, FrameBufferInfo or Shadow is
+                                    NULL.
+  @retval RETURN_UNSUPPORTED        The requested mode is not supported by
+                                    FrameBufferBltLib.
+  @retval RETURN_OUT_OF_RESOURCES   A new shadow could not be created.
+**/
+RETURN_STATUS
+EFIAPI
+FrameBufferShadowConfigure (
+  IN      VOID                                  *FrameBuffer,
+  IN      EFI_GRAPHICS_OUTPUT_MODE_INFORMATION  *FrameBufferInfo,
+  IN OUT  FRAME_BUFFER_SHADOW                   **Shadow
+  );
+
+/**
+  Perform a Blt() operation on the shadow, and schedule the damaged rectangle
+  to be written to the frame buffer.
+
+  @param[in]      Shadow        The shadow, from FrameBufferShadowConfigure().
+  @param[in, out] BltBuffer     The data to transfer to screen.
+  @param[in]      BltOperation  The operation to perform.
+  @param[in]      SourceX       The X coordinate of the source for BltOperation.
+  @param[in]      SourceY       The Y coordinate of the source for BltOperation.
+  @param[in]      DestinationX  The X coordinate of the destination for
+                                BltOperation.
+  @param[in]      DestinationY  The Y coordinate of the destination for
+                                BltOperation.
+  @param[in]      Width         The width of a rectangle in the blt rectangle
+                                in pixels.
+  @param[in]      Height        The height of a rectangle in the blt rectangle
+                                in pixels.
+  @param[in]      Delta         Not used for EfiBltVideoFill and
+                                EfiBltVideoToVideo operation. If a Delta of 0
+                                is used, the entire BltBuffer will be operated
+                                on. If a subrectangle of the BltBuffer is
+                                used, then Delta represents the number of
+                                bytes in a row of the BltBuffer.
+
+  @retval RETURN_SUCCESS            The operation was performed on the shadow.
+  @retval RETURN_INVALID_PARAMETER  Invalid parameter were passed in.
+  @retval RETURN_DEVICE_ERROR       The shadow is not configured for a valid
+                                    mode.
+**/
+RETURN_STATUS
+EFIAPI
+FrameBufferShadowBlt (
+  IN      FRAME_BUFFER_SHADOW                *Shadow,
+  IN OUT  EFI_GRAPHICS_OUTPUT_BLT_PIXEL      *BltBuffer OPTIONAL,
+  IN      EFI_GRAPHICS_OUTPUT_BLT_OPERATION  BltOperation,
+  IN      UINTN                              SourceX,
+  IN      UINTN                              SourceY,
+  IN      UINTN                              DestinationX,
+  IN      UINTN                              DestinationY,
+  IN      UINTN                              Width,
+  IN      UINTN                              Height,
+  IN      UINTN                              Delta
+  );
+
+/**
+  Write the damaged rectangle of the shadow to the frame buffer now.
+
+  @param[in] Shadow  The shadow, from FrameBufferShadowConfigure().
+**/
+VOID
+EFIAPI
+FrameBufferShadowFlush (
+  IN FRAME_BUFFER_SHADOW  *Shadow
+  );
+
+/**
+  Flush and free a shadow.
+
+  @param[in] Shadow  The shadow, from FrameBufferShadowConfigure().
+**/
+VOID
+EFIAPI
+FrameBufferShadowFree (
+  IN FRAME_BUFFER_SHADOW  *Shadow
+  );
+
+#endif
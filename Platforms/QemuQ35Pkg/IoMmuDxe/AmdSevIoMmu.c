@@ -16,6 +16,17 @@
 
 #define MAP_INFO_SIG  SIGNATURE_64 ('M', 'A', 'P', '_', 'I', 'N', 'F', 'O')
 
+//
+// A size class of the bounce buffer pool. Each class is a run of SlotCount
+// (at most 32) contiguous, page aligned slots of SlotSize bytes.
+//
+typedef struct {
+  UINTN                   SlotSize;
+  UINT32                  SlotCount;
+  UINT32                  FreeSlots;  // Bitmap of the free slots
+  EFI_PHYSICAL_ADDRESS    Base;
+} BOUNCE_POOL_CLASS;
+
 typedef struct {
   UINT64                   Signature;
   LIST_ENTRY               Link;
@@ -24,6 +35,9 @@ typedef struct {
   UINTN                    NumberOfPages;
   EFI_PHYSICAL_ADDRESS     CryptedAddress;
   EFI_PHYSICAL_ADDRESS     PlainTextAddress;
+  BOUNCE_POOL_CLASS        *PoolClass;     // NULL unless PlainTextAddress is a
+                                           // bounce pool slot
+  UINT32                   PoolSlot;
 } MAP_INFO;
 
 //
@@ -33,6 +47,42 @@ typedef struct {
 //
 STATIC LIST_ENTRY  mMapInfos = INITIALIZE_LIST_HEAD_VARIABLE (mMapInfos);
 
+//
+// MAP_INFO structures are taken from a static slab, and only allocated from
+// pool once the slab is exhausted. mFreeMapInfos links the unused elements of
+// the slab.
+//
+#define MAP_INFO_SLAB_SIZE  64
+
+STATIC MAP_INFO    mMapInfoSlab[MAP_INFO_SLAB_SIZE];
+STATIC LIST_ENTRY  mFreeMapInfos = INITIALIZE_LIST_HEAD_VARIABLE (mFreeMapInfos);
+
+//
+// The bounce buffer pool serves BusMasterRead[64] and BusMasterWrite[64]
+// operations. It is allocated below 4GB, so that it suits both the 32-bit and
+// the 64-bit operations, and it is decrypted once, when the protocol is
+// installed. Map() and Unmap() thus neither allocate the bounce buffer nor
+// change page encryption attributes for requests that fit a free slot;
+// larger requests, and requests arriving while the matching slots are busy,
+// take the page allocation path.
+//
+STATIC BOUNCE_POOL_CLASS  mBouncePool[] = {
+  { SIZE_4KB,   32 },
+  { SIZE_32KB,  16 },
+  { SIZE_128KB, 8  },
+  { SIZE_1MB,   2  },
+};
+
+STATIC EFI_PHYSICAL_ADDRESS  mBouncePoolBase;
+STATIC UINTN                 mBouncePoolPages;
+
+//
+// Bounce buffer statistics, reported at ExitBootServices().
+//
+STATIC UINT64  mBouncePoolHits;
+STATIC UINT64  mBouncePoolMisses;
+STATIC UINT64  mBouncedBytes;
+
 #define COMMON_BUFFER_SIG  SIGNATURE_64 ('C', 'M', 'N', 'B', 'U', 'F', 'F', 'R')
 
 //
@@ -72,6 +122,190 @@ typedef struct {
 } COMMON_BUFFER_HEADER;
 #pragma pack ()
 
+/**
+  Take a MAP_INFO structure from the slab, or allocate one from pool if the
+  slab is exhausted.
+
+  @return  The MAP_INFO structure, or NULL if pool allocation failed.
+**/
+STATIC
+MAP_INFO *
+AllocateMapInfo (
+  VOID
+  )
+{
+  EFI_TPL   OldTpl;
+  MAP_INFO  *MapInfo;
+
+  MapInfo = NULL;
+  OldTpl  = gBS->RaiseTPL (TPL_NOTIFY);
+  if (!IsListEmpty (&mFreeMapInfos)) {
+    MapInfo = CR (GetFirstNode (&mFreeMapInfos), MAP_INFO, Link, MAP_INFO_SIG);
+    RemoveEntryList (&MapInfo->Link);
+  }
+
+  gBS->RestoreTPL (OldTpl);
+
+  if (MapInfo == NULL) {
+    MapInfo = AllocatePool (sizeof (MAP_INFO));
+  }
+
+  return MapInfo;
+}
+
+/**
+  Release a MAP_INFO structure returned by AllocateMapInfo().
+
+  @param[in] MapInfo          The MAP_INFO structure to release. It must not
+                              be linked into mMapInfos.
+  @param[in] MemoryMapLocked  Changes to the UEFI memory map are forbidden;
+                              MapInfo is leaked if it was allocated from pool.
+**/
+STATIC
+VOID
+FreeMapInfo (
+  IN MAP_INFO  *MapInfo,
+  IN BOOLEAN   MemoryMapLocked
+  )
+{
+  EFI_TPL  OldTpl;
+
+  if ((MapInfo >= mMapInfoSlab) &&
+      (MapInfo < mMapInfoSlab + MAP_INFO_SLAB_SIZE))
+  {
+    MapInfo->Signature = MAP_INFO_SIG;
+    OldTpl             = gBS->RaiseTPL (TPL_NOTIFY);
+    InsertHeadList (&mFreeMapInfos, &MapInfo->Link);
+    gBS->RestoreTPL (OldTpl);
+  } else if (!MemoryMapLocked) {
+    FreePool (MapInfo);
+  }
+}
+
+/**
+  Take the smallest free bounce pool slot that can hold MapInfo->NumberOfBytes,
+  and point MapInfo->PlainTextAddress to it.
+
+  @param[in,out] MapInfo  The MAP_INFO structure of a BusMasterRead[64] or
+                          BusMasterWrite[64] operation.
+
+  @retval TRUE   MapInfo->PlainTextAddress, MapInfo->PoolClass and
+                 MapInfo->PoolSlot have been set.
+  @retval FALSE  No free slot is large enough.
+**/
+STATIC
+BOOLEAN
+BouncePoolAcquire (
+  IN OUT MAP_INFO  *MapInfo
+  )
+{
+  EFI_TPL            OldTpl;
+  UINTN              Index;
+  BOUNCE_POOL_CLASS  *Class;
+  UINT32             Slot;
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  for (Index = 0; Index < ARRAY_SIZE (mBouncePool); Index++) {
+    Class = &mBouncePool[Index];
+    if ((Class->SlotSize < MapInfo->NumberOfBytes) || (Class->FreeSlots == 0)) {
+      continue;
+    }
+
+    Slot              = (UINT32)LowBitSet32 (Class->FreeSlots);
+    Class->FreeSlots &= ~(BIT0 << Slot);
+    gBS->RestoreTPL (OldTpl);
+
+    MapInfo->PoolClass        = Class;
+    MapInfo->PoolSlot         = Slot;
+    MapInfo->PlainTextAddress = Class->Base + MultU64x32 (Class->SlotSize, Slot);
+    ++mBouncePoolHits;
+    return TRUE;
+  }
+
+  gBS->RestoreTPL (OldTpl);
+  ++mBouncePoolMisses;
+  return FALSE;
+}
+
+/**
+  Return the bounce pool slot of MapInfo to the pool.
+
+  @param[in] MapInfo  The MAP_INFO structure whose slot BouncePoolAcquire()
+                      has taken.
+**/
+STATIC
+VOID
+BouncePoolRelease (
+  IN MAP_INFO  *MapInfo
+  )
+{
+  EFI_TPL  OldTpl;
+
+  OldTpl                        = gBS->RaiseTPL (TPL_NOTIFY);
+  MapInfo->PoolClass->FreeSlots |= BIT0 << MapInfo->PoolSlot;
+  gBS->RestoreTPL (OldTpl);
+}
+
+/**
+  Allocate the bounce buffer pool below 4GB and decrypt it.
+
+  If the pool cannot be allocated, every class is left without free slots,
+  and all bounce buffers are allocated on demand.
+**/
+STATIC
+VOID
+BouncePoolInit (
+  VOID
+  )
+{
+  EFI_STATUS            Status;
+  UINTN                 Index;
+  UINTN                 PoolSize;
+  EFI_PHYSICAL_ADDRESS  Address;
+
+  PoolSize = 0;
+  for (Index = 0; Index < ARRAY_SIZE (mBouncePool); Index++) {
+    ASSERT (mBouncePool[Index].SlotCount <= 32);
+    PoolSize += mBouncePool[Index].SlotSize * mBouncePool[Index].SlotCount;
+  }
+
+  Address = BASE_4GB - 1;
+  Status  = gBS->AllocatePages (
+                   AllocateMaxAddress,
+                   EfiBootServicesData,
+                   EFI_SIZE_TO_PAGES (PoolSize),
+                   &Address
+                   );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "%a: no bounce buffer pool: %r\n", __FUNCTION__, Status));
+    return;
+  }
+
+  Status = MemEncryptSevClearPageEncMask (0, Address, EFI_SIZE_TO_PAGES (PoolSize));
+  ASSERT_EFI_ERROR (Status);
+  if (EFI_ERROR (Status)) {
+    CpuDeadLoop ();
+  }
+
+  ZeroMem ((VOID *)(UINTN)Address, PoolSize);
+
+  mBouncePoolBase  = Address;
+  mBouncePoolPages = EFI_SIZE_TO_PAGES (PoolSize);
+  for (Index = 0; Index < ARRAY_SIZE (mBouncePool); Index++) {
+    mBouncePool[Index].Base      = Address;
+    mBouncePool[Index].FreeSlots = MAX_UINT32 >> (32 - mBouncePool[Index].SlotCount);
+    Address                     += mBouncePool[Index].SlotSize * mBouncePool[Index].SlotCount;
+  }
+
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: bounce buffer pool at 0x%Lx, 0x%Lx pages\n",
+    __FUNCTION__,
+    mBouncePoolBase,
+    (UINT64)mBouncePoolPages
+    ));
+}
+
 /**
   Provides the controller-specific addresses required to access system memory
   from a DMA bus master. On SEV guest, the DMA operations must be performed on
@@ -118,6 +352,7 @@ IoMmuMap (
   EFI_ALLOCATE_TYPE     AllocateType;
   COMMON_BUFFER_HEADER  *CommonBufferHeader;
   VOID                  *DecryptionSource;
+  EFI_TPL               OldTpl;
 
   DEBUG ((
     DEBUG_VERBOSE,
@@ -141,7 +376,7 @@ IoMmuMap (
   // Allocate a MAP_INFO structure to remember the mapping when Unmap() is
   // called later.
   //
-  MapInfo = AllocatePool (sizeof (MAP_INFO));
+  MapInfo = AllocateMapInfo ();
   if (MapInfo == NULL) {
     Status = EFI_OUT_OF_RESOURCES;
     goto Failed;
@@ -156,6 +391,8 @@ IoMmuMap (
   MapInfo->NumberOfBytes  = *NumberOfBytes;
   MapInfo->NumberOfPages  = EFI_SIZE_TO_PAGES (MapInfo->NumberOfBytes);
   MapInfo->CryptedAddress = (UINTN)HostAddress;
+  MapInfo->PoolClass      = NULL;
+  MapInfo->PoolSlot       = 0;
 
   //
   // In the switch statement below, we point "MapInfo->PlainTextAddress" to the
@@ -180,6 +417,16 @@ IoMmuMap (
     //
     case EdkiiIoMmuOperationBusMasterRead64:
     case EdkiiIoMmuOperationBusMasterWrite64:
+      mBouncedBytes += MapInfo->NumberOfBytes;
+
+      //
+      // Take an already decrypted slot from the bounce buffer pool, if one is
+      // free. The pool lies below 4GB, so it fits every operation.
+      //
+      if (BouncePoolAcquire (MapInfo)) {
+        break;
+      }
+
       //
       // Allocate the implicit plaintext bounce buffer.
       //
@@ -251,16 +498,19 @@ IoMmuMap (
   }
 
   //
-  // Clear the memory encryption mask on the plaintext buffer.
+  // Clear the memory encryption mask on the plaintext buffer. Bounce pool
+  // slots are permanently decrypted.
   //
-  Status = MemEncryptSevClearPageEncMask (
-             0,
-             MapInfo->PlainTextAddress,
-             MapInfo->NumberOfPages
-             );
-  ASSERT_EFI_ERROR (Status);
-  if (EFI_ERROR (Status)) {
-    CpuDeadLoop ();
+  if (MapInfo->PoolClass == NULL) {
+    Status = MemEncryptSevClearPageEncMask (
+               0,
+               MapInfo->PlainTextAddress,
+               MapInfo->NumberOfPages
+               );
+    ASSERT_EFI_ERROR (Status);
+    if (EFI_ERROR (Status)) {
+      CpuDeadLoop ();
+    }
   }
 
   //
@@ -286,7 +536,9 @@ IoMmuMap (
   //
   // Track all MAP_INFO structures.
   //
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
   InsertHeadList (&mMapInfos, &MapInfo->Link);
+  gBS->RestoreTPL (OldTpl);
   //
   // Populate output parameters.
   //
@@ -306,7 +558,7 @@ IoMmuMap (
   return EFI_SUCCESS;
 
 FreeMapInfo:
-  FreePool (MapInfo);
+  FreeMapInfo (MapInfo, FALSE);
 
 Failed:
   *NumberOfBytes = 0;
@@ -344,6 +596,7 @@ IoMmuUnmapWorker (
   EFI_STATUS            Status;
   COMMON_BUFFER_HEADER  *CommonBufferHeader;
   VOID                  *EncryptionTarget;
+  EFI_TPL               OldTpl;
 
   DEBUG ((
     DEBUG_VERBOSE,
@@ -404,6 +657,15 @@ IoMmuUnmapWorker (
       break;
   }
 
+  //
+  // A bounce pool slot stays decrypted; just return it to the pool. It only
+  // ever held data that was shared with the hypervisor anyway.
+  //
+  if (MapInfo->PoolClass != NULL) {
+    BouncePoolRelease (MapInfo);
+    goto ForgetMapInfo;
+  }
+
   //
   // Restore the memory encryption mask on the area we used to hold the
   // plaintext.
@@ -444,14 +706,15 @@ IoMmuUnmapWorker (
     }
   }
 
+ForgetMapInfo:
   //
   // Forget the MAP_INFO structure, then free it (unless the UEFI memory map is
   // locked).
   //
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
   RemoveEntryList (&MapInfo->Link);
-  if (!MemoryMapLocked) {
-    FreePool (MapInfo);
-  }
+  gBS->RestoreTPL (OldTpl);
+  FreeMapInfo (MapInfo, MemoryMapLocked);
 
   return EFI_SUCCESS;
 }
@@ -831,6 +1094,7 @@ AmdSevUnmapAllMappings (
   LIST_ENTRY  *Node;
   LIST_ENTRY  *NextNode;
   MAP_INFO    *MapInfo;
+  EFI_STATUS  Status;
 
   DEBUG ((DEBUG_VERBOSE, "%a\n", __FUNCTION__));
 
@@ -847,6 +1111,29 @@ AmdSevUnmapAllMappings (
       TRUE      // MemoryMapLocked
       );
   }
+
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: bounce pool hits=%Lu misses=%Lu, 0x%Lx bytes bounced\n",
+    __FUNCTION__,
+    mBouncePoolHits,
+    mBouncePoolMisses,
+    mBouncedBytes
+    ));
+
+  //
+  // Hand the bounce buffer pool back to the OS encrypted, like every other
+  // bounce buffer.
+  //
+  if (mBouncePoolPages != 0) {
+    Status = MemEncryptSevSetPageEncMask (0, mBouncePoolBase, mBouncePoolPages);
+    ASSERT_EFI_ERROR (Status);
+    if (EFI_ERROR (Status)) {
+      CpuDeadLoop ();
+    }
+
+    ZeroMem ((VOID *)(UINTN)mBouncePoolBase, EFI_PAGES_TO_SIZE (mBouncePoolPages));
+  }
 }
 
 /**
@@ -863,6 +1150,14 @@ AmdSevInstallIoMmuProtocol (
   EFI_EVENT   UnmapAllMappingsEvent;
   EFI_EVENT   ExitBootEvent;
   EFI_HANDLE  Handle;
+  UINTN       Index;
+
+  for (Index = 0; Index < MAP_INFO_SLAB_SIZE; Index++) {
+    mMapInfoSlab[Index].Signature = MAP_INFO_SIG;
+    InsertTailList (&mFreeMapInfos, &mMapInfoSlab[Index].Link);
+  }
+
+  BouncePoolInit ();
 
   //
   // Create the "late" event whose notification function will tear down all
@@ -1,6 +1,10 @@
 /** @file
   ACPI Timer implements one instance of Timer Library.
 
+  Instances that provide a TSC frequency (see InternalGetTscFrequency()) use
+  the invariant TSC instead of the ACPI timer, because reading the ACPI timer
+  traps to the hypervisor.
+
   Copyright (c) 2008 - 2012, Intel Corporation. All rights reserved.<BR>
   Copyright (c) 2011, Andrei Warkentin <andreiw@motorola.com>
 
@@ -19,6 +23,119 @@
 //
 #define ACPI_TIMER_COUNT_SIZE  BIT24
 
+//
+// Number of ACPI timer ticks (about 10ms) to measure the TSC against, when
+// its frequency is not reported by CPUID.
+//
+#define TSC_CALIBRATION_TICKS  (ACPI_TIMER_FREQUENCY / 100)
+
+/**
+  Determine the frequency of the invariant TSC.
+
+  The frequency is taken from the hypervisor timing leaf or from CPUID leaves
+  0x15 / 0x16, if they report it. Otherwise, the TSC is measured against the
+  ACPI timer; InternalAcpiGetTimerTick() must be usable at this point.
+
+  @return The TSC frequency in Hz, or 0 if the TSC is not invariant.
+
+**/
+UINT64
+InternalCalibrateTscFrequency (
+  VOID
+  )
+{
+  UINT32  MaxLeaf;
+  UINT32  RegEax;
+  UINT32  RegEbx;
+  UINT32  RegEcx;
+  UINT32  RegEdx;
+  UINT32  StartTick;
+  UINT32  Elapsed;
+  UINT64  StartTsc;
+  UINT64  EndTsc;
+
+  //
+  // The TSC is only usable as a timer if it runs at a constant rate.
+  //
+  AsmCpuid (0x80000000, &MaxLeaf, NULL, NULL, NULL);
+  if (MaxLeaf < 0x80000007) {
+    return 0;
+  }
+
+  AsmCpuid (0x80000007, NULL, NULL, NULL, &RegEdx);
+  if ((RegEdx & BIT8) == 0) {
+    return 0;
+  }
+
+  //
+  // QEMU/KVM publish the TSC frequency (in kHz) in the hypervisor timing
+  // leaf 0x40000010.
+  //
+  AsmCpuid (0x1, NULL, NULL, &RegEcx, NULL);
+  if ((RegEcx & BIT31) != 0) {
+    AsmCpuid (0x40000000, &MaxLeaf, NULL, NULL, NULL);
+    if (MaxLeaf >= 0x40000010) {
+      AsmCpuid (0x40000010, &RegEax, NULL, NULL, NULL);
+      if (RegEax != 0) {
+        return MultU64x32 (RegEax, 1000);
+      }
+    }
+  }
+
+  //
+  // Time Stamp Counter and Core Crystal Clock leaf, then Processor Frequency
+  // Information leaf.
+  //
+  AsmCpuid (0x0, &MaxLeaf, NULL, NULL, NULL);
+  if (MaxLeaf >= 0x15) {
+    AsmCpuid (0x15, &RegEax, &RegEbx, &RegEcx, NULL);
+    if ((RegEax != 0) && (RegEbx != 0) && (RegEcx != 0)) {
+      return DivU64x32 (MultU64x32 (RegEcx, RegEbx), RegEax);
+    }
+  }
+
+  if (MaxLeaf >= 0x16) {
+    AsmCpuid (0x16, &RegEax, NULL, NULL, NULL);
+    if ((RegEax & 0xFFFF) != 0) {
+      return MultU64x32 (RegEax & 0xFFFF, 1000000u);
+    }
+  }
+
+  //
+  // Measure the TSC against the ACPI timer.
+  //
+  StartTick = InternalAcpiGetTimerTick ();
+  StartTsc  = AsmReadTsc ();
+  do {
+    CpuPause ();
+    Elapsed = (InternalAcpiGetTimerTick () - StartTick) & (ACPI_TIMER_COUNT_SIZE - 1);
+  } while (Elapsed < TSC_CALIBRATION_TICKS);
+
+  EndTsc = AsmReadTsc ();
+
+  return DivU64x32 (MultU64x32 (EndTsc - StartTsc, ACPI_TIMER_FREQUENCY), Elapsed);
+}
+
+/**
+  Stalls the CPU for at least the given number of TSC ticks.
+
+  @param  Delay     A period of time to delay in TSC ticks.
+
+**/
+STATIC
+VOID
+InternalTscDelay (
+  IN      UINT64  Delay
+  )
+{
+  UINT64  Start;
+
+  Start = AsmReadTsc ();
+  while (AsmReadTsc () - Start < Delay) {
+    CpuPause ();
+  }
+}
+
 /**
   Stalls the CPU for at least the given number of ticks.
 
@@ -71,6 +188,14 @@ MicroSecondDelay (
   IN      UINTN  MicroSeconds
   )
 {
+  UINT64  TscFrequency;
+
+  TscFrequency = InternalGetTscFrequency ();
+  if (TscFrequency != 0) {
+    InternalTscDelay (DivU64x32 (MultU64x64 (MicroSeconds, TscFrequency), 1000000u));
+    return MicroSeconds;
+  }
+
   InternalAcpiDelay (
     (UINT32)DivU64x32 (
               MultU64x32 (
@@ -99,6 +224,14 @@ NanoSecondDelay (
   IN      UINTN  NanoSeconds
   )
 {
+  UINT64  TscFrequency;
+
+  TscFrequency = InternalGetTscFrequency ();
+  if (TscFrequency != 0) {
+    InternalTscDelay (DivU64x32 (MultU64x64 (NanoSeconds, TscFrequency), 1000000000u));
+    return NanoSeconds;
+  }
+
   InternalAcpiDelay (
     (UINT32)DivU64x32 (
               MultU64x32 (
@@ -129,6 +262,10 @@ GetPerformanceCounter (
   VOID
   )
 {
+  if (InternalGetTscFrequency () != 0) {
+    return AsmReadTsc ();
+  }
+
   return (UINT64)InternalAcpiGetTimerTick ();
 }
 
@@ -162,10 +299,21 @@ GetPerformanceCounterProperties (
   OUT      UINT64  *EndValue     OPTIONAL
   )
 {
+  UINT64  TscFrequency;
+
   if (StartValue != NULL) {
     *StartValue = 0;
   }
 
+  TscFrequency = InternalGetTscFrequency ();
+  if (TscFrequency != 0) {
+    if (EndValue != NULL) {
+      *EndValue = MAX_UINT64;
+    }
+
+    return TscFrequency;
+  }
+
   if (EndValue != NULL) {
     *EndValue = ACPI_TIMER_COUNT_SIZE - 1;
   }
@@ -190,21 +338,24 @@ GetTimeInNanoSecond (
   IN      UINT64  Ticks
   )
 {
+  UINT64  Frequency;
   UINT64  NanoSeconds;
-  UINT32  Remainder;
+  UINT64  Remainder;
+
+  Frequency = GetPerformanceCounterProperties (NULL, NULL);
 
   //
   //          Ticks
   // Time = --------- x 1,000,000,000
   //        Frequency
   //
-  NanoSeconds = MultU64x32 (DivU64x32Remainder (Ticks, ACPI_TIMER_FREQUENCY, &Remainder), 1000000000u);
+  NanoSeconds = MultU64x32 (DivU64x64Remainder (Ticks, Frequency, &Remainder), 1000000000u);
 
   //
-  // Frequency < 0x100000000, so Remainder < 0x100000000, then (Remainder * 1,000,000,000)
-  // will not overflow 64-bit.
+  // Frequency < 0x400000000 (the TSC runs below 17 GHz), so Remainder < 0x400000000,
+  // then (Remainder * 1,000,000,000) will not overflow 64-bit.
   //
-  NanoSeconds += DivU64x32 (MultU64x32 ((UINT64)Remainder, 1000000000u), ACPI_TIMER_FREQUENCY);
+  NanoSeconds += DivU64x64Remainder (MultU64x32 (Remainder, 1000000000u), Frequency, NULL);
 
   return NanoSeconds;
 }
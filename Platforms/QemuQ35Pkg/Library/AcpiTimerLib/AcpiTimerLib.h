@@ -20,4 +20,31 @@ InternalAcpiGetTimerTick (
   VOID
   );
 
+/**
+  Internal function to retrieve the frequency of the invariant TSC.
+
+  @return The TSC frequency in Hz, or 0 if the ACPI timer is to be used
+          instead of the TSC.
+
+**/
+UINT64
+InternalGetTscFrequency (
+  VOID
+  );
+
+/**
+  Determine the frequency of the invariant TSC.
+
+  The frequency is taken from the hypervisor timing leaf or from CPUID leaves
+  0x15 / 0x16, if they report it. Otherwise, the TSC is measured against the
+  ACPI timer; InternalAcpiGetTimerTick() must be usable at this point.
+
+  @return The TSC frequency in Hz, or 0 if the TSC is not invariant.
+
+**/
+UINT64
+InternalCalibrateTscFrequency (
+  VOID
+  );
+
 #endif // _ACPI_TIMER_LIB_INTERNAL_H_
@@ -7,18 +7,59 @@
 **/
 
 #include <Library/DebugLib.h>
+#include <Library/HobLib.h>
 #include <Library/IoLib.h>
+#include <Library/PcdLib.h>
 #include <Library/PciLib.h>
+#include <Guid/QemuTscFrequencyHob.h>
 #include <OvmfPlatforms.h>
 
+#include "AcpiTimerLib.h"
+
 //
 // Cached ACPI Timer IO Address
 //
 STATIC UINT32  mAcpiTimerIoAddr;
 
+//
+// Cached TSC frequency; zero if the ACPI timer is used
+//
+STATIC UINT64  mTscFrequency;
+
+/**
+  Cache the TSC frequency, taking it from gQemuTscFrequencyHobGuid.
+
+  The first PEIM that links this instance determines the frequency and
+  produces the HOB, so that later modules (including DXE_CORE) find it.
+
+**/
+STATIC
+VOID
+InitializeTscFrequency (
+  VOID
+  )
+{
+  EFI_HOB_GUID_TYPE  *GuidHob;
+
+  if (!FeaturePcdGet (PcdAcpiTimerLibUseTsc)) {
+    return;
+  }
+
+  GuidHob = GetFirstGuidHob (&gQemuTscFrequencyHobGuid);
+  if (GuidHob != NULL) {
+    mTscFrequency = *(UINT64 *)GET_GUID_HOB_DATA (GuidHob);
+    return;
+  }
+
+  mTscFrequency = InternalCalibrateTscFrequency ();
+  DEBUG ((DEBUG_INFO, "%a: TSC frequency: %Lu Hz\n", __FUNCTION__, mTscFrequency));
+
+  BuildGuidDataHob (&gQemuTscFrequencyHobGuid, &mTscFrequency, sizeof (mTscFrequency));
+}
+
 /**
   The constructor function caches the ACPI tick counter address, and,
-  if necessary, enables ACPI IO space.
+  if necessary, enables ACPI IO space. It also caches the TSC frequency.
 
   @retval EFI_SUCCESS   The constructor always returns RETURN_SUCCESS.
 
@@ -57,6 +98,7 @@ AcpiTimerLibConstructor (
       break;
     case CLOUDHV_DEVICE_ID:
       mAcpiTimerIoAddr =  CLOUDHV_ACPI_TIMER_IO_ADDRESS;
+      InitializeTscFrequency ();
       return RETURN_SUCCESS;
     default:
       DEBUG ((
@@ -86,6 +128,7 @@ AcpiTimerLibConstructor (
   }
 
   mAcpiTimerIoAddr = (PciRead32 (Pmba) & ~PMBA_RTE) + ACPI_TIMER_OFFSET;
+  InitializeTscFrequency ();
   return RETURN_SUCCESS;
 }
 
@@ -108,3 +151,18 @@ InternalAcpiGetTimerTick (
   //
   return IoRead32 (mAcpiTimerIoAddr);
 }
+
+/**
+  Internal function to retrieve the frequency of the invariant TSC.
+
+  @return The TSC frequency cached by this instance's constructor, or 0 if
+          the ACPI timer is to be used.
+
+**/
+UINT64
+InternalGetTscFrequency (
+  VOID
+  )
+{
+  return mTscFrequency;
+}
@@ -11,6 +11,8 @@
 #include <Library/IoLib.h>
 #include <OvmfPlatforms.h>
 
+#include "AcpiTimerLib.h"
+
 /**
   Internal function to read the current tick counter of ACPI.
 
@@ -30,3 +32,20 @@ InternalAcpiGetTimerTick (
   //
   return IoRead32 (BHYVE_ACPI_TIMER_IO_ADDR);
 }
+
+/**
+  Internal function to retrieve the frequency of the invariant TSC.
+
+  The TSC frequency HOB is not produced on bhyve, so this instance keeps
+  using the ACPI timer.
+
+  @return 0, the ACPI timer is always used.
+
+**/
+UINT64
+InternalGetTscFrequency (
+  VOID
+  )
+{
+  return 0;
+}
@@ -12,6 +12,8 @@
 #include <Library/PciLib.h>
 #include <OvmfPlatforms.h>
 
+#include "AcpiTimerLib.h"
+
 /**
   The constructor function enables ACPI IO space.
 
@@ -131,3 +133,20 @@ InternalAcpiGetTimerTick (
   //
   return IoRead32 ((PciRead32 (Pmba) & ~PMBA_RTE) + ACPI_TIMER_OFFSET);
 }
+
+/**
+  Internal function to retrieve the frequency of the invariant TSC.
+
+  This instance must not rely on global variables, so it does not cache
+  the TSC frequency, and keeps using the ACPI timer.
+
+  @return 0, the ACPI timer is always used.
+
+**/
+UINT64
+InternalGetTscFrequency (
+  VOID
+  )
+{
+  return 0;
+}
@@ -7,16 +7,52 @@
 **/
 
 #include <Library/DebugLib.h>
+#include <Library/HobLib.h>
 #include <Library/IoLib.h>
 #include <Library/PcdLib.h>
 #include <Library/PciLib.h>
+#include <Guid/QemuTscFrequencyHob.h>
 #include <OvmfPlatforms.h>
 
+#include "AcpiTimerLib.h"
+
 //
 // Cached ACPI Timer IO Address
 //
 STATIC UINT32  mAcpiTimerIoAddr;
 
+//
+// Cached TSC frequency; zero if the ACPI timer is used
+//
+STATIC UINT64  mTscFrequency;
+
+/**
+  Cache the TSC frequency, taking it from gQemuTscFrequencyHobGuid.
+
+  The HOB is normally produced by the "Base" instance of this library in
+  PEI. If it is missing, the frequency is determined locally.
+
+**/
+STATIC
+VOID
+InitializeTscFrequency (
+  VOID
+  )
+{
+  EFI_HOB_GUID_TYPE  *GuidHob;
+
+  if (!FeaturePcdGet (PcdAcpiTimerLibUseTsc)) {
+    return;
+  }
+
+  GuidHob = GetFirstGuidHob (&gQemuTscFrequencyHobGuid);
+  if (GuidHob != NULL) {
+    mTscFrequency = *(UINT64 *)GET_GUID_HOB_DATA (GuidHob);
+  } else {
+    mTscFrequency = InternalCalibrateTscFrequency ();
+  }
+}
+
 /**
   The constructor function caches the ACPI tick counter address
 
@@ -25,7 +61,8 @@ STATIC UINT32  mAcpiTimerIoAddr;
   instance of this library.
   In order to avoid querying the underlying platform type during each
   tick counter read operation, we cache the counter address during
-  initialization of this instance of the Timer Library.
+  initialization of this instance of the Timer Library. The TSC frequency
+  is cached likewise.
 
   @retval EFI_SUCCESS   The constructor always returns RETURN_SUCCESS.
 
@@ -52,6 +89,7 @@ AcpiTimerLibConstructor (
       break;
     case CLOUDHV_DEVICE_ID:
       mAcpiTimerIoAddr = CLOUDHV_ACPI_TIMER_IO_ADDRESS;
+      InitializeTscFrequency ();
       return RETURN_SUCCESS;
     default:
       DEBUG ((
@@ -65,6 +103,7 @@ AcpiTimerLibConstructor (
   }
 
   mAcpiTimerIoAddr = (PciRead32 (Pmba) & ~PMBA_RTE) + ACPI_TIMER_OFFSET;
+  InitializeTscFrequency ();
 
   return RETURN_SUCCESS;
 }
@@ -88,3 +127,18 @@ InternalAcpiGetTimerTick (
   //
   return IoRead32 (mAcpiTimerIoAddr);
 }
+
+/**
+  Internal function to retrieve the frequency of the invariant TSC.
+
+  @return The TSC frequency cached by this instance's constructor, or 0 if
+          the ACPI timer is to be used.
+
+**/
+UINT64
+InternalGetTscFrequency (
+  VOID
+  )
+{
+  return mTscFrequency;
+}
@@ -0,0 +1,498 @@
+/** @file
+  Keep a RAM copy of a linear frame buffer, and flush the rectangle damaged by
+  Blt() operations to the frame buffer from a timer event.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+
+#include <Guid/EventGroup.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/FrameBufferBltLib.h>
+#include <Library/FrameBufferShadowLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+struct FRAME_BUFFER_SHADOW {
+  //
+  // FrameBufferBltLib configuration for Buffer, or for FrameBuffer if no
+  // memory could be allocated for Buffer
+  //
+  FRAME_BUFFER_CONFIGURE    *Configure;
+  UINTN                     ConfigureSize;
+  BOOLEAN                   Ready;
+
+  UINT8                     *FrameBuffer;
+  UINT8                     *Buffer;
+  UINTN                     BufferPages;
+  UINTN                     BytesPerPixel;
+  UINTN                     BytesPerScanLine;
+
+  //
+  // The damaged rectangle, in pixels: [DamageLeft, DamageRight) horizontally,
+  // [DamageTop, DamageBottom) vertically. Empty if DamageRight is 0.
+  //
+  UINTN                     DamageLeft;
+  UINTN                     DamageTop;
+  UINTN                     DamageRight;
+  UINTN                     DamageBottom;
+
+  EFI_EVENT                 FlushEvent;
+  EFI_EVENT                 ExitBootServicesEvent;
+};
+
+/**
+  Return the number of bytes per pixel of a mode, or 0 if the mode has no
+  linear frame buffer.
+
+  @param[in] FrameBufferInfo  Describes the frame buffer characteristics.
+
+  @return The number of bytes per pixel.
+**/
+STATIC
+UINTN
+GetBytesPerPixel (
+  IN EFI_GRAPHICS_OUTPUT_MODE_INFORMATION  *FrameBufferInfo
+  )
+{
+  EFI_PIXEL_BITMASK  *Mask;
+
+  switch (FrameBufferInfo->PixelFormat) {
+    case PixelRedGreenBlueReserved8BitPerColor:
+    case PixelBlueGreenRedReserved8BitPerColor:
+      return sizeof (UINT32);
+    case PixelBitMask:
+      Mask = &FrameBufferInfo->PixelInformation;
+      return (UINTN)(HighBitSet32 (
+                       Mask->RedMask | Mask->GreenMask |
+                       Mask->BlueMask | Mask->ReservedMask
+                       ) + 8) / 8;
+    default:
+      return 0;
+  }
+}
+
+/**
+  Write the damaged rectangle of the shadow to the frame buffer.
+
+  The caller must be running at TPL_NOTIFY.
+
+  @param[in] Shadow  The shadow.
+**/
+STATIC
+VOID
+FlushDamage (
+  IN FRAME_BUFFER_SHADOW  *Shadow
+  )
+{
+  UINTN  Offset;
+  UINTN  Length;
+  UINTN  Row;
+
+  if (Shadow->DamageRight == 0) {
+    return;
+  }
+
+  Offset = Shadow->DamageTop * Shadow->BytesPerScanLine +
+           Shadow->DamageLeft * Shadow->BytesPerPixel;
+  Length = (Shadow->DamageRight - Shadow->DamageLeft) * Shadow->BytesPerPixel;
+
+  if (Length == Shadow->BytesPerScanLine) {
+    //
+    // Whole scan lines, such as after scrolling; copy them in one go.
+    //
+    CopyMem (
+      Shadow->FrameBuffer + Offset,
+      Shadow->Buffer + Offset,
+      Length * (Shadow->DamageBottom - Shadow->DamageTop)
+      );
+  } else {
+    for (Row = Shadow->DamageTop; Row < Shadow->DamageBottom; Row++) {
+      CopyMem (Shadow->FrameBuffer + Offset, Shadow->Buffer + Offset, Length);
+      Offset += Shadow->BytesPerScanLine;
+    }
+  }
+
+  Shadow->DamageLeft   = 0;
+  Shadow->DamageTop    = 0;
+  Shadow->DamageRight  = 0;
+  Shadow->DamageBottom = 0;
+}
+
+/**
+  Add a rectangle to the damaged rectangle of the shadow, and arm the flush
+  timer if the shadow was clean.
+
+  The caller must be running at TPL_NOTIFY.
+
+  @param[in] Shadow  The shadow.
+  @param[in] X       The X coordinate of the rectangle.
+  @param[in] Y       The Y coordinate of the rectangle.
+  @param[in] Width   The width of the rectangle in pixels.
+  @param[in] Height  The height of the rectangle in pixels.
+**/
+STATIC
+VOID
+AddDamage (
+  IN FRAME_BUFFER_SHADOW  *Shadow,
+  IN UINTN                X,
+  IN UINTN                Y,
+  IN UINTN                Width,
+  IN UINTN                Height
+  )
+{
+  UINT32  Interval;
+
+  if ((Shadow->Buffer == NULL) || (Width == 0) || (Height == 0)) {
+    return;
+  }
+
+  if (Shadow->DamageRight != 0) {
+    Shadow->DamageLeft   = MIN (Shadow->DamageLeft, X);
+    Shadow->DamageTop    = MIN (Shadow->DamageTop, Y);
+    Shadow->DamageRight  = MAX (Shadow->DamageRight, X + Width);
+    Shadow->DamageBottom = MAX (Shadow->DamageBottom, Y + Height);
+    return;
+  }
+
+  Shadow->DamageLeft   = X;
+  Shadow->DamageTop    = Y;
+  Shadow->DamageRight  = X + Width;
+  Shadow->DamageBottom = Y + Height;
+
+  Interval = PcdGet32 (PcdFrameBufferShadowFlushInterval);
+  if (Interval == 0) {
+    FlushDamage (Shadow);
+    return;
+  }
+
+  gBS->SetTimer (Shadow->FlushEvent, TimerRelative, Interval);
+}
+
+/**
+  Flush the shadow, on expiry of the flush timer, or at ExitBootServices().
+
+  @param[in] Event    Event whose notification function is being invoked.
+  @param[in] Context  The shadow.
+**/
+STATIC
+VOID
+EFIAPI
+FlushNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  FlushDamage (Context);
+}
+
+/**
+  Create the configuration for FrameBufferBltLib, growing the configuration
+  buffer if necessary.
+
+  @param[in]      FrameBuffer      Pointer to the start of the frame buffer.
+  @param[in]      FrameBufferInfo  Describes the frame buffer characteristics.
+  @param[in, out] Configure        The configuration buffer.
+  @param[in, out] ConfigureSize    The size of the configuration buffer.
+
+  @return Status from FrameBufferBltConfigure(), or RETURN_OUT_OF_RESOURCES.
+**/
+STATIC
+RETURN_STATUS
+ConfigureBlt (
+  IN      VOID                                  *FrameBuffer,
+  IN      EFI_GRAPHICS_OUTPUT_MODE_INFORMATION  *FrameBufferInfo,
+  IN OUT  FRAME_BUFFER_CONFIGURE                **Configure,
+  IN OUT  UINTN                                 *ConfigureSize
+  )
+{
+  RETURN_STATUS  Status;
+
+  Status = FrameBufferBltConfigure (
+             FrameBuffer,
+             FrameBufferInfo,
+             *Configure,
+             ConfigureSize
+             );
+  if (Status == RETURN_BUFFER_TOO_SMALL) {
+    if (*Configure != NULL) {
+      FreePool (*Configure);
+    }
+
+    *Configure = AllocatePool (*ConfigureSize);
+    if (*Configure == NULL) {
+      *ConfigureSize = 0;
+      return RETURN_OUT_OF_RESOURCES;
+    }
+
+    Status = FrameBufferBltConfigure (
+               FrameBuffer,
+               FrameBufferInfo,
+               *Configure,
+               ConfigureSize
+               );
+  }
+
+  return Status;
+}
+
+/**
+  Create the shadow of a frame buffer, or reconfigure it for a new mode.
+
+  The contents of the shadow are undefined afterwards; the caller is expected
+  to clear the screen with FrameBufferShadowBlt(). If no memory is available
+  for the shadow, Blt() operations are performed on the frame buffer directly.
+
+  @param[in]      FrameBuffer      Pointer to the start of the frame buffer.
+  @param[in]      FrameBufferInfo  Describes the frame buffer characteristics.
+  @param[in, out] Shadow           On input, the shadow to reconfigure, or
+                                   NULL to create one. On output, the shadow.
+
+  @retval RETURN_SUCCESS            The shadow was configured.
+  @retval RETURN_INVALID_PARAMETER  FrameBuffer, FrameBufferInfo or Shadow is
+                                    NULL.
+  @retval RETURN_UNSUPPORTED        The requested mode is not supported by
+                                    FrameBufferBltLib.
+  @retval RETURN_OUT_OF_RESOURCES   A new shadow could not be created.
+**/
+RETURN_STATUS
+EFIAPI
+FrameBufferShadowConfigure (
+  IN      VOID                                  *FrameBuffer,
+  IN      EFI_GRAPHICS_OUTPUT_MODE_INFORMATION  *FrameBufferInfo,
+  IN OUT  FRAME_BUFFER_SHADOW                   **Shadow
+  )
+{
+  FRAME_BUFFER_SHADOW  *Instance;
+  UINTN                BytesPerPixel;
+  UINTN                Pages;
+  EFI_TPL              OriginalTpl;
+  EFI_STATUS           Status;
+
+  if ((FrameBuffer == NULL) || (FrameBufferInfo == NULL) || (Shadow == NULL)) {
+    return RETURN_INVALID_PARAMETER;
+  }
+
+  BytesPerPixel = GetBytesPerPixel (FrameBufferInfo);
+  if (BytesPerPixel == 0) {
+    return RETURN_UNSUPPORTED;
+  }
+
+  Instance = *Shadow;
+  if (Instance == NULL) {
+    Instance = AllocateZeroPool (sizeof (*Instance));
+    if (Instance == NULL) {
+      return RETURN_OUT_OF_RESOURCES;
+    }
+
+    Status = gBS->CreateEvent (
+                    EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                    TPL_NOTIFY,
+                    FlushNotify,
+                    Instance,
+                    &Instance->FlushEvent
+                    );
+    if (EFI_ERROR (Status)) {
+      goto FreeInstance;
+    }
+
+    Status = gBS->CreateEventEx (
+                    EVT_NOTIFY_SIGNAL,
+                    TPL_NOTIFY,
+                    FlushNotify,
+                    Instance,
+                    &gEfiEventExitBootServicesGuid,
+                    &Instance->ExitBootServicesEvent
+                    );
+    if (EFI_ERROR (Status)) {
+      goto CloseFlushEvent;
+    }
+
+    *Shadow = Instance;
+  }
+
+  OriginalTpl = gBS->RaiseTPL (TPL_NOTIFY);
+
+  //
+  // Damage in the previous mode means nothing in the new one.
+  //
+  gBS->SetTimer (Instance->FlushEvent, TimerCancel, 0);
+  Instance->DamageLeft   = 0;
+  Instance->DamageTop    = 0;
+  Instance->DamageRight  = 0;
+  Instance->DamageBottom = 0;
+
+  Pages = 0;
+  if (FeaturePcdGet (PcdFrameBufferShadowEnable)) {
+    Pages = EFI_SIZE_TO_PAGES (
+              FrameBufferInfo->PixelsPerScanLine *
+              FrameBufferInfo->VerticalResolution *
+              BytesPerPixel
+              );
+  }
+
+  if (Pages != Instance->BufferPages) {
+    if (Instance->Buffer != NULL) {
+      FreePages (Instance->Buffer, Instance->BufferPages);
+    }
+
+    Instance->Buffer      = (Pages == 0) ? NULL : AllocatePages (Pages);
+    Instance->BufferPages = (Instance->Buffer == NULL) ? 0 : Pages;
+    if ((Pages != 0) && (Instance->Buffer == NULL)) {
+      DEBUG ((
+        DEBUG_WARN,
+        "%a: no memory for the shadow, using the frame buffer directly\n",
+        __FUNCTION__
+        ));
+    }
+  }
+
+  Instance->FrameBuffer      = FrameBuffer;
+  Instance->BytesPerPixel    = BytesPerPixel;
+  Instance->BytesPerScanLine = FrameBufferInfo->PixelsPerScanLine * BytesPerPixel;
+
+  Status = ConfigureBlt (
+             (Instance->Buffer != NULL) ? Instance->Buffer : FrameBuffer,
+             FrameBufferInfo,
+             &Instance->Configure,
+             &Instance->ConfigureSize
+             );
+  Instance->Ready = !RETURN_ERROR (Status);
+
+  gBS->RestoreTPL (OriginalTpl);
+
+  return Status;
+
+CloseFlushEvent:
+  gBS->CloseEvent (Instance->FlushEvent);
+
+FreeInstance:
+  FreePool (Instance);
+  return RETURN_OUT_OF_RESOURCES;
+}
+
+/**
+  Perform a Blt() operation on the shadow, and schedule the damaged rectangle
+  to be written to the frame buffer.
+
+  @param[in]      Shadow        The shadow, from FrameBufferShadowConfigure().
+  @param[in, out] BltBuffer     The data to transfer to screen.
+  @param[in]      BltOperation  The operation to perform.
+  @param[in]      SourceX       The X coordinate of the source for BltOperation.
+  @param[in]      SourceY       The Y coordinate of the source for BltOperation.
+  @param[in]      DestinationX  The X coordinate of the destination for
+                                BltOperation.
+  @param[in]      DestinationY  The Y coordinate of the destination for
+                                BltOperation.
+  @param[in]      Width         The width of a rectangle in the blt rectangle
+                                in pixels.
+  @param[in]      Height        The height of a rectangle in the blt rectangle
+                                in pixels.
+  @param[in]      Delta         Not used for EfiBltVideoFill and
+                                EfiBltVideoToVideo operation. If a Delta of 0
+                                is used, the entire BltBuffer will be operated
+                                on. If a subrectangle of the BltBuffer is
+                                used, then Delta represents the number of
+                                bytes in a row of the BltBuffer.
+
+  @retval RETURN_SUCCESS            The operation was performed on the shadow.
+  @retval RETURN_INVALID_PARAMETER  Invalid parameter were passed in.
+  @retval RETURN_DEVICE_ERROR       The shadow is not configured for a valid
+                                    mode.
+**/
+RETURN_STATUS
+EFIAPI
+FrameBufferShadowBlt (
+  IN      FRAME_BUFFER_SHADOW                *Shadow,
+  IN OUT  EFI_GRAPHICS_OUTPUT_BLT_PIXEL      *BltBuffer OPTIONAL,
+  IN      EFI_GRAPHICS_OUTPUT_BLT_OPERATION  BltOperation,
+  IN      UINTN                              SourceX,
+  IN      UINTN                              SourceY,
+  IN      UINTN                              DestinationX,
+  IN      UINTN                              DestinationY,
+  IN      UINTN                              Width,
+  IN      UINTN                              Height,
+  IN      UINTN                              Delta
+  )
+{
+  RETURN_STATUS  Status;
+  EFI_TPL        OriginalTpl;
+
+  if ((Shadow == NULL) || !Shadow->Ready) {
+    return RETURN_DEVICE_ERROR;
+  }
+
+  OriginalTpl = gBS->RaiseTPL (TPL_NOTIFY);
+
+  Status = FrameBufferBlt (
+             Shadow->Configure,
+             BltBuffer,
+             BltOperation,
+             SourceX,
+             SourceY,
+             DestinationX,
+             DestinationY,
+             Width,
+             Height,
+             Delta
+             );
+  if (!RETURN_ERROR (Status) && (BltOperation != EfiBltVideoToBltBuffer)) {
+    AddDamage (Shadow, DestinationX, DestinationY, Width, Height);
+  }
+
+  gBS->RestoreTPL (OriginalTpl);
+
+  return Status;
+}
+
+/**
+  Write the damaged rectangle of the shadow to the frame buffer now.
+
+  @param[in] Shadow  The shadow, from FrameBufferShadowConfigure().
+**/
+VOID
+EFIAPI
+FrameBufferShadowFlush (
+  IN FRAME_BUFFER_SHADOW  *Shadow
+  )
+{
+  EFI_TPL  OriginalTpl;
+
+  OriginalTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  gBS->SetTimer (Shadow->FlushEvent, TimerCancel, 0);
+  FlushDamage (Shadow);
+  gBS->RestoreTPL (OriginalTpl);
+}
+
+/**
+  Flush and free a shadow.
+
+  @param[in] Shadow  The shadow, from FrameBufferShadowConfigure().
+**/
+VOID
+EFIAPI
+FrameBufferShadowFree (
+  IN FRAME_BUFFER_SHADOW  *Shadow
+  )
+{
+  FrameBufferShadowFlush (Shadow);
+
+  gBS->CloseEvent (Shadow->ExitBootServicesEvent);
+  gBS->CloseEvent (Shadow->FlushEvent);
+
+  if (Shadow->Buffer != NULL) {
+    FreePages (Shadow->Buffer, Shadow->BufferPages);
+  }
+
+  if (Shadow->Configure != NULL) {
+    FreePool (Shadow->Configure);
+  }
+
+  FreePool (Shadow);
+}
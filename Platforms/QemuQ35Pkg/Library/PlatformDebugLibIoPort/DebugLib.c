@@ -29,6 +29,177 @@
 //
 VA_LIST  mVaListNull;
 
+//
+// Header of the optional debug log ring at PcdDebugLogRingBase. The data area
+// follows the header and fills the rest of PcdDebugLogRingSize. Written and
+// Flushed count bytes since the ring was initialized; output byte N is stored
+// at offset (N % DataSize) of the data area.
+//
+#define DEBUG_LOG_RING_SIGNATURE  SIGNATURE_32 ('Q', 'D', 'B', 'G')
+
+typedef struct {
+  UINT32    Signature;
+  UINT32    DataSize;
+  UINT64    Written;
+  UINT64    Flushed;
+} DEBUG_LOG_RING;
+
+/**
+  Send a buffer to the debug I/O port.
+
+  @param  Buffer  The bytes to send.
+  @param  Length  The number of bytes in Buffer.
+
+**/
+STATIC
+VOID
+DebugIoPortWrite (
+  IN  CONST UINT8  *Buffer,
+  IN  UINTN        Length
+  )
+{
+  if (FeaturePcdGet (PcdDebugIoPortFifoWrite)) {
+    IoWriteFifo8 (PcdGet16 (PcdDebugIoPort), Length, (VOID *)Buffer);
+    return;
+  }
+
+  while (Length-- > 0) {
+    IoWrite8 (PcdGet16 (PcdDebugIoPort), *Buffer++);
+  }
+}
+
+/**
+  Return the debug log ring, initializing its header if necessary.
+
+  @return  The ring, or NULL if it is disabled.
+
+**/
+STATIC
+DEBUG_LOG_RING *
+DebugLogRing (
+  VOID
+  )
+{
+  DEBUG_LOG_RING  *Ring;
+  UINT32          DataSize;
+
+  if (PcdGet32 (PcdDebugLogRingSize) <= sizeof (DEBUG_LOG_RING)) {
+    return NULL;
+  }
+
+  Ring     = (DEBUG_LOG_RING *)(UINTN)PcdGet32 (PcdDebugLogRingBase);
+  DataSize = PcdGet32 (PcdDebugLogRingSize) - sizeof (DEBUG_LOG_RING);
+  if ((Ring->Signature != DEBUG_LOG_RING_SIGNATURE) ||
+      (Ring->DataSize != DataSize))
+  {
+    Ring->DataSize  = DataSize;
+    Ring->Written   = 0;
+    Ring->Flushed   = 0;
+    Ring->Signature = DEBUG_LOG_RING_SIGNATURE;
+  }
+
+  return Ring;
+}
+
+/**
+  Send the bytes of the debug log ring that have not been sent yet to the debug
+  I/O port, with at most two port writes.
+
+  @param  Ring  The debug log ring.
+
+**/
+STATIC
+VOID
+DebugLogRingFlush (
+  IN OUT DEBUG_LOG_RING  *Ring
+  )
+{
+  UINT8  *Data;
+  UINTN  Offset;
+  UINTN  Chunk;
+
+  if (!PlatformDebugLibIoPortFound ()) {
+    Ring->Flushed = Ring->Written;
+    return;
+  }
+
+  //
+  // Bytes that have been overwritten before they could be flushed are lost.
+  //
+  if (Ring->Written - Ring->Flushed > Ring->DataSize) {
+    Ring->Flushed = Ring->Written - Ring->DataSize;
+  }
+
+  Data = (UINT8 *)(Ring + 1);
+  while (Ring->Flushed < Ring->Written) {
+    Offset = (UINTN)ModU64x32 (Ring->Flushed, Ring->DataSize);
+    Chunk  = (UINTN)MIN (Ring->Written - Ring->Flushed, Ring->DataSize - Offset);
+    DebugIoPortWrite (Data + Offset, Chunk);
+    Ring->Flushed += Chunk;
+  }
+}
+
+/**
+  Send a formatted message to the debug log ring if it is enabled, and to the
+  debug I/O port if it is present.
+
+  With the ring enabled, the port only receives the message once
+  PcdDebugLogRingFlushThreshold bytes are pending, or when Flush is TRUE.
+
+  @param  Buffer  The message.
+  @param  Length  The number of bytes in Buffer.
+  @param  Flush   Whether to send all pending output to the port right away.
+
+**/
+STATIC
+VOID
+DebugOutput (
+  IN  CONST CHAR8  *Buffer,
+  IN  UINTN        Length,
+  IN  BOOLEAN      Flush
+  )
+{
+  DEBUG_LOG_RING  *Ring;
+  UINT8           *Data;
+  UINTN           Offset;
+  UINTN           Chunk;
+
+  Ring = DebugLogRing ();
+  if (Ring == NULL) {
+    if (PlatformDebugLibIoPortFound ()) {
+      DebugIoPortWrite ((CONST UINT8 *)Buffer, Length);
+    }
+
+    return;
+  }
+
+  //
+  // Only the tail of a message longer than the ring can be kept.
+  //
+  if (Length > Ring->DataSize) {
+    Ring->Written += Length - Ring->DataSize;
+    Buffer        += Length - Ring->DataSize;
+    Length         = Ring->DataSize;
+  }
+
+  Data = (UINT8 *)(Ring + 1);
+  while (Length > 0) {
+    Offset = (UINTN)ModU64x32 (Ring->Written, Ring->DataSize);
+    Chunk  = MIN (Length, Ring->DataSize - Offset);
+    CopyMem (Data + Offset, Buffer, Chunk);
+    Ring->Written += Chunk;
+    Buffer        += Chunk;
+    Length        -= Chunk;
+  }
+
+  if (Flush ||
+      ((PcdGet32 (PcdDebugLogRingFlushThreshold) != 0) &&
+       (Ring->Written - Ring->Flushed >= PcdGet32 (PcdDebugLogRingFlushThreshold))))
+  {
+    DebugLogRingFlush (Ring);
+  }
+}
+
 /**
   Prints a debug message to the debug output device if the specified error level is enabled.
 
@@ -86,7 +257,6 @@ DebugPrintMarker (
 {
   CHAR8  Buffer[MAX_DEBUG_MESSAGE_LENGTH];
   UINTN  Length;
-  UINT8  *Buffer8;
 
   //
   // If Format is NULL, then ASSERT().
@@ -94,10 +264,10 @@ DebugPrintMarker (
   ASSERT (Format != NULL);
 
   //
-  // Check if the global mask disables this message or the device is inactive
+  // Check if the global mask disables this message or there is no output
   //
   if (((ErrorLevel & GetDebugPrintErrorLevel ()) == 0) ||
-      !PlatformDebugLibIoPortFound ())
+      ((DebugLogRing () == NULL) && !PlatformDebugLibIoPortFound ()))
   {
     return;
   }
@@ -112,12 +282,9 @@ DebugPrintMarker (
   }
 
   //
-  // Send the print string to the debug I/O port
+  // Send the print string to the debug log ring and / or the debug I/O port
   //
-  Buffer8 = (UINT8 *)Buffer;
-  while (Length-- > 0) {
-    IoWrite8 (PcdGet16 (PcdDebugIoPort), *Buffer8++);
-  }
+  DebugOutput (Buffer, Length, FALSE);
 }
 
 /**
@@ -205,7 +372,6 @@ DebugAssert (
 {
   CHAR8  Buffer[MAX_DEBUG_MESSAGE_LENGTH];
   UINTN  Length;
-  UINT8  *Buffer8;
 
   //
   // Generate the ASSERT() message in Ascii format
@@ -220,14 +386,10 @@ DebugAssert (
              );
 
   //
-  // Send the print string to the debug I/O port, if present
+  // Send the print string to the debug log ring and / or the debug I/O port,
+  // flushing everything that is still pending
   //
-  if (PlatformDebugLibIoPortFound ()) {
-    Buffer8 = (UINT8 *)Buffer;
-    while (Length-- > 0) {
-      IoWrite8 (PcdGet16 (PcdDebugIoPort), *Buffer8++);
-    }
-  }
+  DebugOutput (Buffer, Length, TRUE);
 
   //
   // Generate a Breakpoint, DeadLoop, or NOP based on PCD settings
@@ -17,6 +17,8 @@
 #include <Library/BaseMemoryLib.h>
 #include <Library/IoLib.h>
 #include <Library/DebugLib.h>
+#include <Library/HobLib.h>
+#include <Library/MemoryAllocationLib.h>
 #include <Library/QemuFwCfgLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/MemEncryptSevLib.h>
@@ -28,6 +30,26 @@ STATIC BOOLEAN  mQemuFwCfgDmaSupported;
 
 STATIC EDKII_IOMMU_PROTOCOL  *mIoMmuProtocol;
 
+STATIC UINTN                 mQemuFwCfgTransfers;
+STATIC QEMU_FW_CFG_FILE_DIR  *mFileDir;
+
+//
+// FW_CFG_DMA_CTL_SELECT plus the item number, to be applied by the next DMA
+// transfer; zero if no selection is pending.
+//
+STATIC UINT32  mQemuFwCfgPendingSelect;
+
+//
+// With SEV, the DMA access descriptor and a bounce window for small transfers
+// share a page that is mapped (decrypted) once, and stays mapped.
+//
+typedef struct {
+  FW_CFG_DMA_ACCESS    Access;
+  UINT8                Bounce[EFI_PAGE_SIZE - sizeof (FW_CFG_DMA_ACCESS)];
+} FW_CFG_SEV_SHARED_PAGE;
+
+STATIC FW_CFG_SEV_SHARED_PAGE  *mSevSharedPage;
+
 /**
   Returns a boolean indicating if the firmware configuration interface
   is available or not.
@@ -145,16 +167,14 @@ InternalQemuFwCfgDmaIsAvailable (
 }
 
 /**
-  Function is used for allocating a bi-directional FW_CFG_DMA_ACCESS used
-  between Host and device to exchange the information. The buffer must be free'd
-  using FreeFwCfgDmaAccessBuffer ().
+  Allocate and map the page that holds the DMA access descriptor and the bounce
+  window, on first use. The page is never freed.
 
 **/
 STATIC
 VOID
-AllocFwCfgDmaAccessBuffer (
-  OUT   VOID  **Access,
-  OUT   VOID  **MapInfo
+AllocFwCfgSevSharedPage (
+  VOID
   )
 {
   UINTN                 Size;
@@ -164,7 +184,11 @@ AllocFwCfgDmaAccessBuffer (
   EFI_PHYSICAL_ADDRESS  DmaAddress;
   VOID                  *Mapping;
 
-  Size     = sizeof (FW_CFG_DMA_ACCESS);
+  if (mSevSharedPage != NULL) {
+    return;
+  }
+
+  Size     = sizeof (FW_CFG_SEV_SHARED_PAGE);
   NumPages = EFI_SIZE_TO_PAGES (Size);
 
   //
@@ -220,7 +244,7 @@ AllocFwCfgDmaAccessBuffer (
     CpuDeadLoop ();
   }
 
-  if (Size < sizeof (FW_CFG_DMA_ACCESS)) {
+  if (Size < sizeof (FW_CFG_SEV_SHARED_PAGE)) {
     mIoMmuProtocol->Unmap (mIoMmuProtocol, Mapping);
     mIoMmuProtocol->FreeBuffer (mIoMmuProtocol, NumPages, HostAddress);
     DEBUG ((
@@ -228,59 +252,14 @@ AllocFwCfgDmaAccessBuffer (
       "%a:%a failed to Map() - requested 0x%Lx got 0x%Lx\n",
       gEfiCallerBaseName,
       __FUNCTION__,
-      (UINT64)sizeof (FW_CFG_DMA_ACCESS),
+      (UINT64)sizeof (FW_CFG_SEV_SHARED_PAGE),
       (UINT64)Size
       ));
     ASSERT (FALSE);
     CpuDeadLoop ();
   }
 
-  *Access  = HostAddress;
-  *MapInfo = Mapping;
-}
-
-/**
-  Function is to used for freeing the Access buffer allocated using
-  AllocFwCfgDmaAccessBuffer()
-
-**/
-STATIC
-VOID
-FreeFwCfgDmaAccessBuffer (
-  IN  VOID  *Access,
-  IN  VOID  *Mapping
-  )
-{
-  UINTN       NumPages;
-  EFI_STATUS  Status;
-
-  NumPages = EFI_SIZE_TO_PAGES (sizeof (FW_CFG_DMA_ACCESS));
-
-  Status = mIoMmuProtocol->Unmap (mIoMmuProtocol, Mapping);
-  if (EFI_ERROR (Status)) {
-    DEBUG ((
-      DEBUG_ERROR,
-      "%a:%a failed to UnMap() Mapping 0x%Lx\n",
-      gEfiCallerBaseName,
-      __FUNCTION__,
-      (UINT64)(UINTN)Mapping
-      ));
-    ASSERT (FALSE);
-    CpuDeadLoop ();
-  }
-
-  Status = mIoMmuProtocol->FreeBuffer (mIoMmuProtocol, NumPages, Access);
-  if (EFI_ERROR (Status)) {
-    DEBUG ((
-      DEBUG_ERROR,
-      "%a:%a failed to Free() 0x%Lx\n",
-      gEfiCallerBaseName,
-      __FUNCTION__,
-      (UINT64)(UINTN)Access
-      ));
-    ASSERT (FALSE);
-    CpuDeadLoop ();
-  }
+  mSevSharedPage = HostAddress;
 }
 
 /**
@@ -367,11 +346,39 @@ UnmapFwCfgDmaDataBuffer (
   }
 }
 
+/**
+  Select a firmware configuration item.
+
+  If the DMA access method is in use, the selection is deferred to the next DMA
+  transfer, which applies it with FW_CFG_DMA_CTL_SELECT. Otherwise the item is
+  selected through the IO port immediately.
+
+  @param[in] QemuFwCfgItem  Firmware Configuration item to select.
+**/
+VOID
+InternalQemuFwCfgSelectItem (
+  IN FIRMWARE_CONFIG_ITEM  QemuFwCfgItem
+  )
+{
+  if (mQemuFwCfgDmaSupported) {
+    mQemuFwCfgPendingSelect = FW_CFG_DMA_CTL_SELECT |
+                              ((UINT32)(UINT16)(UINTN)QemuFwCfgItem << 16);
+    return;
+  }
+
+  IoWrite16 (FW_CFG_IO_SELECTOR, (UINT16)(UINTN)QemuFwCfgItem);
+  InternalQemuFwCfgCountTransfer ();
+}
+
 /**
   Transfer an array of bytes, or skip a number of bytes, using the DMA
   interface.
 
-  @param[in]     Size     Size in bytes to transfer or skip.
+  A selection deferred by InternalQemuFwCfgSelectItem() is applied as part of
+  the same transfer.
+
+  @param[in]     Size     Size in bytes to transfer or skip. If zero, only a
+                          deferred selection (if any) is applied.
 
   @param[in,out] Buffer   Buffer to read data into or write data from. Ignored,
                           and may be NULL, if Size is zero, or Control is
@@ -393,51 +400,59 @@ InternalQemuFwCfgDmaBytes (
   volatile FW_CFG_DMA_ACCESS  *Access;
   UINT32                      AccessHigh, AccessLow;
   UINT32                      Status;
-  VOID                        *AccessMapping, *DataMapping;
+  VOID                        *DataMapping;
   VOID                        *DataBuffer;
+  BOOLEAN                     Bounced;
 
   ASSERT (
     Control == FW_CFG_DMA_CTL_WRITE || Control == FW_CFG_DMA_CTL_READ ||
     Control == FW_CFG_DMA_CTL_SKIP
     );
 
-  if (Size == 0) {
+  if ((Size == 0) && (mQemuFwCfgPendingSelect == 0)) {
     return;
   }
 
-  Access        = &LocalAccess;
-  AccessMapping = NULL;
-  DataMapping   = NULL;
-  DataBuffer    = Buffer;
+  Control |= mQemuFwCfgPendingSelect;
+
+  mQemuFwCfgPendingSelect = 0;
+
+  Access      = &LocalAccess;
+  DataMapping = NULL;
+  DataBuffer  = Buffer;
+  Bounced     = FALSE;
 
   //
-  // When SEV is enabled, map Buffer to DMA address before issuing the DMA
-  // request
+  // When SEV is enabled, the device must see a shared (decrypted) access
+  // descriptor and data buffer. Use the long-lived shared page for the
+  // descriptor, and for data that fits in its bounce window; map the caller's
+  // buffer only for larger transfers.
   //
   if (MemEncryptSevIsEnabled ()) {
-    VOID                  *AccessBuffer;
     EFI_PHYSICAL_ADDRESS  DataBufferAddress;
 
-    //
-    // Allocate DMA Access buffer
-    //
-    AllocFwCfgDmaAccessBuffer (&AccessBuffer, &AccessMapping);
-
-    Access = AccessBuffer;
-
-    //
-    // Map actual data buffer
-    //
-    if (Control != FW_CFG_DMA_CTL_SKIP) {
-      MapFwCfgDmaDataBuffer (
-        Control == FW_CFG_DMA_CTL_WRITE,
-        Buffer,
-        Size,
-        &DataBufferAddress,
-        &DataMapping
-        );
-
-      DataBuffer = (VOID *)(UINTN)DataBufferAddress;
+    AllocFwCfgSevSharedPage ();
+    Access = &mSevSharedPage->Access;
+
+    if ((Size > 0) && ((Control & FW_CFG_DMA_CTL_SKIP) == 0)) {
+      if (Size <= sizeof (mSevSharedPage->Bounce)) {
+        if ((Control & FW_CFG_DMA_CTL_WRITE) != 0) {
+          CopyMem (mSevSharedPage->Bounce, Buffer, Size);
+        }
+
+        DataBuffer = mSevSharedPage->Bounce;
+        Bounced    = TRUE;
+      } else {
+        MapFwCfgDmaDataBuffer (
+          (Control & FW_CFG_DMA_CTL_WRITE) != 0,
+          Buffer,
+          Size,
+          &DataBufferAddress,
+          &DataMapping
+          );
+
+        DataBuffer = (VOID *)(UINTN)DataBufferAddress;
+      }
     }
   }
 
@@ -477,11 +492,8 @@ InternalQemuFwCfgDmaBytes (
   //
   MemoryFence ();
 
-  //
-  // If Access buffer was dynamically allocated then free it.
-  //
-  if (AccessMapping != NULL) {
-    FreeFwCfgDmaAccessBuffer ((VOID *)Access, AccessMapping);
+  if (Bounced && ((Control & FW_CFG_DMA_CTL_READ) != 0)) {
+    CopyMem (Buffer, mSevSharedPage->Bounce, Size);
   }
 
   //
@@ -491,3 +503,83 @@ InternalQemuFwCfgDmaBytes (
     UnmapFwCfgDmaDataBuffer (DataMapping);
   }
 }
+
+/**
+  Account one fw_cfg transfer (a selector write, or one port FIFO or DMA
+  transfer of data) to the current phase.
+**/
+VOID
+InternalQemuFwCfgCountTransfer (
+  VOID
+  )
+{
+  mQemuFwCfgTransfers++;
+}
+
+/**
+  Return the number of fw_cfg transfers that this library instance has issued
+  in the current phase.
+
+  @return  The number of transfers, or 0 if the instance keeps no state.
+**/
+UINTN
+InternalQemuFwCfgTransferCount (
+  VOID
+  )
+{
+  return mQemuFwCfgTransfers;
+}
+
+/**
+  Return the sorted fw_cfg file directory of the current phase, building it on
+  the first call if necessary.
+
+  The directory is taken from the HOB that PEI produced, if any. It is copied
+  to pool in either case, so that runtime and SMM clients never reference boot
+  services memory.
+
+  @return  The directory, or NULL if the instance keeps no directory, or it
+           could not be built. In the latter case the caller should scan
+           QemuFwCfgItemFileDir.
+**/
+CONST QEMU_FW_CFG_FILE_DIR *
+InternalQemuFwCfgGetFileDir (
+  VOID
+  )
+{
+  EFI_HOB_GUID_TYPE     *GuidHob;
+  QEMU_FW_CFG_FILE_DIR  *Dir;
+  UINT32                Count;
+
+  if (mFileDir != NULL) {
+    return mFileDir;
+  }
+
+  GuidHob = GetFirstGuidHob (&gQemuFwCfgFileDirHobGuid);
+  if (GuidHob != NULL) {
+    mFileDir = AllocateCopyPool (
+                 GET_GUID_HOB_DATA_SIZE (GuidHob),
+                 GET_GUID_HOB_DATA (GuidHob)
+                 );
+    return mFileDir;
+  }
+
+  Count = InternalQemuFwCfgReadFileCount ();
+  Dir   = AllocatePool (QEMU_FW_CFG_FILE_DIR_SIZE (Count));
+  if (Dir == NULL) {
+    return NULL;
+  }
+
+  Dir->Count = Count;
+  InternalQemuFwCfgReadFileDir (Dir);
+  mFileDir = Dir;
+
+  DEBUG ((
+    DEBUG_VERBOSE,
+    "%a: cached %u fw_cfg files, %Lu fw_cfg transfers so far\n",
+    __FUNCTION__,
+    Count,
+    (UINT64)mQemuFwCfgTransfers
+    ));
+  return mFileDir;
+}
@@ -35,7 +35,7 @@ QemuFwCfgSelectItem (
   )
 {
   DEBUG ((DEBUG_INFO, "Select Item: 0x%x\n", (UINT16)(UINTN)QemuFwCfgItem));
-  IoWrite16 (FW_CFG_IO_SELECTOR, (UINT16)(UINTN)QemuFwCfgItem);
+  InternalQemuFwCfgSelectItem (QemuFwCfgItem);
 }
 
 /**
@@ -52,9 +52,19 @@ InternalQemuFwCfgReadBytes (
   IN VOID   *Buffer  OPTIONAL
   )
 {
-  if (InternalQemuFwCfgDmaIsAvailable () && (Size <= MAX_UINT32)) {
-    InternalQemuFwCfgDmaBytes ((UINT32)Size, Buffer, FW_CFG_DMA_CTL_READ);
-    return;
+  InternalQemuFwCfgCountTransfer ();
+
+  if (InternalQemuFwCfgDmaIsAvailable ()) {
+    if (Size <= MAX_UINT32) {
+      InternalQemuFwCfgDmaBytes ((UINT32)Size, Buffer, FW_CFG_DMA_CTL_READ);
+      return;
+    }
+
+    //
+    // Too large for a single DMA transfer; apply any deferred selection
+    // before falling back to the IO port.
+    //
+    InternalQemuFwCfgDmaBytes (0, NULL, FW_CFG_DMA_CTL_SKIP);
   }
 
   IoReadFifo8 (FW_CFG_IO_DATA, Size, Buffer);
@@ -104,9 +114,19 @@ QemuFwCfgWriteBytes (
   )
 {
   if (InternalQemuFwCfgIsAvailable ()) {
-    if (InternalQemuFwCfgDmaIsAvailable () && (Size <= MAX_UINT32)) {
-      InternalQemuFwCfgDmaBytes ((UINT32)Size, Buffer, FW_CFG_DMA_CTL_WRITE);
-      return;
+    InternalQemuFwCfgCountTransfer ();
+
+    if (InternalQemuFwCfgDmaIsAvailable ()) {
+      if (Size <= MAX_UINT32) {
+        InternalQemuFwCfgDmaBytes ((UINT32)Size, Buffer, FW_CFG_DMA_CTL_WRITE);
+        return;
+      }
+
+      //
+      // Too large for a single DMA transfer; apply any deferred selection
+      // before falling back to the IO port.
+      //
+      InternalQemuFwCfgDmaBytes (0, NULL, FW_CFG_DMA_CTL_SKIP);
     }
 
     IoWriteFifo8 (FW_CFG_IO_DATA, Size, Buffer);
@@ -135,9 +155,18 @@ QemuFwCfgSkipBytes (
     return;
   }
 
-  if (InternalQemuFwCfgDmaIsAvailable () && (Size <= MAX_UINT32)) {
-    InternalQemuFwCfgDmaBytes ((UINT32)Size, NULL, FW_CFG_DMA_CTL_SKIP);
-    return;
+  if (InternalQemuFwCfgDmaIsAvailable ()) {
+    if (Size <= MAX_UINT32) {
+      InternalQemuFwCfgCountTransfer ();
+      InternalQemuFwCfgDmaBytes ((UINT32)Size, NULL, FW_CFG_DMA_CTL_SKIP);
+      return;
+    }
+
+    //
+    // Too large for a single DMA transfer; apply any deferred selection
+    // before falling back to the IO port.
+    //
+    InternalQemuFwCfgDmaBytes (0, NULL, FW_CFG_DMA_CTL_SKIP);
   }
 
   //
@@ -152,6 +181,7 @@ QemuFwCfgSkipBytes (
   while (Size > 0) {
     ChunkSize = MIN (Size, sizeof SkipBuffer);
     IoReadFifo8 (FW_CFG_IO_DATA, ChunkSize, SkipBuffer);
+    InternalQemuFwCfgCountTransfer ();
     Size -= ChunkSize;
   }
 }
@@ -232,6 +262,66 @@ QemuFwCfgRead64 (
   return Result;
 }
 
+/**
+  Select QemuFwCfgItemFileDir and read the number of files in it.
+
+  @return  The number of FW_CFG_FILE entries that follow in the item.
+**/
+UINT32
+InternalQemuFwCfgReadFileCount (
+  VOID
+  )
+{
+  QemuFwCfgSelectItem (QemuFwCfgItemFileDir);
+  return SwapBytes32 (QemuFwCfgRead32 ());
+}
+
+/**
+  Read the entries of QemuFwCfgItemFileDir in one transfer, convert them to CPU
+  byte order, and sort them by name.
+
+  InternalQemuFwCfgReadFileCount() must have been called right before.
+
+  @param[in,out] Dir  On input, Dir->Count holds the value returned by
+                      InternalQemuFwCfgReadFileCount(), and Dir has room for
+                      that many entries. On output, Dir->Files has been
+                      populated.
+**/
+VOID
+InternalQemuFwCfgReadFileDir (
+  IN OUT QEMU_FW_CFG_FILE_DIR  *Dir
+  )
+{
+  FW_CFG_FILE  *Files;
+  FW_CFG_FILE  Current;
+  UINT32       Idx;
+  UINT32       Pos;
+
+  Files = Dir->Files;
+  InternalQemuFwCfgReadBytes ((UINTN)Dir->Count * sizeof (FW_CFG_FILE), Files);
+
+  //
+  // The directory holds a few dozen entries, and QEMU normally emits them
+  // sorted already, so an insertion sort finishes in linear time.
+  //
+  for (Idx = 0; Idx < Dir->Count; ++Idx) {
+    CopyMem (&Current, &Files[Idx], sizeof Current);
+    Current.Size                             = SwapBytes32 (Current.Size);
+    Current.Select                           = SwapBytes16 (Current.Select);
+    Current.Name[QEMU_FW_CFG_FNAME_SIZE - 1] = '\0';
+
+    for (Pos = Idx; Pos > 0; --Pos) {
+      if (AsciiStrCmp (Files[Pos - 1].Name, Current.Name) <= 0) {
+        break;
+      }
+
+      CopyMem (&Files[Pos], &Files[Pos - 1], sizeof (FW_CFG_FILE));
+    }
+
+    CopyMem (&Files[Pos], &Current, sizeof Current);
+  }
+}
+
 /**
   Find the configuration item corresponding to the firmware configuration file.
 
@@ -253,34 +343,70 @@ QemuFwCfgFindFile (
   OUT  UINTN                 *Size
   )
 {
-  UINT32  Count;
-  UINT32  Idx;
+  CONST QEMU_FW_CFG_FILE_DIR  *Dir;
+  UINT32                      Count;
+  UINT32                      Idx;
+  UINT32                      Low;
+  UINT32                      High;
+  INTN                        Cmp;
+  FW_CFG_FILE                 File;
+  RETURN_STATUS               Status;
 
   if (!InternalQemuFwCfgIsAvailable ()) {
     return RETURN_UNSUPPORTED;
   }
 
-  QemuFwCfgSelectItem (QemuFwCfgItemFileDir);
-  Count = SwapBytes32 (QemuFwCfgRead32 ());
-
-  for (Idx = 0; Idx < Count; ++Idx) {
-    UINT32  FileSize;
-    UINT16  FileSelect;
-    UINT16  FileReserved;
-    CHAR8   FName[QEMU_FW_CFG_FNAME_SIZE];
-
-    FileSize     = QemuFwCfgRead32 ();
-    FileSelect   = QemuFwCfgRead16 ();
-    FileReserved = QemuFwCfgRead16 ();
-    (VOID)FileReserved;  /* Force a do-nothing reference. */
-    InternalQemuFwCfgReadBytes (sizeof (FName), FName);
-
-    if (AsciiStrCmp (Name, FName) == 0) {
-      *Item = SwapBytes16 (FileSelect);
-      *Size = SwapBytes32 (FileSize);
-      return RETURN_SUCCESS;
+  Status = RETURN_NOT_FOUND;
+  Dir    = InternalQemuFwCfgGetFileDir ();
+
+  if (Dir != NULL) {
+    //
+    // Binary search in the cached directory, without touching fw_cfg.
+    //
+    Low  = 0;
+    High = Dir->Count;
+    while (Low < High) {
+      Idx = Low + (High - Low) / 2;
+      Cmp = AsciiStrCmp (Name, Dir->Files[Idx].Name);
+      if (Cmp == 0) {
+        *Item  = (FIRMWARE_CONFIG_ITEM)Dir->Files[Idx].Select;
+        *Size  = Dir->Files[Idx].Size;
+        Status = RETURN_SUCCESS;
+        break;
+      }
+
+      if (Cmp < 0) {
+        High = Idx;
+      } else {
+        Low = Idx + 1;
+      }
+    }
+  } else {
+    //
+    // No cache in this phase; scan the directory, with one transfer per entry.
+    //
+    Count = InternalQemuFwCfgReadFileCount ();
+
+    for (Idx = 0; Idx < Count; ++Idx) {
+      InternalQemuFwCfgReadBytes (sizeof File, &File);
+      File.Name[QEMU_FW_CFG_FNAME_SIZE - 1] = '\0';
+
+      if (AsciiStrCmp (Name, File.Name) == 0) {
+        *Item  = SwapBytes16 (File.Select);
+        *Size  = SwapBytes32 (File.Size);
+        Status = RETURN_SUCCESS;
+        break;
+      }
     }
   }
 
-  return RETURN_NOT_FOUND;
+  DEBUG ((
+    DEBUG_VERBOSE,
+    "%a: \"%a\": %r (%Lu fw_cfg transfers so far)\n",
+    __FUNCTION__,
+    Name,
+    Status,
+    (UINT64)InternalQemuFwCfgTransferCount ()
+    ));
+  return Status;
 }
@@ -11,6 +11,8 @@
 #ifndef __QEMU_FW_CFG_LIB_INTERNAL_H__
 #define __QEMU_FW_CFG_LIB_INTERNAL_H__
 
+#include <Guid/QemuFwCfgFileDirHob.h>
+
 /**
   Returns a boolean indicating if the firmware configuration interface is
   available for library-internal purposes.
@@ -37,11 +39,29 @@ InternalQemuFwCfgDmaIsAvailable (
   VOID
   );
 
+/**
+  Select a firmware configuration item.
+
+  If the DMA access method is in use, the selection may be deferred to the next
+  DMA transfer, which applies it with FW_CFG_DMA_CTL_SELECT. Otherwise the item
+  is selected through the IO port immediately.
+
+  @param[in] QemuFwCfgItem  Firmware Configuration item to select.
+**/
+VOID
+InternalQemuFwCfgSelectItem (
+  IN FIRMWARE_CONFIG_ITEM  QemuFwCfgItem
+  );
+
 /**
   Transfer an array of bytes, or skip a number of bytes, using the DMA
   interface.
 
-  @param[in]     Size     Size in bytes to transfer or skip.
+  A selection deferred by InternalQemuFwCfgSelectItem() is applied as part of
+  the same transfer.
+
+  @param[in]     Size     Size in bytes to transfer or skip. If zero, only a
+                          deferred selection (if any) is applied.
 
   @param[in,out] Buffer   Buffer to read data into or write data from. Ignored,
                           and may be NULL, if Size is zero, or Control is
@@ -59,4 +79,63 @@ InternalQemuFwCfgDmaBytes (
   IN     UINT32  Control
   );
 
+/**
+  Account one fw_cfg transfer (a selector write, or one port FIFO or DMA
+  transfer of data) to the current phase.
+**/
+VOID
+InternalQemuFwCfgCountTransfer (
+  VOID
+  );
+
+/**
+  Return the number of fw_cfg transfers that this library instance has issued
+  in the current phase.
+
+  @return  The number of transfers, or 0 if the instance keeps no state.
+**/
+UINTN
+InternalQemuFwCfgTransferCount (
+  VOID
+  );
+
+/**
+  Return the sorted fw_cfg file directory of the current phase, building it on
+  the first call if necessary.
+
+  @return  The directory, or NULL if the instance keeps no directory, or it
+           could not be built. In the latter case the caller should scan
+           QemuFwCfgItemFileDir.
+**/
+CONST QEMU_FW_CFG_FILE_DIR *
+InternalQemuFwCfgGetFileDir (
+  VOID
+  );
+
+/**
+  Select QemuFwCfgItemFileDir and read the number of files in it.
+
+  @return  The number of FW_CFG_FILE entries that follow in the item.
+**/
+UINT32
+InternalQemuFwCfgReadFileCount (
+  VOID
+  );
+
+/**
+  Read the entries of QemuFwCfgItemFileDir in one transfer, convert them to CPU
+  byte order, and sort them by name.
+
+  InternalQemuFwCfgReadFileCount() must have been called right before.
+
+  @param[in,out] Dir  On input, Dir->Count holds the value returned by
+                      InternalQemuFwCfgReadFileCount(), and Dir has room for
+                      that many entries. On output, Dir->Files has been
+                      populated.
+**/
+VOID
+InternalQemuFwCfgReadFileDir (
+  IN OUT QEMU_FW_CFG_FILE_DIR  *Dir
+  );
+
 #endif
@@ -12,6 +12,7 @@
 #include <Library/BaseLib.h>
 #include <Library/IoLib.h>
 #include <Library/DebugLib.h>
+#include <Library/HobLib.h>
 #include <Library/QemuFwCfgLib.h>
 #include <Library/MemEncryptSevLib.h>
 
@@ -19,6 +20,13 @@
 
 STATIC BOOLEAN  mQemuFwCfgSupported = FALSE;
 STATIC BOOLEAN  mQemuFwCfgDmaSupported;
+STATIC UINTN    mQemuFwCfgTransfers;
+
+//
+// FW_CFG_DMA_CTL_SELECT plus the item number, to be applied by the next DMA
+// transfer; zero if no selection is pending.
+//
+STATIC UINT32  mQemuFwCfgPendingSelect;
 
 /**
   Returns a boolean indicating if the firmware configuration interface
@@ -122,11 +130,39 @@ InternalQemuFwCfgDmaIsAvailable (
   return mQemuFwCfgDmaSupported;
 }
 
+/**
+  Select a firmware configuration item.
+
+  If the DMA access method is in use, the selection is deferred to the next DMA
+  transfer, which applies it with FW_CFG_DMA_CTL_SELECT. Otherwise the item is
+  selected through the IO port immediately.
+
+  @param[in] QemuFwCfgItem  Firmware Configuration item to select.
+**/
+VOID
+InternalQemuFwCfgSelectItem (
+  IN FIRMWARE_CONFIG_ITEM  QemuFwCfgItem
+  )
+{
+  if (mQemuFwCfgDmaSupported) {
+    mQemuFwCfgPendingSelect = FW_CFG_DMA_CTL_SELECT |
+                              ((UINT32)(UINT16)(UINTN)QemuFwCfgItem << 16);
+    return;
+  }
+
+  IoWrite16 (FW_CFG_IO_SELECTOR, (UINT16)(UINTN)QemuFwCfgItem);
+  InternalQemuFwCfgCountTransfer ();
+}
+
 /**
   Transfer an array of bytes, or skip a number of bytes, using the DMA
   interface.
 
-  @param[in]     Size     Size in bytes to transfer or skip.
+  A selection deferred by InternalQemuFwCfgSelectItem() is applied as part of
+  the same transfer.
+
+  @param[in]     Size     Size in bytes to transfer or skip. If zero, only a
+                          deferred selection (if any) is applied.
 
   @param[in,out] Buffer   Buffer to read data into or write data from. Ignored,
                           and may be NULL, if Size is zero, or Control is
@@ -153,10 +189,14 @@ InternalQemuFwCfgDmaBytes (
     Control == FW_CFG_DMA_CTL_SKIP
     );
 
-  if (Size == 0) {
+  if ((Size == 0) && (mQemuFwCfgPendingSelect == 0)) {
     return;
   }
 
+  Control |= mQemuFwCfgPendingSelect;
+
+  mQemuFwCfgPendingSelect = 0;
+
   //
   // SEV does not support DMA operations in PEI stage, we should
   // not have reached here.
@@ -199,3 +239,85 @@ InternalQemuFwCfgDmaBytes (
   //
   MemoryFence ();
 }
+
+/**
+  Account one fw_cfg transfer (a selector write, or one port FIFO or DMA
+  transfer of data) to the current phase.
+**/
+VOID
+InternalQemuFwCfgCountTransfer (
+  VOID
+  )
+{
+  mQemuFwCfgTransfers++;
+}
+
+/**
+  Return the number of fw_cfg transfers that this library instance has issued
+  in the current phase.
+
+  @return  The number of transfers, or 0 if the instance keeps no state.
+**/
+UINTN
+InternalQemuFwCfgTransferCount (
+  VOID
+  )
+{
+  return mQemuFwCfgTransfers;
+}
+
+/**
+  Return the sorted fw_cfg file directory of the current phase, building it on
+  the first call if necessary.
+
+  The directory lives in a GUIDed HOB, so that it is read from fw_cfg only once
+  for all PEIMs, and DXE can consume it as well.
+
+  @return  The directory, or NULL if the instance keeps no directory, or it
+           could not be built. In the latter case the caller should scan
+           QemuFwCfgItemFileDir.
+**/
+CONST QEMU_FW_CFG_FILE_DIR *
+InternalQemuFwCfgGetFileDir (
+  VOID
+  )
+{
+  EFI_HOB_GUID_TYPE     *GuidHob;
+  QEMU_FW_CFG_FILE_DIR  *Dir;
+  UINT32                Count;
+  UINTN                 DirSize;
+
+  GuidHob = GetFirstGuidHob (&gQemuFwCfgFileDirHobGuid);
+  if (GuidHob != NULL) {
+    return GET_GUID_HOB_DATA (GuidHob);
+  }
+
+  Count   = InternalQemuFwCfgReadFileCount ();
+  DirSize = QEMU_FW_CFG_FILE_DIR_SIZE (Count);
+  if (DirSize > 0xFFF8 - sizeof (EFI_HOB_GUID_TYPE)) {
+    DEBUG ((
+      DEBUG_WARN,
+      "%a: %u fw_cfg files don't fit in a HOB\n",
+      __FUNCTION__,
+      Count
+      ));
+    return NULL;
+  }
+
+  Dir = BuildGuidHob (&gQemuFwCfgFileDirHobGuid, DirSize);
+  if (Dir == NULL) {
+    return NULL;
+  }
+
+  Dir->Count = Count;
+  InternalQemuFwCfgReadFileDir (Dir);
+
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: cached %u fw_cfg files, %Lu fw_cfg transfers in PEI so far\n",
+    __FUNCTION__,
+    Count,
+    (UINT64)mQemuFwCfgTransfers
+    ));
+  return Dir;
+}
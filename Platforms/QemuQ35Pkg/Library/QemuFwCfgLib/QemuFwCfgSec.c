@@ -13,6 +13,7 @@
 
 #include <Library/BaseLib.h>
 #include <Library/DebugLib.h>
+#include <Library/IoLib.h>
 #include <Library/QemuFwCfgLib.h>
 
 #include "QemuFwCfgLibInternal.h"
@@ -91,11 +92,28 @@ InternalQemuFwCfgDmaIsAvailable (
   return FALSE;
 }
 
+/**
+  Select a firmware configuration item through the IO port.
+
+  @param[in] QemuFwCfgItem  Firmware Configuration item to select.
+**/
+VOID
+InternalQemuFwCfgSelectItem (
+  IN FIRMWARE_CONFIG_ITEM  QemuFwCfgItem
+  )
+{
+  IoWrite16 (FW_CFG_IO_SELECTOR, (UINT16)(UINTN)QemuFwCfgItem);
+}
+
 /**
   Transfer an array of bytes, or skip a number of bytes, using the DMA
   interface.
 
-  @param[in]     Size     Size in bytes to transfer or skip.
+  A selection deferred by InternalQemuFwCfgSelectItem() is applied as part of
+  the same transfer.
+
+  @param[in]     Size     Size in bytes to transfer or skip. If zero, only a
+                          deferred selection (if any) is applied.
 
   @param[in,out] Buffer   Buffer to read data into or write data from. Ignored,
                           and may be NULL, if Size is zero, or Control is
@@ -119,3 +137,50 @@ InternalQemuFwCfgDmaBytes (
   ASSERT (FALSE);
   CpuDeadLoop ();
 }
+
+/**
+  Account one fw_cfg transfer (a selector write, or one port FIFO or DMA
+  transfer of data) to the current phase.
+**/
+VOID
+InternalQemuFwCfgCountTransfer (
+  VOID
+  )
+{
+  //
+  // This instance may run from flash, where it cannot keep a counter.
+  //
+}
+
+/**
+  Return the number of fw_cfg transfers that this library instance has issued
+  in the current phase.
+
+  @return  The number of transfers, or 0 if the instance keeps no state.
+**/
+UINTN
+InternalQemuFwCfgTransferCount (
+  VOID
+  )
+{
+  return 0;
+}
+
+/**
+  Return the sorted fw_cfg file directory of the current phase, building it on
+  the first call if necessary.
+
+  @return  The directory, or NULL if the instance keeps no directory, or it
+           could not be built. In the latter case the caller should scan
+           QemuFwCfgItemFileDir.
+**/
+CONST QEMU_FW_CFG_FILE_DIR *
+InternalQemuFwCfgGetFileDir (
+  VOID
+  )
+{
+  //
+  // There is no permanent memory to hold the directory in.
+  //
+  return NULL;
+}
@@ -0,0 +1,558 @@
+/** @file
+  Timer Architectural Protocol as defined in the DXE CIS, implemented with the
+  local APIC timer.
+
+  The timer is armed one interrupt at a time. When the TSC is invariant and
+  its frequency is known (gQemuTscFrequencyHobGuid), the TSC-deadline mode is
+  used, and the registered handler is passed the time that actually elapsed,
+  measured with the TSC. Otherwise, the one-shot mode is used, counting at
+  PcdFSBClock.
+
+  Unlike the 8254 driver, no port I/O is needed to program the timer or to
+  acknowledge its interrupt, and no interrupt at all is taken while the timer
+  period is 0.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "LocalApicTimerDxe.h"
+
+//
+// The handle onto which the Timer Architectural Protocol will be installed
+//
+EFI_HANDLE  mTimerHandle = NULL;
+
+//
+// The Timer Architectural Protocol that this driver produces
+//
+EFI_TIMER_ARCH_PROTOCOL  mTimer = {
+  TimerDriverRegisterHandler,
+  TimerDriverSetTimerPeriod,
+  TimerDriverGetTimerPeriod,
+  TimerDriverGenerateSoftInterrupt
+};
+
+//
+// Pointer to the CPU Architectural Protocol instance
+//
+EFI_CPU_ARCH_PROTOCOL  *mCpu;
+
+//
+// The notification function to call on every timer interrupt.
+//
+EFI_TIMER_NOTIFY  mTimerNotifyFunction;
+
+//
+// The current period of the timer interrupt
+//
+volatile UINT64  mTimerPeriod = 0;
+
+//
+// TSC frequency in Hz if the TSC-deadline mode is used, zero in one-shot mode
+//
+STATIC UINT64  mTscFrequency;
+
+//
+// The current period of the timer interrupt, in TSC ticks (TSC-deadline mode)
+// or in local APIC timer ticks (one-shot mode)
+//
+STATIC UINT64  mTimerCount;
+
+//
+// The TSC value the timer is armed for, and the TSC value up to which the
+// elapsed time has been reported to mTimerNotifyFunction (TSC-deadline mode)
+//
+STATIC UINT64  mTscDeadline;
+STATIC UINT64  mLastNotifyTsc;
+
+//
+// Number of timer interrupts taken, and the time reported for them in 100 ns
+// units. Logged at ExitBootServices(), to compare the interrupt rate with
+// that of the 8254 driver.
+//
+STATIC UINT64  mInterruptCount;
+STATIC UINT64  mNotifiedTime;
+
+//
+// Worker Functions
+//
+
+/**
+  Arm the local APIC timer for the next interrupt, one timer period from the
+  previous deadline (TSC-deadline mode) or from now (one-shot mode).
+
+  In TSC-deadline mode, the deadlines do not drift with interrupt latency. If
+  the next deadline has already passed, the timer is armed one timer period
+  from now; the time missed is reported by NotifyElapsedTime().
+**/
+STATIC
+VOID
+ArmTimer (
+  VOID
+  )
+{
+  UINT64  Now;
+
+  if (mTscFrequency == 0) {
+    WriteLocalApicReg (XAPIC_TIMER_INIT_COUNT_OFFSET, (UINT32)mTimerCount);
+    return;
+  }
+
+  Now           = AsmReadTsc ();
+  mTscDeadline += mTimerCount;
+  if (mTscDeadline <= Now) {
+    mTscDeadline = Now + mTimerCount;
+  }
+
+  AsmWriteMsr64 (MSR_IA32_TSC_DEADLINE, mTscDeadline);
+}
+
+/**
+  Call mTimerNotifyFunction, passing the time elapsed since the previous call.
+
+  The caller must be running at TPL_HIGH_LEVEL.
+**/
+STATIC
+VOID
+NotifyElapsedTime (
+  VOID
+  )
+{
+  UINT64  Elapsed;
+
+  if (mTscFrequency == 0) {
+    Elapsed = mTimerPeriod;
+  } else {
+    Elapsed = DivU64x64Remainder (
+                MultU64x32 (AsmReadTsc () - mLastNotifyTsc, TIMER_PERIOD_UNITS_PER_SECOND),
+                mTscFrequency,
+                NULL
+                );
+    //
+    // Advance by the reported time only, so that the remainder is carried
+    // over to the next call.
+    //
+    mLastNotifyTsc += DivU64x32 (MultU64x64 (Elapsed, mTscFrequency), TIMER_PERIOD_UNITS_PER_SECOND);
+  }
+
+  mNotifiedTime += Elapsed;
+
+  if (mTimerNotifyFunction != NULL) {
+    mTimerNotifyFunction (Elapsed);
+  }
+}
+
+/**
+  Local APIC Timer Interrupt Handler.
+
+  @param InterruptType    The type of interrupt that occurred
+  @param SystemContext    A pointer to the system context when the interrupt occurred
+**/
+VOID
+EFIAPI
+TimerInterruptHandler (
+  IN EFI_EXCEPTION_TYPE  InterruptType,
+  IN EFI_SYSTEM_CONTEXT  SystemContext
+  )
+{
+  EFI_TPL  OriginalTPL;
+
+  OriginalTPL = gBS->RaiseTPL (TPL_HIGH_LEVEL);
+
+  mInterruptCount++;
+
+  //
+  // Arm the next interrupt before running the handler, so that the time the
+  // handler takes does not delay it. The interrupt cannot be delivered before
+  // the EOI below.
+  //
+  if (mTimerPeriod != 0) {
+    ArmTimer ();
+  }
+
+  NotifyElapsedTime ();
+
+  gBS->RestoreTPL (OriginalTPL);
+
+  DisableInterrupts ();
+  SendApicEoi ();
+}
+
+/**
+
+  This function registers the handler NotifyFunction so it is called every time
+  the timer interrupt fires.  It also passes the amount of time since the last
+  handler call to the NotifyFunction.  If NotifyFunction is NULL, then the
+  handler is unregistered.  If the handler is registered, then EFI_SUCCESS is
+  returned.  If the CPU does not support registering a timer interrupt handler,
+  then EFI_UNSUPPORTED is returned.  If an attempt is made to register a handler
+  when a handler is already registered, then EFI_ALREADY_STARTED is returned.
+  If an attempt is made to unregister a handler when a handler is not registered,
+  then EFI_INVALID_PARAMETER is returned.  If an error occurs attempting to
+  register the NotifyFunction with the timer interrupt, then EFI_DEVICE_ERROR
+  is returned.
+
+
+  @param This             The EFI_TIMER_ARCH_PROTOCOL instance.
+  @param NotifyFunction   The function to call when a timer interrupt fires.  This
+                          function executes at TPL_HIGH_LEVEL.  The DXE Core will
+                          register a handler for the timer interrupt, so it can know
+                          how much time has passed.  This information is used to
+                          signal timer based events.  NULL will unregister the handler.
+
+  @retval        EFI_SUCCESS            The timer handler was registered.
+  @retval        EFI_UNSUPPORTED        The platform does not support timer interrupts.
+  @retval        EFI_ALREADY_STARTED    NotifyFunction is not NULL, and a handler is already
+                                        registered.
+  @retval        EFI_INVALID_PARAMETER  NotifyFunction is NULL, and a handler was not
+                                        previously registered.
+  @retval        EFI_DEVICE_ERROR       The timer handler could not be registered.
+
+**/
+EFI_STATUS
+EFIAPI
+TimerDriverRegisterHandler (
+  IN EFI_TIMER_ARCH_PROTOCOL  *This,
+  IN EFI_TIMER_NOTIFY         NotifyFunction
+  )
+{
+  //
+  // Check for invalid parameters
+  //
+  if ((NotifyFunction == NULL) && (mTimerNotifyFunction == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if ((NotifyFunction != NULL) && (mTimerNotifyFunction != NULL)) {
+    return EFI_ALREADY_STARTED;
+  }
+
+  mTimerNotifyFunction = NotifyFunction;
+
+  return EFI_SUCCESS;
+}
+
+/**
+
+  This function adjusts the period of timer interrupts to the value specified
+  by TimerPeriod.  If the timer period is updated, then the selected timer
+  period is stored in EFI_TIMER.TimerPeriod, and EFI_SUCCESS is returned.  If
+  the timer hardware is not programmable, then EFI_UNSUPPORTED is returned.
+  If an error occurs while attempting to update the timer period, then the
+  timer hardware will be put back in its state prior to this call, and
+  EFI_DEVICE_ERROR is returned.  If TimerPeriod is 0, then the timer interrupt
+  is disabled.  This is not the same as disabling the CPU's interrupts.
+  Instead, it must either turn off the timer hardware, or it must adjust the
+  interrupt controller so that a CPU interrupt is not generated when the timer
+  interrupt fires.
+
+
+  @param This            The EFI_TIMER_ARCH_PROTOCOL instance.
+  @param TimerPeriod     The rate to program the timer interrupt in 100 nS units.  If
+                         the timer hardware is not programmable, then EFI_UNSUPPORTED is
+                         returned.  If the timer is programmable, then the timer period
+                         will be rounded up to the nearest timer period that is supported
+                         by the timer hardware.  If TimerPeriod is set to 0, then the
+                         timer interrupts will be disabled.
+
+  @retval        EFI_SUCCESS       The timer period was changed.
+  @retval        EFI_UNSUPPORTED   The platform cannot change the period of the timer interrupt.
+  @retval        EFI_DEVICE_ERROR  The timer period could not be changed due to a device error.
+
+**/
+EFI_STATUS
+EFIAPI
+TimerDriverSetTimerPeriod (
+  IN EFI_TIMER_ARCH_PROTOCOL  *This,
+  IN UINT64                   TimerPeriod
+  )
+{
+  EFI_TPL  OriginalTPL;
+  UINT64   Frequency;
+  UINT64   MaxPeriod;
+
+  //
+  // Keep the timer interrupt handler from re-arming the timer while it is
+  // being reprogrammed.
+  //
+  OriginalTPL = gBS->RaiseTPL (TPL_HIGH_LEVEL);
+
+  if (TimerPeriod == 0) {
+    //
+    // Disable timer interrupt for a TimerPeriod of 0
+    //
+    DisableApicTimerInterrupt ();
+    if (mTscFrequency != 0) {
+      AsmWriteMsr64 (MSR_IA32_TSC_DEADLINE, 0);
+    } else {
+      WriteLocalApicReg (XAPIC_TIMER_INIT_COUNT_OFFSET, 0);
+    }
+  } else {
+    Frequency = (mTscFrequency != 0) ? mTscFrequency : PcdGet32 (PcdFSBClock);
+
+    //
+    // Check for overflow. The count is kept within 32 bits, as required in
+    // one-shot mode; that also keeps the conversions in NotifyElapsedTime()
+    // from overflowing.
+    //
+    MaxPeriod = DivU64x64Remainder (
+                  MultU64x32 (MAX_UINT32, TIMER_PERIOD_UNITS_PER_SECOND),
+                  Frequency,
+                  NULL
+                  );
+    if (TimerPeriod > MaxPeriod) {
+      TimerPeriod = MaxPeriod;
+    }
+
+    //
+    // Convert TimerPeriod into timer ticks, rounding up
+    //
+    mTimerCount = DivU64x32 (
+                    MultU64x64 (TimerPeriod, Frequency) + TIMER_PERIOD_UNITS_PER_SECOND - 1,
+                    TIMER_PERIOD_UNITS_PER_SECOND
+                    );
+
+    if (mTscFrequency != 0) {
+      if (mTimerPeriod == 0) {
+        mLastNotifyTsc = AsmReadTsc ();
+      }
+
+      WriteLocalApicReg (
+        XAPIC_LVT_TIMER_OFFSET,
+        LOCAL_APIC_TIMER_VECTOR | LOCAL_APIC_TIMER_MODE_TSC_DEADLINE
+        );
+      //
+      // The LVT timer must be in TSC-deadline mode before the deadline MSR is
+      // written; otherwise the write is ignored.
+      //
+      MemoryFence ();
+      mTscDeadline = AsmReadTsc ();
+      ArmTimer ();
+    } else {
+      InitializeApicTimer (1, (UINT32)mTimerCount, FALSE, LOCAL_APIC_TIMER_VECTOR);
+    }
+  }
+
+  //
+  // Save the new timer period
+  //
+  mTimerPeriod = TimerPeriod;
+
+  gBS->RestoreTPL (OriginalTPL);
+
+  return EFI_SUCCESS;
+}
+
+/**
+
+  This function retrieves the period of timer interrupts in 100 ns units,
+  returns that value in TimerPeriod, and returns EFI_SUCCESS.  If TimerPeriod
+  is NULL, then EFI_INVALID_PARAMETER is returned.  If a TimerPeriod of 0 is
+  returned, then the timer is currently disabled.
+
+
+  @param This            The EFI_TIMER_ARCH_PROTOCOL instance.
+  @param TimerPeriod     A pointer to the timer period to retrieve in 100 ns units.  If
+                         0 is returned, then the timer is currently disabled.
+
+  @retval EFI_SUCCESS            The timer period was returned in TimerPeriod.
+  @retval EFI_INVALID_PARAMETER  TimerPeriod is NULL.
+
+**/
+EFI_STATUS
+EFIAPI
+TimerDriverGetTimerPeriod (
+  IN EFI_TIMER_ARCH_PROTOCOL  *This,
+  OUT UINT64                  *TimerPeriod
+  )
+{
+  if (TimerPeriod == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  *TimerPeriod = mTimerPeriod;
+
+  return EFI_SUCCESS;
+}
+
+/**
+
+  This function generates a soft timer interrupt. If the platform does not support soft
+  timer interrupts, then EFI_UNSUPPORTED is returned. Otherwise, EFI_SUCCESS is returned.
+  If a handler has been registered through the EFI_TIMER_ARCH_PROTOCOL.RegisterHandler()
+  service, then a soft timer interrupt will be generated. If the timer interrupt is
+  enabled when this service is called, then the registered handler will be invoked. The
+  registered handler should not be able to distinguish a hardware-generated timer
+  interrupt from a software-generated timer interrupt.
+
+
+  @param This              The EFI_TIMER_ARCH_PROTOCOL instance.
+
+  @retval EFI_SUCCESS       The soft timer interrupt was generated.
+  @retval EFI_UNSUPPORTED   The platform does not support the generation of soft timer interrupts.
+
+**/
+EFI_STATUS
+EFIAPI
+TimerDriverGenerateSoftInterrupt (
+  IN EFI_TIMER_ARCH_PROTOCOL  *This
+  )
+{
+  EFI_TPL  OriginalTPL;
+
+  //
+  // If the timer interrupt is enabled, then the registered handler will be invoked.
+  //
+  if (mTimerPeriod == 0) {
+    return EFI_UNSUPPORTED;
+  }
+
+  OriginalTPL = gBS->RaiseTPL (TPL_HIGH_LEVEL);
+
+  NotifyElapsedTime ();
+
+  gBS->RestoreTPL (OriginalTPL);
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Stop the local APIC timer when the OS takes over, and log the number of
+  timer interrupts taken during boot.
+
+  @param[in] Event    Event whose notification function is being invoked.
+  @param[in] Context  Unused.
+**/
+STATIC
+VOID
+EFIAPI
+TimerExitBootServices (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  TimerDriverSetTimerPeriod (&mTimer, 0);
+
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: %Lu timer interrupts in %Lu ms\n",
+    __FUNCTION__,
+    mInterruptCount,
+    DivU64x32 (mNotifiedTime, TIMER_PERIOD_UNITS_PER_SECOND / 1000)
+    ));
+}
+
+/**
+  Determine whether the TSC-deadline mode can be used, and if so, set
+  mTscFrequency.
+**/
+STATIC
+VOID
+InitializeTimerMode (
+  VOID
+  )
+{
+  CPUID_VERSION_INFO_ECX  Ecx;
+  EFI_HOB_GUID_TYPE       *GuidHob;
+
+  AsmCpuid (CPUID_VERSION_INFO, NULL, NULL, &Ecx.Uint32, NULL);
+  if (Ecx.Bits.TSC_Deadline == 0) {
+    return;
+  }
+
+  //
+  // The HOB holds zero if the TSC is not invariant.
+  //
+  GuidHob = GetFirstGuidHob (&gQemuTscFrequencyHobGuid);
+  if (GuidHob != NULL) {
+    mTscFrequency = *(UINT64 *)GET_GUID_HOB_DATA (GuidHob);
+  }
+}
+
+/**
+  Initialize the Timer Architectural Protocol driver
+
+  @param ImageHandle     ImageHandle of the loaded driver
+  @param SystemTable     Pointer to the System Table
+
+  @retval EFI_SUCCESS            Timer Architectural Protocol created
+  @retval EFI_OUT_OF_RESOURCES   Not enough resources available to initialize driver.
+  @retval EFI_DEVICE_ERROR       A device error occurred attempting to initialize the driver.
+
+**/
+EFI_STATUS
+EFIAPI
+TimerDriverInitialize (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  EFI_STATUS  Status;
+  EFI_EVENT   ExitBootServicesEvent;
+
+  //
+  // Initialize the pointer to our notify function.
+  //
+  mTimerNotifyFunction = NULL;
+
+  //
+  // Make sure the Timer Architectural Protocol is not already installed in the system
+  //
+  ASSERT_PROTOCOL_ALREADY_INSTALLED (NULL, &gEfiTimerArchProtocolGuid);
+
+  //
+  // Find the CPU architectural protocol.
+  //
+  Status = gBS->LocateProtocol (&gEfiCpuArchProtocolGuid, NULL, (VOID **)&mCpu);
+  ASSERT_EFI_ERROR (Status);
+
+  InitializeTimerMode ();
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: using %a mode\n",
+    __FUNCTION__,
+    (mTscFrequency != 0) ? "TSC-deadline" : "one-shot"
+    ));
+
+  //
+  // Force the timer to be disabled
+  //
+  Status = TimerDriverSetTimerPeriod (&mTimer, 0);
+  ASSERT_EFI_ERROR (Status);
+
+  //
+  // Install interrupt handler for the local APIC timer
+  //
+  Status = mCpu->RegisterInterruptHandler (mCpu, LOCAL_APIC_TIMER_VECTOR, TimerInterruptHandler);
+  ASSERT_EFI_ERROR (Status);
+
+  //
+  // Force the timer to be enabled at its default period
+  //
+  Status = TimerDriverSetTimerPeriod (&mTimer, PcdGet32 (PcdLocalApicTimerTickDuration));
+  ASSERT_EFI_ERROR (Status);
+
+  Status = gBS->CreateEventEx (
+                  EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  TimerExitBootServices,
+                  NULL,
+                  &gEfiEventExitBootServicesGuid,
+                  &ExitBootServicesEvent
+                  );
+  ASSERT_EFI_ERROR (Status);
+
+  //
+  // Install the Timer Architectural Protocol onto a new handle
+  //
+  Status = gBS->InstallMultipleProtocolInterfaces (
+                  &mTimerHandle,
+                  &gEfiTimerArchProtocolGuid,
+                  &mTimer,
+                  NULL
+                  );
+  ASSERT_EFI_ERROR (Status);
+
+  return Status;
+}
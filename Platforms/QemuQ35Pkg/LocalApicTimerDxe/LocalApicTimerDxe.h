@@ -0,0 +1,135 @@
+/** @file
+  Private data structures for the local APIC timer driver.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+**/
+
+#ifndef _LOCAL_APIC_TIMER_DXE_H_
+#define _LOCAL_APIC_TIMER_DXE_H_
+
+#include <PiDxe.h>
+
+#include <Guid/EventGroup.h>
+#include <Guid/QemuTscFrequencyHob.h>
+#include <Protocol/Cpu.h>
+#include <Protocol/Timer.h>
+#include <Register/Intel/ArchitecturalMsr.h>
+#include <Register/Intel/Cpuid.h>
+#include <Register/Intel/LocalApic.h>
+
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/HobLib.h>
+#include <Library/LocalApicLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+//
+// Interrupt vector of the local APIC timer. It must not overlap the vectors
+// that the 8259 driver assigns to the legacy IRQs (0x68 - 0x77).
+//
+#define LOCAL_APIC_TIMER_VECTOR  0x30
+
+//
+// Timer mode field (bits 18:17) of the LVT timer register
+//
+#define LOCAL_APIC_TIMER_MODE_TSC_DEADLINE  BIT18
+
+//
+// 100 ns units per second
+//
+#define TIMER_PERIOD_UNITS_PER_SECOND  10000000u
+
+//
+// Function Prototypes
+//
+
+/**
+  Initialize the Timer Architectural Protocol driver
+
+  @param ImageHandle     ImageHandle of the loaded driver
+  @param SystemTable     Pointer to the System Table
+
+  @retval EFI_SUCCESS            Timer Architectural Protocol created
+  @retval EFI_OUT_OF_RESOURCES   Not enough resources available to initialize driver.
+  @retval EFI_DEVICE_ERROR       A device error occurred attempting to initialize the driver.
+
+**/
+EFI_STATUS
+EFIAPI
+TimerDriverInitialize (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  );
+
+/**
+  Register the handler NotifyFunction, to be called on every timer interrupt.
+
+  @param This             The EFI_TIMER_ARCH_PROTOCOL instance.
+  @param NotifyFunction   The function to call when a timer interrupt fires.
+                          NULL unregisters the handler.
+
+  @retval EFI_SUCCESS            The timer handler was registered.
+  @retval EFI_ALREADY_STARTED    NotifyFunction is not NULL, and a handler is already
+                                 registered.
+  @retval EFI_INVALID_PARAMETER  NotifyFunction is NULL, and a handler was not
+                                 previously registered.
+
+**/
+EFI_STATUS
+EFIAPI
+TimerDriverRegisterHandler (
+  IN EFI_TIMER_ARCH_PROTOCOL  *This,
+  IN EFI_TIMER_NOTIFY         NotifyFunction
+  );
+
+/**
+  Set the period of timer interrupts, in 100 ns units. A period of 0 disables
+  the timer interrupt.
+
+  @param This            The EFI_TIMER_ARCH_PROTOCOL instance.
+  @param TimerPeriod     The rate to program the timer interrupt in 100 ns units.
+
+  @retval EFI_SUCCESS       The timer period was changed.
+
+**/
+EFI_STATUS
+EFIAPI
+TimerDriverSetTimerPeriod (
+  IN EFI_TIMER_ARCH_PROTOCOL  *This,
+  IN UINT64                   TimerPeriod
+  );
+
+/**
+  Retrieve the period of timer interrupts in 100 ns units.
+
+  @param This            The EFI_TIMER_ARCH_PROTOCOL instance.
+  @param TimerPeriod     A pointer to the timer period to retrieve in 100 ns units.
+
+  @retval EFI_SUCCESS            The timer period was returned in TimerPeriod.
+  @retval EFI_INVALID_PARAMETER  TimerPeriod is NULL.
+
+**/
+EFI_STATUS
+EFIAPI
+TimerDriverGetTimerPeriod (
+  IN EFI_TIMER_ARCH_PROTOCOL  *This,
+  OUT UINT64                  *TimerPeriod
+  );
+
+/**
+  Generate a soft timer interrupt.
+
+  @param This              The EFI_TIMER_ARCH_PROTOCOL instance.
+
+  @retval EFI_SUCCESS       The soft timer interrupt was generated.
+  @retval EFI_UNSUPPORTED   The timer interrupt is disabled.
+
+**/
+EFI_STATUS
+EFIAPI
+TimerDriverGenerateSoftInterrupt (
+  IN EFI_TIMER_ARCH_PROTOCOL  *This
+  );
+
+#endif
@@ -928,6 +928,18 @@ InitializeRamRegions (
     }
   }
 
+  if (FixedPcdGet32 (PcdDebugLogRingSize) != 0) {
+    //
+    // Reserve the debug log ring of PlatformDebugLibIoPort, so that neither
+    // DXE nor the OS reuse it, and the host can dump it at any time.
+    //
+    BuildMemoryAllocationHob (
+      (EFI_PHYSICAL_ADDRESS)(UINTN)FixedPcdGet32 (PcdDebugLogRingBase),
+      (UINT64)(UINTN)FixedPcdGet32 (PcdDebugLogRingSize),
+      EfiReservedMemoryType
+      );
+  }
+
  #ifdef MDE_CPU_X64
   if (FixedPcdGet32 (PcdOvmfWorkAreaSize) != 0) {
     //
@@ -14,13 +14,29 @@
 
 #include "QemuFlash.h"
 
-#define WRITE_BYTE_CMD           0x10
-#define BLOCK_ERASE_CMD          0x20
-#define CLEAR_STATUS_CMD         0x50
-#define READ_STATUS_CMD          0x70
-#define READ_DEVID_CMD           0x90
-#define BLOCK_ERASE_CONFIRM_CMD  0xd0
-#define READ_ARRAY_CMD           0xff
+#define WRITE_BYTE_CMD            0x10
+#define BLOCK_ERASE_CMD           0x20
+#define CLEAR_STATUS_CMD          0x50
+#define READ_STATUS_CMD           0x70
+#define READ_DEVID_CMD            0x90
+#define BLOCK_ERASE_CONFIRM_CMD   0xd0
+#define WRITE_BUFFER_CMD          0xe8
+#define WRITE_BUFFER_CONFIRM_CMD  0xd0
+#define READ_ARRAY_CMD            0xff
+
+//
+// QEMU's pflash_cfi01 device is one byte wide on this platform, so the word
+// count of the write-to-buffer command is a single byte: a buffer holds at
+// most 256 bytes. Buffers must not cross a naturally aligned boundary of that
+// size either, so that they stay within one write block of the device.
+//
+#define WRITE_BUFFER_SIZE  256
+
+//
+// Programming a run of fewer bytes than this with single byte program
+// commands traps fewer times than the write-to-buffer sequence.
+//
+#define WRITE_BUFFER_MIN_RUN  3
 
 #define CLEARED_ARRAY_STATUS  0x00
 
@@ -166,9 +182,54 @@ QemuFlashRead (
   return EFI_SUCCESS;
 }
 
+/**
+  Program a run of bytes with the CFI write-to-buffer command sequence.
+
+  Every write to the flash device traps to the hypervisor. The sequence costs
+  one write per byte plus three, rather than two writes per byte with
+  WRITE_BYTE_CMD. QEMU completes the programming synchronously, so the status
+  register is not polled (like with WRITE_BYTE_CMD).
+
+  @param[in] Ptr       Flash address of the first byte to program.
+  @param[in] NumBytes  Number of bytes to program; between 1 and
+                       WRITE_BUFFER_SIZE, without crossing a
+                       WRITE_BUFFER_SIZE aligned boundary.
+  @param[in] Buffer    The data to program.
+
+**/
+STATIC
+VOID
+QemuFlashWriteBuffer (
+  IN        volatile UINT8  *Ptr,
+  IN        UINTN           NumBytes,
+  IN        CONST UINT8     *Buffer
+  )
+{
+  UINTN  Loop;
+
+  ASSERT (NumBytes > 0 && NumBytes <= WRITE_BUFFER_SIZE);
+  ASSERT (
+    ((UINTN)Ptr & ~(UINTN)(WRITE_BUFFER_SIZE - 1)) ==
+    (((UINTN)Ptr + NumBytes - 1) & ~(UINTN)(WRITE_BUFFER_SIZE - 1))
+    );
+
+  QemuFlashPtrWrite (Ptr, WRITE_BUFFER_CMD);
+  QemuFlashPtrWrite (Ptr, (UINT8)(NumBytes - 1));
+  for (Loop = 0; Loop < NumBytes; Loop++) {
+    QemuFlashPtrWrite (Ptr + Loop, Buffer[Loop]);
+  }
+
+  QemuFlashPtrWrite (Ptr, WRITE_BUFFER_CONFIRM_CMD);
+}
+
 /**
   Write to QEMU Flash
 
+  Bytes that already hold the target value are not programmed; the remaining
+  bytes are programmed in runs that do not cross a WRITE_BUFFER_SIZE aligned
+  boundary, with the write-to-buffer command sequence if it is cheaper than
+  programming single bytes.
+
   @param[in] Lba      The starting logical block index to write to.
   @param[in] Offset   Offset into the block at which to begin writing.
   @param[in] NumBytes On input, indicates the requested write size. On
@@ -186,6 +247,8 @@ QemuFlashWrite (
 {
   volatile UINT8  *Ptr;
   UINTN           Loop;
+  UINTN           RunEnd;
+  UINTN           Index;
 
   //
   // Only write to the first 64k. We don't bother saving the FTW Spare
@@ -196,21 +259,45 @@ QemuFlashWrite (
   }
 
   //
-  // Program flash
+  // Program flash. The flash is in read mode whenever we compare its contents
+  // with the target values; reading in that mode does not trap.
   //
-  Ptr = QemuFlashPtr (Lba, Offset);
-  for (Loop = 0; Loop < *NumBytes; Loop++) {
-    QemuFlashPtrWrite (Ptr, WRITE_BYTE_CMD);
-    QemuFlashPtrWrite (Ptr, Buffer[Loop]);
+  Ptr  = QemuFlashPtr (Lba, Offset);
+  Loop = 0;
+  while (Loop < *NumBytes) {
+    if (Ptr[Loop] == Buffer[Loop]) {
+      Loop++;
+      continue;
+    }
 
-    Ptr++;
-  }
+    //
+    // The run starts with the first differing byte, and ends with the last
+    // differing byte before the next write buffer boundary. Unchanged bytes
+    // inside the run are programmed again, which is harmless.
+    //
+    RunEnd = MIN (
+               *NumBytes,
+               Loop + WRITE_BUFFER_SIZE -
+               ((UINTN)(Ptr + Loop) & (WRITE_BUFFER_SIZE - 1))
+               );
+    while (Ptr[RunEnd - 1] == Buffer[RunEnd - 1]) {
+      RunEnd--;
+    }
 
-  //
-  // Restore flash to read mode
-  //
-  if (*NumBytes > 0) {
-    QemuFlashPtrWrite (Ptr - 1, READ_ARRAY_CMD);
+    if (RunEnd - Loop >= WRITE_BUFFER_MIN_RUN) {
+      QemuFlashWriteBuffer (Ptr + Loop, RunEnd - Loop, Buffer + Loop);
+    } else {
+      for (Index = Loop; Index < RunEnd; Index++) {
+        QemuFlashPtrWrite (Ptr + Index, WRITE_BYTE_CMD);
+        QemuFlashPtrWrite (Ptr + Index, Buffer[Index]);
+      }
+    }
+
+    //
+    // Restore flash to read mode
+    //
+    QemuFlashPtrWrite (Ptr + Loop, READ_ARRAY_CMD);
+    Loop = RunEnd;
   }
 
   return EFI_SUCCESS;
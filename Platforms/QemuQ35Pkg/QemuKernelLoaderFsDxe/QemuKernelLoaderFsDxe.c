@@ -21,6 +21,7 @@
 #include <Library/DebugLib.h>
 #include <Library/DevicePathLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
 #include <Library/QemuFwCfgLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiRuntimeServicesTableLib.h>
@@ -46,7 +47,7 @@ typedef struct {
     UINT32                        Size;
   }                             FwCfgItem[2];
   UINT32          Size;
-  UINT8           *Data;
+  UINT8           *Data; // NULL if the blob is read from fw_cfg on demand.
 } KERNEL_BLOB;
 
 STATIC KERNEL_BLOB  mKernelBlob[KernelBlobTypeMax] = {
@@ -130,6 +131,57 @@ typedef struct {
 #define STUB_FILE_FROM_FILE(FilePointer) \
         CR (FilePointer, STUB_FILE, File, STUB_FILE_SIG)
 
+/**
+  Read part of a blob straight from fw_cfg.
+
+  The fw_cfg items that make up the blob are re-selected on every call, because
+  other fw_cfg clients may have run since the previous read. With the fw_cfg
+  DMA interface, skipping to Position costs a single transfer.
+
+  @param[in]  Blob      The blob to read from; Blob->Size must have been set by
+                        FetchBlob().
+  @param[in]  Position  Offset in the blob to start reading at.
+  @param[in]  Size      Number of bytes to read. Position + Size must not
+                        exceed Blob->Size.
+  @param[out] Buffer    Buffer to read the bytes into.
+**/
+STATIC
+VOID
+ReadBlobFromFwCfg (
+  IN  CONST KERNEL_BLOB  *Blob,
+  IN  UINT64             Position,
+  IN  UINTN              Size,
+  OUT UINT8              *Buffer
+  )
+{
+  UINTN   Idx;
+  UINT64  ItemStart;
+  UINT32  ItemOffset;
+  UINT32  Chunk;
+
+  ItemStart = 0;
+  for (Idx = 0; (Idx < ARRAY_SIZE (Blob->FwCfgItem)) && (Size > 0); Idx++) {
+    if (Blob->FwCfgItem[Idx].DataKey == 0) {
+      break;
+    }
+
+    if (Position < ItemStart + Blob->FwCfgItem[Idx].Size) {
+      ItemOffset = (UINT32)(Position - ItemStart);
+      Chunk      = (UINT32)MIN (Size, Blob->FwCfgItem[Idx].Size - ItemOffset);
+
+      QemuFwCfgSelectItem (Blob->FwCfgItem[Idx].DataKey);
+      QemuFwCfgSkipBytes (ItemOffset);
+      QemuFwCfgReadBytes (Chunk, Buffer);
+
+      Buffer   += Chunk;
+      Position += Chunk;
+      Size     -= Chunk;
+    }
+
+    ItemStart += Blob->FwCfgItem[Idx].Size;
+  }
+}
+
 //
 // Protocol member functions for File.
 //
@@ -403,6 +455,8 @@ StubFileRead (
 
   if (Blob->Data != NULL) {
     CopyMem (Buffer, Blob->Data + StubFile->Position, *BufferSize);
+  } else if (*BufferSize > 0) {
+    ReadBlobFromFwCfg (Blob, StubFile->Position, *BufferSize, Buffer);
   }
 
   StubFile->Position += *BufferSize;
@@ -906,7 +960,11 @@ InitrdLoadFile2 (
     return EFI_BUFFER_TOO_SMALL;
   }
 
-  CopyMem (Buffer, InitrdBlob->Data, InitrdBlob->Size);
+  if (InitrdBlob->Data != NULL) {
+    CopyMem (Buffer, InitrdBlob->Data, InitrdBlob->Size);
+  } else {
+    ReadBlobFromFwCfg (InitrdBlob, 0, InitrdBlob->Size, Buffer);
+  }
 
   *BufferSize = InitrdBlob->Size;
   return EFI_SUCCESS;
@@ -926,16 +984,20 @@ STATIC CONST EFI_LOAD_FILE2_PROTOCOL  mInitrdLoadFile2 = {
   param[in,out] Blob  Pointer to the KERNEL_BLOB element in mKernelBlob that is
                       to be filled from fw_cfg.
 
+  param[in]     Eager If FALSE, only determine the size of the blob; the data
+                      will be read from fw_cfg on demand.
+
   @retval EFI_SUCCESS           Blob has been populated. If fw_cfg reported a
-                                size of zero for the blob, then Blob->Data has
-                                been left unchanged.
+                                size of zero for the blob, or Eager is FALSE,
+                                then Blob->Data has been left unchanged.
 
   @retval EFI_OUT_OF_RESOURCES  Failed to allocate memory for Blob->Data.
 **/
 STATIC
 EFI_STATUS
 FetchBlob (
-  IN OUT KERNEL_BLOB  *Blob
+  IN OUT KERNEL_BLOB  *Blob,
+  IN     BOOLEAN      Eager
   )
 {
   UINT32  Left;
@@ -960,6 +1022,17 @@ FetchBlob (
     return EFI_SUCCESS;
   }
 
+  if (!Eager) {
+    DEBUG ((
+      DEBUG_INFO,
+      "%a: %Ld bytes for \"%s\" will be read on demand\n",
+      __FUNCTION__,
+      (INT64)Blob->Size,
+      Blob->Name
+      ));
+    return EFI_SUCCESS;
+  }
+
   //
   // Read blob.
   //
@@ -1040,6 +1113,8 @@ QemuKernelLoaderFsDxeEntrypoint (
 {
   UINTN        BlobType;
   KERNEL_BLOB  *CurrentBlob;
+  BOOLEAN      EagerFetch;
+  BOOLEAN      Eager;
   KERNEL_BLOB  *KernelBlob;
   EFI_STATUS   Status;
   EFI_HANDLE   FileSystemHandle;
@@ -1056,22 +1131,43 @@ QemuKernelLoaderFsDxeEntrypoint (
   }
 
   //
-  // Fetch all blobs.
+  // Blobs read from fw_cfg on demand are never passed to VerifyBlob(). Fail
+  // closed: if the linked verifier rejects a probe (an empty blob without a
+  // name), it enforces a policy, so fetch and verify all blobs here, whatever
+  // the platform asked for.
+  //
+  EagerFetch = FeaturePcdGet (PcdQemuKernelLoaderFsEagerFetch);
+  if (!EagerFetch && EFI_ERROR (VerifyBlob (L"", NULL, 0))) {
+    DEBUG ((
+      DEBUG_INFO,
+      "%a: blob verification is enforced, fetching blobs eagerly\n",
+      __FUNCTION__
+      ));
+    EagerFetch = TRUE;
+  }
+
+  //
+  // Fetch all blobs. Unless eager fetching is in effect, the kernel and the
+  // initrd are only sized here, and read from fw_cfg when a consumer asks for
+  // them; the command line is small, so it is always fetched.
   //
   for (BlobType = 0; BlobType < KernelBlobTypeMax; ++BlobType) {
     CurrentBlob = &mKernelBlob[BlobType];
-    Status      = FetchBlob (CurrentBlob);
+    Eager       = EagerFetch || (BlobType == KernelBlobTypeCommandLine);
+    Status      = FetchBlob (CurrentBlob, Eager);
     if (EFI_ERROR (Status)) {
       goto FreeBlobs;
     }
 
-    Status = VerifyBlob (
-               CurrentBlob->Name,
-               CurrentBlob->Data,
-               CurrentBlob->Size
-               );
-    if (EFI_ERROR (Status)) {
-      goto FreeBlobs;
+    if (Eager) {
+      Status = VerifyBlob (
+                 CurrentBlob->Name,
+                 CurrentBlob->Data,
+                 CurrentBlob->Size
+                 );
+      if (EFI_ERROR (Status)) {
+        goto FreeBlobs;
+      }
     }
 
     mTotalBlobBytes += CurrentBlob->Size;
@@ -1079,7 +1175,7 @@ QemuKernelLoaderFsDxeEntrypoint (
 
   KernelBlob = &mKernelBlob[KernelBlobTypeKernel];
 
-  if (KernelBlob->Data == NULL) {
+  if (KernelBlob->Size == 0) {
     Status = EFI_NOT_FOUND;
     goto FreeBlobs;
   }
@@ -1146,9 +1242,10 @@ FreeBlobs:
     CurrentBlob = &mKernelBlob[--BlobType];
     if (CurrentBlob->Data != NULL) {
       FreePool (CurrentBlob->Data);
-      CurrentBlob->Size = 0;
       CurrentBlob->Data = NULL;
     }
+
+    CurrentBlob->Size = 0;
   }
 
   return Status;
@@ -14,7 +14,7 @@
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
 #include <Library/DevicePathLib.h>
-#include <Library/FrameBufferBltLib.h>
+#include <Library/FrameBufferShadowLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/QemuFwCfgLib.h>
@@ -35,11 +35,10 @@ typedef struct RAMFB_CONFIG {
 } RAMFB_CONFIG;
 #pragma pack ()
 
-STATIC EFI_HANDLE              mRamfbHandle;
-STATIC EFI_HANDLE              mGopHandle;
-STATIC FRAME_BUFFER_CONFIGURE  *mQemuRamfbFrameBufferBltConfigure;
-STATIC UINTN                   mQemuRamfbFrameBufferBltConfigureSize;
-STATIC FIRMWARE_CONFIG_ITEM    mRamfbFwCfgItem;
+STATIC EFI_HANDLE            mRamfbHandle;
+STATIC EFI_HANDLE            mGopHandle;
+STATIC FRAME_BUFFER_SHADOW   *mQemuRamfbFrameBufferShadow;
+STATIC FIRMWARE_CONFIG_ITEM  mRamfbFwCfgItem;
 
 STATIC EFI_GRAPHICS_OUTPUT_MODE_INFORMATION  mQemuRamfbModeInfo[] = {
   {
@@ -131,35 +130,17 @@ QemuRamfbGraphicsOutputSetMode (
   Config.Height  = SwapBytes32 (ModeInfo->VerticalResolution);
   Config.Stride  = SwapBytes32 (ModeInfo->HorizontalResolution * RAMFB_BPP);
 
-  Status = FrameBufferBltConfigure (
+  //
+  // Blt() works on a shadow of the framebuffer, so that reads and scrolling
+  // do not touch the guest pages that QEMU tracks for display updates.
+  //
+  Status = FrameBufferShadowConfigure (
              (VOID *)(UINTN)mQemuRamfbMode.FrameBufferBase,
              ModeInfo,
-             mQemuRamfbFrameBufferBltConfigure,
-             &mQemuRamfbFrameBufferBltConfigureSize
+             &mQemuRamfbFrameBufferShadow
              );
-
-  if (Status == RETURN_BUFFER_TOO_SMALL) {
-    if (mQemuRamfbFrameBufferBltConfigure != NULL) {
-      FreePool (mQemuRamfbFrameBufferBltConfigure);
-    }
-
-    mQemuRamfbFrameBufferBltConfigure =
-      AllocatePool (mQemuRamfbFrameBufferBltConfigureSize);
-    if (mQemuRamfbFrameBufferBltConfigure == NULL) {
-      mQemuRamfbFrameBufferBltConfigureSize = 0;
-      return EFI_OUT_OF_RESOURCES;
-    }
-
-    Status = FrameBufferBltConfigure (
-               (VOID *)(UINTN)mQemuRamfbMode.FrameBufferBase,
-               ModeInfo,
-               mQemuRamfbFrameBufferBltConfigure,
-               &mQemuRamfbFrameBufferBltConfigureSize
-               );
-  }
-
   if (RETURN_ERROR (Status)) {
-    ASSERT (Status == RETURN_UNSUPPORTED);
+    ASSERT ((Status == RETURN_UNSUPPORTED) || (Status == RETURN_OUT_OF_RESOURCES));
     return Status;
   }
 
@@ -173,8 +154,8 @@ QemuRamfbGraphicsOutputSetMode (
   // clear screen
   //
   ZeroMem (&Black, sizeof (Black));
-  Status = FrameBufferBlt (
-             mQemuRamfbFrameBufferBltConfigure,
+  Status = FrameBufferShadowBlt (
+             mQemuRamfbFrameBufferShadow,
              &Black,
              EfiBltVideoFill,
              0,                               // SourceX -- ignored
@@ -213,8 +194,8 @@ QemuRamfbGraphicsOutputBlt (
   IN  UINTN                              Delta
   )
 {
-  return FrameBufferBlt (
-           mQemuRamfbFrameBufferBltConfigure,
+  return FrameBufferShadowBlt (
+           mQemuRamfbFrameBufferShadow,
            BltBuffer,
            BltOperation,
            SourceX,
@@ -435,6 +416,11 @@ FreeRamfbHandle:
 FreeRamfbDevicePath:
   FreePool (RamfbDevicePath);
 FreeFramebuffer:
+  if (mQemuRamfbFrameBufferShadow != NULL) {
+    FrameBufferShadowFree (mQemuRamfbFrameBufferShadow);
+    mQemuRamfbFrameBufferShadow = NULL;
+  }
+
   FreePages ((VOID *)(UINTN)mQemuRamfbMode.FrameBufferBase, Pages);
   return Status;
 }
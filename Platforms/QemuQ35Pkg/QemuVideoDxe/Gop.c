@@ -195,45 +195,22 @@ Routine Description:
   QemuVideoCompleteModeData (Private, This->Mode);
 
   //
-  // Re-initialize the frame buffer configure when mode changes.
+  // Re-initialize the frame buffer shadow when mode changes. Blt() works on
+  // the shadow in RAM, so that reads and scrolling do not touch VRAM.
   //
-  Status = FrameBufferBltConfigure (
+  Status = FrameBufferShadowConfigure (
              (VOID *)(UINTN)This->Mode->FrameBufferBase,
              This->Mode->Info,
-             Private->FrameBufferBltConfigure,
-             &Private->FrameBufferBltConfigureSize
+             &Private->FrameBufferShadow
              );
-  if (Status == RETURN_BUFFER_TOO_SMALL) {
-    //
-    // Frame buffer configure may be larger in new mode.
-    //
-    if (Private->FrameBufferBltConfigure != NULL) {
-      FreePool (Private->FrameBufferBltConfigure);
-    }
-
-    Private->FrameBufferBltConfigure =
-      AllocatePool (Private->FrameBufferBltConfigureSize);
-    ASSERT (Private->FrameBufferBltConfigure != NULL);
-
-    //
-    // Create the configuration for FrameBufferBltLib
-    //
-    Status = FrameBufferBltConfigure (
-               (VOID *)(UINTN)This->Mode->FrameBufferBase,
-               This->Mode->Info,
-               Private->FrameBufferBltConfigure,
-               &Private->FrameBufferBltConfigureSize
-               );
-  }
-
   ASSERT (Status == RETURN_SUCCESS);
 
   //
   // Per UEFI Spec, need to clear the visible portions of the output display to black.
   //
   ZeroMem (&Black, sizeof (Black));
-  Status = FrameBufferBlt (
-             Private->FrameBufferBltConfigure,
+  Status = FrameBufferShadowBlt (
+             Private->FrameBufferShadow,
              &Black,
              EfiBltVideoFill,
              0,
@@ -310,8 +287,8 @@ Returns:
     case EfiBltBufferToVideo:
     case EfiBltVideoFill:
     case EfiBltVideoToVideo:
-      Status = FrameBufferBlt (
-                 Private->FrameBufferBltConfigure,
+      Status = FrameBufferShadowBlt (
+                 Private->FrameBufferShadow,
                  BltBuffer,
                  BltOperation,
                  SourceX,
@@ -431,8 +408,7 @@ QemuVideoGraphicsOutputConstructor (
 
   Private->GraphicsOutput.Mode->MaxMode = (UINT32)Private->MaxMode;
   Private->GraphicsOutput.Mode->Mode    = GRAPHICS_OUTPUT_INVALID_MODE_NUMBER;
-  Private->FrameBufferBltConfigure      = NULL;
-  Private->FrameBufferBltConfigureSize  = 0;
+  Private->FrameBufferShadow            = NULL;
 
   //
   // Initialize the hardware
@@ -477,8 +453,8 @@ Returns:
 
 --*/
 {
-  if (Private->FrameBufferBltConfigure != NULL) {
-    FreePool (Private->FrameBufferBltConfigure);
+  if (Private->FrameBufferShadow != NULL) {
+    FrameBufferShadowFree (Private->FrameBufferShadow);
   }
 
   if (Private->GraphicsOutput.Mode != NULL) {
@@ -28,7 +28,7 @@
 #include <Library/BaseMemoryLib.h>
 #include <Library/DevicePathLib.h>
 #include <Library/TimerLib.h>
-#include <Library/FrameBufferBltLib.h>
+#include <Library/FrameBufferShadowLib.h>
 
 #include <IndustryStandard/Pci.h>
 #include <IndustryStandard/Acpi.h>
@@ -109,8 +109,7 @@ typedef struct {
   QEMU_VIDEO_MODE_DATA            *ModeData;
 
   QEMU_VIDEO_VARIANT              Variant;
-  FRAME_BUFFER_CONFIGURE          *FrameBufferBltConfigure;
-  UINTN                           FrameBufferBltConfigureSize;
+  FRAME_BUFFER_SHADOW             *FrameBufferShadow;
   UINT8                           FrameBufferVramBarIndex;
 
   UINT8                           Edid[128];
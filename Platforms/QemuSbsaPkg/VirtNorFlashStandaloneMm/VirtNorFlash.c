@@ -84,6 +84,11 @@ NorFlashUnlockSingleBlock (
   return EFI_SUCCESS;
 }
 
+/**
+ * Blocks only get locked by a reset or by an explicit lock command, which this
+ * driver never sends, so the lock status of a block is queried only until the
+ * block is known to be unlocked. Each query costs two trapped accesses.
+ **/
 EFI_STATUS
 NorFlashUnlockSingleBlockIfNecessary (
   IN NOR_FLASH_INSTANCE  *Instance,
@@ -91,16 +96,46 @@ NorFlashUnlockSingleBlockIfNecessary (
   )
 {
   EFI_STATUS  Status;
+  UINTN       Block;
 
   Status = EFI_SUCCESS;
+  Block  = (BlockAddress - Instance->RegionBaseAddress) / Instance->BlockSize;
+
+  if ((Instance->UnlockedBlocks != NULL) &&
+      ((Instance->UnlockedBlocks[Block / 8] & (1 << (Block % 8))) != 0))
+  {
+    return EFI_SUCCESS;
+  }
 
   if (NorFlashBlockIsLocked (Instance, BlockAddress)) {
     Status = NorFlashUnlockSingleBlock (Instance, BlockAddress);
   }
 
+  if (!EFI_ERROR (Status) && (Instance->UnlockedBlocks != NULL)) {
+    Instance->UnlockedBlocks[Block / 8] |= (UINT8)(1 << (Block % 8));
+  }
+
   return Status;
 }
 
+/**
+ * Make the next NorFlashUnlockSingleBlockIfNecessary() call query the lock
+ * status of the block containing Address again.
+ **/
+VOID
+NorFlashForgetBlockUnlocked (
+  IN NOR_FLASH_INSTANCE  *Instance,
+  IN UINTN               Address
+  )
+{
+  UINTN  Block;
+
+  if (Instance->UnlockedBlocks != NULL) {
+    Block                                = (Address - Instance->RegionBaseAddress) / Instance->BlockSize;
+    Instance->UnlockedBlocks[Block / 8] &= (UINT8) ~(1 << (Block % 8));
+  }
+}
+
 /**
  * The following function presumes that the block has already been unlocked.
  **/
@@ -142,6 +177,7 @@ NorFlashEraseSingleBlock (
   if (StatusRegister & P30_SR_BIT_BLOCK_LOCKED) {
     // The debug level message has been reduced because a device lock might happen. In this case we just retry it ...
     DEBUG ((DEBUG_INFO, "EraseSingleBlock(BlockAddress=0x%08x: Block Locked Error\n", BlockAddress));
+    NorFlashForgetBlockUnlocked (Instance, BlockAddress);
     Status = EFI_WRITE_PROTECTED;
   }
 
@@ -325,6 +361,7 @@ NorFlashWriteBuffer (
 
   if (StatusRegister & P30_SR_BIT_BLOCK_LOCKED) {
     DEBUG ((DEBUG_ERROR, "NorFlashWriteBuffer(TargetAddress:0x%X): Device Protect Error\n", TargetAddress));
+    NorFlashForgetBlockUnlocked (Instance, TargetAddress);
     Status = EFI_DEVICE_ERROR;
   }
 
@@ -620,6 +657,10 @@ NorFlashWriteSingleBlock (
                  );
     }
 
+    if (!EFI_ERROR (Status)) {
+      Instance->Stats.InPlaceWrites++;
+    }
+
 Exit:
     // Put device back into Read Array mode
     SEND_NOR_COMMAND (Instance->DeviceBaseAddress, 0, P30_CMD_READ_ARRAY);
@@ -638,7 +679,9 @@ DoErase:
   // Put the data at the appropriate location inside the buffer area
   CopyMem ((VOID *)((UINTN)Instance->ShadowBuffer + Offset), Buffer, *NumBytes);
 
-  // Write the modified buffer back to the NorFlash
+  // Write the modified buffer back to the NorFlash. The block is only erased
+  // if some bit has to change from 0 to 1, and only the 32-word buffers that
+  // differ from the (possibly erased) flash contents get programmed.
   Status = NorFlashWriteBlocks (Instance, Lba, BlockSize, Instance->ShadowBuffer);
   if (EFI_ERROR (Status)) {
     // Return one of the pre-approved error statuses
@@ -112,6 +112,21 @@
 
 typedef struct _NOR_FLASH_INSTANCE NOR_FLASH_INSTANCE;
 
+//
+// Operation counters of a NOR flash instance, to track the cost of variable
+// updates and of variable store reclaims.
+//
+typedef struct {
+  UINT64    InPlaceWrites;      // NorFlashWriteSingleBlock() without block write
+  UINT64    BlockWrites;        // NorFlashWriteFullBlock() calls
+  UINT64    BlockWritesNoErase; // ... that did not need an erase
+  UINT64    Erases;
+  UINT64    ErasesSkipped;      // The block was already erased
+  UINT64    BuffersProgrammed;
+  UINT64    BuffersSkipped;     // The buffer matched the flash contents
+  UINT64    WordsProgrammed;
+} NOR_FLASH_STATS;
+
 #pragma pack (1)
 typedef struct {
   VENDOR_DEVICE_PATH          Vendor;
@@ -135,6 +150,9 @@ struct _NOR_FLASH_INSTANCE {
   VOID                                   *ShadowBuffer;
 
   NOR_FLASH_DEVICE_PATH                  DevicePath;
+
+  UINT8                                  *UnlockedBlocks; // Bitmap, may be NULL
+  NOR_FLASH_STATS                        Stats;
 };
 
 EFI_STATUS
@@ -329,6 +347,12 @@ NorFlashUnlockSingleBlockIfNecessary (
   IN UINTN               BlockAddress
   );
 
+VOID
+NorFlashForgetBlockUnlocked (
+  IN NOR_FLASH_INSTANCE  *Instance,
+  IN UINTN               BlockAddress
+  );
+
 EFI_STATUS
 NorFlashWriteSingleWord (
   IN NOR_FLASH_INSTANCE  *Instance,
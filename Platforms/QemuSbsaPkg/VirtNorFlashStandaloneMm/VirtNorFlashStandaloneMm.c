@@ -60,7 +60,9 @@ NOR_FLASH_INSTANCE  mNorFlashInstanceTemplate = {
       END_ENTIRE_DEVICE_PATH_SUBTYPE,
       { sizeof (EFI_DEVICE_PATH_PROTOCOL), 0 }
     }
-  }   // DevicePath
+  },    // DevicePath
+  NULL, // UnlockedBlocks ... NEED TO BE FILLED
+  { 0 } // Stats
 };
 
 EFI_STATUS
@@ -98,6 +100,9 @@ NorFlashCreateInstance (
     return EFI_OUT_OF_RESOURCES;
   }
 
+  // Not fatal if NULL; the lock status of the blocks is queried every time then
+  Instance->UnlockedBlocks = AllocateRuntimeZeroPool ((UINTN)(Instance->LastBlock / 8) + 1);
+
   if (SupportFvb) {
     NorFlashFvbInitialize (Instance);
 
@@ -121,8 +126,37 @@ NorFlashCreateInstance (
   return Status;
 }
 
+/**
+ * This function checks whether an entire NOR Flash block reads as all 1s.
+ **/
+STATIC
+BOOLEAN
+NorFlashBlockIsErased (
+  IN NOR_FLASH_INSTANCE  *Instance,
+  IN UINTN               BlockAddress
+  )
+{
+  UINT32  *Data;
+  UINTN   Count;
+
+  // Put the device into Read Array mode
+  SEND_NOR_COMMAND (Instance->DeviceBaseAddress, 0, P30_CMD_READ_ARRAY);
+
+  Data = (UINT32 *)BlockAddress;
+  for (Count = 0; Count < Instance->BlockSize / 4; Count++) {
+    if (Data[Count] != MAX_UINT32) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
 /**
  * This function unlock and erase an entire NOR Flash block.
+ *
+ * A block that is already erased is left alone; reading it back is much
+ * cheaper than the trapped erase command sequence.
  **/
 EFI_STATUS
 NorFlashUnlockAndEraseSingleBlock (
@@ -133,6 +167,13 @@ NorFlashUnlockAndEraseSingleBlock (
   EFI_STATUS  Status;
   UINTN       Index;
 
+  if (NorFlashBlockIsErased (Instance, BlockAddress)) {
+    Instance->Stats.ErasesSkipped++;
+    return EFI_SUCCESS;
+  }
+
+  Instance->Stats.Erases++;
+
   Index = 0;
   // The block erase might fail a first time (SW bug ?). Retry it ...
   do {
@@ -153,6 +194,15 @@ NorFlashUnlockAndEraseSingleBlock (
   return Status;
 }
 
+/**
+ * Program DataBuffer into the block at Lba.
+ *
+ * Reads of the flash array are cheap, unlike the trapped command sequences,
+ * so the new contents are compared against the old ones first. The block is
+ * erased only if some bit has to change from 0 to 1, and in each 32-word
+ * buffer only the words up to the last one that differs from the flash
+ * contents (all 1s after an erase) are programmed.
+ **/
 EFI_STATUS
 NorFlashWriteFullBlock (
   IN NOR_FLASH_INSTANCE  *Instance,
@@ -164,77 +214,137 @@ NorFlashWriteFullBlock (
   EFI_STATUS  Status;
   UINTN       WordAddress;
   UINT32      WordIndex;
-  UINTN       BufferIndex;
   UINTN       BlockAddress;
-  UINTN       BuffersInBlock;
-  UINTN       RemainingWords;
-  UINTN       Cnt;
-
-  Status = EFI_SUCCESS;
+  UINT32      *OldData;
+  BOOLEAN     Erase;
+  BOOLEAN     Unlocked;
+  BOOLEAN     ReadArrayMode;
+  UINTN       BufferWords;
+  UINTN       ProgramWords;
+  UINT32      OldWord;
+  UINT32      Programmed;
+  UINT32      Skipped;
+
+  Status     = EFI_SUCCESS;
+  Programmed = 0;
+  Skipped    = 0;
 
   // Get the physical address of the block
   BlockAddress = GET_NOR_BLOCK_ADDRESS (Instance->RegionBaseAddress, Lba, BlockSizeInWords * 4);
+  OldData      = (UINT32 *)BlockAddress;
 
   // Start writing from the first address at the start of the block
   WordAddress = BlockAddress;
 
-  Status = NorFlashUnlockAndEraseSingleBlock (Instance, BlockAddress);
-  if (EFI_ERROR (Status)) {
-    DEBUG ((DEBUG_ERROR, "WriteSingleBlock: ERROR - Failed to Unlock and Erase the single block at 0x%X\n", BlockAddress));
-    goto EXIT;
+  Instance->Stats.BlockWrites++;
+
+  // Find out whether any bit has to change from 0 to 1
+  SEND_NOR_COMMAND (Instance->DeviceBaseAddress, 0, P30_CMD_READ_ARRAY);
+  Erase = FALSE;
+  for (WordIndex = 0; WordIndex < BlockSizeInWords; WordIndex++) {
+    if ((~OldData[WordIndex] & DataBuffer[WordIndex]) != 0) {
+      Erase = TRUE;
+      break;
+    }
+  }
+
+  ReadArrayMode = TRUE;
+  Unlocked      = FALSE;
+  if (Erase) {
+    Status = NorFlashUnlockAndEraseSingleBlock (Instance, BlockAddress);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "WriteSingleBlock: ERROR - Failed to Unlock and Erase the single block at 0x%X\n", BlockAddress));
+      goto EXIT;
+    }
+
+    Unlocked = TRUE;
+  } else {
+    Instance->Stats.BlockWritesNoErase++;
   }
 
   // To speed up the programming operation, NOR Flash is programmed using the Buffered Programming method.
 
   // Check that the address starts at a 32-word boundary, i.e. last 7 bits must be zero
   if ((WordAddress & BOUNDARY_OF_32_WORDS) == 0x00) {
-    // First, break the entire block into buffer-sized chunks.
-    BuffersInBlock = (UINTN)(BlockSizeInWords * 4) / P30_MAX_BUFFER_SIZE_IN_BYTES;
-
-    // Then feed each buffer chunk to the NOR Flash
-    // If a buffer does not contain any data, don't write it.
-    for (BufferIndex = 0;
-         BufferIndex < BuffersInBlock;
-         BufferIndex++, WordAddress += P30_MAX_BUFFER_SIZE_IN_BYTES, DataBuffer += P30_MAX_BUFFER_SIZE_IN_WORDS
-         )
-    {
-      // Check the buffer to see if it contains any data (not set all 1s).
-      for (Cnt = 0; Cnt < P30_MAX_BUFFER_SIZE_IN_WORDS; Cnt++) {
-        if (~DataBuffer[Cnt] != 0 ) {
-          // Some data found, write the buffer.
-          Status = NorFlashWriteBuffer (
-                     Instance,
-                     WordAddress,
-                     P30_MAX_BUFFER_SIZE_IN_BYTES,
-                     DataBuffer
-                     );
-          if (EFI_ERROR (Status)) {
-            goto EXIT;
-          }
+    // Break the entire block into buffer-sized chunks, the last one possibly shorter,
+    // and feed each chunk that changes anything to the NOR Flash.
+    for (WordIndex = 0; WordIndex < BlockSizeInWords; WordIndex += (UINT32)BufferWords) {
+      BufferWords = MIN (BlockSizeInWords - WordIndex, P30_MAX_BUFFER_SIZE_IN_WORDS);
+      WordAddress = BlockAddress + WordIndex * 4;
+
+      if (!Erase && !ReadArrayMode) {
+        SEND_NOR_COMMAND (Instance->DeviceBaseAddress, 0, P30_CMD_READ_ARRAY);
+        ReadArrayMode = TRUE;
+      }
 
+      // Programming a word with its current value is a no-op, so trim the
+      // buffer after the last word that changes.
+      for (ProgramWords = BufferWords; ProgramWords > 0; ProgramWords--) {
+        OldWord = Erase ? MAX_UINT32 : OldData[WordIndex + ProgramWords - 1];
+        if (DataBuffer[WordIndex + ProgramWords - 1] != OldWord) {
           break;
         }
       }
-    }
 
-    // Finally, finish off any remaining words that are less than the maximum size of the buffer
-    RemainingWords = BlockSizeInWords % P30_MAX_BUFFER_SIZE_IN_WORDS;
+      if (ProgramWords == 0) {
+        Skipped++;
+        continue;
+      }
+
+      if (!Unlocked) {
+        Status = NorFlashUnlockSingleBlockIfNecessary (Instance, BlockAddress);
+        if (EFI_ERROR (Status)) {
+          goto EXIT;
+        }
 
-    if (RemainingWords != 0) {
-      Status = NorFlashWriteBuffer (Instance, WordAddress, (RemainingWords * 4), DataBuffer);
+        Unlocked = TRUE;
+      }
+
+      Status = NorFlashWriteBuffer (
+                 Instance,
+                 WordAddress,
+                 ProgramWords * 4,
+                 DataBuffer + WordIndex
+                 );
       if (EFI_ERROR (Status)) {
         goto EXIT;
       }
+
+      ReadArrayMode = FALSE;
+      Programmed++;
+      Instance->Stats.WordsProgrammed += ProgramWords;
     }
   } else {
     // For now, use the single word programming algorithm
     // It is unlikely that the NOR Flash will exist in an address which falls within a 32 word boundary range,
     // i.e. which ends in the range 0x......01 - 0x......7F.
-    for (WordIndex = 0; WordIndex < BlockSizeInWords; WordIndex++, DataBuffer++, WordAddress = WordAddress + 4) {
-      Status = NorFlashWriteSingleWord (Instance, WordAddress, *DataBuffer);
+    for (WordIndex = 0; WordIndex < BlockSizeInWords; WordIndex++, WordAddress = WordAddress + 4) {
+      if (!Erase && !ReadArrayMode) {
+        SEND_NOR_COMMAND (Instance->DeviceBaseAddress, 0, P30_CMD_READ_ARRAY);
+        ReadArrayMode = TRUE;
+      }
+
+      OldWord = Erase ? MAX_UINT32 : OldData[WordIndex];
+      if (DataBuffer[WordIndex] == OldWord) {
+        continue;
+      }
+
+      if (!Unlocked) {
+        Status = NorFlashUnlockSingleBlockIfNecessary (Instance, BlockAddress);
+        if (EFI_ERROR (Status)) {
+          goto EXIT;
+        }
+
+        Unlocked = TRUE;
+      }
+
+      Status = NorFlashWriteSingleWord (Instance, WordAddress, DataBuffer[WordIndex]);
       if (EFI_ERROR (Status)) {
         goto EXIT;
       }
+
+      ReadArrayMode = FALSE;
+      Instance->Stats.WordsProgrammed++;
     }
   }
 
@@ -242,13 +352,72 @@ EXIT:
   // Put device back into Read Array mode
   SEND_NOR_COMMAND (Instance->DeviceBaseAddress, 0, P30_CMD_READ_ARRAY);
 
+  Instance->Stats.BuffersProgrammed += Programmed;
+  Instance->Stats.BuffersSkipped    += Skipped;
+
   if (EFI_ERROR (Status)) {
     DEBUG ((DEBUG_ERROR, "NOR FLASH Programming [WriteSingleBlock] failed at address 0x%08x. Exit Status = \"%r\".\n", WordAddress, Status));
+  } else {
+    DEBUG ((
+      DEBUG_VERBOSE,
+      "NorFlashWriteFullBlock: Lba=%ld %a, buffers programmed=%u skipped=%u\n",
+      Lba,
+      Erase ? "erased" : "not erased",
+      Programmed,
+      Skipped
+      ));
   }
 
   return Status;
 }
 
+/**
+  Report the write statistics of every NOR flash instance, once the OS has
+  taken over and firmware writes to the flash are done.
+
+  @param[in] Protocol   Points to the protocol's unique identifier.
+  @param[in] Interface  Points to the interface instance.
+  @param[in] Handle     The handle on which the interface was installed.
+
+  @retval EFI_SUCCESS   Always.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+NorFlashExitBootServicesNotify (
+  IN CONST EFI_GUID  *Protocol,
+  IN VOID            *Interface,
+  IN EFI_HANDLE      Handle
+  )
+{
+  UINT32              Index;
+  NOR_FLASH_INSTANCE  *Instance;
+
+  for (Index = 0; Index < mNorFlashDeviceCount; Index++) {
+    Instance = mNorFlashInstances[Index];
+    if (Instance == NULL) {
+      continue;
+    }
+
+    DEBUG ((
+      DEBUG_INFO,
+      "NorFlash[%u]: block writes=%lu (no erase %lu) erases=%lu (skipped %lu) "
+      "in-place writes=%lu buffers programmed=%lu (skipped %lu) words=%lu\n",
+      Index,
+      Instance->Stats.BlockWrites,
+      Instance->Stats.BlockWritesNoErase,
+      Instance->Stats.Erases,
+      Instance->Stats.ErasesSkipped,
+      Instance->Stats.InPlaceWrites,
+      Instance->Stats.BuffersProgrammed,
+      Instance->Stats.BuffersSkipped,
+      Instance->Stats.WordsProgrammed
+      ));
+  }
+
+  return EFI_SUCCESS;
+}
+
 EFI_STATUS
 EFIAPI
 NorFlashInitialise (
@@ -260,6 +429,7 @@ NorFlashInitialise (
   UINT32                      Index;
   VIRT_NOR_FLASH_DESCRIPTION  *NorFlashDevices;
   BOOLEAN                     ContainVariableStorage;
+  VOID                        *Registration;
 
   Status = VirtNorFlashPlatformInitialization ();
   if (EFI_ERROR (Status)) {
@@ -273,7 +443,7 @@ NorFlashInitialise (
     return Status;
   }
 
-  mNorFlashInstances = AllocatePool (sizeof (NOR_FLASH_INSTANCE *) * mNorFlashDeviceCount);
+  mNorFlashInstances = AllocateZeroPool (sizeof (NOR_FLASH_INSTANCE *) * mNorFlashDeviceCount);
   if (mNorFlashInstances == NULL) {
     ASSERT (mNorFlashInstances != NULL);
     return EFI_OUT_OF_RESOURCES;
@@ -308,6 +478,16 @@ NorFlashInitialise (
     }
   }
 
+  //
+  // The MM core installs this protocol GUID when the OS calls
+  // ExitBootServices(); report the write statistics then.
+  //
+  gMmst->MmRegisterProtocolNotify (
+           &gEfiEventExitBootServicesGuid,
+           NorFlashExitBootServicesNotify,
+           &Registration
+           );
+
   return Status;
 }
 
@@ -92,6 +92,17 @@ typedef struct {
   UINT32    Length;
   UINT64    Address;
 } FW_CFG_DMA_ACCESS;
+
+//
+// One entry of the QemuFwCfgItemFileDir item, which starts with a big endian
+// UINT32 entry count. Size and Select are encoded in big endian.
+//
+typedef struct {
+  UINT32    Size;
+  UINT16    Select;
+  UINT16    Reserved;
+  CHAR8     Name[QEMU_FW_CFG_FNAME_SIZE];
+} FW_CFG_FILE;
 #pragma pack ()
 
 #endif
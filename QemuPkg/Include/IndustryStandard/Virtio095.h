@@ -100,7 +100,7 @@ typedef struct {
   volatile UINT16    *Idx;
 
   volatile UINT16    *Ring;      // QueueSize elements
-  volatile UINT16    *UsedEvent; // unused as per negotiation
+  volatile UINT16    *UsedEvent; // only with VIRTIO_F_RING_EVENT_IDX
 } VRING_AVAIL;
 
 //
@@ -119,7 +119,8 @@ typedef struct {
   volatile UINT16             *Flags;
   volatile UINT16             *Idx;
   volatile VRING_USED_ELEM    *UsedElem;   // QueueSize elements
-  volatile UINT16             *AvailEvent; // unused as per negotiation
+  volatile UINT16             *AvailEvent; // only with
+                                           // VIRTIO_F_RING_EVENT_IDX
 } VRING_USED;
 
 //
@@ -127,7 +128,7 @@ typedef struct {
 //
 #define VRING_DESC_F_NEXT      BIT0 // more descriptors in this request
 #define VRING_DESC_F_WRITE     BIT1 // buffer to be written *by the host*
-#define VRING_DESC_F_INDIRECT  BIT2 // unused
+#define VRING_DESC_F_INDIRECT  BIT2 // buffer is a table of descriptors
 
 #pragma pack(1)
 typedef struct {
@@ -138,13 +139,106 @@ typedef struct {
 } VRING_DESC;
 #pragma pack()
 
+//
+// virtio-1.1, 2.7 Packed Virtqueues
+//
+// The packed layout is negotiated with VIRTIO_F_RING_PACKED, a VirtIo 1.0+
+// feature; it is declared here because VRING covers both layouts. The
+// VRING_DESC_F_* flags above keep their values in packed descriptors.
+//
+#define VRING_PACKED_DESC_F_AVAIL  BIT7
+#define VRING_PACKED_DESC_F_USED   BIT15
+
+#pragma pack(1)
+typedef struct {
+  UINT64    Addr;
+  UINT32    Len;
+  UINT16    Id;
+  UINT16    Flags;
+} VRING_PACKED_DESC;
+
+typedef struct {
+  UINT16    OffWrap;
+  UINT16    Flags;
+} VRING_PACKED_EVENT;
+#pragma pack()
+
+#define VRING_PACKED_EVENT_F_ENABLE   0x0
+#define VRING_PACKED_EVENT_F_DISABLE  0x1
+#define VRING_PACKED_EVENT_F_DESC     0x2
+
+//
+// Guest-side state of a packed ring. Ring positions ("cursors") are kept in
+// UINT16 objects: bits 0..14 hold the descriptor index, bit 15 holds the
+// complement of the wrap counter. Thus the initial cursor, with the wrap
+// counter set, is 0, like the initial index of a split ring.
+//
+#define VRING_PACKED_CURSOR_PHASE  BIT15
+
+typedef struct {
+  volatile VRING_PACKED_DESC     *Desc;        // QueueSize elements
+  volatile VRING_PACKED_EVENT    *DriverEvent;
+  volatile VRING_PACKED_EVENT    *DeviceEvent;
+  UINT16                         NextAvail;    // cursor
+  UINT16                         *ChainLen;    // QueueSize elements, indexed
+                                               // by buffer ID; not shared
+} VRING_PACKED;
+
+//
+// Guest-side statistics about waiting for the host to produce used elements,
+// maintained by VirtioLib. Not part of the communication area.
+//
+typedef struct {
+  UINT64    SpinWaits;      // waits satisfied while busy-polling
+  UINT64    StallWaits;     // waits that needed to stall
+  UINT64    SpinIterations; // busy-poll iterations, across all waits
+  UINT64    StallUsecs;     // microseconds stalled, across all waits
+  UINT32    MaxStallUsecs;  // longest stall time of a single wait
+} VRING_WAIT_STATS;
+
+//
+// Guest-side statistics about notifying the host, maintained by VirtioLib. Not
+// part of the communication area.
+//
+typedef struct {
+  UINT64    Sent;       // notifications sent to the host
+  UINT64    Suppressed; // notifications the host asked us to skip
+} VRING_NOTIFY_STATS;
+
+//
+// Guest-side state of the indirect descriptor tables of a ring (virtio-1.0,
+// 2.4.5.3 Indirect Descriptors), set up with VirtioRingInitIndirect(). There
+// is one table per descriptor chain identifier, each with TableSize entries
+// of VRING_DESC (split ring) or VRING_PACKED_DESC (packed ring) format. The
+// tables are allocated and mapped for common buffer bus master operation
+// once, so that VirtioLib can reference them without per-request mapping.
+//
+typedef struct {
+  VOID      *Base;      // NumTables * TableSize entries
+  UINT64    DeviceBase; // bus master device address of Base
+  VOID      *Mapping;
+  UINTN     NumPages;
+  UINT16    NumTables;  // zero if indirect descriptors are not in use
+  UINT16    TableSize;
+} VRING_INDIRECT;
+
 typedef struct {
   UINTN                  NumPages;
-  VOID                   *Base;  // deallocate only this field
-  volatile VRING_DESC    *Desc;  // QueueSize elements
+  VOID                   *Base;       // deallocate only this field
+  volatile VRING_DESC    *Desc;       // QueueSize elements
   VRING_AVAIL            Avail;
   VRING_USED             Used;
   UINT16                 QueueSize;
+  VRING_WAIT_STATS       WaitStats;
+  VRING_NOTIFY_STATS     NotifyStats;
+  BOOLEAN                IsPacked;
+  VRING_PACKED           Packed;      // only if IsPacked; Desc, Avail and
+                                      // Used are unused then
+  BOOLEAN                EventIdx;    // VIRTIO_F_RING_EVENT_IDX negotiated
+  UINT16                 LastKickIdx; // Avail.Idx (split ring) or
+                                      // Packed.NextAvail (packed ring) at
+                                      // the last VirtioNeedNotify() call
+  VRING_INDIRECT         Indirect;
 } VRING;
 
 //
@@ -80,6 +80,7 @@ typedef struct {
 //
 #define VIRTIO_F_VERSION_1       BIT32
 #define VIRTIO_F_IOMMU_PLATFORM  BIT33
+#define VIRTIO_F_RING_PACKED     BIT34 // VirtIo 1.1
 
 //
 // MMIO VirtIo Header Offsets
@@ -51,6 +51,99 @@ VirtioRingInit (
   OUT VRING                   *Ring
   );
 
+/**
+
+  Configure a virtio ring, in the layout selected by the negotiated features.
+
+  If Features contains VIRTIO_F_RING_PACKED, then a packed ring is set up
+  (virtio-1.1, 2.7 Packed Virtqueues); the descriptor ring is followed by the
+  driver and device event suppression structures. Otherwise, the function
+  sets up a split ring, like VirtioRingInit().
+
+  If Features contains VIRTIO_F_RING_EVENT_IDX, then VirtioNeedNotify() and
+  VirtioPrepareChain() use the event index mechanism for suppressing
+  notifications (virtio-1.0, 2.4.7 and 2.4.9).
+
+  @param[in]  VirtIo            The virtio device which will use the ring.
+
+  @param[in]  QueueSize         The number of descriptors to allocate for the
+                                virtio ring, as requested by the host.
+
+  @param[in]  Features          The feature bits that the driver negotiated
+                                (or is about to negotiate) with the device.
+
+  @param[out] Ring              The virtio ring to set up.
+
+  @retval EFI_OUT_OF_RESOURCES  Failed to allocate the guest-private chain
+                                length array of a packed ring.
+
+  @return                       Status codes propagated from
+                                VirtIo->AllocateSharedPages().
+
+  @retval EFI_SUCCESS           Allocation and setup successful. The ring is
+                                released with VirtioRingUninit().
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioRingInitEx (
+  IN  VIRTIO_DEVICE_PROTOCOL  *VirtIo,
+  IN  UINT16                  QueueSize,
+  IN  UINT64                  Features,
+  OUT VRING                   *Ring
+  );
+
+/**
+
+  Set up indirect descriptor tables for a configured virtio ring.
+
+  This function implements virtio-1.0, 2.4.5.3 Indirect Descriptors, and
+  virtio-1.1, 2.7.7 Indirect Flag: Scatter-Gather Support. After it succeeds,
+  VirtioAppendDesc() places descriptors in the indirect table that belongs to
+  the descriptor chain being built, and VirtioSubmitChain() makes the chain
+  available to the host through a single VRING_DESC_F_INDIRECT descriptor.
+  Thus every descriptor chain occupies exactly one descriptor of the ring,
+  independently of its length.
+
+  The tables are allocated and mapped for bus master common buffer operation
+  once, here; they are released by VirtioRingUninit().
+
+  The caller is responsible for having negotiated
+  VIRTIO_F_RING_INDIRECT_DESC with the device.
+
+  @param[in]     VirtIo     The virtio device which uses the ring.
+
+  @param[in,out] Ring       The virtio ring, set up with VirtioRingInit() or
+                            VirtioRingInitEx().
+
+  @param[in]     NumTables  The number of indirect tables to allocate. The
+                            HeadDescIdx argument of VirtioPrepareChain() must
+                            stay below NumTables.
+
+  @param[in]     TableSize  The maximum number of descriptors in a single
+                            descriptor chain.
+
+  @retval EFI_INVALID_PARAMETER  NumTables is zero or exceeds
+                                 Ring->QueueSize, or TableSize is zero, or
+                                 indirect tables have been set up for Ring
+                                 already.
+
+  @return                        Status codes propagated from
+                                 VirtIo->AllocateSharedPages() and
+                                 VirtioMapAllBytesInSharedBuffer().
+
+  @retval EFI_SUCCESS            The indirect tables are in use.
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioRingInitIndirect (
+  IN     VIRTIO_DEVICE_PROTOCOL  *VirtIo,
+  IN OUT VRING                   *Ring,
+  IN     UINT16                  NumTables,
+  IN     UINT16                  TableSize
+  );
+
 /**
 
   Map the ring buffer so that it can be accessed equally by both guest
@@ -125,6 +218,43 @@ VirtioPrepare (
   OUT    DESC_INDICES  *Indices
   );
 
+/**
+
+  Turn off interrupt notifications from the host, and prepare for appending a
+  descriptor chain that the caller identifies with HeadDescIdx.
+
+  This function is intended for drivers that keep several descriptor chains
+  in flight, and track free descriptors themselves (see VirtioSubmitChain()):
+
+  - With a split ring, the chain is built in the descriptor table starting at
+    HeadDescIdx, and the caller is responsible for owning the descriptors from
+    HeadDescIdx on.
+
+  - With a packed ring, the chain is built at the next available position of
+    the descriptor ring, and HeadDescIdx is used as the buffer ID. The caller
+    is responsible for keeping at most Ring->QueueSize descriptors in flight.
+
+  Either way, VirtioGetNextUsed() reports HeadDescIdx back when the host has
+  processed the chain.
+
+  The calling driver must be in VSTAT_DRIVER_OK state.
+
+  @param[in,out] Ring      The virtio ring we intend to append descriptors to.
+
+  @param[in] HeadDescIdx   The identifier of the descriptor chain, less than
+                           Ring->QueueSize.
+
+  @param[out] Indices      The DESC_INDICES structure to initialize.
+
+**/
+VOID
+EFIAPI
+VirtioPrepareChain (
+  IN OUT VRING         *Ring,
+  IN     UINT16        HeadDescIdx,
+  OUT    DESC_INDICES  *Indices
+  );
+
 /**
 
   Append a contiguous buffer for transmission / reception via the virtio ring.
@@ -137,6 +267,10 @@ VirtioPrepare (
   request submission. It is the calling driver's responsibility to verify the
   ring size in advance.
 
+  If indirect descriptor tables have been set up for the ring with
+  VirtioRingInitIndirect(), then the buffer is placed in the table of the
+  descriptor chain instead; see VirtioSubmitChain().
+
   The caller is responsible for initializing *Indices with VirtioPrepare()
   first.
 
@@ -152,15 +286,17 @@ VirtioPrepare (
                                     caller computes this mask dependent on
                                     further buffers to append and transfer
                                     direction. VRING_DESC_F_INDIRECT is
-                                    unsupported. The VRING_DESC.Next field is
-                                    always set, but the host only interprets
-                                    it dependent on VRING_DESC_F_NEXT.
-
-  @param[in,out] Indices            Indices->HeadDescIdx is not accessed.
-                                    On input, Indices->NextDescIdx identifies
+                                    reserved for VirtioLib. The VRING_DESC.Next
+                                    field is always set, but the host only
+                                    interprets it dependent on
+                                    VRING_DESC_F_NEXT.
+
+  @param[in,out] Indices            Indices->HeadDescIdx is only accessed
+                                    for packed rings, as the buffer ID. On
+                                    input, Indices->NextDescIdx identifies
                                     the next descriptor to carry the buffer.
                                     On output, Indices->NextDescIdx is
-                                    incremented by one, modulo 2^16.
+                                    advanced by one descriptor.
 
 **/
 VOID
@@ -173,6 +309,47 @@ VirtioAppendDesc (
   IN OUT DESC_INDICES  *Indices
   );
 
+/**
+
+  Wait until the host produces a used element at ExpectedIdx, or until the
+  caller's used cursor moves away from ExpectedIdx.
+
+  The used index (split ring) or the next used descriptor (packed ring) is
+  busy-polled first, for PcdVirtioPollSpinCount iterations.
+  Under a hypervisor, a request is frequently completed within that budget,
+  and the wait then costs neither a timer access nor a VM exit. If the host
+  is slower, the function falls back to gBS->Stall(), doubling the stall
+  period from 1 microsecond up to PcdVirtioPollMaxStallUsecs.
+
+  Drivers that also collect used elements from a timer callback sample
+  ExpectedIdx at raised TPL, and wait at the caller's TPL. If the callback
+  collects used elements in between, ExpectedIdx is stale: on a packed ring,
+  its descriptor may have been resubmitted already, and the host would only
+  mark it used again a full ring lap later. Re-reading the live cursor in
+  LastUsedIdx lets the function return as soon as that happens, so that the
+  caller re-checks its own completion state.
+
+  The outcome of the wait is accounted for in Ring->WaitStats.
+
+  @param[in,out] Ring     The virtio ring to wait on.
+
+  @param[in] LastUsedIdx  The caller's used cursor, as advanced by
+                          VirtioGetNextUsed(). Re-read on every poll.
+
+  @param[in] ExpectedIdx  The free-running index (split ring) or cursor
+                          (packed ring) of the next used element that the
+                          caller expects; the value of *LastUsedIdx that the
+                          caller sampled last.
+
+**/
+VOID
+EFIAPI
+VirtioWaitUsed (
+  IN OUT VRING                  *Ring,
+  IN     CONST volatile UINT16  *LastUsedIdx,
+  IN     UINT16                 ExpectedIdx
+  );
+
 /**
 
   Notify the host about the descriptor chain just built, and wait until the
@@ -184,9 +361,9 @@ VirtioAppendDesc (
 
   @param[in,out] Ring     The virtio ring with descriptors to submit.
 
-  @param[in] Indices      Indices->NextDescIdx is not accessed.
-                          Indices->HeadDescIdx identifies the head descriptor
-                          of the descriptor chain.
+  @param[in] Indices      Indices->HeadDescIdx identifies the descriptor
+                          chain. Indices->NextDescIdx is only accessed for
+                          packed rings.
 
   @param[out] UsedLen     On success, the total number of bytes, consecutively
                           across the buffers linked by the descriptor chain,
@@ -210,6 +387,112 @@ VirtioFlush (
   OUT    UINT32                  *UsedLen    OPTIONAL
   );
 
+/**
+
+  Make the descriptor chain just built available to the host, without
+  notifying the host and without waiting for the host to process the chain.
+
+  This function implements the following sections from virtio-0.9.5:
+  - 2.4.1.2 Updating the Available Ring
+  - 2.4.1.3 Updating the Index Field
+
+  and, for packed rings, virtio-1.1, 2.7.13 Supplying Buffers to The Device.
+
+  It is intended for drivers that keep several descriptor chains in flight.
+  Such drivers are responsible for tracking free descriptors themselves, for
+  notifying the host with VirtIo->SetQueueNotify() when VirtioNeedNotify()
+  says so, and for collecting the used elements with VirtioGetNextUsed().
+
+  If indirect descriptor tables are in use (see VirtioRingInitIndirect()), then
+  the function first appends a single VRING_DESC_F_INDIRECT descriptor to the
+  ring, referencing the table in which VirtioAppendDesc() has built the chain.
+
+  @param[in,out] Ring  The virtio ring with descriptors to submit.
+
+  @param[in] Indices   Indices->HeadDescIdx identifies the descriptor chain.
+                       Indices->NextDescIdx is only accessed for packed rings,
+                       and with indirect descriptors, to determine the length
+                       of the chain.
+
+**/
+VOID
+EFIAPI
+VirtioSubmitChain (
+  IN OUT VRING         *Ring,
+  IN     DESC_INDICES  *Indices
+  );
+
+/**
+
+  Decide whether the host needs to be notified about the descriptor chains
+  that have been submitted with VirtioSubmitChain() since the last call to
+  this function.
+
+  This function implements virtio-1.0, 2.4.7 Virtqueue Notification
+  Suppression (split ring) and virtio-1.1, 2.7.10 Event Suppression
+  Structure Format (packed ring). If VIRTIO_F_RING_EVENT_IDX has been
+  negotiated (see VirtioRingInitEx()), then the host is notified only if it
+  asked to be notified about one of the new descriptor chains; otherwise,
+  the host's on / off hint is honored.
+
+  The caller is expected to call VirtIo->SetQueueNotify() if and only if this
+  function returns TRUE.
+
+  @param[in,out] Ring  The virtio ring that descriptor chains have been
+                       submitted to.
+
+  @retval TRUE   The host needs to be notified.
+
+  @retval FALSE  The host has suppressed the notification, or no descriptor
+                 chain has been submitted.
+
+**/
+BOOLEAN
+EFIAPI
+VirtioNeedNotify (
+  IN OUT VRING  *Ring
+  );
+
+/**
+
+  Fetch the next used element that the host has produced in the used ring,
+  if any.
+
+  This function implements virtio-0.9.5, 2.4.2 Receiving Used Buffers From
+  the Device, for drivers that keep several descriptor chains in flight (see
+  VirtioSubmitChain()).
+
+  @param[in] Ring             The virtio ring to check.
+
+  @param[in,out] LastUsedIdx  On input, the free-running index (split ring)
+                              or cursor (packed ring) of the next used element
+                              that the caller expects; initially zero. On
+                              successful output, advanced past the used
+                              element.
+
+  @param[out] HeadDescIdx     On success, the head descriptor index (split
+                              ring) or buffer ID (packed ring) of the
+                              descriptor chain that the host processed; see
+                              VirtioPrepareChain().
+
+  @param[out] UsedLen         On success, the total number of bytes that the
+                              host wrote to the buffers of the descriptor
+                              chain. May be NULL if the caller doesn't care.
+
+  @retval EFI_SUCCESS    A used element has been fetched.
+
+  @retval EFI_NOT_READY  The host has not produced a new used element yet.
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioGetNextUsed (
+  IN     VRING   *Ring,
+  IN OUT UINT16  *LastUsedIdx,
+  OUT    UINT16  *HeadDescIdx,
+  OUT    UINT32  *UsedLen     OPTIONAL
+  );
+
 /**
 
   Report the feature bits to the VirtIo 1.0 device that the VirtIo 1.0 driver
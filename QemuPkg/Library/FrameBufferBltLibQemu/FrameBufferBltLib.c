@@ -0,0 +1,978 @@
+/** @file
+  FrameBufferBltLib instance with per-mode line kernels.
+
+  The frame buffer pixel format is examined once, in FrameBufferBltConfigure(),
+  and the line conversion routines for it are selected there rather than
+  re-deciding per pixel:
+
+  - PixelBlueGreenRedReserved8BitPerColor modes need no conversion. Fills,
+    copies and scrolls become whole-line SetMem32() / CopyMem() calls, or a
+    single call when the rectangle spans complete scan lines, so they run at
+    the speed of the platform's BaseMemoryLib (REP STOS/MOVS, SSE2 or NEON,
+    depending on the instance linked in).
+  - 32-bit PixelBitMask modes with the same color layout only clear the
+    reserved byte, as MdeModulePkg's FrameBufferBltLib does.
+  - 32-bit RGB modes exchange the red and blue bytes a machine word (two
+    pixels on 64-bit builds) at a time.
+  - Packed 24-bit BGR modes move bytes directly.
+  - Any other PixelBitMask layout uses precomputed shifts and masks.
+
+  Copyright (C) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+**/
+
+#include <Uefi.h>
+#include <Protocol/GraphicsOutput.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/FrameBufferBltLib.h>
+
+//
+// Exchanging red and blue in a 32-bit RGBX or BGRX pixel keeps green, moves
+// bits 0..7 to 16..23 and back, and clears the reserved byte. Truncated to
+// UINTN on 32-bit builds, the masks describe a single pixel.
+//
+#define SWAP_RED_BLUE_KEEP_MASK  ((UINTN)0x0000FF000000FF00ULL)
+#define SWAP_RED_BLUE_MOVE_MASK  ((UINTN)0x000000FF000000FFULL)
+
+/**
+  Convert a line of pixels between EFI_GRAPHICS_OUTPUT_BLT_PIXEL and the frame
+  buffer pixel format.
+
+  @param[in]  Configure    The frame buffer configuration.
+  @param[out] Destination  The converted pixels.
+  @param[in]  Source       The pixels to convert.
+  @param[in]  Width        The number of pixels in the line.
+**/
+typedef
+VOID
+(*FRAME_BUFFER_CONVERT_LINE)(
+  IN  CONST FRAME_BUFFER_CONFIGURE  *Configure,
+  OUT VOID                          *Destination,
+  IN  CONST VOID                    *Source,
+  IN  UINTN                         Width
+  );
+
+struct FRAME_BUFFER_CONFIGURE {
+  UINT32                       PixelsPerScanLine;
+  UINT32                       BytesPerPixel;
+  UINT32                       Width;
+  UINT32                       Height;
+  UINT8                        *FrameBuffer;
+  EFI_GRAPHICS_PIXEL_FORMAT    PixelFormat;
+  EFI_PIXEL_BITMASK            PixelMasks;
+  INT8                         PixelShl[4]; // R-G-B-Rsvd
+  INT8                         PixelShr[4]; // R-G-B-Rsvd
+  FRAME_BUFFER_CONVERT_LINE    BltToVideo;  // NULL if no conversion is needed
+  FRAME_BUFFER_CONVERT_LINE    VideoToBlt;  // NULL if no conversion is needed
+  UINT8                        LineBuffer[0];
+};
+
+CONST EFI_PIXEL_BITMASK  mRgbPixelMasks = {
+  0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000
+};
+
+CONST EFI_PIXEL_BITMASK  mBgrPixelMasks = {
+  0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000
+};
+
+/**
+  Exchange the red and blue bytes of 32-bit pixels. The conversion is its own
+  inverse, so it serves both Blt directions.
+
+  @param[in]  Configure    The frame buffer configuration.
+  @param[out] Destination  The converted pixels.
+  @param[in]  Source       The pixels to convert.
+  @param[in]  Width        The number of pixels in the line.
+**/
+STATIC
+VOID
+SwapRedBlueLine (
+  IN  CONST FRAME_BUFFER_CONFIGURE  *Configure,
+  OUT VOID                          *Destination,
+  IN  CONST VOID                    *Source,
+  IN  UINTN                         Width
+  )
+{
+  UINT32        *Destination32;
+  CONST UINT32  *Source32;
+  UINTN         *DestinationWord;
+  CONST UINTN   *SourceWord;
+  UINTN         Pixels;
+  UINTN         PixelsPerWord;
+
+  Destination32 = Destination;
+  Source32      = Source;
+  PixelsPerWord = sizeof (UINTN) / sizeof (UINT32);
+
+  //
+  // Work a machine word at a time once both pointers are word aligned.
+  //
+  if ((((UINTN)Destination32 ^ (UINTN)Source32) & (sizeof (UINTN) - 1)) == 0) {
+    for ( ; (Width > 0) && (((UINTN)Source32 & (sizeof (UINTN) - 1)) != 0); Width--) {
+      Pixels           = *Source32++;
+      *Destination32++ = (UINT32)((Pixels & SWAP_RED_BLUE_KEEP_MASK) |
+                                  ((Pixels & SWAP_RED_BLUE_MOVE_MASK) << 16) |
+                                  ((Pixels >> 16) & SWAP_RED_BLUE_MOVE_MASK));
+    }
+
+    DestinationWord = (UINTN *)Destination32;
+    SourceWord      = (CONST UINTN *)Source32;
+    for ( ; Width >= PixelsPerWord; Width -= PixelsPerWord) {
+      Pixels             = *SourceWord++;
+      *DestinationWord++ = (Pixels & SWAP_RED_BLUE_KEEP_MASK) |
+                           ((Pixels & SWAP_RED_BLUE_MOVE_MASK) << 16) |
+                           ((Pixels >> 16) & SWAP_RED_BLUE_MOVE_MASK);
+    }
+
+    Destination32 = (UINT32 *)DestinationWord;
+    Source32      = (CONST UINT32 *)SourceWord;
+  }
+
+  for ( ; Width > 0; Width--) {
+    Pixels           = *Source32++;
+    *Destination32++ = (UINT32)((Pixels & SWAP_RED_BLUE_KEEP_MASK) |
+                                ((Pixels & SWAP_RED_BLUE_MOVE_MASK) << 16) |
+                                ((Pixels >> 16) & SWAP_RED_BLUE_MOVE_MASK));
+  }
+}
+
+/**
+  Copy 32-bit BGR pixels, clearing the reserved byte. The conversion is its own
+  inverse, so it serves both Blt directions.
+
+  @param[in]  Configure    The frame buffer configuration.
+  @param[out] Destination  The converted pixels.
+  @param[in]  Source       The pixels to convert.
+  @param[in]  Width        The number of pixels in the line.
+**/
+STATIC
+VOID
+ClearReservedLine (
+  IN  CONST FRAME_BUFFER_CONFIGURE  *Configure,
+  OUT VOID                          *Destination,
+  IN  CONST VOID                    *Source,
+  IN  UINTN                         Width
+  )
+{
+  UINT32        *Destination32;
+  CONST UINT32  *Source32;
+
+  Destination32 = Destination;
+  Source32      = Source;
+
+  for ( ; Width > 0; Width--) {
+    *Destination32++ = *Source32++ & ~mBgrPixelMasks.ReservedMask;
+  }
+}
+
+/**
+  Convert EFI_GRAPHICS_OUTPUT_BLT_PIXELs to packed 24-bit BGR pixels.
+
+  @param[in]  Configure    The frame buffer configuration.
+  @param[out] Destination  The converted pixels.
+  @param[in]  Source       The pixels to convert.
+  @param[in]  Width        The number of pixels in the line.
+**/
+STATIC
+VOID
+BltToPacked24Line (
+  IN  CONST FRAME_BUFFER_CONFIGURE  *Configure,
+  OUT VOID                          *Destination,
+  IN  CONST VOID                    *Source,
+  IN  UINTN                         Width
+  )
+{
+  UINT8                                *Pixel;
+  CONST EFI_GRAPHICS_OUTPUT_BLT_PIXEL  *Blt;
+
+  Pixel = Destination;
+  Blt   = Source;
+
+  for ( ; Width > 0; Width--, Blt++, Pixel += 3) {
+    Pixel[0] = Blt->Blue;
+    Pixel[1] = Blt->Green;
+    Pixel[2] = Blt->Red;
+  }
+}
+
+/**
+  Convert packed 24-bit BGR pixels to EFI_GRAPHICS_OUTPUT_BLT_PIXELs.
+
+  @param[in]  Configure    The frame buffer configuration.
+  @param[out] Destination  The converted pixels.
+  @param[in]  Source       The pixels to convert.
+  @param[in]  Width        The number of pixels in the line.
+**/
+STATIC
+VOID
+Packed24ToBltLine (
+  IN  CONST FRAME_BUFFER_CONFIGURE  *Configure,
+  OUT VOID                          *Destination,
+  IN  CONST VOID                    *Source,
+  IN  UINTN                         Width
+  )
+{
+  CONST UINT8                    *Pixel;
+  EFI_GRAPHICS_OUTPUT_BLT_PIXEL  *Blt;
+
+  Pixel = Source;
+  Blt   = Destination;
+
+  for ( ; Width > 0; Width--, Blt++, Pixel += 3) {
+    Blt->Blue     = Pixel[0];
+    Blt->Green    = Pixel[1];
+    Blt->Red      = Pixel[2];
+    Blt->Reserved = 0;
+  }
+}
+
+/**
+  Convert EFI_GRAPHICS_OUTPUT_BLT_PIXELs to an arbitrary PixelBitMask layout.
+
+  @param[in]  Configure    The frame buffer configuration.
+  @param[out] Destination  The converted pixels.
+  @param[in]  Source       The pixels to convert.
+  @param[in]  Width        The number of pixels in the line.
+**/
+STATIC
+VOID
+BltToMaskedLine (
+  IN  CONST FRAME_BUFFER_CONFIGURE  *Configure,
+  OUT VOID                          *Destination,
+  IN  CONST VOID                    *Source,
+  IN  UINTN                         Width
+  )
+{
+  UINT8         *Pixel;
+  CONST UINT32  *Blt;
+  UINT32        Uint32;
+
+  Pixel = Destination;
+  Blt   = Source;
+
+  for ( ; Width > 0; Width--, Blt++, Pixel += Configure->BytesPerPixel) {
+    Uint32 = (UINT32)(
+                      (((*Blt << Configure->PixelShl[0]) >> Configure->PixelShr[0]) &
+                       Configure->PixelMasks.RedMask) |
+                      (((*Blt << Configure->PixelShl[1]) >> Configure->PixelShr[1]) &
+                       Configure->PixelMasks.GreenMask) |
+                      (((*Blt << Configure->PixelShl[2]) >> Configure->PixelShr[2]) &
+                       Configure->PixelMasks.BlueMask)
+                      );
+
+    switch (Configure->BytesPerPixel) {
+      case 1:
+        *Pixel = (UINT8)Uint32;
+        break;
+      case 2:
+        *(UINT16 *)Pixel = (UINT16)Uint32;
+        break;
+      case 4:
+        *(UINT32 *)Pixel = Uint32;
+        break;
+      default:
+        CopyMem (Pixel, &Uint32, Configure->BytesPerPixel);
+        break;
+    }
+  }
+}
+
+/**
+  Convert pixels of an arbitrary PixelBitMask layout to
+  EFI_GRAPHICS_OUTPUT_BLT_PIXELs.
+
+  @param[in]  Configure    The frame buffer configuration.
+  @param[out] Destination  The converted pixels.
+  @param[in]  Source       The pixels to convert.
+  @param[in]  Width        The number of pixels in the line.
+**/
+STATIC
+VOID
+MaskedToBltLine (
+  IN  CONST FRAME_BUFFER_CONFIGURE  *Configure,
+  OUT VOID                          *Destination,
+  IN  CONST VOID                    *Source,
+  IN  UINTN                         Width
+  )
+{
+  CONST UINT8  *Pixel;
+  UINT32       *Blt;
+  UINT32       Uint32;
+
+  Pixel = Source;
+  Blt   = Destination;
+
+  for ( ; Width > 0; Width--, Blt++, Pixel += Configure->BytesPerPixel) {
+    switch (Configure->BytesPerPixel) {
+      case 1:
+        Uint32 = *Pixel;
+        break;
+      case 2:
+        Uint32 = *(CONST UINT16 *)Pixel;
+        break;
+      case 4:
+        Uint32 = *(CONST UINT32 *)Pixel;
+        break;
+      default:
+        Uint32 = 0;
+        CopyMem (&Uint32, Pixel, Configure->BytesPerPixel);
+        break;
+    }
+
+    *Blt = (UINT32)(
+                    (((Uint32 & Configure->PixelMasks.RedMask) >>
+                      Configure->PixelShl[0]) << Configure->PixelShr[0]) |
+                    (((Uint32 & Configure->PixelMasks.GreenMask) >>
+                      Configure->PixelShl[1]) << Configure->PixelShr[1]) |
+                    (((Uint32 & Configure->PixelMasks.BlueMask) >>
+                      Configure->PixelShl[2]) << Configure->PixelShr[2])
+                    );
+  }
+}
+
+/**
+  Initialize the bit shift values and bytes per pixel for a pixel bit mask.
+
+  @param[in]  BitMask        Pixel bit mask of the frame buffer.
+  @param[out] BytesPerPixel  Bytes per pixel of the frame buffer.
+  @param[out] PixelShl       Left shift values, red-green-blue-reserved.
+  @param[out] PixelShr       Right shift values, red-green-blue-reserved.
+
+  @retval RETURN_SUCCESS            The shift values were computed.
+  @retval RETURN_INVALID_PARAMETER  The bit masks are empty or overlap.
+**/
+STATIC
+RETURN_STATUS
+FrameBufferBltLibConfigurePixelFormat (
+  IN  CONST EFI_PIXEL_BITMASK  *BitMask,
+  OUT UINT32                   *BytesPerPixel,
+  OUT INT8                     *PixelShl,
+  OUT INT8                     *PixelShr
+  )
+{
+  UINT8         Index;
+  CONST UINT32  *Masks;
+  UINT32        MergedMasks;
+
+  MergedMasks = 0;
+  Masks       = (CONST UINT32 *)BitMask;
+  for (Index = 0; Index < 3; Index++) {
+    if ((Masks[Index] == 0) || ((MergedMasks & Masks[Index]) != 0)) {
+      return RETURN_INVALID_PARAMETER;
+    }
+
+    //
+    // Align the top bit of each color with the top bit of the same color in
+    // EFI_GRAPHICS_OUTPUT_BLT_PIXEL (bit 23 for red, 15 for green, 7 for
+    // blue).
+    //
+    PixelShl[Index] = (INT8)(HighBitSet32 (Masks[Index]) - 23 + (Index * 8));
+    if (PixelShl[Index] < 0) {
+      PixelShr[Index] = -PixelShl[Index];
+      PixelShl[Index] = 0;
+    } else {
+      PixelShr[Index] = 0;
+    }
+
+    MergedMasks |= Masks[Index];
+  }
+
+  if ((MergedMasks & Masks[3]) != 0) {
+    return RETURN_INVALID_PARAMETER;
+  }
+
+  MergedMasks   |= Masks[3];
+  *BytesPerPixel = (UINT32)((HighBitSet32 (MergedMasks) + 7) / 8);
+  return RETURN_SUCCESS;
+}
+
+/**
+  Check that a rectangle is non-empty and lies within the frame buffer.
+
+  @param[in] Configure  The frame buffer configuration.
+  @param[in] X          Left edge of the rectangle.
+  @param[in] Y          Top edge of the rectangle.
+  @param[in] Width      Width of the rectangle.
+  @param[in] Height     Height of the rectangle.
+
+  @retval TRUE   The rectangle is valid.
+  @retval FALSE  The rectangle is empty or extends past the frame buffer.
+**/
+STATIC
+BOOLEAN
+FrameBufferBltLibIsValidRectangle (
+  IN CONST FRAME_BUFFER_CONFIGURE  *Configure,
+  IN UINTN                         X,
+  IN UINTN                         Y,
+  IN UINTN                         Width,
+  IN UINTN                         Height
+  )
+{
+  return (BOOLEAN)((Width != 0) && (Height != 0) &&
+                   (X < Configure->Width) && (Width <= Configure->Width - X) &&
+                   (Y < Configure->Height) && (Height <= Configure->Height - Y));
+}
+
+/**
+  Create the configuration for a video frame buffer.
+
+  The configuration is returned in the caller provided buffer.
+
+  @param[in] FrameBuffer       Pointer to the start of the frame buffer.
+  @param[in] FrameBufferInfo   Describes the frame buffer characteristics.
+  @param[in,out] Configure     The created configuration information.
+  @param[in,out] ConfigureSize Size of the configuration information.
+
+  @retval RETURN_SUCCESS            The configuration was successful created.
+  @retval RETURN_BUFFER_TOO_SMALL   The Configure is to too small. The required
+                                    size is returned in ConfigureSize.
+  @retval RETURN_UNSUPPORTED        The requested mode is not supported by
+                                    this implementaion.
+
+**/
+RETURN_STATUS
+EFIAPI
+FrameBufferBltConfigure (
+  IN      VOID                                  *FrameBuffer,
+  IN      EFI_GRAPHICS_OUTPUT_MODE_INFORMATION  *FrameBufferInfo,
+  IN OUT  FRAME_BUFFER_CONFIGURE                *Configure,
+  IN OUT  UINTN                                 *ConfigureSize
+  )
+{
+  RETURN_STATUS            Status;
+  CONST EFI_PIXEL_BITMASK  *BitMask;
+  UINT32                   BytesPerPixel;
+  INT8                     PixelShl[4];
+  INT8                     PixelShr[4];
+  UINTN                    Size;
+
+  if ((FrameBuffer == NULL) || (FrameBufferInfo == NULL) || (ConfigureSize == NULL)) {
+    return RETURN_INVALID_PARAMETER;
+  }
+
+  switch (FrameBufferInfo->PixelFormat) {
+    case PixelRedGreenBlueReserved8BitPerColor:
+      BitMask = &mRgbPixelMasks;
+      break;
+
+    case PixelBlueGreenRedReserved8BitPerColor:
+      BitMask = &mBgrPixelMasks;
+      break;
+
+    case PixelBitMask:
+      BitMask = &FrameBufferInfo->PixelInformation;
+      break;
+
+    case PixelBltOnly:
+      ASSERT (FrameBufferInfo->PixelFormat != PixelBltOnly);
+      return RETURN_UNSUPPORTED;
+
+    default:
+      ASSERT (FALSE);
+      return RETURN_INVALID_PARAMETER;
+  }
+
+  if (FrameBufferInfo->PixelsPerScanLine < FrameBufferInfo->HorizontalResolution) {
+    return RETURN_UNSUPPORTED;
+  }
+
+  Status = FrameBufferBltLibConfigurePixelFormat (BitMask, &BytesPerPixel, PixelShl, PixelShr);
+  if (RETURN_ERROR (Status)) {
+    ASSERT_RETURN_ERROR (Status);
+    return Status;
+  }
+
+  //
+  // The line buffer holds one line in the frame buffer pixel format.
+  //
+  Size = sizeof (FRAME_BUFFER_CONFIGURE) +
+         FrameBufferInfo->HorizontalResolution * BytesPerPixel;
+  if (*ConfigureSize < Size) {
+    *ConfigureSize = Size;
+    return RETURN_BUFFER_TOO_SMALL;
+  }
+
+  if (Configure == NULL) {
+    return RETURN_INVALID_PARAMETER;
+  }
+
+  CopyMem (&Configure->PixelMasks, BitMask, sizeof (*BitMask));
+  CopyMem (Configure->PixelShl, PixelShl, sizeof (PixelShl));
+  CopyMem (Configure->PixelShr, PixelShr, sizeof (PixelShr));
+  Configure->BytesPerPixel     = BytesPerPixel;
+  Configure->PixelFormat       = FrameBufferInfo->PixelFormat;
+  Configure->FrameBuffer       = (UINT8 *)FrameBuffer;
+  Configure->Width             = FrameBufferInfo->HorizontalResolution;
+  Configure->Height            = FrameBufferInfo->VerticalResolution;
+  Configure->PixelsPerScanLine = FrameBufferInfo->PixelsPerScanLine;
+
+  //
+  // Select the line kernels for this layout. Only the color masks matter
+  // here; the reserved mask is accounted for in BytesPerPixel.
+  //
+  if (FrameBufferInfo->PixelFormat == PixelBlueGreenRedReserved8BitPerColor) {
+    Configure->BltToVideo = NULL;
+    Configure->VideoToBlt = NULL;
+  } else if (CompareMem (BitMask, &mBgrPixelMasks, OFFSET_OF (EFI_PIXEL_BITMASK, ReservedMask)) == 0) {
+    if (BytesPerPixel == sizeof (UINT32)) {
+      Configure->BltToVideo = ClearReservedLine;
+      Configure->VideoToBlt = ClearReservedLine;
+    } else if (BytesPerPixel == 3) {
+      Configure->BltToVideo = BltToPacked24Line;
+      Configure->VideoToBlt = Packed24ToBltLine;
+    } else {
+      Configure->BltToVideo = BltToMaskedLine;
+      Configure->VideoToBlt = MaskedToBltLine;
+    }
+  } else if ((BytesPerPixel == sizeof (UINT32)) &&
+             (CompareMem (BitMask, &mRgbPixelMasks, OFFSET_OF (EFI_PIXEL_BITMASK, ReservedMask)) == 0))
+  {
+    Configure->BltToVideo = SwapRedBlueLine;
+    Configure->VideoToBlt = SwapRedBlueLine;
+  } else {
+    Configure->BltToVideo = BltToMaskedLine;
+    Configure->VideoToBlt = MaskedToBltLine;
+  }
+
+  DEBUG ((
+    DEBUG_VERBOSE,
+    "%a: %ux%u, %u bytes per pixel, %a\n",
+    __func__,
+    Configure->Width,
+    Configure->Height,
+    Configure->BytesPerPixel,
+    (Configure->BltToVideo == NULL) ? "native" :
+    (Configure->BltToVideo == SwapRedBlueLine) ? "red/blue swap" :
+    (Configure->BltToVideo == ClearReservedLine) ? "reserved byte clear" :
+    (Configure->BltToVideo == BltToPacked24Line) ? "packed 24-bit" : "bit mask"
+    ));
+
+  return RETURN_SUCCESS;
+}
+
+/**
+  Performs a UEFI Graphics Output Protocol Blt Video Fill.
+
+  @param[in]  Configure     Pointer to a configuration which was successfully
+                            created by FrameBufferBltConfigure ().
+  @param[in]  Color         Color to fill the region with.
+  @param[in]  DestinationX  X location to start fill operation.
+  @param[in]  DestinationY  Y location to start fill operation.
+  @param[in]  Width         Width (in pixels) to fill.
+  @param[in]  Height        Height to fill.
+
+  @retval  RETURN_INVALID_PARAMETER Invalid parameter was passed in.
+  @retval  RETURN_SUCCESS           The video was filled successfully.
+
+**/
+STATIC
+RETURN_STATUS
+FrameBufferBltLibVideoFill (
+  IN  FRAME_BUFFER_CONFIGURE         *Configure,
+  IN  EFI_GRAPHICS_OUTPUT_BLT_PIXEL  *Color,
+  IN  UINTN                          DestinationX,
+  IN  UINTN                          DestinationY,
+  IN  UINTN                          Width,
+  IN  UINTN                          Height
+  )
+{
+  UINT8   *Destination;
+  UINTN   BytesPerScanLine;
+  UINTN   WidthInBytes;
+  UINTN   Filled;
+  UINT32  Pixel;
+
+  if (!FrameBufferBltLibIsValidRectangle (Configure, DestinationX, DestinationY, Width, Height)) {
+    DEBUG ((DEBUG_VERBOSE, "VideoFill: Past screen\n"));
+    return RETURN_INVALID_PARAMETER;
+  }
+
+  //
+  // Convert the color once; it occupies the low BytesPerPixel bytes of Pixel.
+  // Even in native mode, the reserved byte is not filled in.
+  //
+  Pixel = 0;
+  if (Configure->BltToVideo == NULL) {
+    Pixel = *(UINT32 *)Color & ~mBgrPixelMasks.ReservedMask;
+  } else {
+    Configure->BltToVideo (Configure, &Pixel, Color, 1);
+  }
+
+  BytesPerScanLine = Configure->PixelsPerScanLine * Configure->BytesPerPixel;
+  WidthInBytes     = Width * Configure->BytesPerPixel;
+  Destination      = Configure->FrameBuffer +
+                     DestinationY * BytesPerScanLine +
+                     DestinationX * Configure->BytesPerPixel;
+
+  if (Configure->BytesPerPixel == sizeof (UINT32)) {
+    if (WidthInBytes == BytesPerScanLine) {
+      //
+      // Whole scan lines are contiguous; fill them in one go.
+      //
+      SetMem32 (Destination, WidthInBytes * Height, Pixel);
+    } else {
+      for ( ; Height > 0; Height--, Destination += BytesPerScanLine) {
+        SetMem32 (Destination, WidthInBytes, Pixel);
+      }
+    }
+
+    return RETURN_SUCCESS;
+  }
+
+  //
+  // Replicate the pixel across one line by doubling, then copy the line.
+  //
+  CopyMem (Configure->LineBuffer, &Pixel, Configure->BytesPerPixel);
+  for (Filled = Configure->BytesPerPixel; Filled < WidthInBytes; Filled *= 2) {
+    CopyMem (Configure->LineBuffer + Filled, Configure->LineBuffer, MIN (Filled, WidthInBytes - Filled));
+  }
+
+  for ( ; Height > 0; Height--, Destination += BytesPerScanLine) {
+    CopyMem (Destination, Configure->LineBuffer, WidthInBytes);
+  }
+
+  return RETURN_SUCCESS;
+}
+
+/**
+  Performs a UEFI Graphics Output Protocol Blt Video to Buffer operation
+  with extended parameters.
+
+  @param[in]  Configure     Pointer to a configuration which was successfully
+                            created by FrameBufferBltConfigure ().
+  @param[out] BltBuffer     Output buffer for pixel color data.
+  @param[in]  SourceX       X location within video.
+  @param[in]  SourceY       Y location within video.
+  @param[in]  DestinationX  X location within BltBuffer.
+  @param[in]  DestinationY  Y location within BltBuffer.
+  @param[in]  Width         Width (in pixels).
+  @param[in]  Height        Height.
+  @param[in]  Delta         Number of bytes in a row of BltBuffer.
+
+  @retval RETURN_INVALID_PARAMETER Invalid parameter were passed in.
+  @retval RETURN_SUCCESS           The Blt operation was performed successfully.
+**/
+STATIC
+RETURN_STATUS
+FrameBufferBltLibVideoToBltBuffer (
+  IN     FRAME_BUFFER_CONFIGURE         *Configure,
+  OUT    EFI_GRAPHICS_OUTPUT_BLT_PIXEL  *BltBuffer,
+  IN     UINTN                          SourceX,
+  IN     UINTN                          SourceY,
+  IN     UINTN                          DestinationX,
+  IN     UINTN                          DestinationY,
+  IN     UINTN                          Width,
+  IN     UINTN                          Height,
+  IN     UINTN                          Delta
+  )
+{
+  UINT8  *Source;
+  UINT8  *Destination;
+  UINTN  BytesPerScanLine;
+  UINTN  WidthInBytes;
+
+  if (!FrameBufferBltLibIsValidRectangle (Configure, SourceX, SourceY, Width, Height)) {
+    return RETURN_INVALID_PARAMETER;
+  }
+
+  if (Delta == 0) {
+    Delta = Width * sizeof (EFI_GRAPHICS_OUTPUT_BLT_PIXEL);
+  }
+
+  BytesPerScanLine = Configure->PixelsPerScanLine * Configure->BytesPerPixel;
+  WidthInBytes     = Width * Configure->BytesPerPixel;
+  Source           = Configure->FrameBuffer +
+                     SourceY * BytesPerScanLine +
+                     SourceX * Configure->BytesPerPixel;
+  Destination = (UINT8 *)BltBuffer +
+                DestinationY * Delta +
+                DestinationX * sizeof (EFI_GRAPHICS_OUTPUT_BLT_PIXEL);
+
+  if (Configure->VideoToBlt == NULL) {
+    if ((WidthInBytes == BytesPerScanLine) && (Delta == WidthInBytes)) {
+      CopyMem (Destination, Source, WidthInBytes * Height);
+    } else {
+      for ( ; Height > 0; Height--, Source += BytesPerScanLine, Destination += Delta) {
+        CopyMem (Destination, Source, WidthInBytes);
+      }
+    }
+
+    return RETURN_SUCCESS;
+  }
+
+  //
+  // Read each line from the frame buffer in one go, then convert it.
+  //
+  for ( ; Height > 0; Height--, Source += BytesPerScanLine, Destination += Delta) {
+    CopyMem (Configure->LineBuffer, Source, WidthInBytes);
+    Configure->VideoToBlt (Configure, Destination, Configure->LineBuffer, Width);
+  }
+
+  return RETURN_SUCCESS;
+}
+
+/**
+  Performs a UEFI Graphics Output Protocol Blt Buffer to Video operation
+  with extended parameters.
+
+  @param[in]  Configure     Pointer to a configuration which was successfully
+                            created by FrameBufferBltConfigure ().
+  @param[in]  BltBuffer     Output buffer for pixel color data.
+  @param[in]  SourceX       X location within BltBuffer.
+  @param[in]  SourceY       Y location within BltBuffer.
+  @param[in]  DestinationX  X location within video.
+  @param[in]  DestinationY  Y location within video.
+  @param[in]  Width         Width (in pixels).
+  @param[in]  Height        Height.
+  @param[in]  Delta         Number of bytes in a row of BltBuffer.
+
+  @retval RETURN_INVALID_PARAMETER Invalid parameter were passed in.
+  @retval RETURN_SUCCESS           The Blt operation was performed successfully.
+**/
+STATIC
+RETURN_STATUS
+FrameBufferBltLibBufferToVideo (
+  IN  FRAME_BUFFER_CONFIGURE         *Configure,
+  IN  EFI_GRAPHICS_OUTPUT_BLT_PIXEL  *BltBuffer,
+  IN  UINTN                          SourceX,
+  IN  UINTN                          SourceY,
+  IN  UINTN                          DestinationX,
+  IN  UINTN                          DestinationY,
+  IN  UINTN                          Width,
+  IN  UINTN                          Height,
+  IN  UINTN                          Delta
+  )
+{
+  UINT8  *Source;
+  UINT8  *Destination;
+  UINTN  BytesPerScanLine;
+  UINTN  WidthInBytes;
+
+  if (!FrameBufferBltLibIsValidRectangle (Configure, DestinationX, DestinationY, Width, Height)) {
+    return RETURN_INVALID_PARAMETER;
+  }
+
+  if (Delta == 0) {
+    Delta = Width * sizeof (EFI_GRAPHICS_OUTPUT_BLT_PIXEL);
+  }
+
+  BytesPerScanLine = Configure->PixelsPerScanLine * Configure->BytesPerPixel;
+  WidthInBytes     = Width * Configure->BytesPerPixel;
+  Source           = (UINT8 *)BltBuffer +
+                     SourceY * Delta +
+                     SourceX * sizeof (EFI_GRAPHICS_OUTPUT_BLT_PIXEL);
+  Destination = Configure->FrameBuffer +
+                DestinationY * BytesPerScanLine +
+                DestinationX * Configure->BytesPerPixel;
+
+  if (Configure->BltToVideo == NULL) {
+    if ((WidthInBytes == BytesPerScanLine) && (Delta == WidthInBytes)) {
+      CopyMem (Destination, Source, WidthInBytes * Height);
+    } else {
+      for ( ; Height > 0; Height--, Source += Delta, Destination += BytesPerScanLine) {
+        CopyMem (Destination, Source, WidthInBytes);
+      }
+    }
+
+    return RETURN_SUCCESS;
+  }
+
+  //
+  // Convert each line in RAM, then write it to the frame buffer in one go.
+  //
+  for ( ; Height > 0; Height--, Source += Delta, Destination += BytesPerScanLine) {
+    Configure->BltToVideo (Configure, Configure->LineBuffer, Source, Width);
+    CopyMem (Destination, Configure->LineBuffer, WidthInBytes);
+  }
+
+  return RETURN_SUCCESS;
+}
+
+/**
+  Performs a UEFI Graphics Output Protocol Blt Video to Video operation
+
+  @param[in]  Configure     Pointer to a configuration which was successfully
+                            created by FrameBufferBltConfigure ().
+  @param[in]  SourceX       X location within video.
+  @param[in]  SourceY       Y location within video.
+  @param[in]  DestinationX  X location within video.
+  @param[in]  DestinationY  Y location within video.
+  @param[in]  Width         Width (in pixels).
+  @param[in]  Height        Height.
+
+  @retval RETURN_INVALID_PARAMETER Invalid parameter were passed in.
+  @retval RETURN_SUCCESS           The Blt operation was performed successfully.
+**/
+STATIC
+RETURN_STATUS
+FrameBufferBltLibVideoToVideo (
+  IN  FRAME_BUFFER_CONFIGURE  *Configure,
+  IN  UINTN                   SourceX,
+  IN  UINTN                   SourceY,
+  IN  UINTN                   DestinationX,
+  IN  UINTN                   DestinationY,
+  IN  UINTN                   Width,
+  IN  UINTN                   Height
+  )
+{
+  UINT8  *Source;
+  UINT8  *Destination;
+  UINTN  BytesPerScanLine;
+  UINTN  WidthInBytes;
+
+  if (!FrameBufferBltLibIsValidRectangle (Configure, SourceX, SourceY, Width, Height) ||
+      !FrameBufferBltLibIsValidRectangle (Configure, DestinationX, DestinationY, Width, Height))
+  {
+    return RETURN_INVALID_PARAMETER;
+  }
+
+  BytesPerScanLine = Configure->PixelsPerScanLine * Configure->BytesPerPixel;
+  WidthInBytes     = Width * Configure->BytesPerPixel;
+  Source           = Configure->FrameBuffer +
+                     SourceY * BytesPerScanLine +
+                     SourceX * Configure->BytesPerPixel;
+  Destination = Configure->FrameBuffer +
+                DestinationY * BytesPerScanLine +
+                DestinationX * Configure->BytesPerPixel;
+
+  //
+  // CopyMem() handles overlapping buffers, so whole scan lines (vertical
+  // scrolling) move in a single call.
+  //
+  if (WidthInBytes == BytesPerScanLine) {
+    CopyMem (Destination, Source, WidthInBytes * Height);
+    return RETURN_SUCCESS;
+  }
+
+  if (Destination <= Source) {
+    for ( ; Height > 0; Height--, Source += BytesPerScanLine, Destination += BytesPerScanLine) {
+      CopyMem (Destination, Source, WidthInBytes);
+    }
+  } else {
+    //
+    // Copy bottom-up so that overlapping lines are read before they are
+    // overwritten.
+    //
+    Source      += (Height - 1) * BytesPerScanLine;
+    Destination += (Height - 1) * BytesPerScanLine;
+    for ( ; Height > 0; Height--, Source -= BytesPerScanLine, Destination -= BytesPerScanLine) {
+      CopyMem (Destination, Source, WidthInBytes);
+    }
+  }
+
+  return RETURN_SUCCESS;
+}
+
+/**
+  Performs a UEFI Graphics Output Protocol Blt operation.
+
+  @param[in]     Configure    Pointer to a configuration which was successfully
+                              created by FrameBufferBltConfigure ().
+  @param[in,out] BltBuffer    The data to transfer to screen.
+  @param[in]     BltOperation The operation to perform.
+  @param[in]     SourceX      The X coordinate of the source for BltOperation.
+  @param[in]     SourceY      The Y coordinate of the source for BltOperation.
+  @param[in]     DestinationX The X coordinate of the destination for
+                              BltOperation.
+  @param[in]     DestinationY The Y coordinate of the destination for
+                              BltOperation.
+  @param[in]     Width        The width of a rectangle in the blt rectangle
+                              in pixels.
+  @param[in]     Height       The height of a rectangle in the blt rectangle
+                              in pixels.
+  @param[in]     Delta        Not used for EfiBltVideoFill and
+                              EfiBltVideoToVideo operation. If a Delta of 0
+                              is used, the entire BltBuffer will be operated
+                              on. If a subrectangle of the BltBuffer is
+                              used, then Delta represents the number of
+                              bytes in a row of the BltBuffer.
+
+  @retval RETURN_INVALID_PARAMETER Invalid parameter were passed in.
+  @retval RETURN_SUCCESS           The Blt operation was performed successfully.
+**/
+RETURN_STATUS
+EFIAPI
+FrameBufferBlt (
+  IN     FRAME_BUFFER_CONFIGURE             *Configure,
+  IN OUT EFI_GRAPHICS_OUTPUT_BLT_PIXEL      *BltBuffer  OPTIONAL,
+  IN     EFI_GRAPHICS_OUTPUT_BLT_OPERATION  BltOperation,
+  IN     UINTN                              SourceX,
+  IN     UINTN                              SourceY,
+  IN     UINTN                              DestinationX,
+  IN     UINTN                              DestinationY,
+  IN     UINTN                              Width,
+  IN     UINTN                              Height,
+  IN     UINTN                              Delta
+  )
+{
+  if (Configure == NULL) {
+    return RETURN_INVALID_PARAMETER;
+  }
+
+  switch (BltOperation) {
+    case EfiBltVideoToBltBuffer:
+      if (BltBuffer == NULL) {
+        return RETURN_INVALID_PARAMETER;
+      }
+
+      return FrameBufferBltLibVideoToBltBuffer (
+               Configure,
+               BltBuffer,
+               SourceX,
+               SourceY,
+               DestinationX,
+               DestinationY,
+               Width,
+               Height,
+               Delta
+               );
+
+    case EfiBltVideoToVideo:
+      return FrameBufferBltLibVideoToVideo (
+               Configure,
+               SourceX,
+               SourceY,
+               DestinationX,
+               DestinationY,
+               Width,
+               Height
+               );
+
+    case EfiBltVideoFill:
+      if (BltBuffer == NULL) {
+        return RETURN_INVALID_PARAMETER;
+      }
+
+      return FrameBufferBltLibVideoFill (
+               Configure,
+               BltBuffer,
+               DestinationX,
+               DestinationY,
+               Width,
+               Height
+               );
+
+    case EfiBltBufferToVideo:
+      if (BltBuffer == NULL) {
+        return RETURN_INVALID_PARAMETER;
+      }
+
+      return FrameBufferBltLibBufferToVideo (
+               Configure,
+               BltBuffer,
+               SourceX,
+               SourceY,
+               DestinationX,
+               DestinationY,
+               Width,
+               Height,
+               Delta
+               );
+
+    default:
+      return RETURN_INVALID_PARAMETER;
+  }
+}
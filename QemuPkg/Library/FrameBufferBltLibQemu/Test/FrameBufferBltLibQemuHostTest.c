@@ -0,0 +1,829 @@
+/** @file
+  Host-based unit test of FrameBufferBltLibQemu.
+
+  Every frame buffer mode below is driven through FrameBufferBltLibQemu and
+  through MdeModulePkg's FrameBufferBltLib (see StockFrameBufferBltLib.c) side
+  by side. Both start from identical frame buffer contents and receive the
+  same sequence of fills, copies to and from Blt buffers and overlapping
+  scrolls; after every request the return statuses, the frame buffers and the
+  Blt buffers read back have to be identical. The time both libraries take for
+  full-screen fills, scrolls and Blt buffer copies is reported as well.
+
+  Copyright (c) Microsoft Corporation
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <time.h>                             // clock()
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>                  // DivU64x32()
+#include <Library/BaseMemoryLib.h>            // CompareMem()
+#include <Library/DebugLib.h>                 // DEBUG()
+#include <Library/MemoryAllocationLib.h>      // AllocatePool()
+#include <Library/UnitTestLib.h>              // UT_ASSERT_EQUAL()
+
+#include "FrameBufferBltLibQemuHostTest.h"
+
+#define UNIT_TEST_APP_NAME     "FrameBufferBltLibQemu Host Test"
+#define UNIT_TEST_APP_VERSION  "1.0"
+
+//
+// Extra pixels at the end of each Blt buffer line, so that requests with a
+// non-zero Delta use a line pitch different from their width.
+//
+#define BLT_BUFFER_PAD  3
+
+//
+// Number of random requests replayed per mode, after the fixed ones.
+//
+#define RANDOM_REQUESTS  1000
+
+//
+// Number of times each library carries out a request for the timing report.
+//
+#define TIMING_ITERATIONS  100
+
+//
+// Lines scrolled by the VideoToVideo requests.
+//
+#define SCROLL_LINES  16
+
+typedef
+RETURN_STATUS
+(EFIAPI *BLT_CONFIGURE)(
+  IN      VOID                                  *FrameBuffer,
+  IN      EFI_GRAPHICS_OUTPUT_MODE_INFORMATION  *FrameBufferInfo,
+  IN OUT  FRAME_BUFFER_CONFIGURE                *Configure,
+  IN OUT  UINTN                                 *ConfigureSize
+  );
+
+typedef
+RETURN_STATUS
+(EFIAPI *BLT)(
+  IN     FRAME_BUFFER_CONFIGURE             *Configure,
+  IN OUT EFI_GRAPHICS_OUTPUT_BLT_PIXEL      *BltBuffer  OPTIONAL,
+  IN     EFI_GRAPHICS_OUTPUT_BLT_OPERATION  BltOperation,
+  IN     UINTN                              SourceX,
+  IN     UINTN                              SourceY,
+  IN     UINTN                              DestinationX,
+  IN     UINTN                              DestinationY,
+  IN     UINTN                              Width,
+  IN     UINTN                              Height,
+  IN     UINTN                              Delta
+  );
+
+typedef struct {
+  CHAR8                                   *Name;
+  EFI_GRAPHICS_OUTPUT_MODE_INFORMATION    Info;
+  UINTN                                   BytesPerPixel;
+} BLT_MODE_CONTEXT;
+
+//
+// One library, configured for a frame buffer of its own.
+//
+typedef struct {
+  BLT                       Blt;
+  FRAME_BUFFER_CONFIGURE    *Configure;
+  UINT8                     *FrameBuffer;
+  UINTN                     FrameBufferSize;
+  EFI_STATUS                ConfigureStatus;
+} BLT_INSTANCE;
+
+typedef struct {
+  EFI_GRAPHICS_OUTPUT_BLT_OPERATION    Operation;
+  UINTN                                SourceX;
+  UINTN                                SourceY;
+  UINTN                                DestinationX;
+  UINTN                                DestinationY;
+  UINTN                                Width;
+  UINTN                                Height;
+  UINTN                                Delta;
+} BLT_REQUEST;
+
+//
+// A request sized relative to the screen: the rectangle is WidthMargin pixels
+// narrower and HeightMargin lines lower than the screen, or wider or taller if
+// the margin is negative. A padded request uses Blt buffer lines of
+// BLT_BUFFER_PAD extra pixels, the others a Delta of zero.
+//
+typedef struct {
+  EFI_GRAPHICS_OUTPUT_BLT_OPERATION    Operation;
+  UINTN                                SourceX;
+  UINTN                                SourceY;
+  UINTN                                DestinationX;
+  UINTN                                DestinationY;
+  INTN                                 WidthMargin;
+  INTN                                 HeightMargin;
+  BOOLEAN                              Padded;
+} SCREEN_REQUEST;
+
+STATIC CHAR8  *mOperationName[] = {
+  "VideoFill",
+  "VideoToBltBuffer",
+  "BufferToVideo",
+  "VideoToVideo"
+};
+
+//
+// Full-screen requests first, then scrolls overlapping in every direction,
+// partial rectangles, and rectangles reaching past the screen.
+//
+STATIC CONST SCREEN_REQUEST  mFixedRequests[] = {
+  { EfiBltVideoFill,        0, 0,            0, 0,            0,  0,            FALSE },
+  { EfiBltBufferToVideo,    0, 0,            0, 0,            0,  0,            FALSE },
+  { EfiBltVideoToBltBuffer, 0, 0,            0, 0,            0,  0,            FALSE },
+  { EfiBltVideoToVideo,     0, SCROLL_LINES, 0, 0,            0,  SCROLL_LINES, FALSE },
+  { EfiBltVideoToVideo,     0, 0,            0, SCROLL_LINES, 0,  SCROLL_LINES, FALSE },
+  { EfiBltVideoToVideo,     7, 3,            0, 0,            7,  3,            FALSE },
+  { EfiBltVideoToVideo,     0, 0,            7, 3,            7,  3,            FALSE },
+  { EfiBltVideoFill,        0, 0,            1, SCROLL_LINES, 2,  0,            FALSE },
+  { EfiBltBufferToVideo,    1, 2,            5, 6,            5,  6,            TRUE  },
+  { EfiBltVideoToBltBuffer, 5, 6,            1, 2,            5,  6,            TRUE  },
+  { EfiBltVideoFill,        0, 0,            0, 0,            -1, 0,            FALSE },
+  { EfiBltVideoToVideo,     0, 1,            0, 0,            0,  0,            FALSE },
+  { EfiBltBufferToVideo,    0, 0,            0, 1,            0,  0,            FALSE },
+};
+
+//
+// Requests timed for the report: clearing the screen, scrolling it by
+// SCROLL_LINES lines, and redrawing it.
+//
+STATIC CONST SCREEN_REQUEST  mTimedRequests[] = {
+  { EfiBltVideoFill,     0, 0,            0, 0, 0, 0,            FALSE },
+  { EfiBltVideoToVideo,  0, SCROLL_LINES, 0, 0, 0, SCROLL_LINES, FALSE },
+  { EfiBltBufferToVideo, 0, 0,            0, 0, 0, 0,            FALSE },
+};
+
+STATIC UINT32  mRandomState;
+
+/**
+  Return the next number of a fixed pseudo-random sequence, so that every run
+  replays the same requests.
+
+  @param[in] Limit  The number returned is below Limit, which is non-zero.
+
+  @return  The number.
+**/
+STATIC
+UINTN
+NextRandom (
+  IN UINTN  Limit
+  )
+{
+  mRandomState ^= mRandomState << 13;
+  mRandomState ^= mRandomState >> 17;
+  mRandomState ^= mRandomState << 5;
+  return mRandomState % Limit;
+}
+
+/**
+  Fill a buffer with pseudo-random bytes.
+
+  @param[out] Buffer  The buffer.
+  @param[in]  Size    The size of the buffer in bytes.
+**/
+STATIC
+VOID
+FillRandom (
+  OUT VOID   *Buffer,
+  IN  UINTN  Size
+  )
+{
+  UINT8  *Bytes;
+
+  for (Bytes = Buffer; Size > 0; Size--) {
+    *Bytes++ = (UINT8)NextRandom (256);
+  }
+}
+
+/**
+  Allocate a frame buffer for a mode and configure a library for it.
+
+  @param[in]  Mode       The frame buffer mode.
+  @param[in]  Configure  FrameBufferBltConfigure() of the library.
+  @param[in]  Blt        FrameBufferBlt() of the library.
+  @param[out] Instance   The library instance. ConfigureStatus reports the
+                         result of FrameBufferBltConfigure().
+
+  @retval FALSE  Out of memory. Instance has been released.
+**/
+STATIC
+BOOLEAN
+CreateInstance (
+  IN  BLT_MODE_CONTEXT  *Mode,
+  IN  BLT_CONFIGURE     Configure,
+  IN  BLT               Blt,
+  OUT BLT_INSTANCE      *Instance
+  )
+{
+  UINTN  ConfigureSize;
+
+  ZeroMem (Instance, sizeof (*Instance));
+  Instance->Blt             = Blt;
+  Instance->FrameBufferSize = Mode->Info.PixelsPerScanLine *
+                              Mode->Info.VerticalResolution *
+                              Mode->BytesPerPixel;
+  Instance->FrameBuffer = AllocatePool (Instance->FrameBufferSize);
+  if (Instance->FrameBuffer == NULL) {
+    return FALSE;
+  }
+
+  ConfigureSize             = 0;
+  Instance->ConfigureStatus = Configure (Instance->FrameBuffer, &Mode->Info, NULL, &ConfigureSize);
+  if (Instance->ConfigureStatus != RETURN_BUFFER_TOO_SMALL) {
+    return TRUE;
+  }
+
+  Instance->Configure = AllocatePool (ConfigureSize);
+  if (Instance->Configure == NULL) {
+    FreePool (Instance->FrameBuffer);
+    return FALSE;
+  }
+
+  Instance->ConfigureStatus = Configure (Instance->FrameBuffer, &Mode->Info, Instance->Configure, &ConfigureSize);
+  return TRUE;
+}
+
+/**
+  Release a library instance.
+
+  @param[in] Instance  The instance.
+**/
+STATIC
+VOID
+DestroyInstance (
+  IN BLT_INSTANCE  *Instance
+  )
+{
+  if (Instance->Configure != NULL) {
+    FreePool (Instance->Configure);
+  }
+
+  if (Instance->FrameBuffer != NULL) {
+    FreePool (Instance->FrameBuffer);
+  }
+}
+
+/**
+  Create the stock and the QEMU library instances for a mode, with identical
+  random frame buffer contents.
+
+  @param[in]  Mode   The frame buffer mode.
+  @param[out] Stock  The MdeModulePkg library instance.
+  @param[out] Qemu   The FrameBufferBltLibQemu instance.
+
+  @retval FALSE  Out of memory. Neither instance needs to be released.
+**/
+STATIC
+BOOLEAN
+CreateInstances (
+  IN  BLT_MODE_CONTEXT  *Mode,
+  OUT BLT_INSTANCE      *Stock,
+  OUT BLT_INSTANCE      *Qemu
+  )
+{
+  if (!CreateInstance (Mode, StockFrameBufferBltConfigure, StockFrameBufferBlt, Stock)) {
+    return FALSE;
+  }
+
+  if (!CreateInstance (Mode, FrameBufferBltConfigure, FrameBufferBlt, Qemu)) {
+    DestroyInstance (Stock);
+    return FALSE;
+  }
+
+  FillRandom (Stock->FrameBuffer, Stock->FrameBufferSize);
+  CopyMem (Qemu->FrameBuffer, Stock->FrameBuffer, Qemu->FrameBufferSize);
+  return TRUE;
+}
+
+/**
+  Carry out a request with both libraries, and compare the results.
+
+  BltBuffer is used by the stock library. The QEMU library gets a copy of it,
+  which has to match it afterwards.
+
+  @param[in]     Stock          The MdeModulePkg library instance.
+  @param[in]     Qemu           The FrameBufferBltLibQemu instance.
+  @param[in]     Request        The request.
+  @param[in]     Index          The number of the request, for the log.
+  @param[in,out] BltBuffer      The Blt buffer, or NULL for VideoToVideo.
+  @param[in]     QemuBltBuffer  The space for the copy of BltBuffer.
+  @param[in]     BltBufferSize  The size of BltBuffer in bytes.
+**/
+STATIC
+UNIT_TEST_STATUS
+CompareRequest (
+  IN     BLT_INSTANCE                   *Stock,
+  IN     BLT_INSTANCE                   *Qemu,
+  IN     CONST BLT_REQUEST              *Request,
+  IN     UINTN                          Index,
+  IN OUT EFI_GRAPHICS_OUTPUT_BLT_PIXEL  *BltBuffer,
+  IN     EFI_GRAPHICS_OUTPUT_BLT_PIXEL  *QemuBltBuffer,
+  IN     UINTN                          BltBufferSize
+  )
+{
+  RETURN_STATUS  StockStatus;
+  RETURN_STATUS  QemuStatus;
+
+  if (BltBuffer != NULL) {
+    CopyMem (QemuBltBuffer, BltBuffer, BltBufferSize);
+  } else {
+    QemuBltBuffer = NULL;
+  }
+
+  StockStatus = Stock->Blt (
+                         Stock->Configure,
+                         BltBuffer,
+                         Request->Operation,
+                         Request->SourceX,
+                         Request->SourceY,
+                         Request->DestinationX,
+                         Request->DestinationY,
+                         Request->Width,
+                         Request->Height,
+                         Request->Delta
+                         );
+  QemuStatus = Qemu->Blt (
+                       Qemu->Configure,
+                       QemuBltBuffer,
+                       Request->Operation,
+                       Request->SourceX,
+                       Request->SourceY,
+                       Request->DestinationX,
+                       Request->DestinationY,
+                       Request->Width,
+                       Request->Height,
+                       Request->Delta
+                       );
+
+  if ((QemuStatus != StockStatus) ||
+      (CompareMem (Qemu->FrameBuffer, Stock->FrameBuffer, Stock->FrameBufferSize) != 0) ||
+      ((BltBuffer != NULL) && (CompareMem (QemuBltBuffer, BltBuffer, BltBufferSize) != 0)))
+  {
+    UT_LOG_ERROR (
+      "Request %u: %a (%u,%u) -> (%u,%u), %ux%u, Delta %u\n",
+      (UINT32)Index,
+      mOperationName[Request->Operation],
+      (UINT32)Request->SourceX,
+      (UINT32)Request->SourceY,
+      (UINT32)Request->DestinationX,
+      (UINT32)Request->DestinationY,
+      (UINT32)Request->Width,
+      (UINT32)Request->Height,
+      (UINT32)Request->Delta
+      );
+  }
+
+  UT_ASSERT_STATUS_EQUAL (QemuStatus, StockStatus);
+  UT_ASSERT_MEM_EQUAL (Qemu->FrameBuffer, Stock->FrameBuffer, Stock->FrameBufferSize);
+  if (BltBuffer != NULL) {
+    UT_ASSERT_MEM_EQUAL (QemuBltBuffer, BltBuffer, BltBufferSize);
+  }
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Turn a request sized relative to the screen into a request.
+
+  @param[in]  Info           The frame buffer mode.
+  @param[in]  ScreenRequest  The request sized relative to the screen.
+  @param[out] Request        The request.
+**/
+STATIC
+VOID
+ResolveRequest (
+  IN  EFI_GRAPHICS_OUTPUT_MODE_INFORMATION  *Info,
+  IN  CONST SCREEN_REQUEST                  *ScreenRequest,
+  OUT BLT_REQUEST                           *Request
+  )
+{
+  Request->Operation    = ScreenRequest->Operation;
+  Request->SourceX      = ScreenRequest->SourceX;
+  Request->SourceY      = ScreenRequest->SourceY;
+  Request->DestinationX = ScreenRequest->DestinationX;
+  Request->DestinationY = ScreenRequest->DestinationY;
+  Request->Width        = (UINTN)((INTN)Info->HorizontalResolution - ScreenRequest->WidthMargin);
+  Request->Height       = (UINTN)((INTN)Info->VerticalResolution - ScreenRequest->HeightMargin);
+  Request->Delta        = 0;
+  if (ScreenRequest->Padded) {
+    Request->Delta = (Info->HorizontalResolution + BLT_BUFFER_PAD) * sizeof (EFI_GRAPHICS_OUTPUT_BLT_PIXEL);
+  }
+}
+
+/**
+  Pick a random span of a screen dimension. Now and then the span reaches past
+  the end, or is empty, so that the parameter checks get compared too.
+
+  @param[in]  Size    The screen width or height.
+  @param[out] Start   The first pixel of the span.
+  @param[out] Length  The length of the span.
+**/
+STATIC
+VOID
+RandomSpan (
+  IN  UINTN  Size,
+  OUT UINTN  *Start,
+  OUT UINTN  *Length
+  )
+{
+  *Start = NextRandom (Size);
+  switch (NextRandom (32)) {
+    case 0:
+      *Length = Size - *Start + 1 + NextRandom (4);
+      break;
+    case 1:
+      *Length = 0;
+      break;
+    default:
+      *Length = 1 + NextRandom (Size - *Start);
+      break;
+  }
+}
+
+/**
+  Build a random request. Blt buffer coordinates are kept within a buffer of
+  (HorizontalResolution + BLT_BUFFER_PAD) x VerticalResolution pixels.
+
+  @param[in]  Info     The frame buffer mode.
+  @param[out] Request  The request.
+**/
+STATIC
+VOID
+RandomRequest (
+  IN  EFI_GRAPHICS_OUTPUT_MODE_INFORMATION  *Info,
+  OUT BLT_REQUEST                           *Request
+  )
+{
+  UINTN  BltWidth;
+  UINTN  Width;
+  UINTN  Height;
+  UINTN  BltX;
+  UINTN  BltY;
+
+  BltWidth           = Info->HorizontalResolution + BLT_BUFFER_PAD;
+  Request->Operation = (EFI_GRAPHICS_OUTPUT_BLT_OPERATION)NextRandom (EfiGraphicsOutputBltOperationMax);
+  RandomSpan (Info->HorizontalResolution, &Request->DestinationX, &Request->Width);
+  RandomSpan (Info->VerticalResolution, &Request->DestinationY, &Request->Height);
+
+  Width  = MIN (Request->Width, Info->HorizontalResolution);
+  Height = MIN (Request->Height, Info->VerticalResolution);
+  if (Request->Operation == EfiBltVideoToVideo) {
+    Request->SourceX = NextRandom (Info->HorizontalResolution - Width + 1);
+    Request->SourceY = NextRandom (Info->VerticalResolution - Height + 1);
+    Request->Delta   = 0;
+    return;
+  }
+
+  //
+  // A zero Delta means lines of exactly Width pixels, so then the rectangle
+  // has to start at the origin of the Blt buffer.
+  //
+  BltX           = 0;
+  BltY           = 0;
+  Request->Delta = 0;
+  if (NextRandom (4) != 0) {
+    Request->Delta = BltWidth * sizeof (EFI_GRAPHICS_OUTPUT_BLT_PIXEL);
+    BltX           = NextRandom (BltWidth - Width + 1);
+    BltY           = NextRandom (Info->VerticalResolution - Height + 1);
+  }
+
+  //
+  // For VideoToBltBuffer, the Blt buffer is the destination.
+  //
+  Request->SourceX = BltX;
+  Request->SourceY = BltY;
+  if (Request->Operation == EfiBltVideoToBltBuffer) {
+    Request->SourceX      = Request->DestinationX;
+    Request->SourceY      = Request->DestinationY;
+    Request->DestinationX = BltX;
+    Request->DestinationY = BltY;
+  }
+}
+
+/**
+  Replay fixed and random requests through both libraries, and compare the
+  results after every request.
+
+  @param[in] Context  The BLT_MODE_CONTEXT of the mode.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+BltMatchesStock (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  BLT_MODE_CONTEXT               *Mode;
+  BLT_INSTANCE                   Stock;
+  BLT_INSTANCE                   Qemu;
+  EFI_GRAPHICS_OUTPUT_BLT_PIXEL  *BltBuffer;
+  EFI_GRAPHICS_OUTPUT_BLT_PIXEL  *QemuBltBuffer;
+  UINTN                          BltBufferSize;
+  UINTN                          Width;
+  UINTN                          Height;
+  UINTN                          Index;
+  BLT_REQUEST                    Request;
+  UNIT_TEST_STATUS               Status;
+
+  Mode   = Context;
+  Width  = Mode->Info.HorizontalResolution;
+  Height = Mode->Info.VerticalResolution;
+
+  mRandomState = 0x2545F491;
+  if (!CreateInstances (Mode, &Stock, &Qemu)) {
+    return UNIT_TEST_ERROR_TEST_FAILED;
+  }
+
+  Status        = UNIT_TEST_ERROR_TEST_FAILED;
+  BltBufferSize = (Width + BLT_BUFFER_PAD) * Height * sizeof (EFI_GRAPHICS_OUTPUT_BLT_PIXEL);
+  BltBuffer     = AllocatePool (BltBufferSize);
+  QemuBltBuffer = AllocatePool (BltBufferSize);
+  if ((BltBuffer == NULL) || (QemuBltBuffer == NULL)) {
+    goto Done;
+  }
+
+  if (RETURN_ERROR (Stock.ConfigureStatus) || (Qemu.ConfigureStatus != Stock.ConfigureStatus)) {
+    UT_LOG_ERROR ("Configure status %r, stock %r\n", Qemu.ConfigureStatus, Stock.ConfigureStatus);
+    goto Done;
+  }
+
+  for (Index = 0; Index < ARRAY_SIZE (mFixedRequests) + RANDOM_REQUESTS; Index++) {
+    if (Index < ARRAY_SIZE (mFixedRequests)) {
+      ResolveRequest (&Mode->Info, &mFixedRequests[Index], &Request);
+    } else {
+      RandomRequest (&Mode->Info, &Request);
+    }
+
+    FillRandom (BltBuffer, BltBufferSize);
+    Status = CompareRequest (
+               &Stock,
+               &Qemu,
+               &Request,
+               Index,
+               (Request.Operation == EfiBltVideoToVideo) ? NULL : BltBuffer,
+               QemuBltBuffer,
+               BltBufferSize
+               );
+    if (Status != UNIT_TEST_PASSED) {
+      break;
+    }
+  }
+
+Done:
+  if (BltBuffer != NULL) {
+    FreePool (BltBuffer);
+  }
+
+  if (QemuBltBuffer != NULL) {
+    FreePool (QemuBltBuffer);
+  }
+
+  DestroyInstance (&Stock);
+  DestroyInstance (&Qemu);
+  return Status;
+}
+
+/**
+  Measure the time it takes one library to carry out a request.
+
+  @param[in] Instance   The library instance.
+  @param[in] BltBuffer  The Blt buffer of the request.
+  @param[in] Request    The request.
+
+  @return  The average time per request, in microseconds.
+**/
+STATIC
+UINT64
+TimeRequest (
+  IN BLT_INSTANCE                   *Instance,
+  IN EFI_GRAPHICS_OUTPUT_BLT_PIXEL  *BltBuffer,
+  IN CONST BLT_REQUEST              *Request
+  )
+{
+  UINTN    Iteration;
+  clock_t  Start;
+
+  Start = clock ();
+  for (Iteration = 0; Iteration < TIMING_ITERATIONS; Iteration++) {
+    Instance->Blt (
+                Instance->Configure,
+                BltBuffer,
+                Request->Operation,
+                Request->SourceX,
+                Request->SourceY,
+                Request->DestinationX,
+                Request->DestinationY,
+                Request->Width,
+                Request->Height,
+                Request->Delta
+                );
+  }
+
+  return DivU64x32 (
+           MultU64x32 ((UINT64)(clock () - Start), 1000000 / CLOCKS_PER_SEC),
+           TIMING_ITERATIONS
+           );
+}
+
+/**
+  Report the time both libraries take for full-screen fills, scrolls and Blt
+  buffer copies. There is no pass / fail criterion, as host timings are too
+  noisy for one.
+
+  @param[in] Context  The BLT_MODE_CONTEXT of the mode.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+ReportBltTime (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  BLT_MODE_CONTEXT               *Mode;
+  BLT_INSTANCE                   Stock;
+  BLT_INSTANCE                   Qemu;
+  EFI_GRAPHICS_OUTPUT_BLT_PIXEL  *BltBuffer;
+  UINTN                          Width;
+  UINTN                          Height;
+  UINTN                          Index;
+  BLT_REQUEST                    Request;
+  UINT64                         StockUs;
+  UINT64                         QemuUs;
+  UNIT_TEST_STATUS               Status;
+
+  Mode   = Context;
+  Width  = Mode->Info.HorizontalResolution;
+  Height = Mode->Info.VerticalResolution;
+
+  mRandomState = 0x2545F491;
+  if (!CreateInstances (Mode, &Stock, &Qemu)) {
+    return UNIT_TEST_ERROR_TEST_FAILED;
+  }
+
+  Status    = UNIT_TEST_ERROR_TEST_FAILED;
+  BltBuffer = AllocatePool (Width * Height * sizeof (EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+  if ((BltBuffer == NULL) ||
+      RETURN_ERROR (Stock.ConfigureStatus) ||
+      RETURN_ERROR (Qemu.ConfigureStatus))
+  {
+    goto Done;
+  }
+
+  FillRandom (BltBuffer, Width * Height * sizeof (EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+
+  for (Index = 0; Index < ARRAY_SIZE (mTimedRequests); Index++) {
+    ResolveRequest (&Mode->Info, &mTimedRequests[Index], &Request);
+    StockUs = TimeRequest (&Stock, BltBuffer, &Request);
+    QemuUs  = TimeRequest (&Qemu, BltBuffer, &Request);
+
+    UT_LOG_INFO (
+      "%a, %a: stock %Lu us, QEMU %Lu us per request\n",
+      Mode->Name,
+      mOperationName[Request.Operation],
+      StockUs,
+      QemuUs
+      );
+    //
+    // The unit test log only goes to the report; show the numbers on the
+    // console too.
+    //
+    DEBUG ((
+      DEBUG_ERROR,
+      "%a, %a: stock %Lu us, QEMU %Lu us per request\n",
+      Mode->Name,
+      mOperationName[Request.Operation],
+      StockUs,
+      QemuUs
+      ));
+  }
+
+  Status = UNIT_TEST_PASSED;
+
+Done:
+  if (BltBuffer != NULL) {
+    FreePool (BltBuffer);
+  }
+
+  DestroyInstance (&Stock);
+  DestroyInstance (&Qemu);
+  return Status;
+}
+
+//
+// The 32-bit BGR layout is covered as PixelBlueGreenRedReserved8BitPerColor,
+// with and without scan line padding, and as PixelBitMask; the stock library
+// treats those differently.
+//
+STATIC BLT_MODE_CONTEXT  mBgrxMode = {
+  "BGRX 1024x768",
+  { 0, 1024, 768, PixelBlueGreenRedReserved8BitPerColor, { 0 }, 1024 },
+  4
+};
+STATIC BLT_MODE_CONTEXT  mBgrxPaddedMode = {
+  "BGRX 800x600, 832 pixel scan lines",
+  { 0, 800, 600, PixelBlueGreenRedReserved8BitPerColor, { 0 }, 832 },
+  4
+};
+STATIC BLT_MODE_CONTEXT  mRgbxMode = {
+  "RGBX 1024x768",
+  { 0, 1024, 768, PixelRedGreenBlueReserved8BitPerColor, { 0 }, 1024 },
+  4
+};
+STATIC BLT_MODE_CONTEXT  mBitMaskBgrxMode = {
+  "Bit mask BGRX 800x600",
+  { 0, 800, 600, PixelBitMask, { 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000 }, 800 },
+  4
+};
+STATIC BLT_MODE_CONTEXT  mBitMaskBgr24Mode = {
+  "Bit mask BGR 24-bit 800x600, 808 pixel scan lines",
+  { 0, 800, 600, PixelBitMask, { 0x00FF0000, 0x0000FF00, 0x000000FF, 0x00000000 }, 808 },
+  3
+};
+STATIC BLT_MODE_CONTEXT  mBitMask565Mode = {
+  "Bit mask RGB 5:6:5 640x480",
+  { 0, 640, 480, PixelBitMask, { 0x0000F800, 0x000007E0, 0x0000001F, 0x00000000 }, 640 },
+  2
+};
+
+STATIC BLT_MODE_CONTEXT  *mModes[] = {
+  &mBgrxMode,
+  &mBgrxPaddedMode,
+  &mRgbxMode,
+  &mBitMaskBgrxMode,
+  &mBitMaskBgr24Mode,
+  &mBitMask565Mode
+};
+
+/**
+  Initialize the unit test framework, suites, and test cases, and run them.
+
+  @retval EFI_SUCCESS  All test cases were dispatched.
+  @return              Error codes from the unit test framework.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+UefiTestMain (
+  VOID
+  )
+{
+  EFI_STATUS                  Status;
+  UNIT_TEST_FRAMEWORK_HANDLE  Framework;
+  UNIT_TEST_SUITE_HANDLE      CompareSuite;
+  UNIT_TEST_SUITE_HANDLE      TimingSuite;
+  UINTN                       Index;
+
+  Framework = NULL;
+
+  DEBUG ((DEBUG_INFO, "%a v%a\n", UNIT_TEST_APP_NAME, UNIT_TEST_APP_VERSION));
+
+  Status = InitUnitTestFramework (&Framework, UNIT_TEST_APP_NAME, gEfiCallerBaseName, UNIT_TEST_APP_VERSION);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in InitUnitTestFramework. Status = %r\n", Status));
+    goto EXIT;
+  }
+
+  Status = CreateUnitTestSuite (&CompareSuite, Framework, "Output matches MdeModulePkg FrameBufferBltLib", "QemuPkg.FrameBufferBltLibQemu.Compare", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in CreateUnitTestSuite for the compare suite\n"));
+    goto EXIT;
+  }
+
+  for (Index = 0; Index < ARRAY_SIZE (mModes); Index++) {
+    AddTestCase (CompareSuite, mModes[Index]->Name, "Compare", BltMatchesStock, NULL, NULL, mModes[Index]);
+  }
+
+  Status = CreateUnitTestSuite (&TimingSuite, Framework, "Blt timing against MdeModulePkg FrameBufferBltLib", "QemuPkg.FrameBufferBltLibQemu.Timing", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in CreateUnitTestSuite for the timing suite\n"));
+    goto EXIT;
+  }
+
+  for (Index = 0; Index < ARRAY_SIZE (mModes); Index++) {
+    AddTestCase (TimingSuite, mModes[Index]->Name, "Timing", ReportBltTime, NULL, NULL, mModes[Index]);
+  }
+
+  Status = RunAllTestSuites (Framework);
+
+EXIT:
+  if (Framework != NULL) {
+    FreeUnitTestFramework (Framework);
+  }
+
+  return Status;
+}
+
+/**
+  Standard POSIX C entry point for host based unit test execution.
+**/
+int
+main (
+  int   argc,
+  char  *argv[]
+  )
+{
+  return UefiTestMain ();
+}
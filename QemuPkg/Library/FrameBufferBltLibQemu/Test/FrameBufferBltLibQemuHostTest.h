@@ -0,0 +1,45 @@
+/** @file
+  Declarations shared by the sources of FrameBufferBltLibQemuHostTest.
+
+  Copyright (C) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+**/
+
+#ifndef FRAME_BUFFER_BLT_LIB_QEMU_HOST_TEST_H_
+#define FRAME_BUFFER_BLT_LIB_QEMU_HOST_TEST_H_
+
+#include <Library/FrameBufferBltLib.h>
+
+/**
+  FrameBufferBltConfigure() of MdeModulePkg's FrameBufferBltLib. See
+  StockFrameBufferBltLib.c.
+**/
+RETURN_STATUS
+EFIAPI
+StockFrameBufferBltConfigure (
+  IN      VOID                                  *FrameBuffer,
+  IN      EFI_GRAPHICS_OUTPUT_MODE_INFORMATION  *FrameBufferInfo,
+  IN OUT  FRAME_BUFFER_CONFIGURE                *Configure,
+  IN OUT  UINTN                                 *ConfigureSize
+  );
+
+/**
+  FrameBufferBlt() of MdeModulePkg's FrameBufferBltLib. See
+  StockFrameBufferBltLib.c.
+**/
+RETURN_STATUS
+EFIAPI
+StockFrameBufferBlt (
+  IN     FRAME_BUFFER_CONFIGURE             *Configure,
+  IN OUT EFI_GRAPHICS_OUTPUT_BLT_PIXEL      *BltBuffer  OPTIONAL,
+  IN     EFI_GRAPHICS_OUTPUT_BLT_OPERATION  BltOperation,
+  IN     UINTN                              SourceX,
+  IN     UINTN                              SourceY,
+  IN     UINTN                              DestinationX,
+  IN     UINTN                              DestinationY,
+  IN     UINTN                              Width,
+  IN     UINTN                              Height,
+  IN     UINTN                              Delta
+  );
+
+#endif
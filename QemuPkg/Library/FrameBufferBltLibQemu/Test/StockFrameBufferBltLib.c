@@ -0,0 +1,22 @@
+/** @file
+  MdeModulePkg's FrameBufferBltLib, built with its external symbols renamed so
+  that it links next to FrameBufferBltLibQemu in FrameBufferBltLibQemuHostTest.
+
+  Copyright (C) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+**/
+
+#define FrameBufferBltConfigure                StockFrameBufferBltConfigure
+#define FrameBufferBlt                         StockFrameBufferBlt
+#define FrameBufferBltLibConfigurePixelFormat  StockFrameBufferBltLibConfigurePixelFormat
+#define FrameBufferBltLibVideoFill             StockFrameBufferBltLibVideoFill
+#define FrameBufferBltLibVideoToBltBuffer      StockFrameBufferBltLibVideoToBltBuffer
+#define FrameBufferBltLibBufferToVideo         StockFrameBufferBltLibBufferToVideo
+#define FrameBufferBltLibVideoToVideo          StockFrameBufferBltLibVideoToVideo
+#define mRgbPixelMasks                         mStockRgbPixelMasks
+#define mBgrPixelMasks                         mStockBgrPixelMasks
+
+//
+// The path is relative to this directory, in the layout of the submodules.
+//
+#include "../../../../MU_BASECORE/MdeModulePkg/Library/FrameBufferBltLib/FrameBufferBltLib.c"
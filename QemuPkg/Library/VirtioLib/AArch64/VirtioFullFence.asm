@@ -0,0 +1,23 @@
+;------------------------------------------------------------------------------
+;
+; Full memory barrier for virtio notification suppression.
+;
+; SPDX-License-Identifier: BSD-2-Clause-Patent
+;
+;------------------------------------------------------------------------------
+
+  EXPORT InternalVirtioFullFence
+  AREA VirtioFullFence, CODE, READONLY
+
+;------------------------------------------------------------------------------
+; VOID
+; EFIAPI
+; InternalVirtioFullFence (
+;   VOID
+;   );
+;------------------------------------------------------------------------------
+InternalVirtioFullFence
+  dmb     ish
+  ret
+
+  END
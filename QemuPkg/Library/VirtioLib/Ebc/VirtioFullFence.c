@@ -0,0 +1,28 @@
+/** @file
+
+  Full memory barrier for virtio notification suppression, EBC version.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Library/BaseLib.h>
+
+#include "VirtioLibInternal.h"
+
+/**
+
+  Order all earlier loads and stores before all later loads and stores.
+
+  The EBC interpreter executes memory accesses in program order, so a
+  compiler barrier suffices.
+
+**/
+VOID
+EFIAPI
+InternalVirtioFullFence (
+  VOID
+  )
+{
+  MemoryFence ();
+}
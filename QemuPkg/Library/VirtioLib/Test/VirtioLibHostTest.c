@@ -0,0 +1,932 @@
+/** @file
+  Host-based unit test of the virtio ring handling in VirtioLib.
+
+  VirtioLib is driven against a simulated loopback device, which implements
+  the device side of split (virtio-1.0, 2.4) and packed (virtio-1.1, 2.7)
+  virtqueues, including indirect descriptors, independently of VirtioLib. The
+  device copies the bytes of the device-readable buffers of every descriptor
+  chain into its device-writable buffers. Every ring layout is checked for:
+
+  - lock-step requests through VirtioFlush(), across several ring wraps,
+  - several descriptor chains in flight, completed in and out of order, and
+    collected with VirtioGetNextUsed(),
+  - used elements with a buffer ID that is not in flight.
+
+  The time a VirtioFlush() round trip takes with each layout is reported as
+  well.
+
+  Copyright (c) Microsoft Corporation
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <time.h>                             // clock()
+
+#include <Uefi.h>
+#include <IndustryStandard/Virtio10.h>        // VIRTIO_F_RING_PACKED
+#include <Library/BaseLib.h>                  // DivU64x32()
+#include <Library/BaseMemoryLib.h>            // CopyMem()
+#include <Library/DebugLib.h>                 // DEBUG()
+#include <Library/MemoryAllocationLib.h>      // AllocatePages()
+#include <Library/UefiBootServicesTableLib.h> // gBS
+#include <Library/UnitTestLib.h>              // UT_ASSERT_EQUAL()
+#include <Library/VirtioLib.h>                // VirtioFlush()
+
+#include "../VirtioLibInternal.h"
+
+#define UNIT_TEST_APP_NAME     "VirtioLib Ring Host Test"
+#define UNIT_TEST_APP_VERSION  "1.0"
+
+//
+// A small queue, so that the tests wrap around the ring many times.
+//
+#define QUEUE_SIZE  16
+
+//
+// The buffers of a request: a device-readable header and payload, and a
+// device-writable response that the loopback device fills in.
+//
+#define REQUEST_HEADER_SIZE  16
+#define REQUEST_DATA_MAX     64
+#define RESPONSE_SIZE        (REQUEST_HEADER_SIZE + REQUEST_DATA_MAX)
+
+//
+// Number of lock-step requests, and of rounds of requests in flight.
+//
+#define FLUSH_REQUESTS   (5 * QUEUE_SIZE + 3)
+#define IN_FLIGHT_ROUNDS 12
+
+//
+// Number of VirtioFlush() round trips timed per ring layout.
+//
+#define TIMING_ITERATIONS  100000
+
+typedef struct {
+  UINT16    Id;
+  UINT16    Count;    // ring descriptors taken by the chain
+  UINT32    Len;      // bytes written to the chain
+} FAKE_COMPLETION;
+
+//
+// The simulated device. VirtIo comes first, so that the protocol pointer
+// that VirtioLib passes back can be converted to the device.
+//
+typedef struct {
+  VIRTIO_DEVICE_PROTOCOL    VirtIo;
+  VRING                     *Ring;
+  //
+  // TRUE: SetQueueNotify() only fetches the available chains, and
+  // FakeDeviceComplete() marks them used.
+  //
+  BOOLEAN                   HoldCompletions;
+  //
+  // TRUE: the next used element carries a buffer ID out of range.
+  //
+  BOOLEAN                   CorruptNextId;
+  //
+  // Split ring: the free-running index of the next available element.
+  // Packed ring: the next available and used positions, and the device's
+  // wrap counters for them.
+  //
+  UINT16                    NextAvail;
+  BOOLEAN                   AvailWrap;
+  UINT16                    NextUsed;
+  BOOLEAN                   UsedWrap;
+  FAKE_COMPLETION           Pending[QUEUE_SIZE];
+  UINTN                     NumPending;
+  UINTN                     Notifies;
+  //
+  // Set when a chain violates the virtio specification.
+  //
+  BOOLEAN                   Malformed;
+} FAKE_VIRTIO_DEVICE;
+
+typedef struct {
+  CHAR8      *Name;
+  UINT64     Features;
+  BOOLEAN    Indirect;
+} RING_CONTEXT;
+
+STATIC EFI_BOOT_SERVICES   mBootServices;
+STATIC FAKE_VIRTIO_DEVICE  mDevice;
+
+/**
+  VirtioLib.c relies on an assembly routine for the full memory fence; the
+  simulated device runs synchronously, on the same thread.
+**/
+VOID
+EFIAPI
+InternalVirtioFullFence (
+  VOID
+  )
+{
+  MemoryFence ();
+}
+
+/**
+  Fake EFI_BOOT_SERVICES.Stall(). The simulated device never makes VirtioLib
+  wait.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+FakeStall (
+  IN UINTN  Microseconds
+  )
+{
+  return EFI_SUCCESS;
+}
+
+/**
+  Fake VIRTIO_DEVICE_PROTOCOL.AllocateSharedPages().
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+FakeAllocateSharedPages (
+  IN     VIRTIO_DEVICE_PROTOCOL  *This,
+  IN     UINTN                   Pages,
+  IN OUT VOID                    **HostAddress
+  )
+{
+  *HostAddress = AllocatePages (Pages);
+  return (*HostAddress == NULL) ? EFI_OUT_OF_RESOURCES : EFI_SUCCESS;
+}
+
+/**
+  Fake VIRTIO_DEVICE_PROTOCOL.FreeSharedPages().
+**/
+STATIC
+VOID
+EFIAPI
+FakeFreeSharedPages (
+  IN  VIRTIO_DEVICE_PROTOCOL  *This,
+  IN  UINTN                   Pages,
+  IN  VOID                    *HostAddress
+  )
+{
+  FreePages (HostAddress, Pages);
+}
+
+/**
+  Fake VIRTIO_DEVICE_PROTOCOL.MapSharedBuffer(). Device addresses equal host
+  addresses.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+FakeMapSharedBuffer (
+  IN     VIRTIO_DEVICE_PROTOCOL  *This,
+  IN     VIRTIO_MAP_OPERATION    Operation,
+  IN     VOID                    *HostAddress,
+  IN OUT UINTN                   *NumberOfBytes,
+  OUT    EFI_PHYSICAL_ADDRESS    *DeviceAddress,
+  OUT    VOID                    **Mapping
+  )
+{
+  *DeviceAddress = (EFI_PHYSICAL_ADDRESS)(UINTN)HostAddress;
+  *Mapping       = HostAddress;
+  return EFI_SUCCESS;
+}
+
+/**
+  Fake VIRTIO_DEVICE_PROTOCOL.UnmapSharedBuffer().
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+FakeUnmapSharedBuffer (
+  IN  VIRTIO_DEVICE_PROTOCOL  *This,
+  IN  VOID                    *Mapping
+  )
+{
+  return EFI_SUCCESS;
+}
+
+/**
+  Carry out the loopback operation for one buffer of a descriptor chain.
+
+  @param[in]     Addr      The device address of the buffer.
+  @param[in]     Len       The size of the buffer.
+  @param[in]     Write     TRUE if the buffer is device-writable.
+  @param[in,out] Staging   The bytes read from the chain so far.
+  @param[in,out] Read      The number of bytes in Staging.
+  @param[in,out] Written   The number of bytes written to the chain so far.
+**/
+STATIC
+VOID
+FakeDeviceBuffer (
+  IN     UINT64  Addr,
+  IN     UINT32  Len,
+  IN     BOOLEAN Write,
+  IN OUT UINT8   *Staging,
+  IN OUT UINT32  *Read,
+  IN OUT UINT32  *Written
+  )
+{
+  UINT32  Count;
+
+  if (!Write) {
+    if (*Written != 0) {
+      //
+      // virtio-1.0, 2.4.4.2: device-readable buffers come first.
+      //
+      mDevice.Malformed = TRUE;
+      return;
+    }
+
+    Count = MIN (Len, RESPONSE_SIZE - *Read);
+    CopyMem (Staging + *Read, (VOID *)(UINTN)Addr, Count);
+    *Read += Count;
+    return;
+  }
+
+  Count = MIN (Len, *Read - *Written);
+  CopyMem ((VOID *)(UINTN)Addr, Staging + *Written, Count);
+  *Written += Count;
+}
+
+/**
+  Fetch the next available chain of the split ring.
+
+  @param[out] Completion  The used element to produce for the chain.
+
+  @retval FALSE  No chain is available.
+**/
+STATIC
+BOOLEAN
+FakeDeviceFetchSplit (
+  OUT FAKE_COMPLETION  *Completion
+  )
+{
+  VRING                         *Ring;
+  volatile CONST VRING_DESC     *Table;
+  UINT32                        TableSize;
+  UINT16                        Index;
+  UINT32                        Hops;
+  UINT8                         Staging[RESPONSE_SIZE];
+  UINT32                        Read;
+  UINT32                        Written;
+
+  Ring = mDevice.Ring;
+  if (*Ring->Avail.Idx == mDevice.NextAvail) {
+    return FALSE;
+  }
+
+  MemoryFence ();
+  Completion->Id    = Ring->Avail.Ring[mDevice.NextAvail++ % Ring->QueueSize];
+  Completion->Count = 1;
+
+  Table     = Ring->Desc;
+  TableSize = Ring->QueueSize;
+  Index     = Completion->Id;
+  if ((Table[Index].Flags & VRING_DESC_F_INDIRECT) != 0) {
+    //
+    // virtio-1.0, 2.4.5.3.1: an indirect descriptor is alone in its chain.
+    //
+    if ((Table[Index].Flags & VRING_DESC_F_NEXT) != 0) {
+      mDevice.Malformed = TRUE;
+    }
+
+    TableSize = Table[Index].Len / sizeof (VRING_DESC);
+    Table     = (volatile CONST VRING_DESC *)(UINTN)Table[Index].Addr;
+    Index     = 0;
+  }
+
+  Read    = 0;
+  Written = 0;
+  for (Hops = 0; Hops < TableSize; Hops++) {
+    if ((Index >= TableSize) || ((Table[Index].Flags & VRING_DESC_F_INDIRECT) != 0)) {
+      mDevice.Malformed = TRUE;
+      break;
+    }
+
+    FakeDeviceBuffer (
+      Table[Index].Addr,
+      Table[Index].Len,
+      (BOOLEAN)((Table[Index].Flags & VRING_DESC_F_WRITE) != 0),
+      Staging,
+      &Read,
+      &Written
+      );
+    if ((Table[Index].Flags & VRING_DESC_F_NEXT) == 0) {
+      break;
+    }
+
+    Index = Table[Index].Next;
+  }
+
+  if (Hops == TableSize) {
+    mDevice.Malformed = TRUE;
+  }
+
+  Completion->Len = Written;
+  return TRUE;
+}
+
+/**
+  Fetch the next available chain of the packed ring.
+
+  @param[out] Completion  The used element to produce for the chain.
+
+  @retval FALSE  No chain is available.
+**/
+STATIC
+BOOLEAN
+FakeDeviceFetchPacked (
+  OUT FAKE_COMPLETION  *Completion
+  )
+{
+  VRING                              *Ring;
+  volatile CONST VRING_PACKED_DESC   *Desc;
+  volatile CONST VRING_PACKED_DESC   *Table;
+  UINT16                             Flags;
+  UINT16                             Position;
+  UINT32                             Index;
+  UINT8                              Staging[RESPONSE_SIZE];
+  UINT32                             Read;
+  UINT32                             Written;
+
+  Ring  = mDevice.Ring;
+  Desc  = &Ring->Packed.Desc[mDevice.NextAvail];
+  Flags = Desc->Flags;
+
+  //
+  // virtio-1.1, 2.7.1: the descriptor is available if its AVAIL flag matches
+  // the device's wrap counter, and its USED flag does not.
+  //
+  if ((((Flags & VRING_PACKED_DESC_F_AVAIL) != 0) != mDevice.AvailWrap) ||
+      (((Flags & VRING_PACKED_DESC_F_USED) != 0) == mDevice.AvailWrap))
+  {
+    return FALSE;
+  }
+
+  MemoryFence ();
+  Read              = 0;
+  Written           = 0;
+  Completion->Count = 0;
+  Position          = mDevice.NextAvail;
+  do {
+    Desc  = &Ring->Packed.Desc[Position];
+    Flags = Desc->Flags;
+    if ((Flags & VRING_DESC_F_INDIRECT) != 0) {
+      //
+      // virtio-1.1, 2.7.7: the entries of an indirect table are consecutive.
+      //
+      if ((Flags & VRING_DESC_F_NEXT) != 0) {
+        mDevice.Malformed = TRUE;
+      }
+
+      Table = (volatile CONST VRING_PACKED_DESC *)(UINTN)Desc->Addr;
+      for (Index = 0; Index < Desc->Len / sizeof (VRING_PACKED_DESC); Index++) {
+        FakeDeviceBuffer (
+          Table[Index].Addr,
+          Table[Index].Len,
+          (BOOLEAN)((Table[Index].Flags & VRING_DESC_F_WRITE) != 0),
+          Staging,
+          &Read,
+          &Written
+          );
+      }
+    } else {
+      FakeDeviceBuffer (
+        Desc->Addr,
+        Desc->Len,
+        (BOOLEAN)((Flags & VRING_DESC_F_WRITE) != 0),
+        Staging,
+        &Read,
+        &Written
+        );
+    }
+
+    //
+    // virtio-1.1, 2.7.6: the buffer ID is taken from the last descriptor.
+    //
+    Completion->Id = Desc->Id;
+    ++Completion->Count;
+    if (++mDevice.NextAvail == Ring->QueueSize) {
+      mDevice.NextAvail = 0;
+      mDevice.AvailWrap = !mDevice.AvailWrap;
+    }
+
+    Position = mDevice.NextAvail;
+  } while ((Flags & VRING_DESC_F_NEXT) != 0 && Completion->Count < Ring->QueueSize);
+
+  if ((Flags & VRING_DESC_F_NEXT) != 0) {
+    mDevice.Malformed = TRUE;
+  }
+
+  Completion->Len = Written;
+  return TRUE;
+}
+
+/**
+  Produce the used element for a chain.
+
+  @param[in] Completion  The used element.
+**/
+STATIC
+VOID
+FakeDeviceUse (
+  IN CONST FAKE_COMPLETION  *Completion
+  )
+{
+  VRING                       *Ring;
+  volatile VRING_PACKED_DESC  *Desc;
+  UINT32                      Id;
+  UINT16                      Position;
+
+  Ring = mDevice.Ring;
+  Id   = Completion->Id;
+  if (mDevice.CorruptNextId) {
+    mDevice.CorruptNextId = FALSE;
+    Id                    = Ring->QueueSize + 1;
+  }
+
+  if (!Ring->IsPacked) {
+    Ring->Used.UsedElem[*Ring->Used.Idx % Ring->QueueSize].Id  = Id;
+    Ring->Used.UsedElem[*Ring->Used.Idx % Ring->QueueSize].Len = Completion->Len;
+    MemoryFence ();
+    ++*Ring->Used.Idx;
+    return;
+  }
+
+  //
+  // virtio-1.1, 2.7.14: one used descriptor per chain, written at the device's
+  // used position, which then skips the rest of the chain.
+  //
+  Desc      = &Ring->Packed.Desc[mDevice.NextUsed];
+  Desc->Id  = (UINT16)Id;
+  Desc->Len = Completion->Len;
+  MemoryFence ();
+  Desc->Flags = mDevice.UsedWrap ?
+                (VRING_PACKED_DESC_F_AVAIL | VRING_PACKED_DESC_F_USED) :
+                0;
+
+  Position = (UINT16)(mDevice.NextUsed + Completion->Count);
+  if (Position >= Ring->QueueSize) {
+    Position         -= Ring->QueueSize;
+    mDevice.UsedWrap  = !mDevice.UsedWrap;
+  }
+
+  mDevice.NextUsed = Position;
+}
+
+/**
+  Mark the chains fetched by SetQueueNotify() used.
+
+  @param[in] Reverse  TRUE to complete the chains in the opposite order.
+**/
+STATIC
+VOID
+FakeDeviceComplete (
+  IN BOOLEAN  Reverse
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < mDevice.NumPending; Index++) {
+    FakeDeviceUse (&mDevice.Pending[Reverse ? mDevice.NumPending - 1 - Index : Index]);
+  }
+
+  mDevice.NumPending = 0;
+}
+
+/**
+  Fake VIRTIO_DEVICE_PROTOCOL.SetQueueNotify(): process the available chains.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+FakeSetQueueNotify (
+  IN VIRTIO_DEVICE_PROTOCOL  *This,
+  IN UINT16                  Index
+  )
+{
+  FAKE_COMPLETION  *Completion;
+  BOOLEAN          Fetched;
+
+  ++mDevice.Notifies;
+  do {
+    if (mDevice.NumPending == ARRAY_SIZE (mDevice.Pending)) {
+      mDevice.Malformed = TRUE;
+      break;
+    }
+
+    Completion = &mDevice.Pending[mDevice.NumPending];
+    Fetched    = mDevice.Ring->IsPacked ?
+                 FakeDeviceFetchPacked (Completion) :
+                 FakeDeviceFetchSplit (Completion);
+    if (Fetched) {
+      ++mDevice.NumPending;
+    }
+  } while (Fetched);
+
+  if (!mDevice.HoldCompletions) {
+    FakeDeviceComplete (FALSE);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Set up a ring in the layout of a RING_CONTEXT, and reset the simulated
+  device to serve it.
+
+  @param[in]  Context  The RING_CONTEXT.
+  @param[out] Ring     The ring.
+
+  @return  Status codes from VirtioRingInitEx() and VirtioRingInitIndirect().
+**/
+STATIC
+EFI_STATUS
+SetUpRing (
+  IN  RING_CONTEXT  *Context,
+  OUT VRING         *Ring
+  )
+{
+  EFI_STATUS  Status;
+
+  ZeroMem (&mDevice, sizeof (mDevice));
+  mDevice.VirtIo.Revision            = VIRTIO_SPEC_REVISION (1, 0, 0);
+  mDevice.VirtIo.SetQueueNotify      = FakeSetQueueNotify;
+  mDevice.VirtIo.AllocateSharedPages = FakeAllocateSharedPages;
+  mDevice.VirtIo.FreeSharedPages     = FakeFreeSharedPages;
+  mDevice.VirtIo.MapSharedBuffer     = FakeMapSharedBuffer;
+  mDevice.VirtIo.UnmapSharedBuffer   = FakeUnmapSharedBuffer;
+  mDevice.AvailWrap                  = TRUE;
+  mDevice.UsedWrap                   = TRUE;
+  mDevice.Ring                       = Ring;
+
+  Status = VirtioRingInitEx (&mDevice.VirtIo, QUEUE_SIZE, Context->Features, Ring);
+  if (EFI_ERROR (Status) || !Context->Indirect) {
+    return Status;
+  }
+
+  Status = VirtioRingInitIndirect (&mDevice.VirtIo, Ring, QUEUE_SIZE, 3);
+  if (EFI_ERROR (Status)) {
+    VirtioRingUninit (&mDevice.VirtIo, Ring);
+  }
+
+  return Status;
+}
+
+/**
+  Build a request chain: the header and the payload for the device to read,
+  and the response buffer for the device to write.
+
+  @param[in,out] Ring      The ring.
+  @param[in]     HeadIdx   The identifier of the chain.
+  @param[in]     Header    The header, REQUEST_HEADER_SIZE bytes.
+  @param[in]     Data      The payload.
+  @param[in]     DataSize  The size of the payload, at most REQUEST_DATA_MAX.
+  @param[out]    Response  The response buffer, RESPONSE_SIZE bytes.
+  @param[out]    Indices   The chain, ready for submission.
+**/
+STATIC
+VOID
+BuildRequest (
+  IN OUT VRING         *Ring,
+  IN     UINT16        HeadIdx,
+  IN     CONST UINT8   *Header,
+  IN     CONST UINT8   *Data,
+  IN     UINT32        DataSize,
+  OUT    UINT8         *Response,
+  OUT    DESC_INDICES  *Indices
+  )
+{
+  VirtioPrepareChain (Ring, HeadIdx, Indices);
+  VirtioAppendDesc (Ring, (UINTN)Header, REQUEST_HEADER_SIZE, VRING_DESC_F_NEXT, Indices);
+  VirtioAppendDesc (Ring, (UINTN)Data, DataSize, VRING_DESC_F_NEXT, Indices);
+  VirtioAppendDesc (Ring, (UINTN)Response, RESPONSE_SIZE, VRING_DESC_F_WRITE, Indices);
+}
+
+/**
+  Send requests in lock-step through VirtioFlush(), and check the loopback
+  responses.
+
+  @param[in] Context  The RING_CONTEXT of the ring layout.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+FlushLoopback (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  VRING         Ring;
+  DESC_INDICES  Indices;
+  UINT8         Header[REQUEST_HEADER_SIZE];
+  UINT8         Data[REQUEST_DATA_MAX];
+  UINT8         Response[RESPONSE_SIZE];
+  UINT32        DataSize;
+  UINT32        UsedLen;
+  UINTN         Request;
+  EFI_STATUS    Status;
+
+  UT_ASSERT_NOT_EFI_ERROR (SetUpRing (Context, &Ring));
+
+  for (Request = 0; Request < FLUSH_REQUESTS; Request++) {
+    DataSize = 1 + (UINT32)(Request % REQUEST_DATA_MAX);
+    SetMem (Header, sizeof (Header), (UINT8)Request);
+    SetMem (Data, sizeof (Data), (UINT8)~Request);
+    SetMem (Response, sizeof (Response), 0xCC);
+
+    BuildRequest (&Ring, 0, Header, Data, DataSize, Response, &Indices);
+    Status = VirtioFlush (&mDevice.VirtIo, 0, &Ring, &Indices, &UsedLen);
+    if (EFI_ERROR (Status) || (UsedLen != REQUEST_HEADER_SIZE + DataSize) ||
+        (CompareMem (Response, Header, REQUEST_HEADER_SIZE) != 0) ||
+        (CompareMem (Response + REQUEST_HEADER_SIZE, Data, DataSize) != 0))
+    {
+      UT_LOG_ERROR ("Request %u: %r, UsedLen %u\n", (UINT32)Request, Status, UsedLen);
+      break;
+    }
+  }
+
+  VirtioRingUninit (&mDevice.VirtIo, &Ring);
+
+  UT_ASSERT_FALSE (mDevice.Malformed);
+  UT_ASSERT_EQUAL (Request, FLUSH_REQUESTS);
+  UT_ASSERT_EQUAL (mDevice.Notifies, FLUSH_REQUESTS);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Keep QUEUE_SIZE / 2 chains in flight per round, have the device complete
+  them in order in even rounds and in reverse order in odd rounds, and collect
+  them with VirtioGetNextUsed().
+
+  @param[in] Context  The RING_CONTEXT of the ring layout.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+InFlightOutOfOrder (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  VRING             Ring;
+  DESC_INDICES      Indices;
+  UINT8             Header[QUEUE_SIZE][REQUEST_HEADER_SIZE];
+  UINT8             Data[QUEUE_SIZE];
+  UINT8             Response[QUEUE_SIZE][RESPONSE_SIZE];
+  BOOLEAN           Collected[QUEUE_SIZE];
+  UINT16            LastUsedIdx;
+  UINT16            HeadIdx;
+  UINT32            UsedLen;
+  UINTN             Round;
+  UINTN             Chain;
+  UINTN             NumCollected;
+  UNIT_TEST_STATUS  TestStatus;
+
+  UT_ASSERT_NOT_EFI_ERROR (SetUpRing (Context, &Ring));
+  mDevice.HoldCompletions = TRUE;
+
+  TestStatus  = UNIT_TEST_ERROR_TEST_FAILED;
+  LastUsedIdx = 0;
+  for (Round = 0; Round < IN_FLIGHT_ROUNDS; Round++) {
+    //
+    // Chain #N is identified by 2 * N: on a split ring without indirect
+    // descriptors, it takes the descriptors from there on.
+    //
+    for (Chain = 0; Chain < QUEUE_SIZE / 2; Chain++) {
+      SetMem (Header[Chain], REQUEST_HEADER_SIZE, (UINT8)(Round * QUEUE_SIZE + Chain));
+      Data[Chain] = (UINT8)Round;
+      SetMem (Response[Chain], RESPONSE_SIZE, 0xCC);
+      Collected[Chain] = FALSE;
+
+      VirtioPrepareChain (&Ring, (UINT16)(2 * Chain), &Indices);
+      VirtioAppendDesc (&Ring, (UINTN)Header[Chain], REQUEST_HEADER_SIZE, VRING_DESC_F_NEXT, &Indices);
+      VirtioAppendDesc (&Ring, (UINTN)Response[Chain], RESPONSE_SIZE, VRING_DESC_F_WRITE, &Indices);
+      VirtioSubmitChain (&Ring, &Indices);
+    }
+
+    if (!VirtioNeedNotify (&Ring)) {
+      UT_LOG_ERROR ("Round %u: no notification\n", (UINT32)Round);
+      goto Done;
+    }
+
+    mDevice.VirtIo.SetQueueNotify (&mDevice.VirtIo, 0);
+    if (VirtioGetNextUsed (&Ring, &LastUsedIdx, &HeadIdx, &UsedLen) != EFI_NOT_READY) {
+      UT_LOG_ERROR ("Round %u: used element before completion\n", (UINT32)Round);
+      goto Done;
+    }
+
+    FakeDeviceComplete ((BOOLEAN)((Round & 1) != 0));
+
+    NumCollected = 0;
+    while (VirtioGetNextUsed (&Ring, &LastUsedIdx, &HeadIdx, &UsedLen) == EFI_SUCCESS) {
+      Chain = HeadIdx / 2;
+      if (((HeadIdx & 1) != 0) || (Chain >= QUEUE_SIZE / 2) || Collected[Chain] ||
+          (UsedLen != REQUEST_HEADER_SIZE) ||
+          (CompareMem (Response[Chain], Header[Chain], REQUEST_HEADER_SIZE) != 0))
+      {
+        UT_LOG_ERROR ("Round %u: bad used element %u, UsedLen %u\n", (UINT32)Round, HeadIdx, UsedLen);
+        goto Done;
+      }
+
+      Collected[Chain] = TRUE;
+      ++NumCollected;
+    }
+
+    if (NumCollected != QUEUE_SIZE / 2) {
+      UT_LOG_ERROR ("Round %u: %u used elements\n", (UINT32)Round, (UINT32)NumCollected);
+      goto Done;
+    }
+  }
+
+  TestStatus = UNIT_TEST_PASSED;
+
+Done:
+  VirtioRingUninit (&mDevice.VirtIo, &Ring);
+  UT_ASSERT_FALSE (mDevice.Malformed);
+  return TestStatus;
+}
+
+/**
+  Have the device report a buffer ID that is not in flight, and check that
+  VirtioGetNextUsed() rejects it without losing its place in the ring.
+
+  @param[in] Context  The RING_CONTEXT of the ring layout.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+RejectBadId (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  VRING         Ring;
+  DESC_INDICES  Indices;
+  UINT8         Header[REQUEST_HEADER_SIZE];
+  UINT8         Response[RESPONSE_SIZE];
+  UINT16        LastUsedIdx;
+  UINT16        HeadIdx;
+  UINT32        UsedLen;
+  EFI_STATUS    Status;
+
+  UT_ASSERT_NOT_EFI_ERROR (SetUpRing (Context, &Ring));
+  mDevice.CorruptNextId = TRUE;
+
+  SetMem (Header, sizeof (Header), 0x5A);
+  VirtioPrepareChain (&Ring, 0, &Indices);
+  VirtioAppendDesc (&Ring, (UINTN)Header, sizeof (Header), VRING_DESC_F_NEXT, &Indices);
+  VirtioAppendDesc (&Ring, (UINTN)Response, sizeof (Response), VRING_DESC_F_WRITE, &Indices);
+  VirtioSubmitChain (&Ring, &Indices);
+  mDevice.VirtIo.SetQueueNotify (&mDevice.VirtIo, 0);
+
+  LastUsedIdx = 0;
+  Status      = VirtioGetNextUsed (&Ring, &LastUsedIdx, &HeadIdx, &UsedLen);
+  VirtioRingUninit (&mDevice.VirtIo, &Ring);
+
+  UT_ASSERT_STATUS_EQUAL (Status, EFI_PROTOCOL_ERROR);
+  //
+  // A split ring skips the bad element; a packed ring can't tell how many
+  // descriptors to skip, so the cursor stays.
+  //
+  if ((((RING_CONTEXT *)Context)->Features & VIRTIO_F_RING_PACKED) != 0) {
+    UT_ASSERT_EQUAL (LastUsedIdx, 0);
+  } else {
+    UT_ASSERT_EQUAL (LastUsedIdx, 1);
+  }
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Report the time a VirtioFlush() round trip takes. There is no pass / fail
+  criterion, as host timings are too noisy for one.
+
+  @param[in] Context  The RING_CONTEXT of the ring layout.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+ReportFlushTime (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  RING_CONTEXT  *Ring;
+  VRING         VRing;
+  DESC_INDICES  Indices;
+  UINT8         Header[REQUEST_HEADER_SIZE];
+  UINT8         Data[REQUEST_DATA_MAX];
+  UINT8         Response[RESPONSE_SIZE];
+  UINTN         Iteration;
+  clock_t       Start;
+  UINT64        FlushNs;
+
+  Ring = Context;
+  UT_ASSERT_NOT_EFI_ERROR (SetUpRing (Ring, &VRing));
+
+  SetMem (Header, sizeof (Header), 0x5A);
+  SetMem (Data, sizeof (Data), 0xA5);
+
+  Start = clock ();
+  for (Iteration = 0; Iteration < TIMING_ITERATIONS; Iteration++) {
+    BuildRequest (&VRing, 0, Header, Data, sizeof (Data), Response, &Indices);
+    VirtioFlush (&mDevice.VirtIo, 0, &VRing, &Indices, NULL);
+  }
+
+  FlushNs = DivU64x32 (
+              MultU64x32 ((UINT64)(clock () - Start), 1000000000 / CLOCKS_PER_SEC),
+              TIMING_ITERATIONS
+              );
+  VirtioRingUninit (&mDevice.VirtIo, &VRing);
+
+  UT_LOG_INFO ("%a: %Lu ns per VirtioFlush() round trip\n", Ring->Name, FlushNs);
+  //
+  // The unit test log only goes to the report; show the numbers on the console
+  // too.
+  //
+  DEBUG ((DEBUG_ERROR, "%a: %Lu ns per VirtioFlush() round trip\n", Ring->Name, FlushNs));
+  return UNIT_TEST_PASSED;
+}
+
+STATIC RING_CONTEXT  mSplitRing          = { "split", 0, FALSE };
+STATIC RING_CONTEXT  mSplitIndirectRing  = { "split, indirect", VIRTIO_F_RING_INDIRECT_DESC, TRUE };
+STATIC RING_CONTEXT  mPackedRing         = { "packed", VIRTIO_F_RING_PACKED, FALSE };
+STATIC RING_CONTEXT  mPackedIndirectRing = { "packed, indirect", VIRTIO_F_RING_PACKED | VIRTIO_F_RING_INDIRECT_DESC, TRUE };
+
+STATIC RING_CONTEXT  *mRings[] = {
+  &mSplitRing,
+  &mSplitIndirectRing,
+  &mPackedRing,
+  &mPackedIndirectRing
+};
+
+/**
+  Initialize the unit test framework, suites, and test cases, and run them.
+
+  @retval EFI_SUCCESS  All test cases were dispatched.
+  @return              Error codes from the unit test framework.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+UefiTestMain (
+  VOID
+  )
+{
+  EFI_STATUS                  Status;
+  UNIT_TEST_FRAMEWORK_HANDLE  Framework;
+  UNIT_TEST_SUITE_HANDLE      RingSuite;
+  UNIT_TEST_SUITE_HANDLE      TimingSuite;
+  UINTN                       Index;
+
+  Framework = NULL;
+
+  DEBUG ((DEBUG_INFO, "%a v%a\n", UNIT_TEST_APP_NAME, UNIT_TEST_APP_VERSION));
+
+  mBootServices.Stall = FakeStall;
+  gBS                 = &mBootServices;
+
+  Status = InitUnitTestFramework (&Framework, UNIT_TEST_APP_NAME, gEfiCallerBaseName, UNIT_TEST_APP_VERSION);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in InitUnitTestFramework. Status = %r\n", Status));
+    goto EXIT;
+  }
+
+  Status = CreateUnitTestSuite (&RingSuite, Framework, "Virtio ring against a simulated device", "QemuPkg.VirtioLib.Ring", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in CreateUnitTestSuite for the ring suite\n"));
+    goto EXIT;
+  }
+
+  for (Index = 0; Index < ARRAY_SIZE (mRings); Index++) {
+    AddTestCase (RingSuite, "Lock-step requests through VirtioFlush()", "Flush", FlushLoopback, NULL, NULL, mRings[Index]);
+    AddTestCase (RingSuite, "Chains in flight, completed out of order", "InFlight", InFlightOutOfOrder, NULL, NULL, mRings[Index]);
+    AddTestCase (RingSuite, "Used element with a bad buffer ID", "BadId", RejectBadId, NULL, NULL, mRings[Index]);
+  }
+
+  Status = CreateUnitTestSuite (&TimingSuite, Framework, "Virtio ring timing", "QemuPkg.VirtioLib.Timing", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in CreateUnitTestSuite for the timing suite\n"));
+    goto EXIT;
+  }
+
+  for (Index = 0; Index < ARRAY_SIZE (mRings); Index++) {
+    AddTestCase (TimingSuite, mRings[Index]->Name, "Flush", ReportFlushTime, NULL, NULL, mRings[Index]);
+  }
+
+  Status = RunAllTestSuites (Framework);
+
+EXIT:
+  if (Framework != NULL) {
+    FreeUnitTestFramework (Framework);
+  }
+
+  return Status;
+}
+
+/**
+  Standard POSIX C entry point for host based unit test execution.
+**/
+int
+main (
+  int   argc,
+  char  *argv[]
+  )
+{
+  return UefiTestMain ();
+}
@@ -13,10 +13,123 @@
 #include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 
+#include <IndustryStandard/Virtio10.h>
 #include <Library/VirtioLib.h>
 
+#include "VirtioLibInternal.h"
+
+/**
+
+  Advance a packed ring cursor by Count descriptors.
+
+  @param[in] Ring    The packed virtio ring that the cursor belongs to.
+
+  @param[in] Cursor  The cursor to advance, see VRING_PACKED.
+
+  @param[in] Count   The number of descriptors to advance by, at most
+                     Ring->QueueSize.
+
+  @return  The advanced cursor; the wrap counter is flipped when the cursor
+           wraps around the end of the descriptor ring.
+
+**/
+STATIC
+UINT16
+VirtioPackedAdvance (
+  IN CONST VRING  *Ring,
+  IN UINT16       Cursor,
+  IN UINT16       Count
+  )
+{
+  UINT32  Position;
+  UINT16  Phase;
+
+  ASSERT (Count <= Ring->QueueSize);
+
+  Position = (UINT32)(Cursor & ~VRING_PACKED_CURSOR_PHASE) + Count;
+  Phase    = Cursor & VRING_PACKED_CURSOR_PHASE;
+  if (Position >= Ring->QueueSize) {
+    Position -= Ring->QueueSize;
+    Phase    ^= VRING_PACKED_CURSOR_PHASE;
+  }
+
+  return (UINT16)(Position | Phase);
+}
+
+/**
+
+  Compute the number of descriptors between two packed ring cursors.
+
+  @param[in] Ring  The packed virtio ring that the cursors belong to.
+
+  @param[in] From  The earlier cursor, see VRING_PACKED.
+
+  @param[in] To    The later cursor, at most Ring->QueueSize descriptors
+                   ahead of From.
+
+  @return  The number of descriptors that VirtioPackedAdvance() would have to
+           advance From by, in order to reach To.
+
+**/
+STATIC
+UINT16
+VirtioPackedDistance (
+  IN CONST VRING  *Ring,
+  IN UINT16       From,
+  IN UINT16       To
+  )
+{
+  UINT16  Distance;
+
+  Distance = (UINT16)((To & ~VRING_PACKED_CURSOR_PHASE) -
+                      (From & ~VRING_PACKED_CURSOR_PHASE));
+  if ((To & VRING_PACKED_CURSOR_PHASE) != (From & VRING_PACKED_CURSOR_PHASE)) {
+    Distance += Ring->QueueSize;
+  }
+
+  return Distance;
+}
+
+/**
+
+  Compute the descriptor flags that mark a packed ring descriptor available
+  (from the driver's point of view) or used (from the device's point of view),
+  at the ring position identified by Cursor.
+
+  @param[in] Cursor  A cursor of the packed ring, see VRING_PACKED.
+
+  @param[in] Used    FALSE for the available pattern, TRUE for the used
+                     pattern.
+
+  @return  A combination of VRING_PACKED_DESC_F_AVAIL and
+           VRING_PACKED_DESC_F_USED.
+
+**/
+STATIC
+UINT16
+VirtioPackedFlags (
+  IN UINT16   Cursor,
+  IN BOOLEAN  Used
+  )
+{
+  BOOLEAN  WrapCounter;
+
+  WrapCounter = (BOOLEAN)((Cursor & VRING_PACKED_CURSOR_PHASE) == 0);
+  if (Used) {
+    return WrapCounter ?
+           (VRING_PACKED_DESC_F_AVAIL | VRING_PACKED_DESC_F_USED) :
+           0;
+  }
+
+  return WrapCounter ?
+         VRING_PACKED_DESC_F_AVAIL :
+         VRING_PACKED_DESC_F_USED;
+}
+
 /**
 
   Configure a virtio ring.
@@ -51,11 +164,108 @@ VirtioRingInit (
   IN  UINT16                  QueueSize,
   OUT VRING                   *Ring
   )
+{
+  return VirtioRingInitEx (VirtIo, QueueSize, 0, Ring);
+}
+
+/**
+
+  Configure a virtio ring, in the layout selected by the negotiated features.
+
+  If Features contains VIRTIO_F_RING_PACKED, then a packed ring is set up
+  (virtio-1.1, 2.7 Packed Virtqueues); the descriptor ring is followed by the
+  driver and device event suppression structures. Otherwise, the function
+  sets up a split ring, like VirtioRingInit().
+
+  If Features contains VIRTIO_F_RING_EVENT_IDX, then VirtioNeedNotify() and
+  VirtioPrepareChain() use the event index mechanism for suppressing
+  notifications (virtio-1.0, 2.4.7 and 2.4.9).
+
+  @param[in]  VirtIo            The virtio device which will use the ring.
+
+  @param[in]  QueueSize         The number of descriptors to allocate for the
+                                virtio ring, as requested by the host.
+
+  @param[in]  Features          The feature bits that the driver negotiated
+                                (or is about to negotiate) with the device.
+
+  @param[out] Ring              The virtio ring to set up.
+
+  @retval EFI_OUT_OF_RESOURCES  Failed to allocate the guest-private chain
+                                length array of a packed ring.
+
+  @return                       Status codes propagated from
+                                VirtIo->AllocateSharedPages().
+
+  @retval EFI_SUCCESS           Allocation and setup successful. The ring is
+                                released with VirtioRingUninit().
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioRingInitEx (
+  IN  VIRTIO_DEVICE_PROTOCOL  *VirtIo,
+  IN  UINT16                  QueueSize,
+  IN  UINT64                  Features,
+  OUT VRING                   *Ring
+  )
 {
   EFI_STATUS      Status;
   UINTN           RingSize;
   volatile UINT8  *RingPagesPtr;
 
+  if ((Features & VIRTIO_F_RING_PACKED) != 0) {
+    Ring->Packed.ChainLen = AllocateZeroPool (
+                              QueueSize * sizeof *Ring->Packed.ChainLen
+                              );
+    if (Ring->Packed.ChainLen == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    RingSize = ALIGN_VALUE (
+                 sizeof *Ring->Packed.Desc        * QueueSize +
+                 sizeof *Ring->Packed.DriverEvent             +
+                 sizeof *Ring->Packed.DeviceEvent,
+                 EFI_PAGE_SIZE
+                 );
+
+    Ring->NumPages = EFI_SIZE_TO_PAGES (RingSize);
+    Status         = VirtIo->AllocateSharedPages (
+                               VirtIo,
+                               Ring->NumPages,
+                               &Ring->Base
+                               );
+    if (EFI_ERROR (Status)) {
+      FreePool (Ring->Packed.ChainLen);
+      return Status;
+    }
+
+    SetMem (Ring->Base, RingSize, 0x00);
+    RingPagesPtr = Ring->Base;
+
+    Ring->Packed.Desc = (volatile VOID *)RingPagesPtr;
+    RingPagesPtr     += sizeof *Ring->Packed.Desc * QueueSize;
+
+    Ring->Packed.DriverEvent = (volatile VOID *)RingPagesPtr;
+    RingPagesPtr            += sizeof *Ring->Packed.DriverEvent;
+
+    Ring->Packed.DeviceEvent = (volatile VOID *)RingPagesPtr;
+    RingPagesPtr            += sizeof *Ring->Packed.DeviceEvent;
+
+    Ring->Packed.NextAvail = 0;
+    Ring->Desc             = NULL;
+    ZeroMem (&Ring->Avail, sizeof Ring->Avail);
+    ZeroMem (&Ring->Used, sizeof Ring->Used);
+    Ring->IsPacked    = TRUE;
+    Ring->QueueSize   = QueueSize;
+    Ring->EventIdx    = (BOOLEAN)((Features & VIRTIO_F_RING_EVENT_IDX) != 0);
+    Ring->LastKickIdx = 0;
+    ZeroMem (&Ring->WaitStats, sizeof Ring->WaitStats);
+    ZeroMem (&Ring->NotifyStats, sizeof Ring->NotifyStats);
+    ZeroMem (&Ring->Indirect, sizeof Ring->Indirect);
+    return EFI_SUCCESS;
+  }
+
   RingSize = ALIGN_VALUE (
                sizeof *Ring->Desc            * QueueSize +
                sizeof *Ring->Avail.Flags                 +
@@ -122,7 +332,110 @@ VirtioRingInit (
   Ring->Used.AvailEvent = (volatile VOID *)RingPagesPtr;
   RingPagesPtr         += sizeof *Ring->Used.AvailEvent;
 
-  Ring->QueueSize = QueueSize;
+  Ring->IsPacked = FALSE;
+  ZeroMem (&Ring->Packed, sizeof Ring->Packed);
+  Ring->QueueSize   = QueueSize;
+  Ring->EventIdx    = (BOOLEAN)((Features & VIRTIO_F_RING_EVENT_IDX) != 0);
+  Ring->LastKickIdx = 0;
+  ZeroMem (&Ring->WaitStats, sizeof Ring->WaitStats);
+  ZeroMem (&Ring->NotifyStats, sizeof Ring->NotifyStats);
+  ZeroMem (&Ring->Indirect, sizeof Ring->Indirect);
+  return EFI_SUCCESS;
+}
+
+/**
+
+  Set up indirect descriptor tables for a configured virtio ring.
+
+  This function implements virtio-1.0, 2.4.5.3 Indirect Descriptors, and
+  virtio-1.1, 2.7.7 Indirect Flag: Scatter-Gather Support. After it succeeds,
+  VirtioAppendDesc() places descriptors in the indirect table that belongs to
+  the descriptor chain being built, and VirtioSubmitChain() makes the chain
+  available to the host through a single VRING_DESC_F_INDIRECT descriptor.
+  Thus every descriptor chain occupies exactly one descriptor of the ring,
+  independently of its length.
+
+  The tables are allocated and mapped for bus master common buffer operation
+  once, here; they are released by VirtioRingUninit().
+
+  The caller is responsible for having negotiated
+  VIRTIO_F_RING_INDIRECT_DESC with the device.
+
+  @param[in]     VirtIo     The virtio device which uses the ring.
+
+  @param[in,out] Ring       The virtio ring, set up with VirtioRingInit() or
+                            VirtioRingInitEx().
+
+  @param[in]     NumTables  The number of indirect tables to allocate. The
+                            HeadDescIdx argument of VirtioPrepareChain() must
+                            stay below NumTables.
+
+  @param[in]     TableSize  The maximum number of descriptors in a single
+                            descriptor chain.
+
+  @retval EFI_INVALID_PARAMETER  NumTables is zero or exceeds
+                                 Ring->QueueSize, or TableSize is zero, or
+                                 indirect tables have been set up for Ring
+                                 already.
+
+  @return                        Status codes propagated from
+                                 VirtIo->AllocateSharedPages() and
+                                 VirtioMapAllBytesInSharedBuffer().
+
+  @retval EFI_SUCCESS            The indirect tables are in use.
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioRingInitIndirect (
+  IN     VIRTIO_DEVICE_PROTOCOL  *VirtIo,
+  IN OUT VRING                   *Ring,
+  IN     UINT16                  NumTables,
+  IN     UINT16                  TableSize
+  )
+{
+  EFI_STATUS            Status;
+  UINTN                 NumPages;
+  VOID                  *Base;
+  EFI_PHYSICAL_ADDRESS  DeviceAddress;
+  VOID                  *Mapping;
+
+  if ((NumTables == 0) || (NumTables > Ring->QueueSize) || (TableSize == 0) ||
+      (Ring->Indirect.NumTables != 0))
+  {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // VRING_DESC and VRING_PACKED_DESC have the same size.
+  //
+  NumPages = EFI_SIZE_TO_PAGES (sizeof (VRING_DESC) * NumTables * TableSize);
+  Status   = VirtIo->AllocateSharedPages (VirtIo, NumPages, &Base);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  SetMem (Base, EFI_PAGES_TO_SIZE (NumPages), 0x00);
+
+  Status = VirtioMapAllBytesInSharedBuffer (
+             VirtIo,
+             VirtioOperationBusMasterCommonBuffer,
+             Base,
+             EFI_PAGES_TO_SIZE (NumPages),
+             &DeviceAddress,
+             &Mapping
+             );
+  if (EFI_ERROR (Status)) {
+    VirtIo->FreeSharedPages (VirtIo, NumPages, Base);
+    return Status;
+  }
+
+  Ring->Indirect.Base       = Base;
+  Ring->Indirect.DeviceBase = DeviceAddress;
+  Ring->Indirect.Mapping    = Mapping;
+  Ring->Indirect.NumPages   = NumPages;
+  Ring->Indirect.NumTables  = NumTables;
+  Ring->Indirect.TableSize  = TableSize;
   return EFI_SUCCESS;
 }
 
@@ -146,6 +459,47 @@ VirtioRingUninit (
   IN OUT VRING                   *Ring
   )
 {
+  if ((Ring->WaitStats.SpinWaits + Ring->WaitStats.StallWaits) > 0) {
+    DEBUG ((
+      DEBUG_INFO,
+      "%a: QueueSize=%d Packed=%d SpinWaits=%Lu StallWaits=%Lu "
+      "SpinIterations=%Lu StallUsecs=%Lu MaxStallUsecs=%u\n",
+      __FUNCTION__,
+      Ring->QueueSize,
+      Ring->IsPacked,
+      Ring->WaitStats.SpinWaits,
+      Ring->WaitStats.StallWaits,
+      Ring->WaitStats.SpinIterations,
+      Ring->WaitStats.StallUsecs,
+      Ring->WaitStats.MaxStallUsecs
+      ));
+  }
+
+  if ((Ring->NotifyStats.Sent + Ring->NotifyStats.Suppressed) > 0) {
+    DEBUG ((
+      DEBUG_INFO,
+      "%a: QueueSize=%d EventIdx=%d Notifies=%Lu SuppressedNotifies=%Lu\n",
+      __FUNCTION__,
+      Ring->QueueSize,
+      Ring->EventIdx,
+      Ring->NotifyStats.Sent,
+      Ring->NotifyStats.Suppressed
+      ));
+  }
+
+  if (Ring->IsPacked) {
+    FreePool (Ring->Packed.ChainLen);
+  }
+
+  if (Ring->Indirect.NumTables != 0) {
+    VirtIo->UnmapSharedBuffer (VirtIo, Ring->Indirect.Mapping);
+    VirtIo->FreeSharedPages (
+              VirtIo,
+              Ring->Indirect.NumPages,
+              Ring->Indirect.Base
+              );
+  }
+
   VirtIo->FreeSharedPages (VirtIo, Ring->NumPages, Ring->Base);
   SetMem (Ring, sizeof *Ring, 0x00);
 }
@@ -169,20 +523,154 @@ VirtioPrepare (
   OUT    DESC_INDICES  *Indices
   )
 {
+  //
+  // Since we support only one in-flight descriptor chain, we can always build
+  // that chain starting at entry #0 of the descriptor table (split ring), or
+  // identify it with buffer ID #0 (packed ring).
+  //
+  VirtioPrepareChain (Ring, 0, Indices);
+}
+
+/**
+
+  Turn off interrupt notifications from the host, and prepare for appending a
+  descriptor chain that the caller identifies with HeadDescIdx.
+
+  This function is intended for drivers that keep several descriptor chains
+  in flight, and track free descriptors themselves (see VirtioSubmitChain()):
+
+  - With a split ring, the chain is built in the descriptor table starting at
+    HeadDescIdx, and the caller is responsible for owning the descriptors from
+    HeadDescIdx on.
+
+  - With a packed ring, the chain is built at the next available position of
+    the descriptor ring, and HeadDescIdx is used as the buffer ID. The caller
+    is responsible for keeping at most Ring->QueueSize descriptors in flight.
+
+  Either way, VirtioGetNextUsed() reports HeadDescIdx back when the host has
+  processed the chain.
+
+  The calling driver must be in VSTAT_DRIVER_OK state.
+
+  @param[in,out] Ring      The virtio ring we intend to append descriptors to.
+
+  @param[in] HeadDescIdx   The identifier of the descriptor chain, less than
+                           Ring->QueueSize.
+
+  @param[out] Indices      The DESC_INDICES structure to initialize.
+
+**/
+VOID
+EFIAPI
+VirtioPrepareChain (
+  IN OUT VRING         *Ring,
+  IN     UINT16        HeadDescIdx,
+  OUT    DESC_INDICES  *Indices
+  )
+{
+  ASSERT (HeadDescIdx < Ring->QueueSize);
+
   //
   // Prepare for virtio-0.9.5, 2.4.2 Receiving Used Buffers From the Device.
   // We're going to poll the answer, the host should not send an interrupt.
   //
-  *Ring->Avail.Flags = (UINT16)VRING_AVAIL_F_NO_INTERRUPT;
+  if (Ring->IsPacked) {
+    Ring->Packed.DriverEvent->Flags = VRING_PACKED_EVENT_F_DISABLE;
+    Indices->HeadDescIdx            = HeadDescIdx;
+    Indices->NextDescIdx            = Ring->Packed.NextAvail;
+  } else {
+    if (Ring->EventIdx) {
+      //
+      // virtio-1.0, 2.4.7.2: the flags field must stay zero; instead, point
+      // used_event at the used element that the host produced last, which it
+      // won't produce again before the index wraps around.
+      //
+      *Ring->Avail.UsedEvent = (UINT16)(*Ring->Used.Idx - 1);
+    } else {
+      *Ring->Avail.Flags = (UINT16)VRING_AVAIL_F_NO_INTERRUPT;
+    }
+
+    //
+    // Prepare for virtio-0.9.5, 2.4.1 Supplying Buffers to the Device.
+    //
+    Indices->HeadDescIdx = HeadDescIdx;
+    Indices->NextDescIdx = Indices->HeadDescIdx;
+  }
 
   //
-  // Prepare for virtio-0.9.5, 2.4.1 Supplying Buffers to the Device.
-  //
-  // Since we support only one in-flight descriptor chain, we can always build
-  // that chain starting at entry #0 of the descriptor table.
+  // With indirect descriptors, the chain is built in its own table, starting
+  // at entry #0; VirtioSubmitChain() takes the descriptor of the ring.
   //
-  Indices->HeadDescIdx = 0;
-  Indices->NextDescIdx = Indices->HeadDescIdx;
+  if (Ring->Indirect.NumTables != 0) {
+    ASSERT (HeadDescIdx < Ring->Indirect.NumTables);
+    Indices->NextDescIdx = 0;
+  }
+}
+
+/**
+
+  Write a descriptor into the descriptor table (split ring) or descriptor ring
+  (packed ring) proper, at the position identified by Indices->NextDescIdx.
+
+  @param[in,out] Ring               The virtio ring to append the buffer to.
+
+  @param[in] BufferDeviceAddress    (Bus master device) start address of the
+                                    buffer.
+
+  @param[in] BufferSize             Number of bytes in the buffer.
+
+  @param[in] Flags                  A bitmask of VRING_DESC_F_* flags.
+
+  @param[in,out] Indices            As described for VirtioAppendDesc().
+
+**/
+STATIC
+VOID
+VirtioAppendRingDesc (
+  IN OUT VRING         *Ring,
+  IN     UINT64        BufferDeviceAddress,
+  IN     UINT32        BufferSize,
+  IN     UINT16        Flags,
+  IN OUT DESC_INDICES  *Indices
+  )
+{
+  volatile VRING_DESC         *Desc;
+  volatile VRING_PACKED_DESC  *PackedDesc;
+
+  if (Ring->IsPacked) {
+    //
+    // virtio-1.1, 2.7.13 Supplying Buffers to The Device. The head
+    // descriptor is written in the "used" pattern of the previous lap, so
+    // that the device ignores it until VirtioSubmitChain() makes the entire
+    // chain available at once.
+    //
+    PackedDesc       = &Ring->Packed.Desc[Indices->NextDescIdx &
+                                          ~VRING_PACKED_CURSOR_PHASE];
+    PackedDesc->Addr = BufferDeviceAddress;
+    PackedDesc->Len  = BufferSize;
+    PackedDesc->Id   = Indices->HeadDescIdx;
+    if (Indices->NextDescIdx == Ring->Packed.NextAvail) {
+      PackedDesc->Flags = Flags | VirtioPackedFlags (
+                                    Indices->NextDescIdx ^
+                                    VRING_PACKED_CURSOR_PHASE,
+                                    TRUE
+                                    );
+    } else {
+      PackedDesc->Flags = Flags | VirtioPackedFlags (
+                                    Indices->NextDescIdx,
+                                    FALSE
+                                    );
+    }
+
+    Indices->NextDescIdx = VirtioPackedAdvance (Ring, Indices->NextDescIdx, 1);
+    return;
+  }
+
+  Desc        = &Ring->Desc[Indices->NextDescIdx++ % Ring->QueueSize];
+  Desc->Addr  = BufferDeviceAddress;
+  Desc->Len   = BufferSize;
+  Desc->Flags = Flags;
+  Desc->Next  = Indices->NextDescIdx % Ring->QueueSize;
 }
 
 /**
@@ -197,6 +685,10 @@ VirtioPrepare (
   request submission. It is the calling driver's responsibility to verify the
   ring size in advance.
 
+  If indirect descriptor tables have been set up for the ring with
+  VirtioRingInitIndirect(), then the buffer is placed in the table of the
+  descriptor chain instead; see VirtioSubmitChain().
+
   The caller is responsible for initializing *Indices with VirtioPrepare()
   first.
 
@@ -212,15 +704,17 @@ VirtioPrepare (
                                     caller computes this mask dependent on
                                     further buffers to append and transfer
                                     direction. VRING_DESC_F_INDIRECT is
-                                    unsupported. The VRING_DESC.Next field is
-                                    always set, but the host only interprets
-                                    it dependent on VRING_DESC_F_NEXT.
-
-  @param[in,out] Indices            Indices->HeadDescIdx is not accessed.
-                                    On input, Indices->NextDescIdx identifies
+                                    reserved for VirtioLib. The VRING_DESC.Next
+                                    field is always set, but the host only
+                                    interprets it dependent on
+                                    VRING_DESC_F_NEXT.
+
+  @param[in,out] Indices            Indices->HeadDescIdx is only accessed
+                                    for packed rings, as the buffer ID. On
+                                    input, Indices->NextDescIdx identifies
                                     the next descriptor to carry the buffer.
                                     On output, Indices->NextDescIdx is
-                                    incremented by one, modulo 2^16.
+                                    advanced by one descriptor.
 
 **/
 VOID
@@ -233,13 +727,212 @@ VirtioAppendDesc (
   IN OUT DESC_INDICES  *Indices
   )
 {
-  volatile VRING_DESC  *Desc;
+  volatile VRING_DESC         *Desc;
+  volatile VRING_PACKED_DESC  *PackedDesc;
+  UINTN                       TableIdx;
+
+  ASSERT ((Flags & VRING_DESC_F_INDIRECT) == 0);
+
+  if (Ring->Indirect.NumTables == 0) {
+    VirtioAppendRingDesc (
+      Ring,
+      BufferDeviceAddress,
+      BufferSize,
+      Flags,
+      Indices
+      );
+    return;
+  }
 
-  Desc        = &Ring->Desc[Indices->NextDescIdx++ % Ring->QueueSize];
-  Desc->Addr  = BufferDeviceAddress;
-  Desc->Len   = BufferSize;
-  Desc->Flags = Flags;
-  Desc->Next  = Indices->NextDescIdx % Ring->QueueSize;
+  //
+  // virtio-1.0, 2.4.5.3 Indirect Descriptors: the chain is built in the
+  // table that belongs to the chain's identifier, starting at entry #0.
+  //
+  ASSERT (Indices->HeadDescIdx < Ring->Indirect.NumTables);
+  ASSERT (Indices->NextDescIdx < Ring->Indirect.TableSize);
+
+  TableIdx = (UINTN)Indices->HeadDescIdx * Ring->Indirect.TableSize +
+             Indices->NextDescIdx;
+  if (Ring->IsPacked) {
+    //
+    // virtio-1.1, 2.7.7 Indirect Flag: the entries of a packed indirect table
+    // are consecutive, and only VRING_DESC_F_WRITE is valid in them.
+    //
+    PackedDesc        = (volatile VRING_PACKED_DESC *)Ring->Indirect.Base +
+                        TableIdx;
+    PackedDesc->Addr  = BufferDeviceAddress;
+    PackedDesc->Len   = BufferSize;
+    PackedDesc->Id    = 0;
+    PackedDesc->Flags = Flags & VRING_DESC_F_WRITE;
+  } else {
+    Desc        = (volatile VRING_DESC *)Ring->Indirect.Base + TableIdx;
+    Desc->Addr  = BufferDeviceAddress;
+    Desc->Len   = BufferSize;
+    Desc->Flags = Flags;
+    Desc->Next  = (UINT16)(Indices->NextDescIdx + 1);
+  }
+
+  ++Indices->NextDescIdx;
+}
+
+/**
+
+  Check whether the host has produced a used element at LastUsedIdx.
+
+  The caller is responsible for issuing a memory fence before reading the
+  used element's contents.
+
+  @param[in] Ring         The virtio ring to check.
+
+  @param[in] LastUsedIdx  The free-running index (split ring) or cursor
+                          (packed ring) of the next used element that the
+                          caller expects.
+
+  @retval TRUE   The used element is available.
+
+  @retval FALSE  The host has not produced the used element yet.
+
+**/
+STATIC
+BOOLEAN
+VirtioIsUsed (
+  IN CONST VRING  *Ring,
+  IN UINT16       LastUsedIdx
+  )
+{
+  UINT16  Flags;
+
+  if (!Ring->IsPacked) {
+    return (BOOLEAN)(*Ring->Used.Idx != LastUsedIdx);
+  }
+
+  //
+  // virtio-1.1, 2.7.1 Driver and Device Ring Wrap Counters: the device marks
+  // a descriptor used by setting both its AVAIL and USED flags to the value of
+  // its own wrap counter.
+  //
+  Flags = Ring->Packed.Desc[LastUsedIdx & ~VRING_PACKED_CURSOR_PHASE].Flags;
+  return (BOOLEAN)(
+                   (Flags & (VRING_PACKED_DESC_F_AVAIL | VRING_PACKED_DESC_F_USED)) ==
+                   VirtioPackedFlags (LastUsedIdx, TRUE)
+                   );
+}
+
+/**
+
+  Check whether a wait in VirtioWaitUsed() is over: either the caller's used
+  cursor has moved away from ExpectedIdx, or the host has produced the used
+  element at ExpectedIdx.
+
+  @param[in] Ring         The virtio ring being waited on.
+
+  @param[in] LastUsedIdx  The caller's live used cursor.
+
+  @param[in] ExpectedIdx  The used cursor value that the caller sampled.
+
+  @retval TRUE   The caller should re-check its completion state.
+
+  @retval FALSE  Keep waiting.
+
+**/
+STATIC
+BOOLEAN
+VirtioWaitSatisfied (
+  IN CONST VRING            *Ring,
+  IN CONST volatile UINT16  *LastUsedIdx,
+  IN UINT16                 ExpectedIdx
+  )
+{
+  //
+  // Check the cursor first: once it has moved, the used element at
+  // ExpectedIdx may have been recycled, and must not be looked at.
+  //
+  if (*LastUsedIdx != ExpectedIdx) {
+    return TRUE;
+  }
+
+  return VirtioIsUsed (Ring, ExpectedIdx);
+}
+
+/**
+
+  Wait until the host produces a used element at ExpectedIdx, or until the
+  caller's used cursor moves away from ExpectedIdx.
+
+  The used index (split ring) or the next used descriptor (packed ring) is
+  busy-polled first, for PcdVirtioPollSpinCount iterations.
+  Under a hypervisor, a request is frequently completed within that budget,
+  and the wait then costs neither a timer access nor a VM exit. If the host
+  is slower, the function falls back to gBS->Stall(), doubling the stall
+  period from 1 microsecond up to PcdVirtioPollMaxStallUsecs.
+
+  Drivers that also collect used elements from a timer callback sample
+  ExpectedIdx at raised TPL, and wait at the caller's TPL. If the callback
+  collects used elements in between, ExpectedIdx is stale: on a packed ring,
+  its descriptor may have been resubmitted already, and the host would only
+  mark it used again a full ring lap later. Re-reading the live cursor in
+  LastUsedIdx lets the function return as soon as that happens, so that the
+  caller re-checks its own completion state.
+
+  The outcome of the wait is accounted for in Ring->WaitStats.
+
+  @param[in,out] Ring     The virtio ring to wait on.
+
+  @param[in] LastUsedIdx  The caller's used cursor, as advanced by
+                          VirtioGetNextUsed(). Re-read on every poll.
+
+  @param[in] ExpectedIdx  The free-running index (split ring) or cursor
+                          (packed ring) of the next used element that the
+                          caller expects; the value of *LastUsedIdx that the
+                          caller sampled last.
+
+**/
+VOID
+EFIAPI
+VirtioWaitUsed (
+  IN OUT VRING                  *Ring,
+  IN     CONST volatile UINT16  *LastUsedIdx,
+  IN     UINT16                 ExpectedIdx
+  )
+{
+  UINT32  SpinBudget;
+  UINT32  SpinCount;
+  UINT32  MaxPollPeriodUsecs;
+  UINT32  PollPeriodUsecs;
+  UINT32  StallUsecs;
+
+  SpinBudget = PcdGet32 (PcdVirtioPollSpinCount);
+  for (SpinCount = 0; SpinCount < SpinBudget; ++SpinCount) {
+    MemoryFence ();
+    if (VirtioWaitSatisfied (Ring, LastUsedIdx, ExpectedIdx)) {
+      Ring->WaitStats.SpinIterations += SpinCount;
+      ++Ring->WaitStats.SpinWaits;
+      return;
+    }
+
+    CpuPause ();
+  }
+
+  Ring->WaitStats.SpinIterations += SpinCount;
+
+  MaxPollPeriodUsecs = PcdGet32 (PcdVirtioPollMaxStallUsecs);
+  PollPeriodUsecs    = 1;
+  StallUsecs         = 0;
+  MemoryFence ();
+  while (!VirtioWaitSatisfied (Ring, LastUsedIdx, ExpectedIdx)) {
+    gBS->Stall (PollPeriodUsecs); // calls TimerLib::MicroSecondDelay
+    StallUsecs += PollPeriodUsecs;
+
+    if (PollPeriodUsecs < MaxPollPeriodUsecs) {
+      PollPeriodUsecs = MIN (PollPeriodUsecs * 2, MaxPollPeriodUsecs);
+    }
+
+    MemoryFence ();
+  }
+
+  ++Ring->WaitStats.StallWaits;
+  Ring->WaitStats.StallUsecs   += StallUsecs;
+  Ring->WaitStats.MaxStallUsecs = MAX (Ring->WaitStats.MaxStallUsecs, StallUsecs);
 }
 
 /**
@@ -253,9 +946,9 @@ VirtioAppendDesc (
 
   @param[in,out] Ring     The virtio ring with descriptors to submit.
 
-  @param[in] Indices      Indices->NextDescIdx is not accessed.
-                          Indices->HeadDescIdx identifies the head descriptor
-                          of the descriptor chain.
+  @param[in] Indices      Indices->HeadDescIdx identifies the descriptor
+                          chain. Indices->NextDescIdx is only accessed for
+                          packed rings.
 
   @param[out] UsedLen     On success, the total number of bytes, consecutively
                           across the buffers linked by the descriptor chain,
@@ -264,9 +957,13 @@ VirtioAppendDesc (
                           from device-specific request structures linked by the
                           descriptor chain.
 
-  @return              Error code from VirtIo->SetQueueNotify() if it fails.
+  @return                   Error code from VirtIo->SetQueueNotify() if it
+                            fails.
 
-  @retval EFI_SUCCESS  Otherwise, the host processed all descriptors.
+  @retval EFI_DEVICE_ERROR  The host reported a used element that does not
+                            belong to the descriptor chain.
+
+  @retval EFI_SUCCESS       Otherwise, the host processed all descriptors.
 
 **/
 EFI_STATUS
@@ -279,73 +976,363 @@ VirtioFlush (
   OUT    UINT32                  *UsedLen    OPTIONAL
   )
 {
-  UINT16      NextAvailIdx;
   UINT16      LastUsedIdx;
+  UINT16      UsedHeadDescIdx;
   EFI_STATUS  Status;
-  UINTN       PollPeriodUsecs;
 
   //
-  // virtio-0.9.5, 2.4.1.2 Updating the Available Ring
-  //
-  // It is not exactly clear from the wording of the virtio-0.9.5
-  // specification, but each entry in the Available Ring references only the
-  // head descriptor of any given descriptor chain.
+  // Due to our lock-step progress, this is where the host will produce the
+  // used element for the head descriptor: the next available index (split
+  // ring) or position (packed ring).
   //
-  NextAvailIdx = *Ring->Avail.Idx;
-  //
-  // (Due to our lock-step progress, this is where the host will produce the
-  // used element with the head descriptor's index in it.)
-  //
-  LastUsedIdx                                        = NextAvailIdx;
-  Ring->Avail.Ring[NextAvailIdx++ % Ring->QueueSize] =
-    Indices->HeadDescIdx % Ring->QueueSize;
+  LastUsedIdx = Ring->IsPacked ? Ring->Packed.NextAvail : *Ring->Avail.Idx;
 
   //
+  // virtio-0.9.5, 2.4.1.2 Updating the Available Ring
   // virtio-0.9.5, 2.4.1.3 Updating the Index Field
   //
-  MemoryFence ();
-  *Ring->Avail.Idx = NextAvailIdx;
+  VirtioSubmitChain (Ring, Indices);
 
   //
-  // virtio-0.9.5, 2.4.1.4 Notifying the Device -- gratuitous notifications are
-  // OK.
+  // virtio-0.9.5, 2.4.1.4 Notifying the Device -- unless the host has asked
+  // us not to.
   //
-  MemoryFence ();
-  Status = VirtIo->SetQueueNotify (VirtIo, VirtQueueId);
-  if (EFI_ERROR (Status)) {
-    return Status;
+  if (VirtioNeedNotify (Ring)) {
+    Status = VirtIo->SetQueueNotify (VirtIo, VirtQueueId);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
   }
 
   //
   // virtio-0.9.5, 2.4.2 Receiving Used Buffers From the Device
   // Wait until the host processes and acknowledges our descriptor chain. The
   // condition we use for polling is greatly simplified and relies on the
-  // synchronous, lock-step progress.
+  // synchronous, lock-step progress: the first used element the host
+  // produces is ours.
+  //
+  VirtioWaitUsed (Ring, &LastUsedIdx, LastUsedIdx);
+  Status = VirtioGetNextUsed (Ring, &LastUsedIdx, &UsedHeadDescIdx, UsedLen);
+  if (EFI_ERROR (Status) ||
+      (UsedHeadDescIdx != Indices->HeadDescIdx % Ring->QueueSize))
+  {
+    return EFI_DEVICE_ERROR;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+
+  Make the descriptor chain just built available to the host, without
+  notifying the host and without waiting for the host to process the chain.
+
+  This function implements the following sections from virtio-0.9.5:
+  - 2.4.1.2 Updating the Available Ring
+  - 2.4.1.3 Updating the Index Field
+
+  and, for packed rings, virtio-1.1, 2.7.13 Supplying Buffers to The Device.
+
+  It is intended for drivers that keep several descriptor chains in flight.
+  Such drivers are responsible for tracking free descriptors themselves, for
+  notifying the host with VirtIo->SetQueueNotify() when VirtioNeedNotify()
+  says so, and for collecting the used elements with VirtioGetNextUsed().
+
+  If indirect descriptor tables are in use (see VirtioRingInitIndirect()), then
+  the function first appends a single VRING_DESC_F_INDIRECT descriptor to the
+  ring, referencing the table in which VirtioAppendDesc() has built the chain.
+
+  @param[in,out] Ring  The virtio ring with descriptors to submit.
+
+  @param[in] Indices   Indices->HeadDescIdx identifies the descriptor chain.
+                       Indices->NextDescIdx is only accessed for packed rings,
+                       and with indirect descriptors, to determine the length
+                       of the chain.
+
+**/
+VOID
+EFIAPI
+VirtioSubmitChain (
+  IN OUT VRING         *Ring,
+  IN     DESC_INDICES  *Indices
+  )
+{
+  UINT16                      NextAvailIdx;
+  volatile VRING_PACKED_DESC  *HeadDesc;
+  UINT16                      ChainLen;
+  DESC_INDICES                RingIndices;
+
+  if (Ring->Indirect.NumTables != 0) {
+    ASSERT (Indices->NextDescIdx > 0);
+    ASSERT (Indices->NextDescIdx <= Ring->Indirect.TableSize);
+
+    RingIndices.HeadDescIdx = Indices->HeadDescIdx;
+    RingIndices.NextDescIdx = Ring->IsPacked ? Ring->Packed.NextAvail :
+                              Indices->HeadDescIdx;
+    VirtioAppendRingDesc (
+      Ring,
+      Ring->Indirect.DeviceBase +
+      sizeof (VRING_DESC) * Indices->HeadDescIdx * Ring->Indirect.TableSize,
+      (UINT32)(sizeof (VRING_DESC) * Indices->NextDescIdx),
+      VRING_DESC_F_INDIRECT,
+      &RingIndices
+      );
+    Indices = &RingIndices;
+  }
+
+  if (Ring->IsPacked) {
+    //
+    // virtio-1.1, 2.7.13.3 Updating flags: the head descriptor is made
+    // available last, after the rest of the chain is visible to the host. Its
+    // VRING_DESC_F_* flags have been set by VirtioAppendDesc() already.
+    //
+    ChainLen = VirtioPackedDistance (
+                 Ring,
+                 Ring->Packed.NextAvail,
+                 Indices->NextDescIdx
+                 );
+    ASSERT (ChainLen > 0);
+    ASSERT (Indices->HeadDescIdx < Ring->QueueSize);
+    Ring->Packed.ChainLen[Indices->HeadDescIdx] = ChainLen;
+
+    HeadDesc = &Ring->Packed.Desc[Ring->Packed.NextAvail &
+                                  ~VRING_PACKED_CURSOR_PHASE];
+    MemoryFence ();
+    HeadDesc->Flags = (UINT16)(
+                               (HeadDesc->Flags &
+                                ~(VRING_PACKED_DESC_F_AVAIL |
+                                  VRING_PACKED_DESC_F_USED)) |
+                               VirtioPackedFlags (Ring->Packed.NextAvail, FALSE)
+                               );
+    Ring->Packed.NextAvail = Indices->NextDescIdx;
+    MemoryFence ();
+    return;
+  }
+
   //
-  // Keep slowing down until we reach a poll period of slightly above 1 ms.
+  // the available index is never written by the host, we can read it back
+  // without a barrier
   //
-  PollPeriodUsecs = 1;
+  NextAvailIdx                                       = *Ring->Avail.Idx;
+  Ring->Avail.Ring[NextAvailIdx++ % Ring->QueueSize] =
+    Indices->HeadDescIdx % Ring->QueueSize;
+
+  MemoryFence ();
+  *Ring->Avail.Idx = NextAvailIdx;
   MemoryFence ();
-  while (*Ring->Used.Idx != NextAvailIdx) {
-    gBS->Stall (PollPeriodUsecs); // calls AcpiTimerLib::MicroSecondDelay
+}
+
+/**
+
+  Decide whether the host needs to be notified about the descriptor chains
+  that have been submitted with VirtioSubmitChain() since the last call to
+  this function.
+
+  This function implements virtio-1.0, 2.4.7 Virtqueue Notification
+  Suppression (split ring) and virtio-1.1, 2.7.10 Event Suppression
+  Structure Format (packed ring). If VIRTIO_F_RING_EVENT_IDX has been
+  negotiated (see VirtioRingInitEx()), then the host is notified only if it
+  asked to be notified about one of the new descriptor chains; otherwise,
+  the host's on / off hint is honored.
+
+  The caller is expected to call VirtIo->SetQueueNotify() if and only if this
+  function returns TRUE.
+
+  @param[in,out] Ring  The virtio ring that descriptor chains have been
+                       submitted to.
+
+  @retval TRUE   The host needs to be notified.
 
-    if (PollPeriodUsecs < 1024) {
-      PollPeriodUsecs *= 2;
+  @retval FALSE  The host has suppressed the notification, or no descriptor
+                 chain has been submitted.
+
+**/
+BOOLEAN
+EFIAPI
+VirtioNeedNotify (
+  IN OUT VRING  *Ring
+  )
+{
+  UINT16   NewIdx;
+  UINT16   OldIdx;
+  UINT16   EventIdx;
+  UINT16   EventFlags;
+  UINT16   OffWrap;
+  BOOLEAN  Need;
+
+  //
+  // The new descriptors must be visible to the host before we read its
+  // notification suppression state. This is a store -> load dependency, which
+  // MemoryFence() does not order on all architectures; otherwise we could
+  // read a stale event index and skip a kick that the host is waiting for.
+  //
+  InternalVirtioFullFence ();
+
+  if (Ring->IsPacked) {
+    NewIdx = Ring->Packed.NextAvail & ~VRING_PACKED_CURSOR_PHASE;
+    OldIdx = (UINT16)(NewIdx -
+                      VirtioPackedDistance (
+                        Ring,
+                        Ring->LastKickIdx,
+                        Ring->Packed.NextAvail
+                        ));
+    EventFlags = Ring->Packed.DeviceEvent->Flags;
+    OffWrap    = Ring->Packed.DeviceEvent->OffWrap;
+
+    if (!Ring->EventIdx || (EventFlags != VRING_PACKED_EVENT_F_DESC)) {
+      Need = (BOOLEAN)(NewIdx != OldIdx &&
+                       EventFlags != VRING_PACKED_EVENT_F_DISABLE);
+    } else {
+      //
+      // Translate the event offset to the lap of NewIdx; if the wrap counters
+      // differ, the event offset belongs to the previous lap.
+      //
+      EventIdx = OffWrap & ~VRING_PACKED_CURSOR_PHASE;
+      if (((OffWrap & VRING_PACKED_CURSOR_PHASE) != 0) !=
+          ((Ring->Packed.NextAvail & VRING_PACKED_CURSOR_PHASE) == 0))
+      {
+        EventIdx -= Ring->QueueSize;
+      }
+
+      Need = (BOOLEAN)((UINT16)(NewIdx - EventIdx - 1) <
+                       (UINT16)(NewIdx - OldIdx));
     }
 
-    MemoryFence ();
+    Ring->LastKickIdx = Ring->Packed.NextAvail;
+  } else {
+    NewIdx = *Ring->Avail.Idx;
+    OldIdx = Ring->LastKickIdx;
+
+    if (!Ring->EventIdx) {
+      Need = (BOOLEAN)(NewIdx != OldIdx &&
+                       (*Ring->Used.Flags & VRING_USED_F_NO_NOTIFY) == 0);
+    } else {
+      //
+      // Notify if the host's avail_event falls into [OldIdx, NewIdx).
+      //
+      EventIdx = *Ring->Used.AvailEvent;
+      Need     = (BOOLEAN)((UINT16)(NewIdx - EventIdx - 1) <
+                           (UINT16)(NewIdx - OldIdx));
+    }
+
+    Ring->LastKickIdx = NewIdx;
+  }
+
+  if (Need) {
+    ++Ring->NotifyStats.Sent;
+  } else if (NewIdx != OldIdx) {
+    ++Ring->NotifyStats.Suppressed;
+  }
+
+  return Need;
+}
+
+/**
+
+  Fetch the next used element that the host has produced in the used ring,
+  if any.
+
+  This function implements virtio-0.9.5, 2.4.2 Receiving Used Buffers From
+  the Device, for drivers that keep several descriptor chains in flight (see
+  VirtioSubmitChain()).
+
+  @param[in] Ring             The virtio ring to check.
+
+  @param[in,out] LastUsedIdx  On input, the free-running index (split ring)
+                              or cursor (packed ring) of the next used element
+                              that the caller expects; initially zero. On
+                              successful output, advanced past the used
+                              element.
+
+  @param[out] HeadDescIdx     On success, the head descriptor index (split
+                              ring) or buffer ID (packed ring) of the
+                              descriptor chain that the host processed; see
+                              VirtioPrepareChain().
+
+  @param[out] UsedLen         On success, the total number of bytes that the
+                              host wrote to the buffers of the descriptor
+                              chain. May be NULL if the caller doesn't care.
+
+  @retval EFI_SUCCESS         A used element has been fetched.
+
+  @retval EFI_NOT_READY       The host has not produced a new used element
+                              yet.
+
+  @retval EFI_PROTOCOL_ERROR  The host produced a used element with an
+                              identifier that does not belong to a descriptor
+                              chain in flight. On a split ring, the element
+                              is skipped. On a packed ring, the position of
+                              the next used element cannot be determined, so
+                              LastUsedIdx is left unchanged.
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioGetNextUsed (
+  IN     VRING   *Ring,
+  IN OUT UINT16  *LastUsedIdx,
+  OUT    UINT16  *HeadDescIdx,
+  OUT    UINT32  *UsedLen     OPTIONAL
+  )
+{
+  volatile CONST VRING_USED_ELEM     *UsedElem;
+  volatile CONST VRING_PACKED_DESC  *UsedDesc;
+  UINT32                            Id;
+  UINT16                            ChainLen;
+
+  MemoryFence ();
+  if (!VirtioIsUsed (Ring, *LastUsedIdx)) {
+    return EFI_NOT_READY;
   }
 
   MemoryFence ();
 
-  if (UsedLen != NULL) {
-    volatile CONST VRING_USED_ELEM  *UsedElem;
+  if (Ring->IsPacked) {
+    //
+    // virtio-1.1, 2.7.14 Receiving Used Buffers From The Device: the device
+    // writes one used descriptor per chain, and skips the rest of the chain's
+    // positions.
+    //
+    // The buffer ID is under the host's control; it must identify a chain
+    // in flight, whose length tells us where the next used element is.
+    //
+    UsedDesc = &Ring->Packed.Desc[*LastUsedIdx & ~VRING_PACKED_CURSOR_PHASE];
+    Id       = UsedDesc->Id;
+    if (Id >= Ring->QueueSize) {
+      DEBUG ((DEBUG_ERROR, "%a: bad buffer ID %u\n", __FUNCTION__, Id));
+      return EFI_PROTOCOL_ERROR;
+    }
+
+    ChainLen = Ring->Packed.ChainLen[Id];
+    if (ChainLen == 0) {
+      DEBUG ((DEBUG_ERROR, "%a: buffer ID %u not in flight\n", __FUNCTION__, Id));
+      return EFI_PROTOCOL_ERROR;
+    }
+
+    Ring->Packed.ChainLen[Id] = 0;
+    *HeadDescIdx              = (UINT16)Id;
+    if (UsedLen != NULL) {
+      *UsedLen = UsedDesc->Len;
+    }
 
-    UsedElem = &Ring->Used.UsedElem[LastUsedIdx % Ring->QueueSize];
-    ASSERT (UsedElem->Id == Indices->HeadDescIdx);
+    *LastUsedIdx = VirtioPackedAdvance (Ring, *LastUsedIdx, ChainLen);
+    return EFI_SUCCESS;
+  }
+
+  UsedElem = &Ring->Used.UsedElem[*LastUsedIdx % Ring->QueueSize];
+  Id       = UsedElem->Id;
+  if (Id >= Ring->QueueSize) {
+    DEBUG ((DEBUG_ERROR, "%a: bad used element ID %u\n", __FUNCTION__, Id));
+    ++*LastUsedIdx;
+    return EFI_PROTOCOL_ERROR;
+  }
+
+  *HeadDescIdx = (UINT16)Id;
+  if (UsedLen != NULL) {
     *UsedLen = UsedElem->Len;
   }
 
+  ++*LastUsedIdx;
   return EFI_SUCCESS;
 }
 
@@ -0,0 +1,32 @@
+/** @file
+
+  Internal definitions of VirtioLib.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef VIRTIO_LIB_INTERNAL_H_
+#define VIRTIO_LIB_INTERNAL_H_
+
+#include <Base.h>
+
+/**
+
+  Order all earlier loads and stores before all later loads and stores, as
+  observed by the host.
+
+  MemoryFence() suffices for store -> store and load -> load ordering of the
+  virtio rings, but not for a store followed by a load: on x86 it is only a
+  compiler barrier, and the processor may still perform the load before the
+  store becomes visible. Notification suppression needs that ordering (the
+  equivalent of Linux's virtio_mb()).
+
+**/
+VOID
+EFIAPI
+InternalVirtioFullFence (
+  VOID
+  );
+
+#endif // VIRTIO_LIB_INTERNAL_H_
@@ -13,9 +13,11 @@
 #include <Library/DevicePathLib.h>
 #include <Library/HiiLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
 #include <Library/ShellLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiHiiServicesLib.h>
+#include <Library/UefiLib.h>
 
 #include <Guid/LinuxEfiInitrdMedia.h>
 
@@ -31,10 +33,11 @@ typedef struct {
 } SINGLE_NODE_VENDOR_MEDIA_DEVPATH;
 #pragma pack ()
 
-STATIC EFI_HII_HANDLE        mLinuxInitrdShellCommandHiiHandle;
-STATIC EFI_PHYSICAL_ADDRESS  mInitrdFileAddress;
-STATIC UINTN                 mInitrdFileSize;
-STATIC EFI_HANDLE            mInitrdLoadFile2Handle;
+STATIC EFI_HII_HANDLE            mLinuxInitrdShellCommandHiiHandle;
+STATIC EFI_PHYSICAL_ADDRESS      mInitrdFileAddress;
+STATIC UINTN                     mInitrdFileSize;
+STATIC EFI_DEVICE_PATH_PROTOCOL  *mInitrdFilePath;
+STATIC EFI_HANDLE                mInitrdLoadFile2Handle;
 
 STATIC CONST SHELL_PARAM_ITEM  ParamList[] = {
   { L"-u", TypeFlag },
@@ -84,6 +87,61 @@ IsOtherInitrdDevicePathAlreadyInstalled (
   return TRUE;
 }
 
+/**
+  Read the initrd file recorded by RecordInitrdFile() straight into the
+  LoadFile2 caller's buffer.
+
+  @param[in,out] BufferSize  On input, the size of Buffer, which is at least
+                             mInitrdFileSize. On output, mInitrdFileSize.
+  @param[out]    Buffer      The buffer to read the initrd into.
+
+  @retval EFI_SUCCESS       The initrd has been read.
+  @retval EFI_DEVICE_ERROR  The file has shrunk since it was recorded.
+  @return                   Errors from opening or reading the file.
+**/
+STATIC
+EFI_STATUS
+ReadInitrdFile (
+  IN OUT UINTN  *BufferSize,
+  OUT    VOID   *Buffer
+  )
+{
+  EFI_STATUS                Status;
+  EFI_DEVICE_PATH_PROTOCOL  *FilePath;
+  EFI_FILE_PROTOCOL         *File;
+  UINTN                     ReadSize;
+
+  FilePath = mInitrdFilePath;
+  Status   = EfiOpenFileByDevicePath (&FilePath, &File, EFI_FILE_MODE_READ, 0);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((
+      DEBUG_WARN,
+      "%a: failed to open initrd file - %r\n",
+      __FUNCTION__,
+      Status
+      ));
+    return Status;
+  }
+
+  ReadSize = mInitrdFileSize;
+  Status   = File->Read (File, &ReadSize, Buffer);
+  File->Close (File);
+  if (EFI_ERROR (Status) || (ReadSize < mInitrdFileSize)) {
+    DEBUG ((
+      DEBUG_WARN,
+      "%a: failed to read initrd file - %r 0x%lx 0x%lx\n",
+      __FUNCTION__,
+      Status,
+      (UINT64)ReadSize,
+      (UINT64)mInitrdFileSize
+      ));
+    return EFI_ERROR (Status) ? Status : EFI_DEVICE_ERROR;
+  }
+
+  *BufferSize = mInitrdFileSize;
+  return EFI_SUCCESS;
+}
+
 STATIC
 EFI_STATUS
 EFIAPI
@@ -115,6 +173,10 @@ InitrdLoadFile2 (
     return EFI_BUFFER_TOO_SMALL;
   }
 
+  if (mInitrdFilePath != NULL) {
+    return ReadInitrdFile (BufferSize, Buffer);
+  }
+
   ASSERT (mInitrdFileAddress != 0);
 
   gBS->CopyMem (Buffer, (VOID *)(UINTN)mInitrdFileAddress, mInitrdFileSize);
@@ -159,10 +221,75 @@ FreeInitrdFile (
   VOID
   )
 {
-  if (mInitrdFileSize != 0) {
+  if (mInitrdFilePath != NULL) {
+    FreePool (mInitrdFilePath);
+    mInitrdFilePath = NULL;
+  } else if (mInitrdFileSize != 0) {
     gBS->FreePages (mInitrdFileAddress, EFI_SIZE_TO_PAGES (mInitrdFileSize));
-    mInitrdFileSize = 0;
   }
+
+  mInitrdFileSize = 0;
+}
+
+STATIC
+EFI_STATUS
+InstallLoadFile2Protocol (
+  VOID
+  )
+{
+  if (mInitrdLoadFile2Handle != NULL) {
+    return EFI_SUCCESS;
+  }
+
+  return gBS->InstallMultipleProtocolInterfaces (
+                &mInitrdLoadFile2Handle,
+                &gEfiDevicePathProtocolGuid,
+                &mInitrdDevicePath,
+                &gEfiLoadFile2ProtocolGuid,
+                &mInitrdLoadFile2,
+                NULL
+                );
+}
+
+/**
+  Record the device path and the size of the initrd file, for ReadInitrdFile()
+  to read it at LoadFile2 time, without keeping a copy in memory.
+
+  @param[in] FileName    The full path of the file, as found by the shell.
+  @param[in] FileHandle  The open file.
+
+  @retval EFI_SUCCESS  The file has been recorded.
+  @return              Errors from querying the file.
+**/
+STATIC
+EFI_STATUS
+RecordInitrdFile (
+  IN  CONST CHAR16       *FileName,
+  IN  SHELL_FILE_HANDLE  FileHandle
+  )
+{
+  EFI_STATUS  Status;
+  UINT64      FileSize;
+
+  Status = gEfiShellProtocol->GetFileSize (FileHandle, &FileSize);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if ((FileSize == 0) || (FileSize > MAX_UINTN)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  mInitrdFilePath = gEfiShellProtocol->GetDevicePathFromFilePath (FileName);
+  if (mInitrdFilePath == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  Status = InstallLoadFile2Protocol ();
+  ASSERT_EFI_ERROR (Status);
+
+  mInitrdFileSize = (UINTN)FileSize;
+  return EFI_SUCCESS;
 }
 
 STATIC
@@ -212,17 +339,8 @@ CacheInitrdFile (
     goto FreeMemory;
   }
 
-  if (mInitrdLoadFile2Handle == NULL) {
-    Status = gBS->InstallMultipleProtocolInterfaces (
-                    &mInitrdLoadFile2Handle,
-                    &gEfiDevicePathProtocolGuid,
-                    &mInitrdDevicePath,
-                    &gEfiLoadFile2ProtocolGuid,
-                    &mInitrdLoadFile2,
-                    NULL
-                    );
-    ASSERT_EFI_ERROR (Status);
-  }
+  Status = InstallLoadFile2Protocol ();
+  ASSERT_EFI_ERROR (Status);
 
   mInitrdFileSize = (UINTN)FileSize;
   return EFI_SUCCESS;
@@ -341,7 +459,12 @@ RunInitrd (
                    );
         if (!EFI_ERROR (Status)) {
           FreeInitrdFile ();
-          Status = CacheInitrdFile (FileHandle);
+          if (FeaturePcdGet (PcdLinuxInitrdShellDirectRead)) {
+            Status = RecordInitrdFile (Filename, FileHandle);
+          } else {
+            Status = CacheInitrdFile (FileHandle);
+          }
+
           ShellCloseFile (&FileHandle);
         }
 
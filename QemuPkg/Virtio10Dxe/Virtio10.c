@@ -490,10 +490,31 @@ Virtio10SetQueueAddress (
   EFI_STATUS      Status;
   UINT64          Address;
   UINT16          Enable;
+  UINTN           DescArea;
+  UINTN           DriverArea;
+  UINTN           DeviceArea;
+  UINT16          NotifyOffset;
 
   Dev = VIRTIO_1_0_FROM_VIRTIO_DEVICE (This);
 
-  Address  = (UINTN)Ring->Desc;
+  //
+  // The three queue address registers take the Descriptor Area, the Driver
+  // Area and the Device Area. With a split ring, those are the descriptor
+  // table, the available ring and the used ring. With a packed ring (see
+  // VIRTIO_F_RING_PACKED), they are the descriptor ring, and the driver and
+  // device event suppression structures.
+  //
+  if (Ring->IsPacked) {
+    DescArea   = (UINTN)Ring->Packed.Desc;
+    DriverArea = (UINTN)Ring->Packed.DriverEvent;
+    DeviceArea = (UINTN)Ring->Packed.DeviceEvent;
+  } else {
+    DescArea   = (UINTN)Ring->Desc;
+    DriverArea = (UINTN)Ring->Avail.Flags;
+    DeviceArea = (UINTN)Ring->Used.Flags;
+  }
+
+  Address  = DescArea;
   Address += RingBaseShift;
   Status   = Virtio10Transfer (
                Dev->PciIo,
@@ -507,7 +528,7 @@ Virtio10SetQueueAddress (
     return Status;
   }
 
-  Address  = (UINTN)Ring->Avail.Flags;
+  Address  = DriverArea;
   Address += RingBaseShift;
   Status   = Virtio10Transfer (
                Dev->PciIo,
@@ -521,7 +542,7 @@ Virtio10SetQueueAddress (
     return Status;
   }
 
-  Address  = (UINTN)Ring->Used.Flags;
+  Address  = DeviceArea;
   Address += RingBaseShift;
   Status   = Virtio10Transfer (
                Dev->PciIo,
@@ -544,7 +565,32 @@ Virtio10SetQueueAddress (
              sizeof Enable,
              &Enable
              );
-  return Status;
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // The queue is still selected; record where its doorbell is, so that
+  // Virtio10SetQueueNotify() need not touch the common config.
+  //
+  if (Dev->QueueSelect < VIRTIO_1_0_NOTIFY_CACHE_SIZE) {
+    Status = Virtio10Transfer (
+               Dev->PciIo,
+               &Dev->CommonConfig,
+               FALSE,
+               OFFSET_OF (VIRTIO_PCI_COMMON_CFG, QueueNotifyOff),
+               sizeof NotifyOffset,
+               &NotifyOffset
+               );
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    Dev->NotifyCache[Dev->QueueSelect] = NotifyOffset * Dev->NotifyOffsetMultiplier;
+    Dev->NotifyCacheValid             |= BIT0 << Dev->QueueSelect;
+  }
+
+  return EFI_SUCCESS;
 }
 
 STATIC
@@ -568,29 +614,43 @@ Virtio10SetQueueSel (
              sizeof Index,
              &Index
              );
+  if (!EFI_ERROR (Status)) {
+    Dev->QueueSelect = Index;
+  }
+
   return Status;
 }
 
+/**
+  Look up the offset of a queue's doorbell in the notification structure, by
+  reading QueueNotifyOff from the common config.
+
+  QueueNotifyOff is queue specific, so the current queue selector is stashed
+  and restored around the read.
+
+  @param[in]  Dev           The VIRTIO_1_0_DEV to query.
+
+  @param[in]  Index         The queue to look up.
+
+  @param[out] NotifyOffset  The byte offset of the queue's doorbell in
+                            Dev->NotifyConfig.
+
+  @return  Status codes from Virtio10Transfer().
+**/
 STATIC
 EFI_STATUS
-EFIAPI
-Virtio10SetQueueNotify (
-  IN VIRTIO_DEVICE_PROTOCOL  *This,
-  IN UINT16                  Index
+Virtio10LookupQueueNotify (
+  IN  VIRTIO_1_0_DEV  *Dev,
+  IN  UINT16          Index,
+  OUT UINT32          *NotifyOffset
   )
 {
-  VIRTIO_1_0_DEV  *Dev;
-  EFI_STATUS      Status;
-  UINT16          SavedQueueSelect;
-  UINT16          NotifyOffset;
-
-  Dev = VIRTIO_1_0_FROM_VIRTIO_DEVICE (This);
+  EFI_STATUS  Status;
+  UINT16      SavedQueueSelect;
+  UINT16      QueueNotifyOff;
 
   //
-  // Read NotifyOffset first. NotifyOffset is queue specific, so we have
-  // to stash & restore the current queue selector around it.
-  //
-  // So, start with saving the current queue selector.
+  // Start with saving the current queue selector.
   //
   Status = Virtio10Transfer (
              Dev->PciIo,
@@ -627,8 +687,8 @@ Virtio10SetQueueNotify (
              &Dev->CommonConfig,
              FALSE,
              OFFSET_OF (VIRTIO_PCI_COMMON_CFG, QueueNotifyOff),
-             sizeof NotifyOffset,
-             &NotifyOffset
+             sizeof QueueNotifyOff,
+             &QueueNotifyOff
              );
   if (EFI_ERROR (Status)) {
     return Status;
@@ -649,14 +709,51 @@ Virtio10SetQueueNotify (
     return Status;
   }
 
+  *NotifyOffset = QueueNotifyOff * Dev->NotifyOffsetMultiplier;
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+Virtio10SetQueueNotify (
+  IN VIRTIO_DEVICE_PROTOCOL  *This,
+  IN UINT16                  Index
+  )
+{
+  VIRTIO_1_0_DEV  *Dev;
+  EFI_STATUS      Status;
+  UINT32          NotifyOffset;
+
+  Dev = VIRTIO_1_0_FROM_VIRTIO_DEVICE (This);
+  ++Dev->NotifyCount;
+
   //
-  // We can now kick the queue.
+  // The doorbell offset of a queue is fixed by the device, so it is normally
+  // recorded when the queue is set up, and a kick is a single write.
   //
+  if ((Index < VIRTIO_1_0_NOTIFY_CACHE_SIZE) &&
+      ((Dev->NotifyCacheValid & (BIT0 << Index)) != 0))
+  {
+    NotifyOffset = Dev->NotifyCache[Index];
+  } else {
+    ++Dev->NotifyLookupCount;
+    Status = Virtio10LookupQueueNotify (Dev, Index, &NotifyOffset);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    if (Index < VIRTIO_1_0_NOTIFY_CACHE_SIZE) {
+      Dev->NotifyCache[Index] = NotifyOffset;
+      Dev->NotifyCacheValid  |= BIT0 << Index;
+    }
+  }
+
   Status = Virtio10Transfer (
              Dev->PciIo,
              &Dev->NotifyConfig,
              TRUE,
-             NotifyOffset * Dev->NotifyOffsetMultiplier,
+             NotifyOffset,
              sizeof Index,
              &Index
              );
@@ -1191,6 +1288,14 @@ Virtio10BindingStop (
 
   Device = VIRTIO_1_0_FROM_VIRTIO_DEVICE (VirtIo);
 
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: %Lu queue notifications, %Lu with QueueNotifyOff lookup\n",
+    __func__,
+    Device->NotifyCount,
+    Device->NotifyLookupCount
+    ));
+
   Status = gBS->UninstallProtocolInterface (
                   DeviceHandle,
                   &gVirtioDeviceProtocolGuid,
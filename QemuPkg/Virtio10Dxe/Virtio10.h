@@ -14,6 +14,12 @@
 
 #define VIRTIO_1_0_SIGNATURE  SIGNATURE_32 ('V', 'I', 'O', '1')
 
+//
+// The number of queues per device whose notification offset is cached. Kicks
+// on queues beyond this still work, but look the offset up every time.
+//
+#define VIRTIO_1_0_NOTIFY_CACHE_SIZE  32
+
 //
 // Type of the PCI BAR that contains a VirtIo 1.0 config structure.
 //
@@ -42,6 +48,16 @@ typedef struct {
   VIRTIO_1_0_CONFIG         NotifyConfig;        // Notifications
   UINT32                    NotifyOffsetMultiplier;
   VIRTIO_1_0_CONFIG         SpecificConfig;      // Device specific settings
+  UINT16                    QueueSelect;         // Last value written to
+                                                 // QueueSelect
+  UINT32                    NotifyCacheValid;    // Bitmap of queues whose
+                                                 // entry in NotifyCache is set
+  UINT32                    NotifyCache[VIRTIO_1_0_NOTIFY_CACHE_SIZE];
+                                                 // Offset of each queue's
+                                                 // doorbell in NotifyConfig
+  UINT64                    NotifyCount;         // Kicks
+  UINT64                    NotifyLookupCount;   // Kicks that had to read
+                                                 // QueueNotifyOff
 } VIRTIO_1_0_DEV;
 
 #define VIRTIO_1_0_FROM_VIRTIO_DEVICE(Device) \
@@ -6,9 +6,9 @@
 
   - No attach/detach (ie. removable media).
 
-  - Although the non-blocking interfaces of EFI_BLOCK_IO2_PROTOCOL could be a
-    good match for multiple in-flight virtio-blk requests, we stick to
-    synchronous requests and EFI_BLOCK_IO_PROTOCOL for now.
+  - EFI_BLOCK_IO2_PROTOCOL is produced alongside EFI_BLOCK_IO_PROTOCOL.
+    Non-blocking requests are kept in flight in fixed descriptor slots of the
+    ring, and completed from a timer-driven poll of the used ring.
 
   Copyright (C) 2012, Red Hat, Inc.
   Copyright (c) 2012 - 2018, Intel Corporation. All rights reserved.<BR>
@@ -19,9 +19,11 @@
 **/
 
 #include <IndustryStandard/VirtioBlk.h>
+#include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiLib.h>
 #include <Library/VirtioLib.h>
@@ -106,9 +108,10 @@ VirtioBlkReset (
     - 24.2.2. ReadBlocks() and ReadBlocksEx() Implementation
     - 24.2.3 WriteBlocks() and WriteBlockEx() Implementation
 
-  Request sizes are limited to 1 GB (checked). This is not a practical
-  limitation, just conformance to virtio-0.9.5, 2.3.2 Descriptor Table: "no
-  descriptor chain may be more than 2^32 bytes long in total".
+  Request sizes are not limited: SynchronousRequest() and
+  VirtioBlkSubmitAsync() split large transfers into requests that conform to
+  virtio-0.9.5, 2.3.2 Descriptor Table ("no descriptor chain may be more than
+  2^32 bytes long in total"), and to the host's VIRTIO_BLK_F_SIZE_MAX limit.
 
   Some Media characteristics are hardcoded in VirtioBlkInit() below (like
   non-removable media, no restriction on buffer alignment etc); we rely on
@@ -152,9 +155,7 @@ VerifyReadWriteRequest (
 
   ASSERT (PositiveBufferSize > 0);
 
-  if ((PositiveBufferSize > SIZE_1GB) ||
-      (PositiveBufferSize % Media->BlockSize > 0))
-  {
+  if (PositiveBufferSize % Media->BlockSize > 0) {
     return EFI_BAD_BUFFER_SIZE;
   }
 
@@ -176,20 +177,260 @@ VerifyReadWriteRequest (
 
 /**
 
-  Format a read / write / flush request as three consecutive virtio
-  descriptors, push them to the host, and poll for the response.
+  Return a request slot to the free stack.
 
-  This is the main workhorse function. Two use cases are supported, read/write
-  and flush. The function may only be called after the request parameters have
-  been verified by
-  - specific checks in ReadBlocks() / WriteBlocks() / FlushBlocks(), and
-  - VerifyReadWriteRequest() (for read/write only).
+  @param[in,out] Dev     The virtio-blk device that owns the slot.
+
+  @param[in]     ReqIdx  The index of the slot in Dev->Reqs.
+
+**/
+STATIC
+VOID
+VirtioBlkReleaseRequest (
+  IN OUT VBLK_DEV  *Dev,
+  IN     UINT16    ReqIdx
+  )
+{
+  ASSERT (Dev->CurPending > 0);
+  ASSERT (!Dev->Reqs[ReqIdx].InFlight);
+
+  Dev->FreeStack[--Dev->CurPending] = ReqIdx;
+}
+
+/**
+
+  Report the result of a transfer whose requests have all been completed.
+
+  Blocking callers collect the result in VirtioBlkWaitTransfer(). Non-blocking
+  transfers have their token's event signaled, and are freed here.
+
+  Must be called at TPL_NOTIFY.
+
+  @param[in] Xfer  The transfer to finish.
+
+**/
+STATIC
+VOID
+VirtioBlkFinishTransfer (
+  IN VBLK_XFER  *Xfer
+  )
+{
+  ASSERT (Xfer->Pending == 0);
+  ASSERT (!Xfer->Submitting);
+
+  if (Xfer->Token == NULL) {
+    return;
+  }
+
+  Xfer->Token->TransactionStatus = Xfer->Status;
+  gBS->SignalEvent (Xfer->Token->Event);
+  FreePool (Xfer);
+}
+
+/**
+
+  Detach the requests in flight from a transfer whose submission failed
+  half-way.
+
+  The descriptor chains of those requests are visible to the host already, so
+  their slots can only be recycled once the host has processed them. Let the
+  used ring poll reap them without reporting anything; the caller is
+  responsible for reporting the failure, and for releasing the transfer.
+
+  Must be called at TPL_NOTIFY.
+
+  @param[in,out] Dev   The virtio-blk device the transfer was submitted to.
+
+  @param[in]     Xfer  The transfer to abandon.
+
+**/
+STATIC
+VOID
+VirtioBlkAbandonTransfer (
+  IN OUT VBLK_DEV   *Dev,
+  IN     VBLK_XFER  *Xfer
+  )
+{
+  UINT16    ReqIdx;
+  VBLK_REQ  *Req;
+
+  for (ReqIdx = 0; ReqIdx < Dev->MaxPending; ++ReqIdx) {
+    Req = &Dev->Reqs[ReqIdx];
+    if (!Req->InFlight || (Req->Xfer != Xfer)) {
+      continue;
+    }
+
+    Req->Xfer = NULL;
+    if (Req->Blocking) {
+      Req->Blocking = FALSE;
+      if (Dev->AsyncPending++ == 0) {
+        gBS->SetTimer (Dev->PollTimer, TimerPeriodic, VBLK_ASYNC_POLL_PERIOD);
+      }
+    }
+  }
+
+  Xfer->Pending    = 0;
+  Xfer->Submitting = FALSE;
+}
+
+/**
+
+  Finish a request that the host has processed, or that has been abandoned
+  after a device reset: release the bus master mapping of the data buffer and
+  the request slot, and account for the result in the request's transfer.
+
+  Must be called at TPL_NOTIFY.
+
+  @param[in,out] Dev           The virtio-blk device the request belongs to.
+
+  @param[in]     ReqIdx        The index of the request in Dev->Reqs.
+
+  @param[in]     HostComplete  TRUE if the host produced a used element for
+                               the request, FALSE if the request is being
+                               aborted.
+
+**/
+STATIC
+VOID
+VirtioBlkCompleteRequest (
+  IN OUT VBLK_DEV  *Dev,
+  IN     UINT16    ReqIdx,
+  IN     BOOLEAN   HostComplete
+  )
+{
+  VBLK_REQ    *Req;
+  VBLK_XFER   *Xfer;
+  EFI_STATUS  Status;
+  EFI_STATUS  UnmapStatus;
+
+  Req = &Dev->Reqs[ReqIdx];
+  ASSERT (Req->InFlight);
+
+  if (!HostComplete) {
+    Status = EFI_ABORTED;
+  } else if (Dev->SharedReqs[ReqIdx].HostStatus == VIRTIO_BLK_S_OK) {
+    Status = EFI_SUCCESS;
+  } else {
+    Status = EFI_DEVICE_ERROR;
+  }
+
+  if (Req->BufferSize > 0) {
+    UnmapStatus = Dev->VirtIo->UnmapSharedBuffer (
+                                 Dev->VirtIo,
+                                 Req->BufferMapping
+                                 );
+    if (EFI_ERROR (UnmapStatus) && !Req->RequestIsWrite && !EFI_ERROR (Status)) {
+      //
+      // Data from the bus master may not reach the caller; fail the request.
+      //
+      Status = EFI_DEVICE_ERROR;
+    }
+  }
+
+  Req->InFlight = FALSE;
+
+  if (!Req->Blocking) {
+    ASSERT (Dev->AsyncPending > 0);
+    if ((--Dev->AsyncPending == 0) && IsListEmpty (&Dev->DeferredXfers)) {
+      gBS->SetTimer (Dev->PollTimer, TimerCancel, 0);
+    }
+  }
+
+  Xfer = Req->Xfer;
+  VirtioBlkReleaseRequest (Dev, ReqIdx);
+
+  if (Xfer == NULL) {
+    return;
+  }
+
+  if (EFI_ERROR (Status) && !EFI_ERROR (Xfer->Status)) {
+    Xfer->Status = Status;
+  }
+
+  ASSERT (Xfer->Pending > 0);
+  if ((--Xfer->Pending == 0) && !Xfer->Submitting) {
+    VirtioBlkFinishTransfer (Xfer);
+  }
+}
+
+/**
+
+  Complete all requests that the host has processed since the last call.
+
+  Must be called at TPL_NOTIFY.
+
+  @param[in,out] Dev  The virtio-blk device whose used ring should be checked.
+
+**/
+STATIC
+VOID
+VirtioBlkProcessUsed (
+  IN OUT VBLK_DEV  *Dev
+  )
+{
+  UINT16  HeadDescIdx;
+  UINT16  ReqIdx;
+
+  while (!EFI_ERROR (
+            VirtioGetNextUsed (
+              &Dev->Ring,
+              &Dev->LastUsed,
+              &HeadDescIdx,
+              NULL
+              )
+            ))
+  {
+    //
+    // The head index comes from the host. Only complete a request that we
+    // actually have in flight; anything else would unmap a stale buffer, or
+    // free a request slot twice.
+    //
+    ReqIdx = HeadDescIdx / Dev->DescPerReq;
+    if ((HeadDescIdx % Dev->DescPerReq != 0) ||
+        (ReqIdx >= Dev->MaxPending) ||
+        !Dev->Reqs[ReqIdx].InFlight)
+    {
+      DEBUG ((
+        DEBUG_ERROR,
+        "%a: ignoring used element with bad head index %u\n",
+        __FUNCTION__,
+        HeadDescIdx
+        ));
+      continue;
+    }
+
+    VirtioBlkCompleteRequest (
+      Dev,
+      ReqIdx,
+      TRUE                              // HostComplete
+      );
+  }
+}
+
+/**
+
+  Format a read / write / flush request as consecutive virtio descriptors in a
+  free request slot, and push them to the host without waiting for the
+  response.
+
+  Must be called at TPL_NOTIFY, from VirtioBlkSubmitRemainder(). If all request
+  slots are in use, then for a blocking transfer, the function temporarily
+  restores OldTpl, and waits on the used ring with VirtioWaitUsed() until a
+  slot becomes free. A non-blocking transfer never waits.
 
   Parameters handled commonly:
 
     @param[in] Dev             The virtio-blk device the request is targeted
                                at.
 
+    @param[in] OldTpl          The TPL to restore while waiting for a free
+                               request slot. Ignored if Xfer->Token is not
+                               NULL.
+
+    @param[in,out] Xfer        The transfer that the request is part of.
+                               Xfer->Pending is incremented once the request
+                               is in flight.
+
   Flush request:
 
     @param[in] Lba             Must be zero.
@@ -207,7 +448,7 @@ VerifyReadWriteRequest (
 
     @param[in] BufferSize      Size of buffer to transfer, in bytes. The caller
                                is responsible to ensure this parameter is
-                               positive.
+                               positive, and not larger than Dev->MaxTransfer.
 
     @param[in out] Buffer      The guest side area to read data from the device
                                into, or write data to the device from.
@@ -215,51 +456,47 @@ VerifyReadWriteRequest (
     @param[in] RequestIsWrite  TRUE iff data transfer goes from guest to
                                device.
 
-  Return values are common to both use cases, and are appropriate to be
-  forwarded by the EFI_BLOCK_IO_PROTOCOL functions (ReadBlocks(),
-  WriteBlocks(), FlushBlocks()).
 
+  @retval EFI_SUCCESS       The request has been submitted to the host.
 
-  @retval EFI_SUCCESS          Transfer complete.
+  @retval EFI_NOT_READY     Xfer->Token is not NULL, and all request slots
+                            are in use. Nothing has been submitted.
 
-  @retval EFI_DEVICE_ERROR     Failed to notify host side via VirtIo write, or
-                               unable to parse host response, or host response
-                               is not VIRTIO_BLK_S_OK or failed to map Buffer
-                               for a bus master operation.
+  @retval EFI_DEVICE_ERROR  Failed to map the data buffer of the request, or
+                            failed to notify the host side via VirtIo write. In
+                            the latter case the request stays in flight as part
+                            of Xfer, and the caller has to abandon Xfer.
 
 **/
 STATIC
 EFI_STATUS
 EFIAPI
-SynchronousRequest (
-  IN              VBLK_DEV  *Dev,
-  IN              EFI_LBA   Lba,
-  IN              UINTN     BufferSize,
-  IN OUT volatile VOID      *Buffer,
-  IN              BOOLEAN   RequestIsWrite
+VirtioBlkSubmitRequest (
+  IN OUT          VBLK_DEV   *Dev,
+  IN              EFI_TPL    OldTpl,
+  IN              EFI_LBA    Lba,
+  IN              UINTN      BufferSize,
+  IN OUT volatile VOID       *Buffer,
+  IN              BOOLEAN    RequestIsWrite,
+  IN OUT          VBLK_XFER  *Xfer
   )
 {
-  UINT32                   BlockSize;
-  volatile VIRTIO_BLK_REQ  Request;
-  volatile UINT8           *HostStatus;
-  VOID                     *HostStatusBuffer;
-  DESC_INDICES             Indices;
-  VOID                     *RequestMapping;
-  VOID                     *StatusMapping;
-  VOID                     *BufferMapping;
-  EFI_PHYSICAL_ADDRESS     BufferDeviceAddress;
-  EFI_PHYSICAL_ADDRESS     HostStatusDeviceAddress;
-  EFI_PHYSICAL_ADDRESS     RequestDeviceAddress;
-  EFI_STATUS               Status;
-  EFI_STATUS               UnmapStatus;
+  UINT32                    BlockSize;
+  UINT16                    LastUsed;
+  UINT16                    ReqIdx;
+  VBLK_REQ                  *Req;
+  volatile VBLK_SHARED_REQ  *Shared;
+  DESC_INDICES              Indices;
+  EFI_PHYSICAL_ADDRESS      BufferDeviceAddress;
+  EFI_PHYSICAL_ADDRESS      HostStatusDeviceAddress;
+  EFI_PHYSICAL_ADDRESS      RequestDeviceAddress;
+  EFI_STATUS                Status;
 
   BlockSize = Dev->BlockIoMedia.BlockSize;
 
   //
-  // Set BufferMapping and BufferDeviceAddress to suppress incorrect
-  // compiler/analyzer warnings.
+  // Set BufferDeviceAddress to suppress incorrect compiler/analyzer warnings.
   //
-  BufferMapping       = NULL;
   BufferDeviceAddress = 0;
 
   //
@@ -272,49 +509,60 @@ SynchronousRequest (
   // ensured by contract above, plus VerifyReadWriteRequest()
   //
   ASSERT (BufferSize % BlockSize == 0);
+  ASSERT (BufferSize <= Dev->MaxTransfer);
 
   //
-  // Prepare virtio-blk request header, setting zero size for flush.
-  // IO Priority is homogeneously 0.
+  // Wait for a free request slot, unless the caller must not be blocked.
   //
-  Request.Type = RequestIsWrite ?
-                 (BufferSize == 0 ? VIRTIO_BLK_T_FLUSH : VIRTIO_BLK_T_OUT) :
-                 VIRTIO_BLK_T_IN;
-  Request.IoPrio = 0;
-  Request.Sector = MultU64x32 (Lba, BlockSize / 512);
+  for ( ; ;) {
+    VirtioBlkProcessUsed (Dev);
+    if (Dev->CurPending < Dev->MaxPending) {
+      break;
+    }
 
-  //
-  // Host status is bi-directional (we preset with a value and expect the
-  // device to update it). Allocate a host status buffer which can be mapped
-  // to access equally by both processor and the device.
-  //
-  Status = Dev->VirtIo->AllocateSharedPages (
-                          Dev->VirtIo,
-                          EFI_SIZE_TO_PAGES (sizeof *HostStatus),
-                          &HostStatusBuffer
-                          );
-  if (EFI_ERROR (Status)) {
-    return EFI_DEVICE_ERROR;
+    if (Xfer->Token != NULL) {
+      return EFI_NOT_READY;
+    }
+
+    LastUsed = Dev->LastUsed;
+    gBS->RestoreTPL (OldTpl);
+    VirtioWaitUsed (&Dev->Ring, &Dev->LastUsed, LastUsed);
+    gBS->RaiseTPL (TPL_NOTIFY);
   }
 
-  HostStatus = HostStatusBuffer;
+  ReqIdx = Dev->FreeStack[Dev->CurPending++];
+  Req    = &Dev->Reqs[ReqIdx];
+  ASSERT (!Req->InFlight);
 
   //
-  // Map virtio-blk request header (must be done after request header is
-  // populated)
+  // Prepare virtio-blk request header, setting zero size for flush.
+  // IO Priority is homogeneously 0. The header and the host status live in the
+  // request slot's shared area, which is mapped as a common buffer for the
+  // lifetime of the device.
   //
-  Status = VirtioMapAllBytesInSharedBuffer (
-             Dev->VirtIo,
-             VirtioOperationBusMasterRead,
-             (VOID *)&Request,
-             sizeof Request,
-             &RequestDeviceAddress,
-             &RequestMapping
-             );
-  if (EFI_ERROR (Status)) {
-    Status = EFI_DEVICE_ERROR;
-    goto FreeHostStatusBuffer;
-  }
+  Shared                 = &Dev->SharedReqs[ReqIdx];
+  Shared->Request.Type   = RequestIsWrite ?
+                           (BufferSize == 0 ? VIRTIO_BLK_T_FLUSH : VIRTIO_BLK_T_OUT) :
+                           VIRTIO_BLK_T_IN;
+  Shared->Request.IoPrio = 0;
+  Shared->Request.Sector = MultU64x32 (Lba, BlockSize / 512);
+
+  //
+  // preset a host status for ourselves that we do not accept as success
+  //
+  Shared->HostStatus = VIRTIO_BLK_S_IOERR;
+
+  Req->BufferSize     = BufferSize;
+  Req->RequestIsWrite = RequestIsWrite;
+  Req->Xfer           = Xfer;
+  Req->Blocking       = (BOOLEAN)(Xfer->Token == NULL);
+
+  RequestDeviceAddress = Dev->SharedReqsBase +
+                         ReqIdx * sizeof *Shared +
+                         OFFSET_OF (VBLK_SHARED_REQ, Request);
+  HostStatusDeviceAddress = Dev->SharedReqsBase +
+                            ReqIdx * sizeof *Shared +
+                            OFFSET_OF (VBLK_SHARED_REQ, HostStatus);
 
   //
   // Map data buffer
@@ -328,43 +576,27 @@ SynchronousRequest (
                (VOID *)Buffer,
                BufferSize,
                &BufferDeviceAddress,
-               &BufferMapping
+               &Req->BufferMapping
                );
     if (EFI_ERROR (Status)) {
-      Status = EFI_DEVICE_ERROR;
-      goto UnmapRequestBuffer;
+      VirtioBlkReleaseRequest (Dev, ReqIdx);
+      return EFI_DEVICE_ERROR;
     }
   }
 
   //
-  // preset a host status for ourselves that we do not accept as success
-  //
-  *HostStatus = VIRTIO_BLK_S_IOERR;
-
-  //
-  // Map the Status Buffer with VirtioOperationBusMasterCommonBuffer so that
-  // both processor and device can access it.
-  //
-  Status = VirtioMapAllBytesInSharedBuffer (
-             Dev->VirtIo,
-             VirtioOperationBusMasterCommonBuffer,
-             HostStatusBuffer,
-             sizeof *HostStatus,
-             &HostStatusDeviceAddress,
-             &StatusMapping
-             );
-  if (EFI_ERROR (Status)) {
-    Status = EFI_DEVICE_ERROR;
-    goto UnmapDataBuffer;
-  }
-
-  VirtioPrepare (&Dev->Ring, &Indices);
-
-  //
-  // ensured by VirtioBlkInit() -- this predicate, in combination with the
-  // lock-step progress, ensures we don't have to track free descriptors.
+  // Every request slot owns Dev->DescPerReq consecutive descriptors of a
+  // split ring, starting at a fixed head index. A packed ring places the
+  // descriptors in ring order instead, but reports the same index back as the
+  // buffer ID. Either way, that's how used elements are mapped back to request
+  // slots. With indirect descriptors, the slot owns a single descriptor of the
+  // ring, and VirtioLib builds the chain in the indirect table of the slot.
   //
-  ASSERT (Dev->Ring.QueueSize >= 3);
+  VirtioPrepareChain (
+    &Dev->Ring,
+    (UINT16)(ReqIdx * Dev->DescPerReq),
+    &Indices
+    );
 
   //
   // virtio-blk header in first desc
@@ -372,7 +604,7 @@ SynchronousRequest (
   VirtioAppendDesc (
     &Dev->Ring,
     RequestDeviceAddress,
-    sizeof Request,
+    sizeof Shared->Request,
     VRING_DESC_F_NEXT,
     &Indices
     );
@@ -382,15 +614,8 @@ SynchronousRequest (
   //
   if (BufferSize > 0) {
     //
-    // From virtio-0.9.5, 2.3.2 Descriptor Table:
-    // "no descriptor chain may be more than 2^32 bytes long in total".
-    //
-    // The predicate is ensured by the call contract above (for flush), or
-    // VerifyReadWriteRequest() (for read/write). It also implies that
-    // converting BufferSize to UINT32 will not truncate it.
-    //
-    ASSERT (BufferSize <= SIZE_1GB);
-
+    // VirtioBlkInit() ensures that Dev->MaxTransfer honors the host's
+    // VIRTIO_BLK_F_SIZE_MAX limit, and also fits in a UINT32.
     //
     // VRING_DESC_F_WRITE is interpreted from the host's point of view.
     //
@@ -409,156 +634,738 @@ SynchronousRequest (
   VirtioAppendDesc (
     &Dev->Ring,
     HostStatusDeviceAddress,
-    sizeof *HostStatus,
+    sizeof Shared->HostStatus,
     VRING_DESC_F_WRITE,
     &Indices
     );
 
+  VirtioSubmitChain (&Dev->Ring, &Indices);
+  Req->InFlight = TRUE;
+  ++Xfer->Pending;
+
+  if (!Req->Blocking) {
+    if (Dev->AsyncPending++ == 0) {
+      gBS->SetTimer (Dev->PollTimer, TimerPeriodic, VBLK_ASYNC_POLL_PERIOD);
+    }
+  }
+
   //
   // virtio-blk's only virtqueue is #0, called "requestq" (see Appendix D).
+  // While the host is still working through earlier requests, it suppresses
+  // the notification, and picks up this request without a VM exit.
   //
-  if ((VirtioFlush (
-         Dev->VirtIo,
-         0,
-         &Dev->Ring,
-         &Indices,
-         NULL
-         ) == EFI_SUCCESS) &&
-      (*HostStatus == VIRTIO_BLK_S_OK))
-  {
-    Status = EFI_SUCCESS;
-  } else {
-    Status = EFI_DEVICE_ERROR;
+  if (VirtioNeedNotify (&Dev->Ring)) {
+    Status = Dev->VirtIo->SetQueueNotify (Dev->VirtIo, 0);
+    if (EFI_ERROR (Status)) {
+      return EFI_DEVICE_ERROR;
+    }
   }
 
-  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, StatusMapping);
+  return EFI_SUCCESS;
+}
+
+/**
+
+  Split the part of a transfer that has not been submitted yet into requests
+  of at most Dev->MaxTransfer bytes, and submit them to the host, without
+  waiting for their completion.
 
-UnmapDataBuffer:
-  if (BufferSize > 0) {
-    UnmapStatus = Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, BufferMapping);
-    if (EFI_ERROR (UnmapStatus) && !RequestIsWrite && !EFI_ERROR (Status)) {
+  Requests are pipelined on the ring: each one is submitted as soon as a
+  request slot is free, so the host may work on the first part of the
+  transfer while the rest is being queued.
+
+  Must be called at TPL_NOTIFY.
+
+  @param[in,out] Dev     The virtio-blk device the transfer is targeted at.
+
+  @param[in]     OldTpl  See VirtioBlkSubmitRequest().
+
+  @param[in,out] Xfer    The transfer to submit. Xfer->Lba, Xfer->Buffer and
+                         Xfer->BufferSize are advanced past every request that
+                         has been submitted.
+
+  @retval EFI_SUCCESS  All requests of the transfer have been submitted.
+
+  @return              Error codes from VirtioBlkSubmitRequest().
+
+**/
+STATIC
+EFI_STATUS
+VirtioBlkSubmitRemainder (
+  IN OUT VBLK_DEV   *Dev,
+  IN     EFI_TPL    OldTpl,
+  IN OUT VBLK_XFER  *Xfer
+  )
+{
+  UINTN       ChunkSize;
+  EFI_STATUS  Status;
+
+  //
+  // A flush is submitted as a single request with zero BufferSize.
+  //
+  do {
+    ChunkSize = MIN (Xfer->BufferSize, Dev->MaxTransfer);
+    Status    = VirtioBlkSubmitRequest (
+                  Dev,
+                  OldTpl,
+                  Xfer->Lba,
+                  ChunkSize,
+                  Xfer->Buffer,
+                  Xfer->RequestIsWrite,
+                  Xfer
+                  );
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    Xfer->Lba        += ChunkSize / Dev->BlockIoMedia.BlockSize;
+    Xfer->Buffer     += ChunkSize;
+    Xfer->BufferSize -= ChunkSize;
+  } while (Xfer->BufferSize > 0);
+
+  return EFI_SUCCESS;
+}
+
+/**
+
+  Submit the rest of the non-blocking transfers that have run out of request
+  slots, in the order they were queued, for as long as request slots are
+  free.
+
+  Must be called at TPL_NOTIFY.
+
+  @param[in,out] Dev  The virtio-blk device whose deferred transfers should be
+                      submitted.
+
+**/
+STATIC
+VOID
+VirtioBlkSubmitDeferred (
+  IN OUT VBLK_DEV  *Dev
+  )
+{
+  VBLK_XFER   *Xfer;
+  EFI_STATUS  Status;
+
+  while (!IsListEmpty (&Dev->DeferredXfers)) {
+    Xfer   = BASE_CR (GetFirstNode (&Dev->DeferredXfers), VBLK_XFER, Link);
+    Status = VirtioBlkSubmitRemainder (Dev, TPL_NOTIFY, Xfer);
+    if (Status == EFI_NOT_READY) {
+      return;
+    }
+
+    RemoveEntryList (&Xfer->Link);
+
+    if (EFI_ERROR (Status)) {
       //
-      // Data from the bus master may not reach the caller; fail the request.
+      // The caller has been told that the transfer was queued; report the
+      // failure through the token.
       //
-      Status = EFI_DEVICE_ERROR;
+      VirtioBlkAbandonTransfer (Dev, Xfer);
+      if (!EFI_ERROR (Xfer->Status)) {
+        Xfer->Status = Status;
+      }
+    }
+
+    Xfer->Submitting = FALSE;
+    if (Xfer->Pending == 0) {
+      VirtioBlkFinishTransfer (Xfer);
     }
   }
 
-UnmapRequestBuffer:
-  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, RequestMapping);
+  if (Dev->AsyncPending == 0) {
+    gBS->SetTimer (Dev->PollTimer, TimerCancel, 0);
+  }
+}
 
-FreeHostStatusBuffer:
-  Dev->VirtIo->FreeSharedPages (
-                 Dev->VirtIo,
-                 EFI_SIZE_TO_PAGES (sizeof *HostStatus),
-                 HostStatusBuffer
-                 );
+/**
 
-  return Status;
+  Timer notification function that completes non-blocking requests, and
+  submits the rest of the non-blocking transfers that have been waiting for a
+  free request slot.
+
+  @param[in] Event    Event whose notification function is being invoked.
+
+  @param[in] Context  Pointer to the VBLK_DEV structure.
+
+**/
+STATIC
+VOID
+EFIAPI
+VirtioBlkPollTimer (
+  IN  EFI_EVENT  Event,
+  IN  VOID       *Context
+  )
+{
+  //
+  // This callback is running at TPL_NOTIFY already.
+  //
+  VirtioBlkProcessUsed (Context);
+  VirtioBlkSubmitDeferred (Context);
+}
+
+/**
+
+  Submit a read / write / flush transfer to the host, without waiting for its
+  completion.
+
+  A blocking transfer is submitted in full before the function returns. If a
+  non-blocking transfer runs out of request slots, the rest of it is queued,
+  and VirtioBlkPollTimer() submits it as slots are freed; the caller is never
+  blocked.
+
+  The function may only be called after the request parameters have been
+  verified by
+  - specific checks in ReadBlocks() / WriteBlocks() / FlushBlocks() and their
+    BlockIo2 counterparts, and
+  - VerifyReadWriteRequest() (for read/write only).
+
+  See VirtioBlkSubmitRequest() for the parameters.
+
+  @param[in,out] Xfer  The transfer to submit. The caller initializes
+                       Xfer->Token, and zeroes the other fields. If Xfer->Token
+                       is not NULL, and the function succeeds, then Xfer is
+                       freed with FreePool() once the transfer completes.
+
+  @retval EFI_SUCCESS  All requests of the transfer have been submitted, or
+                       queued for submission.
+
+  @return              Error codes from VirtioBlkSubmitRequest(). Requests of
+                       the transfer that are already in flight have been
+                       abandoned, and the caller retains ownership of Xfer.
+
+**/
+STATIC
+EFI_STATUS
+VirtioBlkSubmitTransfer (
+  IN OUT          VBLK_DEV   *Dev,
+  IN              EFI_LBA    Lba,
+  IN              UINTN      BufferSize,
+  IN OUT volatile VOID       *Buffer,
+  IN              BOOLEAN    RequestIsWrite,
+  IN OUT          VBLK_XFER  *Xfer
+  )
+{
+  EFI_TPL     OldTpl;
+  EFI_STATUS  Status;
+
+  OldTpl               = gBS->RaiseTPL (TPL_NOTIFY);
+  Xfer->Submitting     = TRUE;
+  Xfer->Lba            = Lba;
+  Xfer->Buffer         = Buffer;
+  Xfer->BufferSize     = BufferSize;
+  Xfer->RequestIsWrite = RequestIsWrite;
+
+  //
+  // Don't let a non-blocking transfer overtake those that are waiting for
+  // request slots already.
+  //
+  if ((Xfer->Token != NULL) && !IsListEmpty (&Dev->DeferredXfers)) {
+    Status = EFI_NOT_READY;
+  } else {
+    Status = VirtioBlkSubmitRemainder (Dev, OldTpl, Xfer);
+  }
+
+  if (Status == EFI_NOT_READY) {
+    //
+    // All request slots are in use, and the caller must not be blocked. The
+    // poll timer may not be running if only blocking requests are in flight.
+    //
+    if ((Dev->AsyncPending == 0) && IsListEmpty (&Dev->DeferredXfers)) {
+      gBS->SetTimer (Dev->PollTimer, TimerPeriodic, VBLK_ASYNC_POLL_PERIOD);
+    }
+
+    InsertTailList (&Dev->DeferredXfers, &Xfer->Link);
+    gBS->RestoreTPL (OldTpl);
+    return EFI_SUCCESS;
+  }
+
+  if (EFI_ERROR (Status)) {
+    VirtioBlkAbandonTransfer (Dev, Xfer);
+    gBS->RestoreTPL (OldTpl);
+    return Status;
+  }
+
+  Xfer->Submitting = FALSE;
+  if (Xfer->Pending == 0) {
+    VirtioBlkFinishTransfer (Xfer);
+  }
+
+  gBS->RestoreTPL (OldTpl);
+  return EFI_SUCCESS;
+}
+
+/**
+
+  Poll the used ring until the host processes all requests of a blocking
+  transfer submitted with VirtioBlkSubmitTransfer().
+
+  Non-blocking requests that the host completes in the meantime are finished
+  as well.
+
+  @param[in,out] Dev   The virtio-blk device the transfer was submitted to.
+
+  @param[in]     Xfer  The transfer to wait for.
+
+  @return  The result of the transfer: EFI_SUCCESS, or the first failure that
+           VirtioBlkCompleteRequest() determined for its requests.
+
+**/
+STATIC
+EFI_STATUS
+VirtioBlkWaitTransfer (
+  IN OUT VBLK_DEV   *Dev,
+  IN     VBLK_XFER  *Xfer
+  )
+{
+  EFI_TPL  OldTpl;
+  UINT16   LastUsed;
+  BOOLEAN  Done;
+
+  ASSERT (Xfer->Token == NULL);
+
+  for ( ; ;) {
+    OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+    VirtioBlkProcessUsed (Dev);
+    Done     = (BOOLEAN)(Xfer->Pending == 0);
+    LastUsed = Dev->LastUsed;
+    gBS->RestoreTPL (OldTpl);
+
+    if (Done) {
+      return Xfer->Status;
+    }
+
+    VirtioWaitUsed (&Dev->Ring, &Dev->LastUsed, LastUsed);
+  }
+}
+
+/**
+
+  Poll the used ring until all non-blocking transfers have been submitted in
+  full, and all non-blocking requests in flight have been completed.
+
+  @param[in,out] Dev  The virtio-blk device to drain.
+
+**/
+STATIC
+VOID
+VirtioBlkDrainRequests (
+  IN OUT VBLK_DEV  *Dev
+  )
+{
+  EFI_TPL  OldTpl;
+  UINT16   LastUsed;
+  BOOLEAN  Drained;
+
+  for ( ; ;) {
+    OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+    VirtioBlkProcessUsed (Dev);
+    VirtioBlkSubmitDeferred (Dev);
+    Drained  = (BOOLEAN)(Dev->AsyncPending == 0 &&
+                         IsListEmpty (&Dev->DeferredXfers));
+    LastUsed = Dev->LastUsed;
+    gBS->RestoreTPL (OldTpl);
+
+    if (Drained) {
+      return;
+    }
+
+    VirtioWaitUsed (&Dev->Ring, &Dev->LastUsed, LastUsed);
+  }
+}
+
+/**
+
+  Format a read / write / flush transfer as virtio requests, push them to the
+  host, and poll for the response.
+
+  This is the main workhorse function of the blocking interfaces. See
+  VirtioBlkSubmitRequest() for the parameters.
+
+  Return values are common to both use cases, and are appropriate to be
+  forwarded by the EFI_BLOCK_IO_PROTOCOL functions (ReadBlocks(),
+  WriteBlocks(), FlushBlocks()).
+
+
+  @retval EFI_SUCCESS          Transfer complete.
+
+  @retval EFI_DEVICE_ERROR     Failed to notify host side via VirtIo write, or
+                               unable to parse host response, or host response
+                               is not VIRTIO_BLK_S_OK or failed to map Buffer
+                               for a bus master operation.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+SynchronousRequest (
+  IN              VBLK_DEV  *Dev,
+  IN              EFI_LBA   Lba,
+  IN              UINTN     BufferSize,
+  IN OUT volatile VOID      *Buffer,
+  IN              BOOLEAN   RequestIsWrite
+  )
+{
+  VBLK_XFER   Xfer;
+  EFI_STATUS  Status;
+
+  ZeroMem (&Xfer, sizeof Xfer);
+  Status = VirtioBlkSubmitTransfer (
+             Dev,
+             Lba,
+             BufferSize,
+             Buffer,
+             RequestIsWrite,
+             &Xfer
+             );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  return VirtioBlkWaitTransfer (Dev, &Xfer);
+}
+
+/**
+
+  Submit a non-blocking BlockIo2 transfer, whose completion is reported through
+  Token.
+
+  See VirtioBlkSubmitRequest() for the other parameters.
+
+  @param[in,out] Token  The BlockIo2 token of the caller, with a non-NULL
+                        Event.
+
+  @retval EFI_SUCCESS           The transfer has been queued.
+
+  @retval EFI_OUT_OF_RESOURCES  Failed to allocate the tracking structure of
+                                the transfer.
+
+  @return                       Error codes from VirtioBlkSubmitTransfer().
+
+**/
+STATIC
+EFI_STATUS
+VirtioBlkSubmitAsync (
+  IN OUT VBLK_DEV             *Dev,
+  IN     EFI_LBA              Lba,
+  IN     UINTN                BufferSize,
+  IN OUT VOID                 *Buffer,
+  IN     BOOLEAN              RequestIsWrite,
+  IN OUT EFI_BLOCK_IO2_TOKEN  *Token
+  )
+{
+  VBLK_XFER   *Xfer;
+  EFI_STATUS  Status;
+
+  Xfer = AllocateZeroPool (sizeof *Xfer);
+  if (Xfer == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Xfer->Token = Token;
+  Status      = VirtioBlkSubmitTransfer (
+                  Dev,
+                  Lba,
+                  BufferSize,
+                  Buffer,
+                  RequestIsWrite,
+                  Xfer
+                  );
+  if (EFI_ERROR (Status)) {
+    FreePool (Xfer);
+  }
+
+  return Status;
+}
+
+/**
+
+  ReadBlocks() operation for virtio-blk.
+
+  See
+  - UEFI Spec 2.3.1 + Errata C, 12.8 EFI Block I/O Protocol, 12.8 EFI Block I/O
+    Protocol, EFI_BLOCK_IO_PROTOCOL.ReadBlocks().
+  - Driver Writer's Guide for UEFI 2.3.1 v1.01, 24.2.2. ReadBlocks() and
+    ReadBlocksEx() Implementation.
+
+  Parameter checks and conformant return values are implemented in
+  VerifyReadWriteRequest() and SynchronousRequest().
+
+  A zero BufferSize doesn't seem to be prohibited, so do nothing in that case,
+  successfully.
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioBlkReadBlocks (
+  IN  EFI_BLOCK_IO_PROTOCOL  *This,
+  IN  UINT32                 MediaId,
+  IN  EFI_LBA                Lba,
+  IN  UINTN                  BufferSize,
+  OUT VOID                   *Buffer
+  )
+{
+  VBLK_DEV    *Dev;
+  EFI_STATUS  Status;
+
+  if (BufferSize == 0) {
+    return EFI_SUCCESS;
+  }
+
+  Dev    = VIRTIO_BLK_FROM_BLOCK_IO (This);
+  Status = VerifyReadWriteRequest (
+             &Dev->BlockIoMedia,
+             Lba,
+             BufferSize,
+             FALSE               // RequestIsWrite
+             );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  return SynchronousRequest (
+           Dev,
+           Lba,
+           BufferSize,
+           Buffer,
+           FALSE       // RequestIsWrite
+           );
+}
+
+/**
+
+  WriteBlocks() operation for virtio-blk.
+
+  See
+  - UEFI Spec 2.3.1 + Errata C, 12.8 EFI Block I/O Protocol, 12.8 EFI Block I/O
+    Protocol, EFI_BLOCK_IO_PROTOCOL.WriteBlocks().
+  - Driver Writer's Guide for UEFI 2.3.1 v1.01, 24.2.3 WriteBlocks() and
+    WriteBlockEx() Implementation.
+
+  Parameter checks and conformant return values are implemented in
+  VerifyReadWriteRequest() and SynchronousRequest().
+
+  A zero BufferSize doesn't seem to be prohibited, so do nothing in that case,
+  successfully.
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioBlkWriteBlocks (
+  IN EFI_BLOCK_IO_PROTOCOL  *This,
+  IN UINT32                 MediaId,
+  IN EFI_LBA                Lba,
+  IN UINTN                  BufferSize,
+  IN VOID                   *Buffer
+  )
+{
+  VBLK_DEV    *Dev;
+  EFI_STATUS  Status;
+
+  if (BufferSize == 0) {
+    return EFI_SUCCESS;
+  }
+
+  Dev    = VIRTIO_BLK_FROM_BLOCK_IO (This);
+  Status = VerifyReadWriteRequest (
+             &Dev->BlockIoMedia,
+             Lba,
+             BufferSize,
+             TRUE                // RequestIsWrite
+             );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  return SynchronousRequest (
+           Dev,
+           Lba,
+           BufferSize,
+           Buffer,
+           TRUE        // RequestIsWrite
+           );
+}
+
+/**
+
+  FlushBlocks() operation for virtio-blk.
+
+  See
+  - UEFI Spec 2.3.1 + Errata C, 12.8 EFI Block I/O Protocol, 12.8 EFI Block I/O
+    Protocol, EFI_BLOCK_IO_PROTOCOL.FlushBlocks().
+  - Driver Writer's Guide for UEFI 2.3.1 v1.01, 24.2.4 FlushBlocks() and
+    FlushBlocksEx() Implementation.
+
+  If the underlying virtio-blk device doesn't support flushing (ie.
+  write-caching), then this function should not be called by higher layers,
+  according to EFI_BLOCK_IO_MEDIA characteristics set in VirtioBlkInit().
+  Should they do nonetheless, we do nothing, successfully.
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioBlkFlushBlocks (
+  IN EFI_BLOCK_IO_PROTOCOL  *This
+  )
+{
+  VBLK_DEV  *Dev;
+
+  Dev = VIRTIO_BLK_FROM_BLOCK_IO (This);
+  return Dev->BlockIoMedia.WriteCaching ?
+         SynchronousRequest (
+           Dev,
+           0,      // Lba
+           0,      // BufferSize
+           NULL,   // Buffer
+           TRUE    // RequestIsWrite
+           ) :
+         EFI_SUCCESS;
+}
+
+//
+// UEFI Spec 2.3.1 + Errata C, 12.9 EFI Block I/O 2 Protocol
+// Driver Writer's Guide for UEFI 2.3.1 v1.01,
+//   24.3 Block I/O 2 Protocol Implementations
+//
+EFI_STATUS
+EFIAPI
+VirtioBlkResetEx (
+  IN EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN BOOLEAN                 ExtendedVerification
+  )
+{
+  //
+  // Let the requests in flight complete; the device itself needs no reset,
+  // see VirtioBlkReset().
+  //
+  VirtioBlkDrainRequests (VIRTIO_BLK_FROM_BLOCK_IO2 (This));
+  return EFI_SUCCESS;
 }
 
 /**
 
-  ReadBlocks() operation for virtio-blk.
-
-  See
-  - UEFI Spec 2.3.1 + Errata C, 12.8 EFI Block I/O Protocol, 12.8 EFI Block I/O
-    Protocol, EFI_BLOCK_IO_PROTOCOL.ReadBlocks().
-  - Driver Writer's Guide for UEFI 2.3.1 v1.01, 24.2.2. ReadBlocks() and
-    ReadBlocksEx() Implementation.
+  Common implementation of ReadBlocksEx() and WriteBlocksEx().
 
   Parameter checks and conformant return values are implemented in
-  VerifyReadWriteRequest() and SynchronousRequest().
+  VerifyReadWriteRequest() and VirtioBlkSubmitAsync().
 
-  A zero BufferSize doesn't seem to be prohibited, so do nothing in that case,
-  successfully.
+  @retval EFI_SUCCESS  The request has been queued (non-blocking), or it has
+                       completed successfully (blocking).
+
+  @return              Error codes from VerifyReadWriteRequest(),
+                       VirtioBlkSubmitAsync(), or SynchronousRequest().
 
 **/
+STATIC
 EFI_STATUS
-EFIAPI
-VirtioBlkReadBlocks (
-  IN  EFI_BLOCK_IO_PROTOCOL  *This,
-  IN  UINT32                 MediaId,
-  IN  EFI_LBA                Lba,
-  IN  UINTN                  BufferSize,
-  OUT VOID                   *Buffer
+VirtioBlkReadWriteEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN     EFI_LBA                 Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN     *Token,
+  IN     UINTN                   BufferSize,
+  IN OUT VOID                    *Buffer,
+  IN     BOOLEAN                 RequestIsWrite
   )
 {
   VBLK_DEV    *Dev;
   EFI_STATUS  Status;
 
+  if ((Token != NULL) && (Token->Event == NULL)) {
+    Token = NULL;
+  }
+
   if (BufferSize == 0) {
+    if (Token != NULL) {
+      Token->TransactionStatus = EFI_SUCCESS;
+      gBS->SignalEvent (Token->Event);
+    }
+
     return EFI_SUCCESS;
   }
 
-  Dev    = VIRTIO_BLK_FROM_BLOCK_IO (This);
+  Dev    = VIRTIO_BLK_FROM_BLOCK_IO2 (This);
   Status = VerifyReadWriteRequest (
              &Dev->BlockIoMedia,
              Lba,
              BufferSize,
-             FALSE               // RequestIsWrite
+             RequestIsWrite
              );
   if (EFI_ERROR (Status)) {
     return Status;
   }
 
-  return SynchronousRequest (
+  if (Token == NULL) {
+    return SynchronousRequest (Dev, Lba, BufferSize, Buffer, RequestIsWrite);
+  }
+
+  return VirtioBlkSubmitAsync (
            Dev,
            Lba,
            BufferSize,
            Buffer,
-           FALSE       // RequestIsWrite
+           RequestIsWrite,
+           Token
            );
 }
 
 /**
 
-  WriteBlocks() operation for virtio-blk.
+  ReadBlocksEx() operation for virtio-blk.
 
   See
-  - UEFI Spec 2.3.1 + Errata C, 12.8 EFI Block I/O Protocol, 12.8 EFI Block I/O
-    Protocol, EFI_BLOCK_IO_PROTOCOL.WriteBlocks().
-  - Driver Writer's Guide for UEFI 2.3.1 v1.01, 24.2.3 WriteBlocks() and
-    WriteBlockEx() Implementation.
-
-  Parameter checks and conformant return values are implemented in
-  VerifyReadWriteRequest() and SynchronousRequest().
-
-  A zero BufferSize doesn't seem to be prohibited, so do nothing in that case,
-  successfully.
+  - UEFI Spec 2.3.1 + Errata C, 12.9 EFI Block I/O 2 Protocol,
+    EFI_BLOCK_IO2_PROTOCOL.ReadBlocksEx().
+  - Driver Writer's Guide for UEFI 2.3.1 v1.01, 24.2.2. ReadBlocks() and
+    ReadBlocksEx() Implementation.
 
 **/
 EFI_STATUS
 EFIAPI
-VirtioBlkWriteBlocks (
-  IN EFI_BLOCK_IO_PROTOCOL  *This,
-  IN UINT32                 MediaId,
-  IN EFI_LBA                Lba,
-  IN UINTN                  BufferSize,
-  IN VOID                   *Buffer
+VirtioBlkReadBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN     UINT32                  MediaId,
+  IN     EFI_LBA                 Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN     *Token,
+  IN     UINTN                   BufferSize,
+  OUT    VOID                    *Buffer
   )
 {
-  VBLK_DEV    *Dev;
-  EFI_STATUS  Status;
+  return VirtioBlkReadWriteEx (
+           This,
+           Lba,
+           Token,
+           BufferSize,
+           Buffer,
+           FALSE       // RequestIsWrite
+           );
+}
 
-  if (BufferSize == 0) {
-    return EFI_SUCCESS;
-  }
+/**
 
-  Dev    = VIRTIO_BLK_FROM_BLOCK_IO (This);
-  Status = VerifyReadWriteRequest (
-             &Dev->BlockIoMedia,
-             Lba,
-             BufferSize,
-             TRUE                // RequestIsWrite
-             );
-  if (EFI_ERROR (Status)) {
-    return Status;
-  }
+  WriteBlocksEx() operation for virtio-blk.
 
-  return SynchronousRequest (
-           Dev,
+  See
+  - UEFI Spec 2.3.1 + Errata C, 12.9 EFI Block I/O 2 Protocol,
+    EFI_BLOCK_IO2_PROTOCOL.WriteBlocksEx().
+  - Driver Writer's Guide for UEFI 2.3.1 v1.01, 24.2.3 WriteBlocks() and
+    WriteBlockEx() Implementation.
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioBlkWriteBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN     UINT32                  MediaId,
+  IN     EFI_LBA                 Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN     *Token,
+  IN     UINTN                   BufferSize,
+  IN     VOID                    *Buffer
+  )
+{
+  return VirtioBlkReadWriteEx (
+           This,
            Lba,
+           Token,
            BufferSize,
            Buffer,
            TRUE        // RequestIsWrite
@@ -567,38 +1374,61 @@ VirtioBlkWriteBlocks (
 
 /**
 
-  FlushBlocks() operation for virtio-blk.
+  FlushBlocksEx() operation for virtio-blk.
 
   See
-  - UEFI Spec 2.3.1 + Errata C, 12.8 EFI Block I/O Protocol, 12.8 EFI Block I/O
-    Protocol, EFI_BLOCK_IO_PROTOCOL.FlushBlocks().
+  - UEFI Spec 2.3.1 + Errata C, 12.9 EFI Block I/O 2 Protocol,
+    EFI_BLOCK_IO2_PROTOCOL.FlushBlocksEx().
   - Driver Writer's Guide for UEFI 2.3.1 v1.01, 24.2.4 FlushBlocks() and
     FlushBlocksEx() Implementation.
 
-  If the underlying virtio-blk device doesn't support flushing (ie.
-  write-caching), then this function should not be called by higher layers,
-  according to EFI_BLOCK_IO_MEDIA characteristics set in VirtioBlkInit().
-  Should they do nonetheless, we do nothing, successfully.
+  The virtio-blk flush command covers only those writes that the host has
+  completed, hence the requests in flight are drained first.
 
 **/
 EFI_STATUS
 EFIAPI
-VirtioBlkFlushBlocks (
-  IN EFI_BLOCK_IO_PROTOCOL  *This
+VirtioBlkFlushBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN OUT EFI_BLOCK_IO2_TOKEN     *Token
   )
 {
   VBLK_DEV  *Dev;
 
-  Dev = VIRTIO_BLK_FROM_BLOCK_IO (This);
-  return Dev->BlockIoMedia.WriteCaching ?
-         SynchronousRequest (
+  if ((Token != NULL) && (Token->Event == NULL)) {
+    Token = NULL;
+  }
+
+  Dev = VIRTIO_BLK_FROM_BLOCK_IO2 (This);
+  if (!Dev->BlockIoMedia.WriteCaching) {
+    if (Token != NULL) {
+      Token->TransactionStatus = EFI_SUCCESS;
+      gBS->SignalEvent (Token->Event);
+    }
+
+    return EFI_SUCCESS;
+  }
+
+  VirtioBlkDrainRequests (Dev);
+
+  if (Token == NULL) {
+    return SynchronousRequest (
+             Dev,
+             0,      // Lba
+             0,      // BufferSize
+             NULL,   // Buffer
+             TRUE    // RequestIsWrite
+             );
+  }
+
+  return VirtioBlkSubmitAsync (
            Dev,
            0,      // Lba
            0,      // BufferSize
            NULL,   // Buffer
-           TRUE    // RequestIsWrite
-           ) :
-         EFI_SUCCESS;
+           TRUE,   // RequestIsWrite
+           Token
+           );
 }
 
 /**
@@ -684,6 +1514,217 @@ VirtioBlkDriverBindingSupported (
   return Status;
 }
 
+/**
+
+  Allocate the request slots and the free stack that track the requests in
+  flight, set up the shared request header / host status area of the slots,
+  and create the timer event that completes non-blocking requests.
+
+  @param[in,out] Dev       The virtio-blk device whose ring has been set up
+                           with VirtioRingInitEx().
+
+  @param[in] UseIndirect   Whether VIRTIO_F_RING_INDIRECT_DESC has been
+                           negotiated. If so, the indirect descriptor tables
+                           of the request slots are set up too, and every
+                           request occupies a single descriptor of the ring.
+
+  @retval EFI_SUCCESS           Setup complete.
+
+  @retval EFI_OUT_OF_RESOURCES  Memory allocation failed.
+
+  @return                       Error codes from VirtIo->AllocateSharedPages(),
+                                VirtioMapAllBytesInSharedBuffer(),
+                                VirtioRingInitIndirect(), or the CreateEvent()
+                                boot service.
+
+**/
+STATIC
+EFI_STATUS
+VirtioBlkInitReqs (
+  IN OUT VBLK_DEV  *Dev,
+  IN     BOOLEAN   UseIndirect
+  )
+{
+  EFI_STATUS  Status;
+  UINT16      ReqIdx;
+  VOID        *SharedReqsBuffer;
+
+  Dev->DescPerReq = UseIndirect ? 1 : VBLK_DESC_PER_REQ;
+
+  //
+  // ensured by VirtioBlkInit()
+  //
+  ASSERT (Dev->Ring.QueueSize >= Dev->DescPerReq);
+
+  Dev->MaxPending = (UINT16)MIN (
+                              Dev->Ring.QueueSize / Dev->DescPerReq,
+                              VBLK_MAX_PENDING
+                              );
+
+  //
+  // The indirect tables are released by VirtioRingUninit().
+  //
+  if (UseIndirect) {
+    Status = VirtioRingInitIndirect (
+               Dev->VirtIo,
+               &Dev->Ring,
+               Dev->MaxPending,
+               VBLK_DESC_PER_REQ
+               );
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+  }
+
+  Dev->CurPending   = 0;
+  Dev->LastUsed     = 0;
+  Dev->AsyncPending = 0;
+  InitializeListHead (&Dev->DeferredXfers);
+
+  Dev->FreeStack = AllocatePool (Dev->MaxPending * sizeof *Dev->FreeStack);
+  if (Dev->FreeStack == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Dev->Reqs = AllocateZeroPool (Dev->MaxPending * sizeof *Dev->Reqs);
+  if (Dev->Reqs == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto FreeFreeStack;
+  }
+
+  for (ReqIdx = 0; ReqIdx < Dev->MaxPending; ++ReqIdx) {
+    Dev->FreeStack[ReqIdx] = ReqIdx;
+  }
+
+  //
+  // Allocate the request headers and host status bytes of all slots, and map
+  // them with BusMasterCommonBuffer so that they can be accessed equally by
+  // both processor and device, without per-request mapping.
+  //
+  Dev->SharedReqsNrPages = EFI_SIZE_TO_PAGES (
+                             Dev->MaxPending * sizeof *Dev->SharedReqs
+                             );
+  Status = Dev->VirtIo->AllocateSharedPages (
+                          Dev->VirtIo,
+                          Dev->SharedReqsNrPages,
+                          &SharedReqsBuffer
+                          );
+  if (EFI_ERROR (Status)) {
+    goto FreeReqs;
+  }
+
+  ZeroMem (SharedReqsBuffer, EFI_PAGES_TO_SIZE (Dev->SharedReqsNrPages));
+
+  Status = VirtioMapAllBytesInSharedBuffer (
+             Dev->VirtIo,
+             VirtioOperationBusMasterCommonBuffer,
+             SharedReqsBuffer,
+             EFI_PAGES_TO_SIZE (Dev->SharedReqsNrPages),
+             &Dev->SharedReqsBase,
+             &Dev->SharedReqsMap
+             );
+  if (EFI_ERROR (Status)) {
+    goto FreeSharedReqs;
+  }
+
+  Dev->SharedReqs = SharedReqsBuffer;
+
+  Status = gBS->CreateEvent (
+                  EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  &VirtioBlkPollTimer,
+                  Dev,
+                  &Dev->PollTimer
+                  );
+  if (EFI_ERROR (Status)) {
+    goto UnmapSharedReqs;
+  }
+
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: QueueSize=%d MaxPending=%d DescPerReq=%d\n",
+    __FUNCTION__,
+    Dev->Ring.QueueSize,
+    Dev->MaxPending,
+    Dev->DescPerReq
+    ));
+  return EFI_SUCCESS;
+
+UnmapSharedReqs:
+  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->SharedReqsMap);
+
+FreeSharedReqs:
+  Dev->VirtIo->FreeSharedPages (
+                 Dev->VirtIo,
+                 Dev->SharedReqsNrPages,
+                 SharedReqsBuffer
+                 );
+
+FreeReqs:
+  FreePool (Dev->Reqs);
+
+FreeFreeStack:
+  FreePool (Dev->FreeStack);
+
+  return Status;
+}
+
+/**
+
+  Release the resources set up by VirtioBlkInitReqs().
+
+  Requests that are still in flight, and non-blocking transfers that are still
+  waiting for request slots, are completed with EFI_ABORTED. The caller is
+  responsible for resetting the device first, so that the host no longer
+  accesses the buffers of those requests.
+
+  @param[in,out] Dev  The virtio-blk device to clean up.
+
+**/
+STATIC
+VOID
+VirtioBlkUninitReqs (
+  IN OUT VBLK_DEV  *Dev
+  )
+{
+  EFI_TPL    OldTpl;
+  UINT16     ReqIdx;
+  VBLK_XFER  *Xfer;
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  for (ReqIdx = 0; ReqIdx < Dev->MaxPending; ++ReqIdx) {
+    if (Dev->Reqs[ReqIdx].InFlight) {
+      VirtioBlkCompleteRequest (Dev, ReqIdx, FALSE);
+    }
+  }
+
+  while (!IsListEmpty (&Dev->DeferredXfers)) {
+    Xfer = BASE_CR (GetFirstNode (&Dev->DeferredXfers), VBLK_XFER, Link);
+    RemoveEntryList (&Xfer->Link);
+
+    if (!EFI_ERROR (Xfer->Status)) {
+      Xfer->Status = EFI_ABORTED;
+    }
+
+    Xfer->Submitting = FALSE;
+    VirtioBlkFinishTransfer (Xfer);
+  }
+
+  gBS->RestoreTPL (OldTpl);
+
+  gBS->CloseEvent (Dev->PollTimer);
+
+  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->SharedReqsMap);
+  Dev->VirtIo->FreeSharedPages (
+                 Dev->VirtIo,
+                 Dev->SharedReqsNrPages,
+                 (VOID *)Dev->SharedReqs
+                 );
+
+  FreePool (Dev->Reqs);
+  FreePool (Dev->FreeStack);
+}
+
 /**
 
   Set up all BlockIo and virtio-blk aspects of this driver for the specified
@@ -698,9 +1739,9 @@ VirtioBlkDriverBindingSupported (
   @retval EFI_UNSUPPORTED  The driver is unable to work with the virtio ring or
                            virtio-blk attributes the host provides.
 
-  @return                  Error codes from VirtioRingInit() or
+  @return                  Error codes from VirtioRingInitEx() or
                            VIRTIO_CFG_READ() / VIRTIO_CFG_WRITE or
-                           VirtioRingMap().
+                           VirtioRingMap() or VirtioBlkInitReqs().
 
 **/
 STATIC
@@ -719,12 +1760,16 @@ VirtioBlkInit (
   UINT8   PhysicalBlockExp;
   UINT8   AlignmentOffset;
   UINT32  OptIoSize;
+  UINT32  SizeMax;
+  UINT32  SegMax;
   UINT16  QueueSize;
   UINT64  RingBaseShift;
 
   PhysicalBlockExp = 0;
   AlignmentOffset  = 0;
   OptIoSize        = 0;
+  SizeMax          = 0;
+  SegMax           = 0;
 
   //
   // Execute virtio-0.9.5, 2.2.1 Device Initialization Sequence.
@@ -819,9 +1864,48 @@ VirtioBlkInit (
     }
   }
 
+  //
+  // Every request carries its data in a single descriptor; limit the size of
+  // that to whole logical blocks, and to what the host accepts in one segment.
+  //
+  Dev->MaxTransfer = MAX (
+                       VBLK_MAX_TRANSFER - VBLK_MAX_TRANSFER % BlockSize,
+                       BlockSize
+                       );
+  if (Features & VIRTIO_BLK_F_SIZE_MAX) {
+    Status = VIRTIO_CFG_READ (Dev, SizeMax, &SizeMax);
+    if (EFI_ERROR (Status)) {
+      goto Failed;
+    }
+
+    if (SizeMax < BlockSize) {
+      Status = EFI_UNSUPPORTED;
+      goto Failed;
+    }
+
+    Dev->MaxTransfer = MIN (Dev->MaxTransfer, SizeMax - SizeMax % BlockSize);
+  }
+
+  if (Features & VIRTIO_BLK_F_SEG_MAX) {
+    Status = VIRTIO_CFG_READ (Dev, SegMax, &SegMax);
+    if (EFI_ERROR (Status)) {
+      goto Failed;
+    }
+
+    if (SegMax == 0) {
+      Status = EFI_UNSUPPORTED;
+      goto Failed;
+    }
+  }
+
   Features &= VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_TOPOLOGY | VIRTIO_BLK_F_RO |
-              VIRTIO_BLK_F_FLUSH | VIRTIO_F_VERSION_1 |
-              VIRTIO_F_IOMMU_PLATFORM;
+              VIRTIO_BLK_F_FLUSH | VIRTIO_BLK_F_SIZE_MAX |
+              VIRTIO_BLK_F_SEG_MAX | VIRTIO_F_VERSION_1 |
+              VIRTIO_F_IOMMU_PLATFORM | VIRTIO_F_RING_EVENT_IDX |
+              VIRTIO_F_RING_INDIRECT_DESC |
+              (FeaturePcdGet (PcdVirtioPackedRingEnable) ?
+               VIRTIO_F_RING_PACKED :
+               0);
 
   //
   // In virtio-1.0, feature negotiation is expected to complete before queue
@@ -847,13 +1931,17 @@ VirtioBlkInit (
     goto Failed;
   }
 
-  if (QueueSize < 3) {
-    // SynchronousRequest() uses at most three descriptors
+  if (QueueSize < (((Features & VIRTIO_F_RING_INDIRECT_DESC) != 0) ?
+                    1 :
+                    VBLK_DESC_PER_REQ))
+  {
+    // VirtioBlkSubmitRequest() uses at most three descriptors, or one indirect
+    // descriptor
     Status = EFI_UNSUPPORTED;
     goto Failed;
   }
 
-  Status = VirtioRingInit (Dev->VirtIo, QueueSize, &Dev->Ring);
+  Status = VirtioRingInitEx (Dev->VirtIo, QueueSize, Features, &Dev->Ring);
   if (EFI_ERROR (Status)) {
     goto Failed;
   }
@@ -871,18 +1959,29 @@ VirtioBlkInit (
     goto ReleaseQueue;
   }
 
+  //
+  // If anything fails from here on, we must unmap the ring resources.
+  //
+  Status = VirtioBlkInitReqs (
+             Dev,
+             (BOOLEAN)((Features & VIRTIO_F_RING_INDIRECT_DESC) != 0)
+             );
+  if (EFI_ERROR (Status)) {
+    goto UnmapQueue;
+  }
+
   //
   // Additional steps for MMIO: align the queue appropriately, and set the
-  // size. If anything fails from here on, we must unmap the ring resources.
+  // size. If anything fails from here on, we must release the request slots.
   //
   Status = Dev->VirtIo->SetQueueNum (Dev->VirtIo, QueueSize);
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto UninitReqs;
   }
 
   Status = Dev->VirtIo->SetQueueAlign (Dev->VirtIo, EFI_PAGE_SIZE);
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto UninitReqs;
   }
 
   //
@@ -894,17 +1993,18 @@ VirtioBlkInit (
                           RingBaseShift
                           );
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto UninitReqs;
   }
 
   //
   // step 5 -- Report understood features.
   //
   if (Dev->VirtIo->Revision < VIRTIO_SPEC_REVISION (1, 0, 0)) {
-    Features &= ~(UINT64)(VIRTIO_F_VERSION_1 | VIRTIO_F_IOMMU_PLATFORM);
+    Features &= ~(UINT64)(VIRTIO_F_VERSION_1 | VIRTIO_F_IOMMU_PLATFORM |
+                          VIRTIO_F_RING_PACKED);
     Status    = Dev->VirtIo->SetGuestFeatures (Dev->VirtIo, Features);
     if (EFI_ERROR (Status)) {
-      goto UnmapQueue;
+      goto UninitReqs;
     }
   }
 
@@ -914,7 +2014,7 @@ VirtioBlkInit (
   NextDevStat |= VSTAT_DRIVER_OK;
   Status       = Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, NextDevStat);
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto UninitReqs;
   }
 
   //
@@ -927,6 +2027,11 @@ VirtioBlkInit (
   Dev->BlockIo.ReadBlocks            = &VirtioBlkReadBlocks;
   Dev->BlockIo.WriteBlocks           = &VirtioBlkWriteBlocks;
   Dev->BlockIo.FlushBlocks           = &VirtioBlkFlushBlocks;
+  Dev->BlockIo2.Media                = &Dev->BlockIoMedia;
+  Dev->BlockIo2.Reset                = &VirtioBlkResetEx;
+  Dev->BlockIo2.ReadBlocksEx         = &VirtioBlkReadBlocksEx;
+  Dev->BlockIo2.WriteBlocksEx        = &VirtioBlkWriteBlocksEx;
+  Dev->BlockIo2.FlushBlocksEx        = &VirtioBlkFlushBlocksEx;
   Dev->BlockIoMedia.MediaId          = 0;
   Dev->BlockIoMedia.RemovableMedia   = FALSE;
   Dev->BlockIoMedia.MediaPresent     = TRUE;
@@ -947,6 +2052,14 @@ VirtioBlkInit (
     Dev->BlockIoMedia.BlockSize,
     Dev->BlockIoMedia.LastBlock + 1
     ));
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: SizeMax=0x%x[B] SegMax=%u MaxTransfer=0x%x[B]\n",
+    __FUNCTION__,
+    SizeMax,
+    SegMax,
+    Dev->MaxTransfer
+    ));
 
   if (Features & VIRTIO_BLK_F_TOPOLOGY) {
     Dev->BlockIo.Revision = EFI_BLOCK_IO_PROTOCOL_REVISION3;
@@ -972,6 +2085,9 @@ VirtioBlkInit (
 
   return EFI_SUCCESS;
 
+UninitReqs:
+  VirtioBlkUninitReqs (Dev);
+
 UnmapQueue:
   Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->RingMap);
 
@@ -1011,10 +2127,12 @@ VirtioBlkUninit (
   //
   Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, 0);
 
+  VirtioBlkUninitReqs (Dev);
   Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->RingMap);
   VirtioRingUninit (Dev->VirtIo, &Dev->Ring);
 
   SetMem (&Dev->BlockIo, sizeof Dev->BlockIo, 0x00);
+  SetMem (&Dev->BlockIo2, sizeof Dev->BlockIo2, 0x00);
   SetMem (&Dev->BlockIoMedia, sizeof Dev->BlockIoMedia, 0x00);
 }
 
@@ -1125,14 +2243,17 @@ VirtioBlkDriverBindingStart (
   }
 
   //
-  // Setup complete, attempt to export the driver instance's BlockIo interface.
+  // Setup complete, attempt to export the driver instance's BlockIo and
+  // BlockIo2 interfaces.
   //
   Dev->Signature = VBLK_SIG;
-  Status         = gBS->InstallProtocolInterface (
+  Status         = gBS->InstallMultipleProtocolInterfaces (
                           &DeviceHandle,
                           &gEfiBlockIoProtocolGuid,
-                          EFI_NATIVE_INTERFACE,
-                          &Dev->BlockIo
+                          &Dev->BlockIo,
+                          &gEfiBlockIo2ProtocolGuid,
+                          &Dev->BlockIo2,
+                          NULL
                           );
   if (EFI_ERROR (Status)) {
     goto CloseExitBoot;
@@ -1212,10 +2333,13 @@ VirtioBlkDriverBindingStop (
   //
   // Handle Stop() requests for in-use driver instances gracefully.
   //
-  Status = gBS->UninstallProtocolInterface (
+  Status = gBS->UninstallMultipleProtocolInterfaces (
                   DeviceHandle,
                   &gEfiBlockIoProtocolGuid,
-                  &Dev->BlockIo
+                  &Dev->BlockIo,
+                  &gEfiBlockIo2ProtocolGuid,
+                  &Dev->BlockIo2,
+                  NULL
                   );
   if (EFI_ERROR (Status)) {
     return Status;
@@ -13,13 +13,85 @@
 #define _VIRTIO_BLK_DXE_H_
 
 #include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
 #include <Protocol/ComponentName.h>
 #include <Protocol/DriverBinding.h>
 
-#include <IndustryStandard/Virtio.h>
+#include <IndustryStandard/VirtioBlk.h>
 
 #define VBLK_SIG  SIGNATURE_32 ('V', 'B', 'L', 'K')
 
+//
+// maximum number of requests in flight, blocking and non-blocking together
+//
+#define VBLK_MAX_PENDING  64
+
+//
+// Every request owns a fixed group of consecutive descriptors in the ring:
+// request header, data buffer (absent for flush), host status. With indirect
+// descriptors, the group lives in the indirect table of the request, and the
+// request owns a single descriptor in the ring.
+//
+#define VBLK_DESC_PER_REQ  3
+
+//
+// Period of the used ring poll that completes non-blocking requests, in 100ns
+// units.
+//
+#define VBLK_ASYNC_POLL_PERIOD  EFI_TIMER_PERIOD_MILLISECONDS (1)
+
+//
+// Request header and host status of a request slot. An array of these is
+// allocated and mapped as a common buffer once per device, and indexed by
+// request slot (that is, by head descriptor index / VBLK_DEV.DescPerReq), so
+// that only the data buffer needs to be mapped per request.
+//
+typedef struct {
+  VIRTIO_BLK_REQ    Request;
+  UINT8             HostStatus;
+} VBLK_SHARED_REQ;
+
+//
+// Largest data buffer that a single request maps and transfers. Longer
+// transfers are split into pipelined requests of this size (or of the
+// device's VIRTIO_BLK_F_SIZE_MAX limit, if smaller), so that no
+// BlockIo / BlockIo2 call needs to map (and, for SEV guests, bounce) the
+// caller's entire buffer at once.
+//
+#define VBLK_MAX_TRANSFER  SIZE_1MB
+
+//
+// A transfer is one BlockIo / BlockIo2 read, write or flush call, carried out
+// by one or more requests. Lba, Buffer and BufferSize describe the part of
+// the transfer that has not been submitted yet. If a non-blocking transfer
+// runs out of request slots, it is linked into VBLK_DEV.DeferredXfers, and the
+// poll timer submits the rest.
+//
+typedef struct {
+  EFI_BLOCK_IO2_TOKEN    *Token;          // NULL if the caller blocks
+  UINTN                  Pending;         // requests in flight
+  BOOLEAN                Submitting;      // more requests to be submitted
+  EFI_STATUS             Status;          // first failure, if any
+  EFI_LBA                Lba;
+  volatile UINT8         *Buffer;
+  UINTN                  BufferSize;
+  BOOLEAN                RequestIsWrite;
+  LIST_ENTRY             Link;            // VBLK_DEV.DeferredXfers
+} VBLK_XFER;
+
+//
+// Tracking structure for a request that has been submitted to the host.
+//
+typedef struct {
+  VOID                   *BufferMapping;  // VirtioBlkSubmitRequest
+  UINTN                  BufferSize;      // VirtioBlkSubmitRequest
+  BOOLEAN                RequestIsWrite;  // VirtioBlkSubmitRequest
+  VBLK_XFER              *Xfer;           // VirtioBlkSubmitRequest; NULL if
+                                          // the transfer was abandoned
+  BOOLEAN                Blocking;        // VirtioBlkSubmitRequest
+  BOOLEAN                InFlight;        // VirtioBlkSubmitRequest
+} VBLK_REQ;
+
 typedef struct {
   //
   // Parts of this structure are initialized / torn down in various functions
@@ -33,13 +105,31 @@ typedef struct {
   EFI_EVENT                 ExitBoot;          // DriverBindingStart  0
   VRING                     Ring;              // VirtioRingInit      2
   EFI_BLOCK_IO_PROTOCOL     BlockIo;           // VirtioBlkInit       1
+  EFI_BLOCK_IO2_PROTOCOL    BlockIo2;          // VirtioBlkInit       1
   EFI_BLOCK_IO_MEDIA        BlockIoMedia;      // VirtioBlkInit       1
+  UINT32                    MaxTransfer;       // VirtioBlkInit       1
   VOID                      *RingMap;          // VirtioRingMap       2
+  UINT16                    DescPerReq;        // VirtioBlkInitReqs   2
+  UINT16                    MaxPending;        // VirtioBlkInitReqs   2
+  UINT16                    CurPending;        // VirtioBlkInitReqs   2
+  UINT16                    *FreeStack;        // VirtioBlkInitReqs   2
+  VBLK_REQ                  *Reqs;             // VirtioBlkInitReqs   2
+  volatile VBLK_SHARED_REQ  *SharedReqs;       // VirtioBlkInitReqs   2
+  UINTN                     SharedReqsNrPages; // VirtioBlkInitReqs   2
+  VOID                      *SharedReqsMap;    // VirtioBlkInitReqs   2
+  EFI_PHYSICAL_ADDRESS      SharedReqsBase;    // VirtioBlkInitReqs   2
+  UINT16                    LastUsed;          // VirtioBlkInitReqs   2
+  UINTN                     AsyncPending;      // VirtioBlkInitReqs   2
+  EFI_EVENT                 PollTimer;         // VirtioBlkInitReqs   2
+  LIST_ENTRY                DeferredXfers;     // VirtioBlkInitReqs   2
 } VBLK_DEV;
 
 #define VIRTIO_BLK_FROM_BLOCK_IO(BlockIoPointer) \
         CR (BlockIoPointer, VBLK_DEV, BlockIo, VBLK_SIG)
 
+#define VIRTIO_BLK_FROM_BLOCK_IO2(BlockIo2Pointer) \
+        CR (BlockIo2Pointer, VBLK_DEV, BlockIo2, VBLK_SIG)
+
 /**
 
   Device probe function for this driver.
@@ -244,6 +334,75 @@ VirtioBlkFlushBlocks (
   IN EFI_BLOCK_IO_PROTOCOL  *This
   );
 
+//
+// UEFI Spec 2.3.1 + Errata C, 12.9 EFI Block I/O 2 Protocol
+// Driver Writer's Guide for UEFI 2.3.1 v1.01,
+//   24.3 Block I/O 2 Protocol Implementations
+//
+EFI_STATUS
+EFIAPI
+VirtioBlkResetEx (
+  IN EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN BOOLEAN                 ExtendedVerification
+  );
+
+/**
+
+  ReadBlocksEx() operation for virtio-blk.
+
+  If Token is NULL or Token->Event is NULL, the request is blocking, as with
+  ReadBlocks(). Otherwise the request is queued to the host, and
+  Token->Event is signaled from the used ring poll when the host completes
+  it.
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioBlkReadBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN     UINT32                  MediaId,
+  IN     EFI_LBA                 Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN     *Token,
+  IN     UINTN                   BufferSize,
+  OUT    VOID                    *Buffer
+  );
+
+/**
+
+  WriteBlocksEx() operation for virtio-blk.
+
+  If Token is NULL or Token->Event is NULL, the request is blocking, as with
+  WriteBlocks(). Otherwise the request is queued to the host, and
+  Token->Event is signaled from the used ring poll when the host completes
+  it.
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioBlkWriteBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN     UINT32                  MediaId,
+  IN     EFI_LBA                 Lba,
+  IN OUT EFI_BLOCK_IO2_TOKEN     *Token,
+  IN     UINTN                   BufferSize,
+  IN     VOID                    *Buffer
+  );
+
+/**
+
+  FlushBlocksEx() operation for virtio-blk.
+
+  All requests in flight are completed first, so that the flush covers every
+  write that the caller has queued before.
+
+**/
+EFI_STATUS
+EFIAPI
+VirtioBlkFlushBlocksEx (
+  IN     EFI_BLOCK_IO2_PROTOCOL  *This,
+  IN OUT EFI_BLOCK_IO2_TOKEN     *Token
+  );
+
 //
 // The purpose of the following scaffolding (EFI_COMPONENT_NAME_PROTOCOL and
 // EFI_COMPONENT_NAME2_PROTOCOL implementation) is to format the driver's name
@@ -42,7 +42,6 @@ VirtioNetIsPacketAvailable (
   // DWG-2.3.1, but WaitForKey does have some.
   //
   VNET_DEV  *Dev;
-  UINT16    RxCurUsed;
 
   Dev = Context;
   if (Dev->Snm.State != EfiSimpleNetworkInitialized) {
@@ -50,13 +49,11 @@ VirtioNetIsPacketAvailable (
   }
 
   //
-  // virtio-0.9.5, 2.4.2 Receiving Used Buffers From the Device
+  // virtio-0.9.5, 2.4.2 Receiving Used Buffers From the Device; collect the
+  // used elements in the RX completion FIFO, VirtioNetReceive() consumes them
   //
-  MemoryFence ();
-  RxCurUsed = *Dev->RxRing.Used.Idx;
-  MemoryFence ();
-
-  if (Dev->RxLastUsed != RxCurUsed) {
+  VirtioNetDrainRx (Dev);
+  if (Dev->RxFifoCount > 0) {
     gBS->SignalEvent (Dev->Snp.WaitForPacket);
   }
 }
@@ -57,8 +57,10 @@ VirtioNetGetStatus (
   VNET_DEV              *Dev;
   EFI_TPL               OldTpl;
   EFI_STATUS            Status;
-  UINT16                RxCurUsed;
   UINT16                TxCurUsed;
+  BOOLEAN               RxReady;
+  BOOLEAN               TxReady;
+  UINT16                DescIdx;
   EFI_PHYSICAL_ADDRESS  DeviceAddress;
 
   if (This == NULL) {
@@ -94,12 +96,17 @@ VirtioNetGetStatus (
   }
 
   //
-  // virtio-0.9.5, 2.4.2 Receiving Used Buffers From the Device
+  // virtio-0.9.5, 2.4.2 Receiving Used Buffers From the Device. Move the used
+  // elements of the RX ring to the RX completion FIFO (VirtioNetReceive()
+  // consumes them from there), and peek at the next used element on the TX
+  // ring; it may be consumed below.
   //
-  MemoryFence ();
-  RxCurUsed = *Dev->RxRing.Used.Idx;
-  TxCurUsed = *Dev->TxRing.Used.Idx;
-  MemoryFence ();
+  VirtioNetDrainRx (Dev);
+  RxReady   = (BOOLEAN)(Dev->RxFifoCount > 0);
+  TxCurUsed = Dev->TxLastUsed;
+  TxReady   = !EFI_ERROR (
+                 VirtioGetNextUsed (&Dev->TxRing, &TxCurUsed, &DescIdx, NULL)
+                 );
 
   if (InterruptStatus != NULL) {
     //
@@ -107,62 +114,65 @@ VirtioNetGetStatus (
     // report the transmit interrupt if we have transmitted at least one buffer
     //
     *InterruptStatus = 0;
-    if (Dev->RxLastUsed != RxCurUsed) {
+    if (RxReady) {
       *InterruptStatus |= EFI_SIMPLE_NETWORK_RECEIVE_INTERRUPT;
     }
 
-    if (Dev->TxLastUsed != TxCurUsed) {
+    if (TxReady) {
       ASSERT (Dev->TxCurPending > 0);
       *InterruptStatus |= EFI_SIMPLE_NETWORK_TRANSMIT_INTERRUPT;
     }
   }
 
   if (TxBuf != NULL) {
-    if (Dev->TxLastUsed == TxCurUsed) {
+    if (!TxReady) {
       *TxBuf = NULL;
     } else {
-      UINT16  UsedElemIdx;
-      UINT32  DescIdx;
-
       //
-      // fetch the first descriptor among those that the hypervisor reports
+      // consume the first descriptor among those that the hypervisor reports
       // completed
       //
       ASSERT (Dev->TxCurPending > 0);
       ASSERT (Dev->TxCurPending <= Dev->TxMaxPending);
 
-      UsedElemIdx = Dev->TxLastUsed++ % Dev->TxRing.QueueSize;
-      DescIdx     = Dev->TxRing.Used.UsedElem[UsedElemIdx].Id;
+      Dev->TxLastUsed = TxCurUsed;
+      ASSERT (DescIdx % 2 == 0);
       ASSERT (DescIdx < (UINT32)(2 * Dev->TxMaxPending - 1));
 
       //
       // get the device address that has been enqueued for the caller's
       // transmit buffer
       //
-      DeviceAddress = Dev->TxRing.Desc[DescIdx + 1].Addr;
+      DeviceAddress = Dev->TxBufDeviceAddr[DescIdx / 2];
 
       //
       // now this descriptor can be used again to enqueue a transmit buffer
       //
-      Dev->TxFreeStack[--Dev->TxCurPending] = (UINT16)DescIdx;
+      Dev->TxFreeStack[--Dev->TxCurPending] = DescIdx;
 
       //
-      // Unmap the device address and perform the reverse mapping to find the
-      // caller buffer address.
+      // If the caller's buffer has been copied to a TX slot, its address has
+      // been saved at VirtioNetTransmit() time. Otherwise, unmap the device
+      // address and perform the reverse mapping to find the caller buffer
+      // address.
       //
-      Status = VirtioNetUnmapTxBuf (
-                 Dev,
-                 TxBuf,
-                 DeviceAddress
-                 );
-      if (EFI_ERROR (Status)) {
-        //
-        // VirtioNetUnmapTxBuf should never fail, if we have reached here
-        // that means our internal state has been corrupted
-        //
-        ASSERT (FALSE);
-        Status = EFI_DEVICE_ERROR;
-        goto Exit;
+      if (Dev->TxCallerBuf[DescIdx / 2] != NULL) {
+        *TxBuf = Dev->TxCallerBuf[DescIdx / 2];
+      } else {
+        Status = VirtioNetUnmapTxBuf (
+                   Dev,
+                   TxBuf,
+                   DeviceAddress
+                   );
+        if (EFI_ERROR (Status)) {
+          //
+          // VirtioNetUnmapTxBuf should never fail, if we have reached here
+          // that means our internal state has been corrupted
+          //
+          ASSERT (FALSE);
+          Status = EFI_DEVICE_ERROR;
+          goto Exit;
+        }
       }
     }
   }
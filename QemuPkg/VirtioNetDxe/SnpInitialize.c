@@ -14,6 +14,7 @@
 #include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 
 #include "VirtioNet.h"
@@ -28,6 +29,8 @@
                            EfiSimpleNetworkInitialized state.
   @param[in]     Selector  Identifies the transfer direction (virtio queue) of
                            the network device.
+  @param[in]     Features  The feature bits negotiated with the device; they
+                           select the ring layout.
   @param[out]    Ring      The virtio-ring inside the VNET_DEV structure,
                            corresponding to Selector.
   @param[out]    Mapping   A resulting token to pass to VirtioNetUninitRing()
@@ -35,7 +38,7 @@
   @retval EFI_UNSUPPORTED  The queue size reported by the virtio-net device is
                            too small.
   @return                  Status codes from VIRTIO_CFG_WRITE(),
-                           VIRTIO_CFG_READ(), VirtioRingInit() and
+                           VIRTIO_CFG_READ(), VirtioRingInitEx() and
                            VirtioRingMap().
   @retval EFI_SUCCESS      Ring initialized.
 */
@@ -45,6 +48,7 @@ EFIAPI
 VirtioNetInitRing (
   IN OUT VNET_DEV  *Dev,
   IN     UINT16    Selector,
+  IN     UINT64    Features,
   OUT    VRING     *Ring,
   OUT    VOID      **Mapping
   )
@@ -75,7 +79,7 @@ VirtioNetInitRing (
     return EFI_UNSUPPORTED;
   }
 
-  Status = VirtioRingInit (Dev->VirtIo, QueueSize, Ring);
+  Status = VirtioRingInitEx (Dev->VirtIo, QueueSize, Features, Ring);
   if (EFI_ERROR (Status)) {
     return Status;
   }
@@ -130,19 +134,20 @@ ReleaseQueue:
   This function may only be called by VirtioNetInitialize().
 
   The structures laid out and resources configured include:
-  - fully populate the TX queue with a static pattern of virtio descriptor
-    chains,
-  - tracking of heads of free descriptor chains from the above,
+  - tracking of heads of free descriptor chains in the TX queue,
   - one common virtio-net request header (never modified by the host) for all
     pending TX packets,
+  - one copy slot per possibly pending TX packet, mapped once, for frames not
+    larger than PcdVirtioNetTxCopyThreshold,
   - select polling over TX interrupt.
 
   @param[in,out] Dev       The VNET_DEV driver instance about to enter the
                            EfiSimpleNetworkInitialized state.
 
   @retval EFI_OUT_OF_RESOURCES  Failed to allocate the stack to track the heads
-                                of free descriptor chains or failed to init
-                                TxBufCollection.
+                                of free descriptor chains, failed to allocate
+                                the arrays of pending TX buffer addresses, or
+                                failed to init TxBufCollection.
   @return                       Status codes from VIRTIO_DEVICE_PROTOCOL.
                                 AllocateSharedPages() or
                                 VirtioMapAllBytesInSharedBuffer()
@@ -155,11 +160,10 @@ VirtioNetInitTx (
   IN OUT VNET_DEV  *Dev
   )
 {
-  UINTN                 TxSharedReqSize;
-  UINTN                 PktIdx;
-  EFI_STATUS            Status;
-  EFI_PHYSICAL_ADDRESS  DeviceAddress;
-  VOID                  *TxSharedReqBuffer;
+  UINTN       PktIdx;
+  EFI_STATUS  Status;
+  VOID        *TxSharedReqBuffer;
+  VOID        *TxCopyBuffer;
 
   Dev->TxMaxPending = (UINT16)MIN (
                                 Dev->TxRing.QueueSize / 2,
@@ -174,13 +178,41 @@ VirtioNetInitTx (
     return EFI_OUT_OF_RESOURCES;
   }
 
+  //
+  // The device-mapped address of each pending packet buffer is remembered
+  // here, indexed by head descriptor index / 2, rather than looked up in the
+  // tail descriptor at completion time: the packed ring layout overwrites the
+  // descriptors with used elements.
+  //
+  Dev->TxBufDeviceAddr = AllocatePool (
+                           Dev->TxMaxPending *
+                           sizeof *Dev->TxBufDeviceAddr
+                           );
+  if (Dev->TxBufDeviceAddr == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto FreeTxFreeStack;
+  }
+
+  //
+  // Likewise, the caller's buffer address of each pending packet that has
+  // been copied to a TX slot, or NULL if the caller's buffer has been mapped.
+  //
+  Dev->TxCallerBuf = AllocateZeroPool (
+                       Dev->TxMaxPending *
+                       sizeof *Dev->TxCallerBuf
+                       );
+  if (Dev->TxCallerBuf == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto FreeTxBufDeviceAddr;
+  }
+
   Dev->TxBufCollection = OrderedCollectionInit (
                            VirtioNetTxBufMapInfoCompare,
                            VirtioNetTxBufDeviceAddressCompare
                            );
   if (Dev->TxBufCollection == NULL) {
     Status = EFI_OUT_OF_RESOURCES;
-    goto FreeTxFreeStack;
+    goto FreeTxCallerBuf;
   }
 
   //
@@ -203,7 +235,7 @@ VirtioNetInitTx (
              VirtioOperationBusMasterCommonBuffer,
              TxSharedReqBuffer,
              sizeof *(Dev->TxSharedReq),
-             &DeviceAddress,
+             &Dev->TxSharedReqBase,
              &Dev->TxSharedReqMap
              );
   if (EFI_ERROR (Status)) {
@@ -213,33 +245,64 @@ VirtioNetInitTx (
   Dev->TxSharedReq = TxSharedReqBuffer;
 
   //
-  // In VirtIo 1.0, the NumBuffers field is mandatory. In 0.9.5, it depends on
-  // VIRTIO_NET_F_MRG_RXBUF, which we never negotiate.
-  //
-  TxSharedReqSize = (Dev->VirtIo->Revision < VIRTIO_SPEC_REVISION (1, 0, 0)) ?
-                    sizeof (Dev->TxSharedReq->V0_9_5) :
-                    sizeof *Dev->TxSharedReq;
+  // Allocate the TX copy slots, indexed by head descriptor index / 2, and map
+  // them with BusMasterCommonBuffer as well. Frames that fit in a slot are
+  // copied there by VirtioNetTransmit(), which saves the per-packet mapping
+  // and the TxBufCollection bookkeeping.
+  //
+  Dev->TxCopySlotSize = (UINT32)MIN (
+                                  PcdGet32 (PcdVirtioNetTxCopyThreshold),
+                                  Dev->Snm.MediaHeaderSize +
+                                  Dev->Snm.MaxPacketSize
+                                  );
+  if (Dev->TxCopySlotSize > 0) {
+    Dev->TxCopyBufNrPages = EFI_SIZE_TO_PAGES (
+                              (UINTN)Dev->TxMaxPending * Dev->TxCopySlotSize
+                              );
+    Status = Dev->VirtIo->AllocateSharedPages (
+                            Dev->VirtIo,
+                            Dev->TxCopyBufNrPages,
+                            &TxCopyBuffer
+                            );
+    if (EFI_ERROR (Status)) {
+      goto UnmapTxSharedReq;
+    }
 
-  for (PktIdx = 0; PktIdx < Dev->TxMaxPending; ++PktIdx) {
-    UINT16  DescIdx;
+    Status = VirtioMapAllBytesInSharedBuffer (
+               Dev->VirtIo,
+               VirtioOperationBusMasterCommonBuffer,
+               TxCopyBuffer,
+               EFI_PAGES_TO_SIZE (Dev->TxCopyBufNrPages),
+               &Dev->TxCopyBufBase,
+               &Dev->TxCopyBufMap
+               );
+    if (EFI_ERROR (Status)) {
+      goto FreeTxCopyBuffer;
+    }
 
-    DescIdx                  = (UINT16)(2 * PktIdx);
-    Dev->TxFreeStack[PktIdx] = DescIdx;
+    Dev->TxCopyBuf = TxCopyBuffer;
+  }
 
-    //
-    // For each possibly pending packet, lay out the descriptor for the common
-    // (unmodified by the host) virtio-net request header.
-    //
-    Dev->TxRing.Desc[DescIdx].Addr  = DeviceAddress;
-    Dev->TxRing.Desc[DescIdx].Len   = (UINT32)TxSharedReqSize;
-    Dev->TxRing.Desc[DescIdx].Flags = VRING_DESC_F_NEXT;
-    Dev->TxRing.Desc[DescIdx].Next  = (UINT16)(DescIdx + 1);
+  //
+  // In VirtIo 1.0, the NumBuffers field is mandatory. In 0.9.5, it depends on
+  // VIRTIO_NET_F_MRG_RXBUF.
+  //
+  Dev->TxSharedReqSize = (UINT32)(
+                                  ((Dev->VirtIo->Revision <
+                                    VIRTIO_SPEC_REVISION (1, 0, 0)) &&
+                                   !Dev->MrgRxBuf) ?
+                                  sizeof (Dev->TxSharedReq->V0_9_5) :
+                                  sizeof *Dev->TxSharedReq
+                                  );
 
-    //
-    // The second descriptor of each pending TX packet is updated on the fly,
-    // but it always terminates the descriptor chain of the packet.
-    //
-    Dev->TxRing.Desc[DescIdx + 1].Flags = 0;
+  //
+  // Each possibly pending packet owns a two-part descriptor chain, headed by
+  // an even descriptor index. VirtioNetTransmit() lays out the chain: the
+  // common (unmodified by the host) virtio-net request header, followed by
+  // the caller's packet.
+  //
+  for (PktIdx = 0; PktIdx < Dev->TxMaxPending; ++PktIdx) {
+    Dev->TxFreeStack[PktIdx] = (UINT16)(2 * PktIdx);
   }
 
   //
@@ -254,19 +317,24 @@ VirtioNetInitTx (
   Dev->TxSharedReq->NumBuffers = 0;
 
   //
-  // virtio-0.9.5, 2.4.2 Receiving Used Buffers From the Device
+  // virtio-0.9.5, 2.4.2 Receiving Used Buffers From the Device; see
+  // VirtioGetNextUsed(). VirtioPrepareChain() in VirtioNetTransmit() asks for
+  // no interrupt when a transmit completes.
   //
-  MemoryFence ();
-  Dev->TxLastUsed = *Dev->TxRing.Used.Idx;
-  ASSERT (Dev->TxLastUsed == 0);
-
-  //
-  // want no interrupt when a transmit completes
-  //
-  *Dev->TxRing.Avail.Flags = (UINT16)VRING_AVAIL_F_NO_INTERRUPT;
+  Dev->TxLastUsed = 0;
 
   return EFI_SUCCESS;
 
+FreeTxCopyBuffer:
+  Dev->VirtIo->FreeSharedPages (
+                 Dev->VirtIo,
+                 Dev->TxCopyBufNrPages,
+                 TxCopyBuffer
+                 );
+
+UnmapTxSharedReq:
+  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->TxSharedReqMap);
+
 FreeTxSharedReqBuffer:
   Dev->VirtIo->FreeSharedPages (
                  Dev->VirtIo,
@@ -277,6 +345,12 @@ FreeTxSharedReqBuffer:
 UninitTxBufCollection:
   OrderedCollectionUninit (Dev->TxBufCollection);
 
+FreeTxCallerBuf:
+  FreePool (Dev->TxCallerBuf);
+
+FreeTxBufDeviceAddr:
+  FreePool (Dev->TxBufDeviceAddr);
+
 FreeTxFreeStack:
   FreePool (Dev->TxFreeStack);
 
@@ -292,6 +366,7 @@ FreeTxFreeStack:
   The structures laid out and resources configured include:
   - destination area for the host to write virtio-net request headers and
     packet data into,
+  - the FIFO that VirtioNetDrainRx() queues filled-in RX buffers in,
   - select polling over RX interrupt,
   - fully populate the RX queue with a static pattern of virtio descriptor
     chains.
@@ -299,6 +374,7 @@ FreeTxFreeStack:
   @param[in,out] Dev       The VNET_DEV driver instance about to enter the
                            EfiSimpleNetworkInitialized state.
 
+  @retval EFI_OUT_OF_RESOURCES  Failed to allocate the RX completion FIFO.
   @return                       Status codes from VIRTIO_CFG_WRITE() or
                                 VIRTIO_DEVICE_PROTOCOL.AllocateSharedPages or
                                 VirtioMapAllBytesInSharedBuffer().
@@ -316,34 +392,59 @@ VirtioNetInitRx (
   UINTN                 VirtioNetReqSize;
   UINTN                 RxBufSize;
   UINT16                RxAlwaysPending;
+  UINT16                RxDescPerBuf;
   UINTN                 PktIdx;
-  UINT16                DescIdx;
   UINTN                 NumBytes;
-  EFI_PHYSICAL_ADDRESS  RxBufDeviceAddress;
   VOID                  *RxBuffer;
 
   //
   // In VirtIo 1.0, the NumBuffers field is mandatory. In 0.9.5, it depends on
-  // VIRTIO_NET_F_MRG_RXBUF, which we never negotiate.
+  // VIRTIO_NET_F_MRG_RXBUF.
   //
-  VirtioNetReqSize = (Dev->VirtIo->Revision < VIRTIO_SPEC_REVISION (1, 0, 0)) ?
+  VirtioNetReqSize = ((Dev->VirtIo->Revision <
+                       VIRTIO_SPEC_REVISION (1, 0, 0)) && !Dev->MrgRxBuf) ?
                      sizeof (VIRTIO_NET_REQ) :
                      sizeof (VIRTIO_1_0_NET_REQ);
 
   //
-  // For each incoming packet we must supply two descriptors:
-  // - the recipient for the virtio-net request header, plus
-  // - the recipient for the network data (which consists of Ethernet header
-  //   and Ethernet payload).
+  // Each RX buffer accommodates the virtio-net request header plus the
+  // network data (which consists of Ethernet header and Ethernet payload).
   //
   RxBufSize = VirtioNetReqSize +
               (Dev->Snm.MediaHeaderSize + Dev->Snm.MaxPacketSize);
 
+  if (Dev->MrgRxBuf) {
+    //
+    // With mergeable RX buffers, a single descriptor covers a whole buffer,
+    // and the host reports in the NumBuffers header field how many buffers a
+    // packet occupies. Populate the entire queue.
+    //
+    RxDescPerBuf    = 1;
+    RxAlwaysPending = Dev->RxRing.QueueSize;
+  } else {
+    //
+    // For each incoming packet we must supply two descriptors:
+    // - the recipient for the virtio-net request header, plus
+    // - the recipient for the network data.
+    //
+    // Limit the number of pending RX packets if the queue is big. The
+    // division by two is due to the "two descriptors per packet" trait.
+    //
+    RxDescPerBuf    = 2;
+    RxAlwaysPending = (UINT16)MIN (
+                                Dev->RxRing.QueueSize / 2,
+                                VNET_MAX_PENDING
+                                );
+  }
+
   //
-  // Limit the number of pending RX packets if the queue is big. The division
-  // by two is due to the above "two descriptors per packet" trait.
+  // Every RX buffer is either available to the host or queued in the
+  // completion FIFO, hence the FIFO needs one entry per buffer.
   //
-  RxAlwaysPending = (UINT16)MIN (Dev->RxRing.QueueSize / 2, VNET_MAX_PENDING);
+  Dev->RxFifo = AllocatePool (RxAlwaysPending * sizeof *Dev->RxFifo);
+  if (Dev->RxFifo == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
 
   //
   // The RxBuf is shared between guest and hypervisor, use
@@ -359,7 +460,7 @@ VirtioNetInitRx (
                                      &RxBuffer
                                      );
   if (EFI_ERROR (Status)) {
-    return Status;
+    goto FreeRxFifo;
   }
 
   ZeroMem (RxBuffer, NumBytes);
@@ -376,55 +477,31 @@ VirtioNetInitRx (
     goto FreeSharedBuffer;
   }
 
-  Dev->RxBuf = RxBuffer;
-
-  //
-  // virtio-0.9.5, 2.4.2 Receiving Used Buffers From the Device
-  //
-  MemoryFence ();
-  Dev->RxLastUsed = *Dev->RxRing.Used.Idx;
-  ASSERT (Dev->RxLastUsed == 0);
-
-  //
-  // virtio-0.9.5, 2.4.2 Receiving Used Buffers From the Device:
-  // the host should not send interrupts, we'll poll in VirtioNetReceive()
-  // and VirtioNetIsPacketAvailable().
-  //
-  *Dev->RxRing.Avail.Flags = (UINT16)VRING_AVAIL_F_NO_INTERRUPT;
+  Dev->RxBuf        = RxBuffer;
+  Dev->RxBufSize    = RxBufSize;
+  Dev->RxReqSize    = (UINT32)VirtioNetReqSize;
+  Dev->RxBufCount   = RxAlwaysPending;
+  Dev->RxDescPerBuf = RxDescPerBuf;
+  Dev->RxLastUsed   = 0;
+  Dev->RxFifoHead   = 0;
+  Dev->RxFifoCount  = 0;
 
   //
-  // now set up a separate, two-part descriptor chain for each RX packet, and
-  // link each chain into (from) the available ring as well
+  // now set up a separate descriptor chain for each RX buffer, and make each
+  // chain available to the host as well; see VirtioNetRecycleRx()
   //
-  DescIdx            = 0;
-  RxBufDeviceAddress = Dev->RxBufDeviceBase;
   for (PktIdx = 0; PktIdx < RxAlwaysPending; ++PktIdx) {
-    //
-    // virtio-0.9.5, 2.4.1.2 Updating the Available Ring
-    // invisible to the host until we update the Index Field
-    //
-    Dev->RxRing.Avail.Ring[PktIdx] = DescIdx;
-
-    //
-    // virtio-0.9.5, 2.4.1.1 Placing Buffers into the Descriptor Table
-    //
-    Dev->RxRing.Desc[DescIdx].Addr  = RxBufDeviceAddress;
-    Dev->RxRing.Desc[DescIdx].Len   = (UINT32)VirtioNetReqSize;
-    Dev->RxRing.Desc[DescIdx].Flags = VRING_DESC_F_WRITE | VRING_DESC_F_NEXT;
-    Dev->RxRing.Desc[DescIdx].Next  = (UINT16)(DescIdx + 1);
-    RxBufDeviceAddress             += Dev->RxRing.Desc[DescIdx++].Len;
-
-    Dev->RxRing.Desc[DescIdx].Addr  = RxBufDeviceAddress;
-    Dev->RxRing.Desc[DescIdx].Len   = (UINT32)(RxBufSize - VirtioNetReqSize);
-    Dev->RxRing.Desc[DescIdx].Flags = VRING_DESC_F_WRITE;
-    RxBufDeviceAddress             += Dev->RxRing.Desc[DescIdx++].Len;
+    VirtioNetRecycleRx (Dev, (UINT16)PktIdx);
   }
 
-  //
-  // virtio-0.9.5, 2.4.1.3 Updating the Index Field
-  //
-  MemoryFence ();
-  *Dev->RxRing.Avail.Idx = RxAlwaysPending;
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: QueueSize=%d RxBufCount=%d MrgRxBuf=%d\n",
+    __FUNCTION__,
+    Dev->RxRing.QueueSize,
+    Dev->RxBufCount,
+    Dev->MrgRxBuf
+    ));
 
   //
   // At this point reception may already be running. In order to make it sure,
@@ -432,16 +509,18 @@ VirtioNetInitRx (
   // before tearing down anything, because reception may have been already
   // running even without the kick.
   //
-  // virtio-0.9.5, 2.4.1.4 Notifying the Device
+  // virtio-0.9.5, 2.4.1.4 Notifying the Device. (VirtioNeedNotify() only
+  // returns FALSE if the host is already processing the RX queue.)
   //
-  MemoryFence ();
-  Status = Dev->VirtIo->SetQueueNotify (Dev->VirtIo, VIRTIO_NET_Q_RX);
-  if (EFI_ERROR (Status)) {
-    Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, 0);
-    goto UnmapSharedBuffer;
+  if (VirtioNeedNotify (&Dev->RxRing)) {
+    Status = Dev->VirtIo->SetQueueNotify (Dev->VirtIo, VIRTIO_NET_Q_RX);
+    if (EFI_ERROR (Status)) {
+      Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, 0);
+      goto UnmapSharedBuffer;
+    }
   }
 
-  return Status;
+  return EFI_SUCCESS;
 
 UnmapSharedBuffer:
   Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->RxBufMap);
@@ -452,6 +531,9 @@ FreeSharedBuffer:
                  Dev->RxBufNrPages,
                  RxBuffer
                  );
+
+FreeRxFifo:
+  FreePool (Dev->RxFifo);
   return Status;
 }
 
@@ -557,8 +639,13 @@ VirtioNetInitialize (
     !!(Features & VIRTIO_NET_F_STATUS)
     );
 
-  Features &= VIRTIO_NET_F_MAC | VIRTIO_NET_F_STATUS | VIRTIO_F_VERSION_1 |
-              VIRTIO_F_IOMMU_PLATFORM;
+  Features &= VIRTIO_NET_F_MAC | VIRTIO_NET_F_STATUS |
+              VIRTIO_NET_F_MRG_RXBUF | VIRTIO_F_VERSION_1 |
+              VIRTIO_F_IOMMU_PLATFORM | VIRTIO_F_RING_EVENT_IDX |
+              (FeaturePcdGet (PcdVirtioPackedRingEnable) ?
+               VIRTIO_F_RING_PACKED :
+               0);
+  Dev->MrgRxBuf = (BOOLEAN)((Features & VIRTIO_NET_F_MRG_RXBUF) != 0);
 
   //
   // In virtio-1.0, feature negotiation is expected to complete before queue
@@ -577,6 +664,7 @@ VirtioNetInitialize (
   Status = VirtioNetInitRing (
              Dev,
              VIRTIO_NET_Q_RX,
+             Features,
              &Dev->RxRing,
              &Dev->RxRingMap
              );
@@ -587,6 +675,7 @@ VirtioNetInitialize (
   Status = VirtioNetInitRing (
              Dev,
              VIRTIO_NET_Q_TX,
+             Features,
              &Dev->TxRing,
              &Dev->TxRingMap
              );
@@ -598,8 +687,9 @@ VirtioNetInitialize (
   // step 5 -- keep only the features we want
   //
   if (Dev->VirtIo->Revision < VIRTIO_SPEC_REVISION (1, 0, 0)) {
-    Features &= ~(UINT64)(VIRTIO_F_VERSION_1 | VIRTIO_F_IOMMU_PLATFORM);
-    Status    = Dev->VirtIo->SetGuestFeatures (Dev->VirtIo, Features);
+    Features &= ~(UINT64)(VIRTIO_F_VERSION_1 | VIRTIO_F_IOMMU_PLATFORM |
+                          VIRTIO_F_RING_PACKED);
+    Status = Dev->VirtIo->SetGuestFeatures (Dev->VirtIo, Features);
     if (EFI_ERROR (Status)) {
       goto ReleaseTxRing;
     }
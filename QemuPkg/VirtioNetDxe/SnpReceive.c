@@ -64,18 +64,18 @@ VirtioNetReceive (
   OUT UINT16                      *Protocol   OPTIONAL
   )
 {
-  VNET_DEV    *Dev;
-  EFI_TPL     OldTpl;
-  EFI_STATUS  Status;
-  UINT16      RxCurUsed;
-  UINT16      UsedElemIdx;
-  UINT32      DescIdx;
-  UINT32      RxLen;
-  UINTN       OrigBufferSize;
-  UINT8       *RxPtr;
-  UINT16      AvailIdx;
-  EFI_STATUS  NotifyStatus;
-  UINTN       RxBufOffset;
+  VNET_DEV            *Dev;
+  EFI_TPL             OldTpl;
+  EFI_STATUS          Status;
+  VNET_RX_COMPLETION  *Completion;
+  UINT16              NumBufs;
+  UINT16              BufNum;
+  UINT32              RxLen;
+  UINT32              ChunkLen;
+  UINTN               OrigBufferSize;
+  UINT8               *RxPtr;
+  UINT8               *DestPtr;
+  EFI_STATUS          NotifyStatus;
 
   if ((This == NULL) || (BufferSize == NULL) || (Buffer == NULL)) {
     return EFI_INVALID_PARAMETER;
@@ -95,30 +95,75 @@ VirtioNetReceive (
   }
 
   //
-  // virtio-0.9.5, 2.4.2 Receiving Used Buffers From the Device
+  // virtio-0.9.5, 2.4.2 Receiving Used Buffers From the Device. Collect all
+  // used elements in one pass; the buffers of a packet are only recycled once
+  // we're done with the packet.
   //
-  MemoryFence ();
-  RxCurUsed = *Dev->RxRing.Used.Idx;
-  MemoryFence ();
-
-  if (Dev->RxLastUsed == RxCurUsed) {
+  VirtioNetDrainRx (Dev);
+  if (Dev->RxFifoCount == 0) {
     Status = EFI_NOT_READY;
     goto Exit;
   }
 
-  UsedElemIdx = Dev->RxLastUsed % Dev->RxRing.QueueSize;
-  DescIdx     = Dev->RxRing.Used.UsedElem[UsedElemIdx].Id;
-  RxLen       = Dev->RxRing.Used.UsedElem[UsedElemIdx].Len;
+  Completion = &Dev->RxFifo[Dev->RxFifoHead];
+  RxPtr      = Dev->RxBuf + Completion->BufIdx * Dev->RxBufSize;
 
   //
-  // the virtio-net request header must be complete; we skip it
-  //
-  ASSERT (RxLen >= Dev->RxRing.Desc[DescIdx].Len);
-  RxLen -= Dev->RxRing.Desc[DescIdx].Len;
-  //
-  // the host must not have filled in more data than requested
+  // the virtio-net request header must be complete; with mergeable RX
+  // buffers, it tells the number of buffers that the packet spans
   //
-  ASSERT (RxLen <= Dev->RxRing.Desc[DescIdx + 1].Len);
+  NumBufs = 1;
+  if ((Completion->Len < Dev->RxReqSize) ||
+      (Completion->Len > Dev->RxBufSize))
+  {
+    //
+    // Without a valid header, we can't tell where the next packet starts in
+    // a mergeable stream; flush all used buffers.
+    //
+    if (Dev->MrgRxBuf) {
+      NumBufs = Dev->RxFifoCount;
+    }
+
+    Status = EFI_DEVICE_ERROR;
+    goto RecycleBufs;
+  }
+
+  if (Dev->MrgRxBuf) {
+    NumBufs = ((volatile VIRTIO_1_0_NET_REQ *)RxPtr)->NumBuffers;
+    if ((NumBufs == 0) || (NumBufs > Dev->RxBufCount)) {
+      //
+      // A garbled buffer count; the rest of the packet would be parsed as
+      // new packet heads. Flush all used buffers.
+      //
+      NumBufs = Dev->RxFifoCount;
+      Status  = EFI_DEVICE_ERROR;
+      goto RecycleBufs;
+    }
+
+    if (NumBufs > Dev->RxFifoCount) {
+      //
+      // The rest of the packet has not been collected yet; keep the packet.
+      //
+      Status = EFI_NOT_READY;
+      goto Exit;
+    }
+  }
+
+  RxLen = 0;
+  for (BufNum = 0; BufNum < NumBufs; ++BufNum) {
+    Completion = &Dev->RxFifo[(Dev->RxFifoHead + BufNum) % Dev->RxBufCount];
+    //
+    // the host must not have filled in more data than requested
+    //
+    if (Completion->Len > Dev->RxBufSize) {
+      Status = EFI_DEVICE_ERROR;
+      goto RecycleBufs; // drop the whole packet
+    }
+
+    RxLen += Completion->Len;
+  }
+
+  RxLen -= Dev->RxReqSize;
 
   OrigBufferSize = *BufferSize;
   *BufferSize    = RxLen;
@@ -130,18 +175,32 @@ VirtioNetReceive (
 
   if (RxLen < Dev->Snm.MediaHeaderSize) {
     Status = EFI_DEVICE_ERROR;
-    goto RecycleDesc; // drop useless short packet
+    goto RecycleBufs; // drop useless short packet
   }
 
   if (HeaderSize != NULL) {
     *HeaderSize = Dev->Snm.MediaHeaderSize;
   }
 
-  RxBufOffset = (UINTN)(Dev->RxRing.Desc[DescIdx + 1].Addr -
-                        Dev->RxBufDeviceBase);
-  RxPtr = Dev->RxBuf + RxBufOffset;
-  CopyMem (Buffer, RxPtr, RxLen);
+  //
+  // gather the packet data; the first buffer starts with the virtio-net
+  // request header, which we skip
+  //
+  DestPtr = Buffer;
+  for (BufNum = 0; BufNum < NumBufs; ++BufNum) {
+    Completion = &Dev->RxFifo[(Dev->RxFifoHead + BufNum) % Dev->RxBufCount];
+    RxPtr      = Dev->RxBuf + Completion->BufIdx * Dev->RxBufSize;
+    ChunkLen   = Completion->Len;
+    if (BufNum == 0) {
+      RxPtr    += Dev->RxReqSize;
+      ChunkLen -= Dev->RxReqSize;
+    }
+
+    CopyMem (DestPtr, RxPtr, ChunkLen);
+    DestPtr += ChunkLen;
+  }
 
+  RxPtr = Buffer;
   if (DestAddr != NULL) {
     CopyMem (DestAddr, RxPtr, SIZE_OF_VNET (Mac));
   }
@@ -158,28 +217,30 @@ VirtioNetReceive (
     *Protocol = (UINT16)((RxPtr[0] << 8) | RxPtr[1]);
   }
 
-  RxPtr += sizeof (UINT16);
-
   Status = EFI_SUCCESS;
 
-RecycleDesc:
-  ++Dev->RxLastUsed;
-
+RecycleBufs:
   //
   // virtio-0.9.5, 2.4.1 Supplying Buffers to The Device
   //
-  AvailIdx                                                   = *Dev->RxRing.Avail.Idx;
-  Dev->RxRing.Avail.Ring[AvailIdx++ % Dev->RxRing.QueueSize] =
-    (UINT16)DescIdx;
-
-  MemoryFence ();
-  *Dev->RxRing.Avail.Idx = AvailIdx;
-
-  MemoryFence ();
-  NotifyStatus = Dev->VirtIo->SetQueueNotify (Dev->VirtIo, VIRTIO_NET_Q_RX);
-  if (!EFI_ERROR (Status)) {
-    // earlier error takes precedence
-    Status = NotifyStatus;
+  for (BufNum = 0; BufNum < NumBufs; ++BufNum) {
+    VirtioNetRecycleRx (Dev, Dev->RxFifo[Dev->RxFifoHead].BufIdx);
+    Dev->RxFifoHead = (UINT16)((Dev->RxFifoHead + 1) % Dev->RxBufCount);
+    --Dev->RxFifoCount;
+  }
+
+  //
+  // Recycled buffers are handed back to the host in bulk: the host is only
+  // considered for a notification once the FIFO has been drained. It only
+  // asks for one when it has run out of receive buffers; normally, recycling
+  // costs no VM exit.
+  //
+  if ((Dev->RxFifoCount == 0) && VirtioNeedNotify (&Dev->RxRing)) {
+    NotifyStatus = Dev->VirtIo->SetQueueNotify (Dev->VirtIo, VIRTIO_NET_Q_RX);
+    if (!EFI_ERROR (Status)) {
+      // earlier error takes precedence
+      Status = NotifyStatus;
+    }
   }
 
 Exit:
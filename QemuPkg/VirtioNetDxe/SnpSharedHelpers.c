@@ -48,6 +48,7 @@ VirtioNetShutdownRx (
                  Dev->RxBufNrPages,
                  Dev->RxBuf
                  );
+  FreePool (Dev->RxFifo);
 }
 
 VOID
@@ -60,6 +61,15 @@ VirtioNetShutdownTx (
   TX_BUF_MAP_INFO           *TxBufMapInfo;
   VOID                      *UserStruct;
 
+  if (Dev->TxCopySlotSize > 0) {
+    Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->TxCopyBufMap);
+    Dev->VirtIo->FreeSharedPages (
+                   Dev->VirtIo,
+                   Dev->TxCopyBufNrPages,
+                   Dev->TxCopyBuf
+                   );
+  }
+
   Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->TxSharedReqMap);
   Dev->VirtIo->FreeSharedPages (
                  Dev->VirtIo,
@@ -80,6 +90,8 @@ VirtioNetShutdownTx (
 
   OrderedCollectionUninit (Dev->TxBufCollection);
 
+  FreePool (Dev->TxCallerBuf);
+  FreePool (Dev->TxBufDeviceAddr);
   FreePool (Dev->TxFreeStack);
 }
 
@@ -103,6 +115,137 @@ VirtioNetUninitRing (
   VirtioRingUninit (Dev->VirtIo, Ring);
 }
 
+/**
+  Make the receive destination area of an RX buffer available to the host.
+
+  Without VIRTIO_NET_F_MRG_RXBUF, a separate, two-part descriptor chain is
+  used for each RX buffer: the first part receives the virtio-net request
+  header, the second part receives the network data (Ethernet header and
+  Ethernet payload). With VIRTIO_NET_F_MRG_RXBUF, a single descriptor covers
+  the entire buffer, and the host places the header at its start. The chain
+  is rebuilt from scratch every time, as the packed ring layout overwrites
+  descriptors with used elements.
+
+  The host is not notified; the caller is responsible for that.
+
+  @param[in,out] Dev      The VNET_DEV driver instance whose RX ring is being
+                          populated.
+  @param[in]     BufIdx   The index of the RX buffer; its receive destination
+                          area is the BufIdx'th slice of RxBuf, and its head
+                          descriptor index is BufIdx * Dev->RxDescPerBuf.
+*/
+VOID
+EFIAPI
+VirtioNetRecycleRx (
+  IN OUT VNET_DEV  *Dev,
+  IN     UINT16    BufIdx
+  )
+{
+  DESC_INDICES          Indices;
+  EFI_PHYSICAL_ADDRESS  RxBufDeviceAddress;
+
+  ASSERT (BufIdx < Dev->RxBufCount);
+  RxBufDeviceAddress = Dev->RxBufDeviceBase + BufIdx * Dev->RxBufSize;
+
+  //
+  // virtio-0.9.5, 2.4.2 Receiving Used Buffers From the Device:
+  // the host should not send interrupts, we'll poll in VirtioNetReceive()
+  // and VirtioNetIsPacketAvailable().
+  //
+  VirtioPrepareChain (
+    &Dev->RxRing,
+    (UINT16)(BufIdx * Dev->RxDescPerBuf),
+    &Indices
+    );
+  if (Dev->RxDescPerBuf == 1) {
+    VirtioAppendDesc (
+      &Dev->RxRing,
+      RxBufDeviceAddress,
+      (UINT32)Dev->RxBufSize,
+      VRING_DESC_F_WRITE,
+      &Indices
+      );
+    VirtioSubmitChain (&Dev->RxRing, &Indices);
+    return;
+  }
+
+  VirtioAppendDesc (
+    &Dev->RxRing,
+    RxBufDeviceAddress,
+    Dev->RxReqSize,
+    VRING_DESC_F_WRITE | VRING_DESC_F_NEXT,
+    &Indices
+    );
+  VirtioAppendDesc (
+    &Dev->RxRing,
+    RxBufDeviceAddress + Dev->RxReqSize,
+    (UINT32)(Dev->RxBufSize - Dev->RxReqSize),
+    VRING_DESC_F_WRITE,
+    &Indices
+    );
+  VirtioSubmitChain (&Dev->RxRing, &Indices);
+}
+
+/**
+  Move all used elements from the RX ring to the RX completion FIFO of the
+  driver instance, in a single pass.
+
+  The buffers are not recycled here; VirtioNetReceive() consumes the FIFO in
+  packet units, and recycles the buffers of each packet it consumes. As every
+  RX buffer is either available to the host or queued in the FIFO, the FIFO
+  cannot overflow, unless the host misbehaves; used elements that don't map to
+  an RX buffer, or that would overflow the FIFO, are dropped.
+
+  @param[in,out] Dev  The VNET_DEV driver instance in the
+                      EfiSimpleNetworkInitialized state.
+*/
+VOID
+EFIAPI
+VirtioNetDrainRx (
+  IN OUT VNET_DEV  *Dev
+  )
+{
+  UINT16              DescIdx;
+  UINT32              Len;
+  VNET_RX_COMPLETION  *Completion;
+
+  //
+  // virtio-0.9.5, 2.4.2 Receiving Used Buffers From the Device
+  //
+  while (!EFI_ERROR (
+            VirtioGetNextUsed (
+              &Dev->RxRing,
+              &Dev->RxLastUsed,
+              &DescIdx,
+              &Len
+              )
+            ))
+  {
+    //
+    // The head index comes from the host. A bad one must not make us index
+    // past RxBuf later, or overwrite completions still queued in the FIFO.
+    //
+    if ((DescIdx % Dev->RxDescPerBuf != 0) ||
+        (DescIdx / Dev->RxDescPerBuf >= Dev->RxBufCount) ||
+        (Dev->RxFifoCount >= Dev->RxBufCount))
+    {
+      DEBUG ((
+        DEBUG_ERROR,
+        "%a: ignoring used element with bad head index %u\n",
+        __FUNCTION__,
+        DescIdx
+        ));
+      continue;
+    }
+
+    Completion = &Dev->RxFifo[(Dev->RxFifoHead + Dev->RxFifoCount) %
+                              Dev->RxBufCount];
+    Completion->BufIdx = DescIdx / Dev->RxDescPerBuf;
+    Completion->Len    = Len;
+    ++Dev->RxFifoCount;
+  }
+}
+
 /**
   Map Caller-supplied TxBuf buffer to the device-mapped address
 
@@ -70,7 +70,7 @@ VirtioNetTransmit (
   EFI_TPL               OldTpl;
   EFI_STATUS            Status;
   UINT16                DescIdx;
-  UINT16                AvailIdx;
+  DESC_INDICES          Indices;
   EFI_PHYSICAL_ADDRESS  DeviceAddress;
 
   if ((This == NULL) || (BufferSize == 0) || (Buffer == NULL)) {
@@ -142,39 +142,73 @@ VirtioNetTransmit (
     ASSERT ((UINTN)(Ptr - (UINT8 *)Buffer) == Dev->Snm.MediaHeaderSize);
   }
 
-  //
-  // Map the transmit buffer system physical address to device address.
-  //
-  Status = VirtioNetMapTxBuf (
-             Dev,
-             Buffer,
-             BufferSize,
-             &DeviceAddress
-             );
-  if (EFI_ERROR (Status)) {
-    Status = EFI_DEVICE_ERROR;
-    goto Exit;
+  DescIdx = Dev->TxFreeStack[Dev->TxCurPending];
+
+  if (BufferSize <= Dev->TxCopySlotSize) {
+    //
+    // Copy the frame to the pre-mapped TX slot of the descriptor chain.
+    //
+    CopyMem (
+      Dev->TxCopyBuf + (UINTN)(DescIdx / 2) * Dev->TxCopySlotSize,
+      Buffer,
+      BufferSize
+      );
+    Dev->TxCallerBuf[DescIdx / 2] = Buffer;
+
+    DeviceAddress = Dev->TxCopyBufBase +
+                    (UINTN)(DescIdx / 2) * Dev->TxCopySlotSize;
+  } else {
+    //
+    // Map the transmit buffer system physical address to device address.
+    //
+    Status = VirtioNetMapTxBuf (
+               Dev,
+               Buffer,
+               BufferSize,
+               &DeviceAddress
+               );
+    if (EFI_ERROR (Status)) {
+      Status = EFI_DEVICE_ERROR;
+      goto Exit;
+    }
+
+    Dev->TxCallerBuf[DescIdx / 2] = NULL;
   }
 
   //
   // virtio-0.9.5, 2.4.1 Supplying Buffers to The Device
   //
-  DescIdx                            = Dev->TxFreeStack[Dev->TxCurPending++];
-  Dev->TxRing.Desc[DescIdx + 1].Addr = DeviceAddress;
-  Dev->TxRing.Desc[DescIdx + 1].Len  = (UINT32)BufferSize;
+  Dev->TxCurPending++;
+  Dev->TxBufDeviceAddr[DescIdx / 2] = DeviceAddress;
 
   //
-  // the available index is never written by the host, we can read it back
-  // without a barrier
+  // want no interrupt when a transmit completes
   //
-  AvailIdx                                                   = *Dev->TxRing.Avail.Idx;
-  Dev->TxRing.Avail.Ring[AvailIdx++ % Dev->TxRing.QueueSize] = DescIdx;
-
-  MemoryFence ();
-  *Dev->TxRing.Avail.Idx = AvailIdx;
+  VirtioPrepareChain (&Dev->TxRing, DescIdx, &Indices);
+  VirtioAppendDesc (
+    &Dev->TxRing,
+    Dev->TxSharedReqBase,
+    Dev->TxSharedReqSize,
+    VRING_DESC_F_NEXT,
+    &Indices
+    );
+  VirtioAppendDesc (
+    &Dev->TxRing,
+    DeviceAddress,
+    (UINT32)BufferSize,
+    0,
+    &Indices
+    );
+  VirtioSubmitChain (&Dev->TxRing, &Indices);
 
-  MemoryFence ();
-  Status = Dev->VirtIo->SetQueueNotify (Dev->VirtIo, VIRTIO_NET_Q_TX);
+  //
+  // The host may suppress the notification while it is still processing
+  // earlier frames; the frame is queued either way.
+  //
+  Status = EFI_SUCCESS;
+  if (VirtioNeedNotify (&Dev->TxRing)) {
+    Status = Dev->VirtIo->SetQueueNotify (Dev->VirtIo, VIRTIO_NET_Q_TX);
+  }
 
 Exit:
   gBS->RestoreTPL (OldTpl);
@@ -25,10 +25,21 @@
 #define VNET_SIG  SIGNATURE_32 ('V', 'N', 'E', 'T')
 
 //
-// maximum number of pending packets, separately for each direction
+// maximum number of pending packets, separately for each direction; with
+// VIRTIO_NET_F_MRG_RXBUF, the number of RX buffers follows the RX queue size
+// instead
 //
 #define VNET_MAX_PENDING  64
 
+//
+// An RX buffer that the host has filled in, queued by VirtioNetDrainRx()
+// until VirtioNetReceive() consumes the packet that the buffer belongs to.
+//
+typedef struct {
+  UINT16    BufIdx; // index of the buffer's slice in RxBuf
+  UINT32    Len;    // bytes written by the host, virtio-net header included
+} VNET_RX_COMPLETION;
+
 //
 // State diagram:
 //
@@ -80,8 +91,16 @@ typedef struct {
   VRING                          RxRing;          // VirtioNetInitRing
   VOID                           *RxRingMap;      // VirtioRingMap and
                                                   // VirtioNetInitRing
+  BOOLEAN                        MrgRxBuf;        // VirtioNetInitialize
   UINT8                          *RxBuf;          // VirtioNetInitRx
+  UINTN                          RxBufSize;       // VirtioNetInitRx
+  UINT32                         RxReqSize;       // VirtioNetInitRx
+  UINT16                         RxBufCount;      // VirtioNetInitRx
+  UINT16                         RxDescPerBuf;    // VirtioNetInitRx
   UINT16                         RxLastUsed;      // VirtioNetInitRx
+  VNET_RX_COMPLETION             *RxFifo;         // VirtioNetInitRx
+  UINT16                         RxFifoHead;      // VirtioNetInitRx
+  UINT16                         RxFifoCount;     // VirtioNetInitRx
   UINTN                          RxBufNrPages;    // VirtioNetInitRx
   EFI_PHYSICAL_ADDRESS           RxBufDeviceBase; // VirtioNetInitRx
   VOID                           *RxBufMap;       // VirtioNetInitRx
@@ -92,8 +111,17 @@ typedef struct {
   UINT16                         TxMaxPending;     // VirtioNetInitTx
   UINT16                         TxCurPending;     // VirtioNetInitTx
   UINT16                         *TxFreeStack;     // VirtioNetInitTx
+  EFI_PHYSICAL_ADDRESS           *TxBufDeviceAddr; // VirtioNetInitTx
+  VOID                           **TxCallerBuf;    // VirtioNetInitTx
+  UINT32                         TxCopySlotSize;   // VirtioNetInitTx
+  UINT8                          *TxCopyBuf;       // VirtioNetInitTx
+  UINTN                          TxCopyBufNrPages; // VirtioNetInitTx
+  VOID                           *TxCopyBufMap;    // VirtioNetInitTx
+  EFI_PHYSICAL_ADDRESS           TxCopyBufBase;    // VirtioNetInitTx
   VIRTIO_1_0_NET_REQ             *TxSharedReq;     // VirtioNetInitTx
   VOID                           *TxSharedReqMap;  // VirtioNetInitTx
+  EFI_PHYSICAL_ADDRESS           TxSharedReqBase;  // VirtioNetInitTx
+  UINT32                         TxSharedReqSize;  // VirtioNetInitTx
   UINT16                         TxLastUsed;       // VirtioNetInitTx
   ORDERED_COLLECTION             *TxBufCollection; // VirtioNetInitTx
 } VNET_DEV;
@@ -275,6 +303,19 @@ VirtioNetUninitRing (
   IN     VOID      *RingMap
   );
 
+VOID
+EFIAPI
+VirtioNetRecycleRx (
+  IN OUT VNET_DEV  *Dev,
+  IN     UINT16    BufIdx
+  );
+
+VOID
+EFIAPI
+VirtioNetDrainRx (
+  IN OUT VNET_DEV  *Dev
+  );
+
 //
 // utility functions to map caller-supplied Tx buffer system physical address
 // to a device address and vice versa
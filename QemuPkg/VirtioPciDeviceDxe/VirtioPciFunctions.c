@@ -214,6 +214,12 @@ VirtioPciSetQueueAddress (
 
   ASSERT (RingBaseShift == 0);
 
+  //
+  // Packed rings depend on VIRTIO_F_RING_PACKED, which legacy devices cannot
+  // offer.
+  //
+  ASSERT (!Ring->IsPacked);
+
   Dev = VIRTIO_PCI_DEVICE_FROM_VIRTIO_DEVICE (This);
 
   return VirtioPciIoWrite (
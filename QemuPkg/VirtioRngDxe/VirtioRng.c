@@ -2,6 +2,10 @@
 
   This driver produces EFI_RNG_PROTOCOL instances for virtio-rng devices.
 
+  Small requests are served from an entropy pool that the host refills in the
+  background; requests that the pool cannot satisfy fall back to a synchronous
+  round trip to the device.
+
   The implementation is based on QemuPkg/VirtioScsiDxe/VirtioScsi.c
 
   Copyright (C) 2012, Red Hat, Inc.
@@ -88,6 +92,249 @@ VirtioRngGetInfo (
   return EFI_SUCCESS;
 }
 
+/**
+
+  Notify the host about descriptor chains submitted since the last
+  notification, if the host asked for it.
+
+  Must be called at TPL_NOTIFY.
+
+  @param[in,out] Dev  The virtio-rng device.
+
+  @return  Status codes returned by VirtIo->SetQueueNotify().
+
+**/
+STATIC
+EFI_STATUS
+VirtioRngKick (
+  IN OUT VIRTIO_RNG_DEV  *Dev
+  )
+{
+  if (!VirtioNeedNotify (&Dev->Ring)) {
+    return EFI_SUCCESS;
+  }
+
+  return Dev->VirtIo->SetQueueNotify (Dev->VirtIo, 0);
+}
+
+/**
+
+  Resubmit the entropy pool buffers that have been used up to the host, for
+  refilling. The host is not notified; see VirtioRngKick().
+
+  Must be called at TPL_NOTIFY.
+
+  @param[in,out] Dev  The virtio-rng device.
+
+**/
+STATIC
+VOID
+VirtioRngRefillPool (
+  IN OUT VIRTIO_RNG_DEV  *Dev
+  )
+{
+  UINT16        SlotIdx;
+  DESC_INDICES  Indices;
+
+  for (SlotIdx = 0; SlotIdx < Dev->NumSlots; ++SlotIdx) {
+    if (Dev->Slots[SlotIdx].InFlight ||
+        (Dev->Slots[SlotIdx].Consumed < Dev->Slots[SlotIdx].Filled))
+    {
+      continue;
+    }
+
+    //
+    // Pool buffer SlotIdx is identified by head descriptor SlotIdx.
+    //
+    VirtioPrepareChain (&Dev->Ring, SlotIdx, &Indices);
+    VirtioAppendDesc (
+      &Dev->Ring,
+      Dev->PoolBase + SlotIdx * VIRTIO_RNG_SLOT_SIZE,
+      VIRTIO_RNG_SLOT_SIZE,
+      VRING_DESC_F_WRITE,
+      &Indices
+      );
+    VirtioSubmitChain (&Dev->Ring, &Indices);
+
+    Dev->Slots[SlotIdx].Filled   = 0;
+    Dev->Slots[SlotIdx].Consumed = 0;
+    Dev->Slots[SlotIdx].InFlight = TRUE;
+
+    if (Dev->SlotsInFlight++ == 0) {
+      gBS->SetTimer (
+             Dev->RefillTimer,
+             TimerPeriodic,
+             VIRTIO_RNG_POOL_POLL_PERIOD
+             );
+    }
+  }
+}
+
+/**
+
+  Collect the used elements that the host has produced since the last call:
+  refilled entropy pool buffers, and the synchronous request, if any.
+
+  Must be called at TPL_NOTIFY.
+
+  @param[in,out] Dev  The virtio-rng device.
+
+**/
+STATIC
+VOID
+VirtioRngProcessUsed (
+  IN OUT VIRTIO_RNG_DEV  *Dev
+  )
+{
+  UINT16           HeadDescIdx;
+  UINT32           UsedLen;
+  VIRTIO_RNG_SLOT  *Slot;
+
+  while (!EFI_ERROR (
+            VirtioGetNextUsed (
+              &Dev->Ring,
+              &Dev->LastUsed,
+              &HeadDescIdx,
+              &UsedLen
+              )
+            ))
+  {
+    //
+    // The head descriptor after the pool buffers is reserved for the
+    // synchronous request. The head index comes from the host; ignore any
+    // that doesn't match a buffer we have in flight, rather than report a
+    // stale length, or account for a refill twice.
+    //
+    if (HeadDescIdx == Dev->NumSlots) {
+      if (!Dev->SyncInFlight || Dev->SyncDone) {
+        DEBUG ((
+          DEBUG_ERROR,
+          "%a: ignoring unexpected used element for the synchronous request\n",
+          __FUNCTION__
+          ));
+        continue;
+      }
+
+      Dev->SyncLen  = UsedLen;
+      Dev->SyncDone = TRUE;
+      continue;
+    }
+
+    if ((HeadDescIdx > Dev->NumSlots) || !Dev->Slots[HeadDescIdx].InFlight) {
+      DEBUG ((
+        DEBUG_ERROR,
+        "%a: ignoring used element with bad head index %u\n",
+        __FUNCTION__,
+        HeadDescIdx
+        ));
+      continue;
+    }
+
+    Slot = &Dev->Slots[HeadDescIdx];
+
+    Slot->Filled   = MIN (UsedLen, VIRTIO_RNG_SLOT_SIZE);
+    Slot->Consumed = 0;
+    Slot->InFlight = FALSE;
+    ++Dev->Stats.Refills;
+
+    ASSERT (Dev->SlotsInFlight > 0);
+    if (--Dev->SlotsInFlight == 0) {
+      gBS->SetTimer (Dev->RefillTimer, TimerCancel, 0);
+    }
+  }
+}
+
+/**
+
+  Timer notification function that collects refilled entropy pool buffers.
+
+  @param[in] Event    Event whose notification function is being invoked.
+
+  @param[in] Context  Pointer to the VIRTIO_RNG_DEV structure.
+
+**/
+STATIC
+VOID
+EFIAPI
+VirtioRngRefillTimer (
+  IN  EFI_EVENT  Event,
+  IN  VOID       *Context
+  )
+{
+  //
+  // This callback is running at TPL_NOTIFY already.
+  //
+  VirtioRngProcessUsed (Context);
+}
+
+/**
+
+  Serve an RNG request from the entropy pool, if the pool holds enough bytes
+  that have not been handed out yet. Used up pool buffers are zeroed and
+  resubmitted to the host.
+
+  Must be called at TPL_NOTIFY.
+
+  @param[in,out] Dev             The virtio-rng device.
+
+  @param[in]     RNGValueLength  The number of bytes to return.
+
+  @param[out]    RNGValue        The caller's buffer.
+
+  @retval TRUE   RNGValue has been filled from the pool.
+
+  @retval FALSE  The pool holds fewer than RNGValueLength bytes; nothing has
+                 been consumed.
+
+**/
+STATIC
+BOOLEAN
+VirtioRngDrainPool (
+  IN OUT VIRTIO_RNG_DEV  *Dev,
+  IN     UINTN           RNGValueLength,
+  OUT    UINT8           *RNGValue
+  )
+{
+  UINT16           SlotIdx;
+  UINTN            Available;
+  UINTN            Index;
+  VIRTIO_RNG_SLOT  *Slot;
+  volatile UINT8   *Source;
+
+  Available = 0;
+  for (SlotIdx = 0; SlotIdx < Dev->NumSlots; ++SlotIdx) {
+    if (!Dev->Slots[SlotIdx].InFlight) {
+      Available += Dev->Slots[SlotIdx].Filled - Dev->Slots[SlotIdx].Consumed;
+    }
+  }
+
+  if (RNGValueLength > Available) {
+    return FALSE;
+  }
+
+  Index = 0;
+  for (SlotIdx = 0; Index < RNGValueLength; ++SlotIdx) {
+    ASSERT (SlotIdx < Dev->NumSlots);
+    Slot = &Dev->Slots[SlotIdx];
+    if (Slot->InFlight) {
+      continue;
+    }
+
+    //
+    // Hand out every byte once, and wipe it from the pool right away.
+    //
+    Source = Dev->Pool + SlotIdx * VIRTIO_RNG_SLOT_SIZE;
+    while ((Index < RNGValueLength) && (Slot->Consumed < Slot->Filled)) {
+      RNGValue[Index++]        = Source[Slot->Consumed];
+      Source[Slot->Consumed++] = 0;
+    }
+  }
+
+  ++Dev->Stats.PoolRequests;
+  Dev->Stats.PoolBytes += RNGValueLength;
+  return TRUE;
+}
+
 /**
   Produces and returns an RNG value using either the default or specified RNG
   algorithm.
@@ -136,6 +383,9 @@ VirtioRngGetRNG (
   EFI_STATUS            Status;
   EFI_PHYSICAL_ADDRESS  DeviceAddress;
   VOID                  *Mapping;
+  EFI_TPL               OldTpl;
+  BOOLEAN               Done;
+  UINT16                LastUsed;
 
   if ((This == NULL) || (RNGValueLength == 0) || (RNGValue == NULL)) {
     return EFI_INVALID_PARAMETER;
@@ -150,12 +400,43 @@ VirtioRngGetRNG (
     return EFI_UNSUPPORTED;
   }
 
+  Dev = VIRTIO_ENTROPY_SOURCE_FROM_RNG (This);
+
+  //
+  // Try the entropy pool first. Whether or not it can serve the request,
+  // resubmit the pool buffers that are used up, so that the pool keeps
+  // filling while the caller works with the data.
+  //
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  VirtioRngProcessUsed (Dev);
+  Done = VirtioRngDrainPool (Dev, RNGValueLength, RNGValue);
+  VirtioRngRefillPool (Dev);
+  VirtioRngKick (Dev);
+
+  if (Done) {
+    gBS->RestoreTPL (OldTpl);
+    return EFI_SUCCESS;
+  }
+
+  //
+  // Fall back to a synchronous request. Only one can be in flight, on the
+  // head descriptor reserved for it. SyncInFlight stays set for good if a
+  // synchronous request had to be abandoned, see below.
+  //
+  if (Dev->SyncInFlight) {
+    gBS->RestoreTPL (OldTpl);
+    return EFI_NOT_READY;
+  }
+
+  Dev->SyncInFlight = TRUE;
+  gBS->RestoreTPL (OldTpl);
+
   Buffer = (volatile UINT8 *)AllocatePool (RNGValueLength);
   if (Buffer == NULL) {
-    return EFI_DEVICE_ERROR;
+    Status = EFI_DEVICE_ERROR;
+    goto ReleaseSync;
   }
 
-  Dev = VIRTIO_ENTROPY_SOURCE_FROM_RNG (This);
   //
   // Map Buffer's system physical address to device address
   //
@@ -180,7 +461,8 @@ VirtioRngGetRNG (
   for (Index = 0; Index < RNGValueLength; Index += Len) {
     BufferSize = (UINT32)MIN (RNGValueLength - Index, (UINTN)MAX_UINT32);
 
-    VirtioPrepare (&Dev->Ring, &Indices);
+    OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+    VirtioPrepareChain (&Dev->Ring, Dev->NumSlots, &Indices);
     VirtioAppendDesc (
       &Dev->Ring,
       DeviceAddress + Index,
@@ -188,12 +470,40 @@ VirtioRngGetRNG (
       VRING_DESC_F_WRITE,
       &Indices
       );
+    VirtioSubmitChain (&Dev->Ring, &Indices);
+    Dev->SyncDone = FALSE;
+
+    if (VirtioRngKick (Dev) != EFI_SUCCESS) {
+      //
+      // The chain is visible to the host, which may still write Buffer at any
+      // time. Deliberately leak Buffer and its mapping, and leave
+      // SyncInFlight set so that the reserved head descriptor is never
+      // reused: every later request that the pool cannot serve fails with
+      // EFI_NOT_READY until the device is reset.
+      //
+      gBS->RestoreTPL (OldTpl);
+      return EFI_DEVICE_ERROR;
+    }
 
-    if (VirtioFlush (Dev->VirtIo, 0, &Dev->Ring, &Indices, &Len) !=
-        EFI_SUCCESS)
-    {
-      Status = EFI_DEVICE_ERROR;
-      goto UnmapBuffer;
+    gBS->RestoreTPL (OldTpl);
+
+    //
+    // Refilled pool buffers that the host returns in the meantime are
+    // collected as well.
+    //
+    for ( ; ;) {
+      OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+      VirtioRngProcessUsed (Dev);
+      Done     = Dev->SyncDone;
+      Len      = Dev->SyncLen;
+      LastUsed = Dev->LastUsed;
+      gBS->RestoreTPL (OldTpl);
+
+      if (Done) {
+        break;
+      }
+
+      VirtioWaitUsed (&Dev->Ring, &Dev->LastUsed, LastUsed);
     }
 
     ASSERT (Len > 0);
@@ -211,24 +521,136 @@ VirtioRngGetRNG (
 
   for (Index = 0; Index < RNGValueLength; Index++) {
     RNGValue[Index] = Buffer[Index];
+    Buffer[Index]   = 0;
   }
 
-  Status = EFI_SUCCESS;
+  ++Dev->Stats.SyncRequests;
+  Dev->Stats.SyncBytes += RNGValueLength;
+  Status                = EFI_SUCCESS;
+
+FreeBuffer:
+  FreePool ((VOID *)Buffer);
+
+ReleaseSync:
+  Dev->SyncInFlight = FALSE;
+  return Status;
+}
+
+/**
+
+  Allocate and map the entropy pool, and create the timer event that collects
+  refilled pool buffers. The pool buffers are submitted to the host once the
+  device is live.
+
+  @param[in,out] Dev        The virtio-rng device being initialized.
+
+  @param[in]     QueueSize  The size of the request virtqueue.
+
+  @retval EFI_SUCCESS  Setup complete.
+
+  @return              Error codes from VirtIo->AllocateSharedPages(),
+                       VirtioMapAllBytesInSharedBuffer(), or the CreateEvent()
+                       boot service.
+
+**/
+STATIC
+EFI_STATUS
+VirtioRngInitPool (
+  IN OUT VIRTIO_RNG_DEV  *Dev,
+  IN     UINT16          QueueSize
+  )
+{
+  EFI_STATUS  Status;
+  VOID        *PoolBuffer;
+
+  //
+  // One head descriptor per pool buffer, plus one for the synchronous
+  // request. Ensured by VirtioRngInit().
+  //
+  ASSERT (QueueSize >= 2);
+  Dev->NumSlots      = (UINT16)MIN (QueueSize - 1, VIRTIO_RNG_POOL_SLOTS);
+  Dev->SlotsInFlight = 0;
+  ZeroMem (Dev->Slots, sizeof Dev->Slots);
 
-UnmapBuffer:
   //
-  // If we are reached here due to the error then unmap the buffer otherwise
-  // the buffer is already unmapped after VirtioFlush().
+  // Map the pool with BusMasterCommonBuffer so that the buffers can be
+  // accessed equally by both processor and device, without per-request
+  // mapping.
   //
+  Dev->PoolNrPages = EFI_SIZE_TO_PAGES (Dev->NumSlots * VIRTIO_RNG_SLOT_SIZE);
+  Status           = Dev->VirtIo->AllocateSharedPages (
+                                    Dev->VirtIo,
+                                    Dev->PoolNrPages,
+                                    &PoolBuffer
+                                    );
   if (EFI_ERROR (Status)) {
-    Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Mapping);
+    return Status;
   }
 
-FreeBuffer:
-  FreePool ((VOID *)Buffer);
+  ZeroMem (PoolBuffer, EFI_PAGES_TO_SIZE (Dev->PoolNrPages));
+
+  Status = VirtioMapAllBytesInSharedBuffer (
+             Dev->VirtIo,
+             VirtioOperationBusMasterCommonBuffer,
+             PoolBuffer,
+             EFI_PAGES_TO_SIZE (Dev->PoolNrPages),
+             &Dev->PoolBase,
+             &Dev->PoolMap
+             );
+  if (EFI_ERROR (Status)) {
+    goto FreePoolBuffer;
+  }
+
+  Status = gBS->CreateEvent (
+                  EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  &VirtioRngRefillTimer,
+                  Dev,
+                  &Dev->RefillTimer
+                  );
+  if (EFI_ERROR (Status)) {
+    goto UnmapPool;
+  }
+
+  Dev->Pool = PoolBuffer;
+  return EFI_SUCCESS;
+
+UnmapPool:
+  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->PoolMap);
+
+FreePoolBuffer:
+  Dev->VirtIo->FreeSharedPages (Dev->VirtIo, Dev->PoolNrPages, PoolBuffer);
+
   return Status;
 }
 
+/**
+
+  Release the entropy pool set up with VirtioRngInitPool(). The device must
+  have been reset.
+
+  @param[in,out] Dev  The virtio-rng device.
+
+**/
+STATIC
+VOID
+VirtioRngUninitPool (
+  IN OUT VIRTIO_RNG_DEV  *Dev
+  )
+{
+  gBS->CloseEvent (Dev->RefillTimer);
+
+  ZeroMem ((VOID *)Dev->Pool, EFI_PAGES_TO_SIZE (Dev->PoolNrPages));
+  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->PoolMap);
+  Dev->VirtIo->FreeSharedPages (
+                 Dev->VirtIo,
+                 Dev->PoolNrPages,
+                 (VOID *)Dev->Pool
+                 );
+  Dev->Pool          = NULL;
+  Dev->SlotsInFlight = 0;
+}
+
 STATIC
 EFI_STATUS
 EFIAPI
@@ -241,6 +663,7 @@ VirtioRngInit (
   UINT16      QueueSize;
   UINT64      Features;
   UINT64      RingBaseShift;
+  EFI_TPL     OldTpl;
 
   //
   // Execute virtio-0.9.5, 2.2.1 Device Initialization Sequence.
@@ -279,7 +702,8 @@ VirtioRngInit (
     goto Failed;
   }
 
-  Features &= VIRTIO_F_VERSION_1 | VIRTIO_F_IOMMU_PLATFORM;
+  Features &= VIRTIO_F_VERSION_1 | VIRTIO_F_IOMMU_PLATFORM |
+              VIRTIO_F_RING_EVENT_IDX;
 
   //
   // In virtio-1.0, feature negotiation is expected to complete before queue
@@ -306,14 +730,16 @@ VirtioRngInit (
   }
 
   //
-  // VirtioRngGetRNG() uses one descriptor
+  // Every entropy pool buffer and the synchronous request in
+  // VirtioRngGetRNG() use one descriptor each; we need at least one pool
+  // buffer.
   //
-  if (QueueSize < 1) {
+  if (QueueSize < 2) {
     Status = EFI_UNSUPPORTED;
     goto Failed;
   }
 
-  Status = VirtioRingInit (Dev->VirtIo, QueueSize, &Dev->Ring);
+  Status = VirtioRingInitEx (Dev->VirtIo, QueueSize, Features, &Dev->Ring);
   if (EFI_ERROR (Status)) {
     goto Failed;
   }
@@ -357,6 +783,16 @@ VirtioRngInit (
     goto UnmapQueue;
   }
 
+  Dev->LastUsed     = 0;
+  Dev->SyncInFlight = FALSE;
+  Dev->SyncDone     = FALSE;
+  ZeroMem (&Dev->Stats, sizeof Dev->Stats);
+
+  Status = VirtioRngInitPool (Dev, QueueSize);
+  if (EFI_ERROR (Status)) {
+    goto UnmapQueue;
+  }
+
   //
   // step 5 -- Report understood features and guest-tuneables.
   //
@@ -364,7 +800,7 @@ VirtioRngInit (
     Features &= ~(UINT64)(VIRTIO_F_VERSION_1 | VIRTIO_F_IOMMU_PLATFORM);
     Status    = Dev->VirtIo->SetGuestFeatures (Dev->VirtIo, Features);
     if (EFI_ERROR (Status)) {
-      goto UnmapQueue;
+      goto UninitPool;
     }
   }
 
@@ -374,7 +810,7 @@ VirtioRngInit (
   NextDevStat |= VSTAT_DRIVER_OK;
   Status       = Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, NextDevStat);
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto UninitPool;
   }
 
   //
@@ -383,8 +819,27 @@ VirtioRngInit (
   Dev->Rng.GetInfo = VirtioRngGetInfo;
   Dev->Rng.GetRNG  = VirtioRngGetRNG;
 
+  //
+  // Start filling the entropy pool.
+  //
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  VirtioRngRefillPool (Dev);
+  VirtioRngKick (Dev);
+  gBS->RestoreTPL (OldTpl);
+
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: QueueSize=%d NumSlots=%d SlotSize=%d\n",
+    __FUNCTION__,
+    Dev->Ring.QueueSize,
+    Dev->NumSlots,
+    VIRTIO_RNG_SLOT_SIZE
+    ));
   return EFI_SUCCESS;
 
+UninitPool:
+  VirtioRngUninitPool (Dev);
+
 UnmapQueue:
   Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->RingMap);
 
@@ -416,6 +871,20 @@ VirtioRngUninit (
   //
   Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, 0);
 
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: pool: %Lu requests, %Lu bytes, %Lu refills; sync: %Lu requests, "
+    "%Lu bytes\n",
+    __FUNCTION__,
+    Dev->Stats.PoolRequests,
+    Dev->Stats.PoolBytes,
+    Dev->Stats.Refills,
+    Dev->Stats.SyncRequests,
+    Dev->Stats.SyncBytes
+    ));
+
+  VirtioRngUninitPool (Dev);
+
   Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->RingMap);
 
   VirtioRingUninit (Dev->VirtIo, &Dev->Ring);
@@ -445,6 +914,11 @@ VirtioRngExitBoot (
   //
   Dev = Context;
   Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, 0);
+
+  //
+  // Don't leave entropy that was never handed out behind for the OS.
+  //
+  ZeroMem ((VOID *)Dev->Pool, EFI_PAGES_TO_SIZE (Dev->PoolNrPages));
 }
 
 //
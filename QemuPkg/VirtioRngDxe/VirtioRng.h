@@ -19,6 +19,42 @@
 
 #define VIRTIO_RNG_SIG  SIGNATURE_32 ('V', 'R', 'N', 'G')
 
+//
+// The entropy pool consists of up to VIRTIO_RNG_POOL_SLOTS buffers of
+// VIRTIO_RNG_SLOT_SIZE bytes each. The host fills the buffers in the
+// background; every byte is handed out to one caller only, after which the
+// buffer is zeroed and resubmitted.
+//
+#define VIRTIO_RNG_POOL_SLOTS  16
+#define VIRTIO_RNG_SLOT_SIZE   256
+
+//
+// Period of the used ring poll that collects refilled pool buffers, in 100ns
+// units.
+//
+#define VIRTIO_RNG_POOL_POLL_PERIOD  EFI_TIMER_PERIOD_MILLISECONDS (1)
+
+//
+// State of an entropy pool buffer. While InFlight is FALSE, the bytes in
+// [Consumed, Filled) of the buffer have not been handed out yet.
+//
+typedef struct {
+  UINT32     Filled;
+  UINT32     Consumed;
+  BOOLEAN    InFlight;
+} VIRTIO_RNG_SLOT;
+
+//
+// Usage counters, reported with DEBUG_INFO when the device is torn down.
+//
+typedef struct {
+  UINT64    PoolRequests;
+  UINT64    PoolBytes;
+  UINT64    SyncRequests;
+  UINT64    SyncBytes;
+  UINT64    Refills;
+} VIRTIO_RNG_STATS;
+
 typedef struct {
   //
   // Parts of this structure are initialized / torn down in various functions
@@ -33,6 +69,20 @@ typedef struct {
   VRING                     Ring;           // VirtioRingInit       2
   EFI_RNG_PROTOCOL          Rng;            // VirtioRngInit        1
   VOID                      *RingMap;       // VirtioRingMap        2
+  UINT16                    LastUsed;       // VirtioRngInit        1
+  UINT16                    NumSlots;       // VirtioRngInitPool    2
+  VIRTIO_RNG_SLOT           Slots[VIRTIO_RNG_POOL_SLOTS];
+                                            // VirtioRngInitPool    2
+  UINT16                    SlotsInFlight;  // VirtioRngInitPool    2
+  volatile UINT8            *Pool;          // VirtioRngInitPool    2
+  UINTN                     PoolNrPages;    // VirtioRngInitPool    2
+  VOID                      *PoolMap;       // VirtioRngInitPool    2
+  EFI_PHYSICAL_ADDRESS      PoolBase;       // VirtioRngInitPool    2
+  EFI_EVENT                 RefillTimer;    // VirtioRngInitPool    2
+  BOOLEAN                   SyncInFlight;   // VirtioRngInit        1
+  BOOLEAN                   SyncDone;       // VirtioRngInit        1
+  UINT32                    SyncLen;        // VirtioRngInit        1
+  VIRTIO_RNG_STATS          Stats;          // VirtioRngInit        1
 } VIRTIO_RNG_DEV;
 
 #define VIRTIO_ENTROPY_SOURCE_FROM_RNG(RngPointer) \
@@ -7,17 +7,16 @@
 
   - No hotplug / hot-unplug.
 
-  - Although EFI_EXT_SCSI_PASS_THRU_PROTOCOL.PassThru() could be a good match
-    for multiple in-flight virtio-scsi requests, we stick to synchronous
-    requests for now.
+  - EFI_EXT_SCSI_PASS_THRU_PROTOCOL.PassThru() supports non-blocking
+    requests. Requests are spread over up to PcdVirtioScsiMaxRequestQueues
+    request queues, with up to VSCSI_MAX_PENDING requests in flight on each;
+    a periodic timer completes the non-blocking ones.
 
   - Timeouts are not supported for EFI_EXT_SCSI_PASS_THRU_PROTOCOL.PassThru().
 
   - Only one channel is supported. (At the time of this writing, host-side
     virtio-scsi supports a single channel too.)
 
-  - Only one request queue is used (for the one synchronous request).
-
   - The ResetChannel() and ResetTargetLun() functions of
     EFI_EXT_SCSI_PASS_THRU_PROTOCOL are not supported (which is allowed by the
     UEFI 2.3.1 Errata C specification), although
@@ -152,7 +151,8 @@ PopulateRequest (
   OUT    volatile VIRTIO_SCSI_REQ                             *Request
   )
 {
-  UINTN  Idx;
+  UINTN   Idx;
+  UINT32  MaxSectors;
 
   if (
       //
@@ -224,17 +224,24 @@ PopulateRequest (
   }
 
   //
-  // Catch oversized requests eagerly. If this condition evaluates to false,
-  // then the combined size of a bidirectional request will not exceed the
-  // virtio-scsi device's transfer limit either.
+  // Catch oversized requests eagerly. A unidirectional request may use the
+  // virtio-scsi device's entire transfer limit. The limit is halved for the
+  // two directions of a bidirectional request; if this condition evaluates to
+  // false, then their combined size will not exceed the device's limit
+  // either.
   //
-  if ((ALIGN_VALUE (Packet->OutTransferLength, 512) / 512
-       > Dev->MaxSectors / 2) ||
-      (ALIGN_VALUE (Packet->InTransferLength, 512) / 512
-       > Dev->MaxSectors / 2))
+  MaxSectors = Dev->MaxSectors;
+  if ((Packet->InTransferLength > 0) && (Packet->OutTransferLength > 0)) {
+    MaxSectors /= 2;
+  }
+
+  MaxSectors = MIN (MaxSectors, SIZE_1GB / 512);
+
+  if ((ALIGN_VALUE (Packet->OutTransferLength, 512) / 512 > MaxSectors) ||
+      (ALIGN_VALUE (Packet->InTransferLength, 512) / 512 > MaxSectors))
   {
-    Packet->InTransferLength  = (Dev->MaxSectors / 2) * 512;
-    Packet->OutTransferLength = (Dev->MaxSectors / 2) * 512;
+    Packet->InTransferLength  = MaxSectors * 512;
+    Packet->OutTransferLength = MaxSectors * 512;
     Packet->HostAdapterStatus =
       EFI_EXT_SCSI_STATUS_HOST_ADAPTER_DATA_OVERRUN_UNDERRUN;
     Packet->TargetStatus    = EFI_EXT_SCSI_STATUS_TARGET_GOOD;
@@ -410,79 +417,284 @@ ReportHostAdapterError (
   return EFI_DEVICE_ERROR;
 }
 
-//
-// The next seven functions implement EFI_EXT_SCSI_PASS_THRU_PROTOCOL
-// for the virtio-scsi HBA. Refer to UEFI Spec 2.3.1 + Errata C, sections
-// - 14.1 SCSI Driver Model Overview,
-// - 14.7 Extended SCSI Pass Thru Protocol.
-//
+/**
 
-EFI_STATUS
+  Return a request slot, whose request is not in flight, to the free stack of
+  its request queue.
+
+  @param[in,out] Queue   The request queue that owns the slot.
+
+  @param[in]     ReqIdx  The index of the slot in Queue->Reqs.
+
+**/
+STATIC
+VOID
+VirtioScsiReleaseRequest (
+  IN OUT VSCSI_QUEUE  *Queue,
+  IN     UINT16       ReqIdx
+  )
+{
+  ASSERT (Queue->CurPending > 0);
+  ASSERT (!Queue->Reqs[ReqIdx].InFlight);
+
+  Queue->FreeStack[--Queue->CurPending] = ReqIdx;
+}
+
+/**
+
+  Finish a request that the host has processed, or that has been aborted
+  after a device reset: update the Extended SCSI Pass Thru Protocol packet,
+  release the data buffers of the request and its slot, and report the result
+  to the caller.
+
+  Blocking callers collect the result in their VSCSI_WAIT structure.
+  Non-blocking callers have their event signaled.
+
+  Must be called at TPL_NOTIFY.
+
+  @param[in,out] Dev           The virtio-scsi host device the request was
+                               submitted to.
+
+  @param[in,out] Queue         The request queue the request was submitted to.
+
+  @param[in]     ReqIdx        The index of the request in Queue->Reqs.
+
+  @param[in]     HostComplete  TRUE if the host produced a used element for
+                               the request, FALSE if the request is being
+                               aborted.
+
+**/
+STATIC
+VOID
+VirtioScsiCompleteRequest (
+  IN OUT VSCSI_DEV    *Dev,
+  IN OUT VSCSI_QUEUE  *Queue,
+  IN     UINT16       ReqIdx,
+  IN     BOOLEAN      HostComplete
+  )
+{
+  VSCSI_REQ                                   *Req;
+  EFI_EXT_SCSI_PASS_THRU_SCSI_REQUEST_PACKET  *Packet;
+  EFI_EVENT                                   Event;
+  VSCSI_WAIT                                  *Wait;
+  EFI_STATUS                                  Status;
+
+  Req = &Queue->Reqs[ReqIdx];
+  ASSERT (Req->InFlight);
+
+  Packet = Req->Packet;
+  Status = EFI_DEVICE_ERROR;
+  if (Packet != NULL) {
+    if (HostComplete) {
+      Status = ParseResponse (Packet, &Queue->SharedReqs[ReqIdx].Response);
+
+      //
+      // If the request had a data-in phase, then we have used an intermediate
+      // buffer. Copy the data from the intermediate buffer to the final
+      // buffer.
+      //
+      if (Req->InDataBuffer != NULL) {
+        CopyMem (Packet->InDataBuffer, Req->InDataBuffer, Packet->InTransferLength);
+      }
+    } else {
+      Status = ReportHostAdapterError (Packet);
+    }
+  }
+
+  if (Req->OutDataIsMapped) {
+    Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Req->OutDataMapping);
+  }
+
+  if (Req->InDataBuffer != NULL) {
+    Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Req->InDataMapping);
+    Dev->VirtIo->FreeSharedPages (
+                   Dev->VirtIo,
+                   Req->InDataNumPages,
+                   Req->InDataBuffer
+                   );
+  }
+
+  Req->InFlight = FALSE;
+
+  if (Req->Async) {
+    ASSERT (Dev->AsyncPending > 0);
+    if (--Dev->AsyncPending == 0) {
+      gBS->SetTimer (Dev->PollTimer, TimerCancel, 0);
+    }
+  }
+
+  Event = Req->Event;
+  Wait  = Req->Wait;
+  VirtioScsiReleaseRequest (Queue, ReqIdx);
+
+  if (Wait != NULL) {
+    Wait->Status = Status;
+    Wait->Done   = TRUE;
+  } else if (Event != NULL) {
+    gBS->SignalEvent (Event);
+  }
+}
+
+/**
+
+  Complete all requests that the host has processed on a request queue since
+  the last call.
+
+  Must be called at TPL_NOTIFY.
+
+  @param[in,out] Dev    The virtio-scsi host device that owns Queue.
+
+  @param[in,out] Queue  The request queue whose used ring should be checked.
+
+**/
+STATIC
+VOID
+VirtioScsiProcessUsed (
+  IN OUT VSCSI_DEV    *Dev,
+  IN OUT VSCSI_QUEUE  *Queue
+  )
+{
+  UINT16  HeadDescIdx;
+  UINT16  ReqIdx;
+
+  while (!EFI_ERROR (
+            VirtioGetNextUsed (
+              &Queue->Ring,
+              &Queue->LastUsed,
+              &HeadDescIdx,
+              NULL
+              )
+            ))
+  {
+    //
+    // The head index comes from the host. Only complete a request that we
+    // actually have in flight on this queue; anything else would parse a
+    // stale response, or signal a caller's event twice.
+    //
+    ReqIdx = HeadDescIdx / Queue->DescPerReq;
+    if ((HeadDescIdx % Queue->DescPerReq != 0) ||
+        (ReqIdx >= Queue->MaxPending) ||
+        !Queue->Reqs[ReqIdx].InFlight)
+    {
+      DEBUG ((
+        DEBUG_ERROR,
+        "%a: ignoring used element with bad head index %u\n",
+        __FUNCTION__,
+        HeadDescIdx
+        ));
+      continue;
+    }
+
+    VirtioScsiCompleteRequest (
+      Dev,
+      Queue,
+      ReqIdx,
+      TRUE                              // HostComplete
+      );
+  }
+}
+
+/**
+
+  Timer notification function that completes non-blocking requests.
+
+  @param[in] Event    Event whose notification function is being invoked.
+
+  @param[in] Context  Pointer to the VSCSI_DEV structure.
+
+**/
+STATIC
+VOID
 EFIAPI
-VirtioScsiPassThru (
-  IN     EFI_EXT_SCSI_PASS_THRU_PROTOCOL             *This,
-  IN     UINT8                                       *Target,
-  IN     UINT64                                      Lun,
+VirtioScsiPollTimer (
+  IN  EFI_EVENT  Event,
+  IN  VOID       *Context
+  )
+{
+  VSCSI_DEV  *Dev;
+  UINT16     QueueIdx;
+
+  //
+  // This callback is running at TPL_NOTIFY already.
+  //
+  Dev = Context;
+  for (QueueIdx = 0; QueueIdx < Dev->NumQueues; ++QueueIdx) {
+    VirtioScsiProcessUsed (Dev, &Dev->Queues[QueueIdx]);
+  }
+}
+
+/**
+
+  Map the data buffers of a request, format the request as consecutive virtio
+  descriptors in a reserved request slot, and push them to the host without
+  waiting for the response.
+
+  Must be called at TPL_NOTIFY.
+
+  @param[in,out] Dev      The virtio-scsi host device the request targets.
+
+  @param[in,out] Queue    The request queue to submit the request to.
+
+  @param[in]     ReqIdx   The request slot, taken from Queue->FreeStack by the
+                          caller.
+
+  @param[in]     Request  The virtio-scsi request header, populated with
+                          PopulateRequest().
+
+  @param[in]     Packet   The Extended SCSI Pass Thru Protocol packet that the
+                          request was populated from.
+
+  @param[in]     Event    The caller's event, for a non-blocking request.
+                          NULL for a blocking request.
+
+  @param[out]    Wait     The caller's VSCSI_WAIT structure, for a blocking
+                          request. NULL for a non-blocking request.
+
+  @retval EFI_SUCCESS  The request has been submitted to the host.
+
+  @return              Error codes from VirtIo->AllocateSharedPages(),
+                       VirtioMapAllBytesInSharedBuffer() or
+                       VirtIo->SetQueueNotify(). In the first two cases, the
+                       slot is not in flight, and the caller has to release
+                       it. In the last case, the request has been abandoned,
+                       and the slot is released once the host processes it.
+
+**/
+STATIC
+EFI_STATUS
+VirtioScsiSubmitRequest (
+  IN OUT VSCSI_DEV                                   *Dev,
+  IN OUT VSCSI_QUEUE                                 *Queue,
+  IN     UINT16                                      ReqIdx,
+  IN     CONST VIRTIO_SCSI_REQ                       *Request,
   IN OUT EFI_EXT_SCSI_PASS_THRU_SCSI_REQUEST_PACKET  *Packet,
-  IN     EFI_EVENT                                   Event   OPTIONAL
+  IN     EFI_EVENT                                   Event    OPTIONAL,
+  OUT    VSCSI_WAIT                                  *Wait    OPTIONAL
   )
 {
-  VSCSI_DEV                  *Dev;
-  UINT16                     TargetValue;
-  EFI_STATUS                 Status;
-  volatile VIRTIO_SCSI_REQ   Request;
-  volatile VIRTIO_SCSI_RESP  *Response;
-  VOID                       *ResponseBuffer;
+  VSCSI_REQ                  *Req;
+  volatile VSCSI_SHARED_REQ  *Shared;
   DESC_INDICES               Indices;
-  VOID                       *RequestMapping;
-  VOID                       *ResponseMapping;
-  VOID                       *InDataMapping;
-  VOID                       *OutDataMapping;
   EFI_PHYSICAL_ADDRESS       RequestDeviceAddress;
   EFI_PHYSICAL_ADDRESS       ResponseDeviceAddress;
   EFI_PHYSICAL_ADDRESS       InDataDeviceAddress;
   EFI_PHYSICAL_ADDRESS       OutDataDeviceAddress;
-  VOID                       *InDataBuffer;
-  UINTN                      InDataNumPages;
-  BOOLEAN                    OutDataBufferIsMapped;
+  EFI_STATUS                 Status;
 
   //
-  // Set InDataMapping,OutDataMapping,InDataDeviceAddress and OutDataDeviceAddress to
-  // suppress incorrect compiler/analyzer warnings.
+  // Set InDataDeviceAddress and OutDataDeviceAddress to suppress incorrect
+  // compiler/analyzer warnings.
   //
-  InDataMapping        = NULL;
-  OutDataMapping       = NULL;
   InDataDeviceAddress  = 0;
   OutDataDeviceAddress = 0;
 
-  ZeroMem ((VOID *)&Request, sizeof (Request));
-
-  Dev = VIRTIO_SCSI_FROM_PASS_THRU (This);
-  CopyMem (&TargetValue, Target, sizeof TargetValue);
-
-  InDataBuffer          = NULL;
-  OutDataBufferIsMapped = FALSE;
-  InDataNumPages        = 0;
-
-  Status = PopulateRequest (Dev, TargetValue, Lun, Packet, &Request);
-  if (EFI_ERROR (Status)) {
-    return Status;
-  }
+  Req    = &Queue->Reqs[ReqIdx];
+  Shared = &Queue->SharedReqs[ReqIdx];
+  ASSERT (!Req->InFlight);
 
-  //
-  // Map the virtio-scsi Request header buffer
-  //
-  Status = VirtioMapAllBytesInSharedBuffer (
-             Dev->VirtIo,
-             VirtioOperationBusMasterRead,
-             (VOID *)&Request,
-             sizeof Request,
-             &RequestDeviceAddress,
-             &RequestMapping
-             );
-  if (EFI_ERROR (Status)) {
-    return ReportHostAdapterError (Packet);
-  }
+  Req->InDataBuffer    = NULL;
+  Req->InDataNumPages  = 0;
+  Req->OutDataIsMapped = FALSE;
 
   //
   // Map the input buffer
@@ -503,29 +715,28 @@ VirtioScsiPassThru (
     // the Virtio request is successful then we copy the data from temporary
     // buffer into Packet->InDataBuffer.
     //
-    InDataNumPages = EFI_SIZE_TO_PAGES ((UINTN)Packet->InTransferLength);
-    Status         = Dev->VirtIo->AllocateSharedPages (
-                                    Dev->VirtIo,
-                                    InDataNumPages,
-                                    &InDataBuffer
-                                    );
+    Req->InDataNumPages = EFI_SIZE_TO_PAGES ((UINTN)Packet->InTransferLength);
+    Status              = Dev->VirtIo->AllocateSharedPages (
+                                         Dev->VirtIo,
+                                         Req->InDataNumPages,
+                                         &Req->InDataBuffer
+                                         );
     if (EFI_ERROR (Status)) {
-      Status = ReportHostAdapterError (Packet);
-      goto UnmapRequestBuffer;
+      Req->InDataBuffer = NULL;
+      return Status;
     }
 
-    ZeroMem (InDataBuffer, Packet->InTransferLength);
+    ZeroMem (Req->InDataBuffer, Packet->InTransferLength);
 
     Status = VirtioMapAllBytesInSharedBuffer (
                Dev->VirtIo,
                VirtioOperationBusMasterCommonBuffer,
-               InDataBuffer,
+               Req->InDataBuffer,
                Packet->InTransferLength,
                &InDataDeviceAddress,
-               &InDataMapping
+               &Req->InDataMapping
                );
     if (EFI_ERROR (Status)) {
-      Status = ReportHostAdapterError (Packet);
       goto FreeInDataBuffer;
     }
   }
@@ -540,72 +751,58 @@ VirtioScsiPassThru (
                Packet->OutDataBuffer,
                Packet->OutTransferLength,
                &OutDataDeviceAddress,
-               &OutDataMapping
+               &Req->OutDataMapping
                );
     if (EFI_ERROR (Status)) {
-      Status = ReportHostAdapterError (Packet);
       goto UnmapInDataBuffer;
     }
 
-    OutDataBufferIsMapped = TRUE;
+    Req->OutDataIsMapped = TRUE;
   }
 
   //
-  // Response header is bi-direction (we preset with host status and expect
-  // the device to update it). Allocate a response buffer which can be mapped
-  // to access equally by both processor and device.
+  // The request header and the response live in the request slot's shared
+  // area, which is mapped as a common buffer for the lifetime of the queue.
   //
-  Status = Dev->VirtIo->AllocateSharedPages (
-                          Dev->VirtIo,
-                          EFI_SIZE_TO_PAGES (sizeof *Response),
-                          &ResponseBuffer
-                          );
-  if (EFI_ERROR (Status)) {
-    Status = ReportHostAdapterError (Packet);
-    goto UnmapOutDataBuffer;
-  }
-
-  Response = ResponseBuffer;
-
-  ZeroMem ((VOID *)Response, sizeof (*Response));
+  CopyMem ((VOID *)&Shared->Request, Request, sizeof *Request);
+  ZeroMem ((VOID *)&Shared->Response, sizeof Shared->Response);
 
   //
   // preset a host status for ourselves that we do not accept as success
   //
-  Response->Response = VIRTIO_SCSI_S_FAILURE;
+  Shared->Response.Response = VIRTIO_SCSI_S_FAILURE;
 
-  //
-  // Map the response buffer with BusMasterCommonBuffer so that response
-  // buffer can be accessed by both host and device.
-  //
-  Status = VirtioMapAllBytesInSharedBuffer (
-             Dev->VirtIo,
-             VirtioOperationBusMasterCommonBuffer,
-             ResponseBuffer,
-             sizeof (*Response),
-             &ResponseDeviceAddress,
-             &ResponseMapping
-             );
-  if (EFI_ERROR (Status)) {
-    Status = ReportHostAdapterError (Packet);
-    goto FreeResponseBuffer;
-  }
+  RequestDeviceAddress = Queue->SharedReqsBase +
+                         ReqIdx * sizeof *Shared +
+                         OFFSET_OF (VSCSI_SHARED_REQ, Request);
+  ResponseDeviceAddress = Queue->SharedReqsBase +
+                          ReqIdx * sizeof *Shared +
+                          OFFSET_OF (VSCSI_SHARED_REQ, Response);
 
-  VirtioPrepare (&Dev->Ring, &Indices);
+  Req->Packet = Packet;
+  Req->Event  = Event;
+  Req->Wait   = Wait;
+  Req->Async  = (BOOLEAN)(Event != NULL);
 
   //
-  // ensured by VirtioScsiInit() -- this predicate, in combination with the
-  // lock-step progress, ensures we don't have to track free descriptors.
+  // Every request slot owns Queue->DescPerReq consecutive descriptors, starting
+  // at a fixed head index, which the host reports back in the used element.
+  // With indirect descriptors, the slot owns a single descriptor of the ring,
+  // and VirtioLib builds the chain in the indirect table of the slot.
   //
-  ASSERT (Dev->Ring.QueueSize >= 4);
+  VirtioPrepareChain (
+    &Queue->Ring,
+    (UINT16)(ReqIdx * Queue->DescPerReq),
+    &Indices
+    );
 
   //
   // enqueue Request
   //
   VirtioAppendDesc (
-    &Dev->Ring,
+    &Queue->Ring,
     RequestDeviceAddress,
-    sizeof Request,
+    sizeof Shared->Request,
     VRING_DESC_F_NEXT,
     &Indices
     );
@@ -615,7 +812,7 @@ VirtioScsiPassThru (
   //
   if (Packet->OutTransferLength > 0) {
     VirtioAppendDesc (
-      &Dev->Ring,
+      &Queue->Ring,
       OutDataDeviceAddress,
       Packet->OutTransferLength,
       VRING_DESC_F_NEXT,
@@ -627,9 +824,9 @@ VirtioScsiPassThru (
   // enqueue Response, to be written by the host
   //
   VirtioAppendDesc (
-    &Dev->Ring,
+    &Queue->Ring,
     ResponseDeviceAddress,
-    sizeof *Response,
+    sizeof Shared->Response,
     VRING_DESC_F_WRITE | (Packet->InTransferLength > 0 ? VRING_DESC_F_NEXT : 0),
     &Indices
     );
@@ -639,7 +836,7 @@ VirtioScsiPassThru (
   //
   if (Packet->InTransferLength > 0) {
     VirtioAppendDesc (
-      &Dev->Ring,
+      &Queue->Ring,
       InDataDeviceAddress,
       Packet->InTransferLength,
       VRING_DESC_F_WRITE,
@@ -647,62 +844,193 @@ VirtioScsiPassThru (
       );
   }
 
-  // If kicking the host fails, we must fake a host adapter error.
-  // EFI_NOT_READY would save us the effort, but it would also suggest that the
-  // caller retry.
+  VirtioSubmitChain (&Queue->Ring, &Indices);
+  Req->InFlight = TRUE;
+
+  if (Req->Async) {
+    if (Dev->AsyncPending++ == 0) {
+      gBS->SetTimer (Dev->PollTimer, TimerPeriodic, VSCSI_ASYNC_POLL_PERIOD);
+    }
+  }
+
   //
-  if (VirtioFlush (
-        Dev->VirtIo,
-        VIRTIO_SCSI_REQUEST_QUEUE,
-        &Dev->Ring,
-        &Indices,
-        NULL
-        ) != EFI_SUCCESS)
-  {
-    Status = ReportHostAdapterError (Packet);
-    goto UnmapResponseBuffer;
+  // While the host is still working through earlier requests on this queue,
+  // it suppresses the notification, and picks up this request without a VM
+  // exit.
+  //
+  if (VirtioNeedNotify (&Queue->Ring)) {
+    Status = Dev->VirtIo->SetQueueNotify (Dev->VirtIo, Queue->QueueIndex);
+    if (EFI_ERROR (Status)) {
+      //
+      // The descriptor chain is visible to the host already, so the slot can
+      // only be recycled once the host has processed it. Let the poll timer
+      // reap it without reporting anything; the caller reports the failure.
+      //
+      Req->Packet = NULL;
+      Req->Event  = NULL;
+      Req->Wait   = NULL;
+      if (!Req->Async) {
+        Req->Async = TRUE;
+        if (Dev->AsyncPending++ == 0) {
+          gBS->SetTimer (Dev->PollTimer, TimerPeriodic, VSCSI_ASYNC_POLL_PERIOD);
+        }
+      }
+
+      return Status;
+    }
   }
 
-  Status = ParseResponse (Packet, Response);
+  return EFI_SUCCESS;
+
+UnmapInDataBuffer:
+  if (Req->InDataBuffer != NULL) {
+    Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Req->InDataMapping);
+  }
+
+FreeInDataBuffer:
+  if (Req->InDataBuffer != NULL) {
+    Dev->VirtIo->FreeSharedPages (
+                   Dev->VirtIo,
+                   Req->InDataNumPages,
+                   Req->InDataBuffer
+                   );
+    Req->InDataBuffer = NULL;
+  }
+
+  return Status;
+}
+
+//
+// The next seven functions implement EFI_EXT_SCSI_PASS_THRU_PROTOCOL
+// for the virtio-scsi HBA. Refer to UEFI Spec 2.3.1 + Errata C, sections
+// - 14.1 SCSI Driver Model Overview,
+// - 14.7 Extended SCSI Pass Thru Protocol.
+//
+
+EFI_STATUS
+EFIAPI
+VirtioScsiPassThru (
+  IN     EFI_EXT_SCSI_PASS_THRU_PROTOCOL             *This,
+  IN     UINT8                                       *Target,
+  IN     UINT64                                      Lun,
+  IN OUT EFI_EXT_SCSI_PASS_THRU_SCSI_REQUEST_PACKET  *Packet,
+  IN     EFI_EVENT                                   Event   OPTIONAL
+  )
+{
+  VSCSI_DEV        *Dev;
+  UINT16           TargetValue;
+  EFI_STATUS       Status;
+  VIRTIO_SCSI_REQ  Request;
+  EFI_TPL          OldTpl;
+  VSCSI_QUEUE      *Queue;
+  UINT16           QueueIdx;
+  UINT16           ReqIdx;
+  UINT16           LastUsed;
+  VSCSI_WAIT       Wait;
+  BOOLEAN          Done;
+
+  ZeroMem (&Request, sizeof (Request));
+
+  Dev = VIRTIO_SCSI_FROM_PASS_THRU (This);
+  CopyMem (&TargetValue, Target, sizeof TargetValue);
+
+  Status = PopulateRequest (Dev, TargetValue, Lun, Packet, &Request);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
 
   //
-  // If virtio request was successful and it was a CPU read request then we
-  // have used an intermediate buffer. Copy the data from intermediate buffer
-  // to the final buffer.
+  // Look for a free request slot, starting with the request queue after the
+  // one used last, so that requests are spread over all request queues.
   //
-  if (InDataBuffer != NULL) {
-    CopyMem (Packet->InDataBuffer, InDataBuffer, Packet->InTransferLength);
-  }
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  for ( ; ;) {
+    for (QueueIdx = 0; QueueIdx < Dev->NumQueues; ++QueueIdx) {
+      Queue = &Dev->Queues[(Dev->NextQueue + QueueIdx) % Dev->NumQueues];
+      VirtioScsiProcessUsed (Dev, Queue);
+      if (Queue->CurPending < Queue->MaxPending) {
+        break;
+      }
+    }
 
-UnmapResponseBuffer:
-  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, ResponseMapping);
+    if (QueueIdx < Dev->NumQueues) {
+      break;
+    }
 
-FreeResponseBuffer:
-  Dev->VirtIo->FreeSharedPages (
-                 Dev->VirtIo,
-                 EFI_SIZE_TO_PAGES (sizeof *Response),
-                 ResponseBuffer
-                 );
+    //
+    // All request slots are in use. A non-blocking caller may retry later; a
+    // blocking caller waits for the next request queue in line.
+    //
+    if (Event != NULL) {
+      gBS->RestoreTPL (OldTpl);
+      return EFI_NOT_READY;
+    }
 
-UnmapOutDataBuffer:
-  if (OutDataBufferIsMapped) {
-    Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, OutDataMapping);
+    Queue    = &Dev->Queues[Dev->NextQueue];
+    LastUsed = Queue->LastUsed;
+    gBS->RestoreTPL (OldTpl);
+    VirtioWaitUsed (&Queue->Ring, &Queue->LastUsed, LastUsed);
+    gBS->RaiseTPL (TPL_NOTIFY);
   }
 
-UnmapInDataBuffer:
-  if (InDataBuffer != NULL) {
-    Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, InDataMapping);
+  Dev->NextQueue = (UINT16)((Queue - Dev->Queues + 1) % Dev->NumQueues);
+  ReqIdx         = Queue->FreeStack[Queue->CurPending++];
+
+  Wait.Done   = FALSE;
+  Wait.Status = EFI_DEVICE_ERROR;
+
+  Status = VirtioScsiSubmitRequest (
+             Dev,
+             Queue,
+             ReqIdx,
+             &Request,
+             Packet,
+             Event,
+             (Event == NULL) ? &Wait : NULL
+             );
+  if (EFI_ERROR (Status)) {
+    if (!Queue->Reqs[ReqIdx].InFlight) {
+      VirtioScsiReleaseRequest (Queue, ReqIdx);
+    }
+
+    gBS->RestoreTPL (OldTpl);
+
+    //
+    // If mapping or kicking the host fails, we must fake a host adapter
+    // error. EFI_NOT_READY would save us the effort, but it would also
+    // suggest that the caller retry.
+    //
+    return ReportHostAdapterError (Packet);
   }
 
-FreeInDataBuffer:
-  if (InDataBuffer != NULL) {
-    Dev->VirtIo->FreeSharedPages (Dev->VirtIo, InDataNumPages, InDataBuffer);
+  gBS->RestoreTPL (OldTpl);
+
+  //
+  // A non-blocking request is completed by VirtioScsiPollTimer(), which
+  // signals Event.
+  //
+  if (Event != NULL) {
+    return EFI_SUCCESS;
   }
 
-UnmapRequestBuffer:
-  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, RequestMapping);
+  //
+  // Poll the used ring until the host processes the request. Non-blocking
+  // requests that the host completes on the same queue in the meantime are
+  // finished as well.
+  //
+  for ( ; ;) {
+    OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+    VirtioScsiProcessUsed (Dev, Queue);
+    Done     = Wait.Done;
+    LastUsed = Queue->LastUsed;
+    gBS->RestoreTPL (OldTpl);
 
-  return Status;
+    if (Done) {
+      return Wait.Status;
+    }
+
+    VirtioWaitUsed (&Queue->Ring, &Queue->LastUsed, LastUsed);
+  }
 }
 
 EFI_STATUS
@@ -918,6 +1246,244 @@ VirtioScsiGetNextTarget (
   return EFI_NOT_FOUND;
 }
 
+/**
+
+  Set up a request virtqueue of the virtio-scsi device, and the request slots
+  that track the requests in flight on it.
+
+  Must be called while the device is being initialized, after feature
+  negotiation.
+
+  @param[in,out] Dev         The virtio-scsi device being initialized.
+
+  @param[out]    Queue       The request queue to set up.
+
+  @param[in]     QueueIndex  The virtqueue index of the request queue.
+
+  @param[in]     Features    The features negotiated with the host.
+
+  @retval EFI_SUCCESS           Setup complete.
+
+  @retval EFI_UNSUPPORTED       The virtqueue is too small for a request.
+
+  @retval EFI_OUT_OF_RESOURCES  Memory allocation failed.
+
+  @return                       Error codes from the VirtIo protocol and from
+                                VirtioLib.
+
+**/
+STATIC
+EFI_STATUS
+VirtioScsiInitQueue (
+  IN OUT VSCSI_DEV    *Dev,
+  OUT    VSCSI_QUEUE  *Queue,
+  IN     UINT16       QueueIndex,
+  IN     UINT64       Features
+  )
+{
+  EFI_STATUS  Status;
+  UINT64      RingBaseShift;
+  UINT16      QueueSize;
+  UINT16      ReqIdx;
+  VOID        *SharedReqsBuffer;
+
+  ZeroMem (Queue, sizeof *Queue);
+  Queue->QueueIndex = QueueIndex;
+
+  Status = Dev->VirtIo->SetQueueSel (Dev->VirtIo, QueueIndex);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = Dev->VirtIo->GetQueueNumMax (Dev->VirtIo, &QueueSize);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // VirtioScsiSubmitRequest() uses at most four descriptors per request, or
+  // one indirect descriptor
+  //
+  Queue->DescPerReq = ((Features & VIRTIO_F_RING_INDIRECT_DESC) != 0) ?
+                      1 :
+                      VSCSI_DESC_PER_REQ;
+  if (QueueSize < Queue->DescPerReq) {
+    return EFI_UNSUPPORTED;
+  }
+
+  Queue->MaxPending = (UINT16)MIN (
+                                QueueSize / Queue->DescPerReq,
+                                VSCSI_MAX_PENDING
+                                );
+
+  Status = VirtioRingInitEx (Dev->VirtIo, QueueSize, Features, &Queue->Ring);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // One indirect table with four entries per request slot. The tables are
+  // released by VirtioRingUninit().
+  //
+  if (Queue->DescPerReq == 1) {
+    Status = VirtioRingInitIndirect (
+               Dev->VirtIo,
+               &Queue->Ring,
+               Queue->MaxPending,
+               VSCSI_DESC_PER_REQ
+               );
+    if (EFI_ERROR (Status)) {
+      goto ReleaseQueue;
+    }
+  }
+
+  //
+  // If anything fails from here on, we must release the ring resources
+  //
+  Status = VirtioRingMap (
+             Dev->VirtIo,
+             &Queue->Ring,
+             &RingBaseShift,
+             &Queue->RingMap
+             );
+  if (EFI_ERROR (Status)) {
+    goto ReleaseQueue;
+  }
+
+  //
+  // Additional steps for MMIO: align the queue appropriately, and set the
+  // size. If anything fails from here on, we must unmap the ring resources.
+  //
+  Status = Dev->VirtIo->SetQueueNum (Dev->VirtIo, QueueSize);
+  if (EFI_ERROR (Status)) {
+    goto UnmapQueue;
+  }
+
+  Status = Dev->VirtIo->SetQueueAlign (Dev->VirtIo, EFI_PAGE_SIZE);
+  if (EFI_ERROR (Status)) {
+    goto UnmapQueue;
+  }
+
+  //
+  // Report GPFN (guest-physical frame number) of queue.
+  //
+  Status = Dev->VirtIo->SetQueueAddress (
+                          Dev->VirtIo,
+                          &Queue->Ring,
+                          RingBaseShift
+                          );
+  if (EFI_ERROR (Status)) {
+    goto UnmapQueue;
+  }
+
+  Queue->FreeStack = AllocatePool (Queue->MaxPending * sizeof *Queue->FreeStack);
+  if (Queue->FreeStack == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto UnmapQueue;
+  }
+
+  Queue->Reqs = AllocateZeroPool (Queue->MaxPending * sizeof *Queue->Reqs);
+  if (Queue->Reqs == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto FreeFreeStack;
+  }
+
+  for (ReqIdx = 0; ReqIdx < Queue->MaxPending; ++ReqIdx) {
+    Queue->FreeStack[ReqIdx] = ReqIdx;
+  }
+
+  //
+  // Allocate the request headers and responses of all slots, and map them
+  // with BusMasterCommonBuffer so that they can be accessed equally by both
+  // processor and device, without per-request mapping.
+  //
+  Queue->SharedReqsNrPages = EFI_SIZE_TO_PAGES (
+                               Queue->MaxPending * sizeof *Queue->SharedReqs
+                               );
+  Status = Dev->VirtIo->AllocateSharedPages (
+                          Dev->VirtIo,
+                          Queue->SharedReqsNrPages,
+                          &SharedReqsBuffer
+                          );
+  if (EFI_ERROR (Status)) {
+    goto FreeReqs;
+  }
+
+  ZeroMem (SharedReqsBuffer, EFI_PAGES_TO_SIZE (Queue->SharedReqsNrPages));
+
+  Status = VirtioMapAllBytesInSharedBuffer (
+             Dev->VirtIo,
+             VirtioOperationBusMasterCommonBuffer,
+             SharedReqsBuffer,
+             EFI_PAGES_TO_SIZE (Queue->SharedReqsNrPages),
+             &Queue->SharedReqsBase,
+             &Queue->SharedReqsMap
+             );
+  if (EFI_ERROR (Status)) {
+    goto FreeSharedReqs;
+  }
+
+  Queue->SharedReqs = SharedReqsBuffer;
+  return EFI_SUCCESS;
+
+FreeSharedReqs:
+  Dev->VirtIo->FreeSharedPages (
+                 Dev->VirtIo,
+                 Queue->SharedReqsNrPages,
+                 SharedReqsBuffer
+                 );
+
+FreeReqs:
+  FreePool (Queue->Reqs);
+
+FreeFreeStack:
+  FreePool (Queue->FreeStack);
+
+UnmapQueue:
+  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Queue->RingMap);
+
+ReleaseQueue:
+  VirtioRingUninit (Dev->VirtIo, &Queue->Ring);
+
+  return Status;
+}
+
+/**
+
+  Release the resources of a request queue set up with VirtioScsiInitQueue().
+
+  The device must have been reset, and no request may be in flight on the
+  queue.
+
+  @param[in,out] Dev    The virtio-scsi device that owns Queue.
+
+  @param[in,out] Queue  The request queue to tear down.
+
+**/
+STATIC
+VOID
+VirtioScsiUninitQueue (
+  IN OUT VSCSI_DEV    *Dev,
+  IN OUT VSCSI_QUEUE  *Queue
+  )
+{
+  ASSERT (Queue->CurPending == 0);
+
+  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Queue->SharedReqsMap);
+  Dev->VirtIo->FreeSharedPages (
+                 Dev->VirtIo,
+                 Queue->SharedReqsNrPages,
+                 (VOID *)Queue->SharedReqs
+                 );
+  FreePool (Queue->Reqs);
+  FreePool (Queue->FreeStack);
+
+  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Queue->RingMap);
+  VirtioRingUninit (Dev->VirtIo, &Queue->Ring);
+
+  ZeroMem (Queue, sizeof *Queue);
+}
+
 STATIC
 EFI_STATUS
 EFIAPI
@@ -927,11 +1493,10 @@ VirtioScsiInit (
 {
   UINT8       NextDevStat;
   EFI_STATUS  Status;
-  UINT64      RingBaseShift;
   UINT64      Features;
   UINT16      MaxChannel; // for validation only
-  UINT32      NumQueues;  // for validation only
-  UINT16      QueueSize;
+  UINT32      NumQueues;
+  UINT16      QueueIdx;
 
   //
   // Execute virtio-0.9.5, 2.2.1 Device Initialization Sequence.
@@ -1028,7 +1593,11 @@ VirtioScsiInit (
   }
 
   Features &= VIRTIO_SCSI_F_INOUT | VIRTIO_F_VERSION_1 |
-              VIRTIO_F_IOMMU_PLATFORM;
+              VIRTIO_F_IOMMU_PLATFORM | VIRTIO_F_RING_EVENT_IDX |
+              VIRTIO_F_RING_INDIRECT_DESC |
+              (FeaturePcdGet (PcdVirtioPackedRingEnable) ?
+               VIRTIO_F_RING_PACKED :
+               0);
 
   //
   // In virtio-1.0, feature negotiation is expected to complete before queue
@@ -1042,78 +1611,57 @@ VirtioScsiInit (
   }
 
   //
-  // step 4b -- allocate request virtqueue
-  //
-  Status = Dev->VirtIo->SetQueueSel (Dev->VirtIo, VIRTIO_SCSI_REQUEST_QUEUE);
-  if (EFI_ERROR (Status)) {
-    goto Failed;
-  }
-
-  Status = Dev->VirtIo->GetQueueNumMax (Dev->VirtIo, &QueueSize);
-  if (EFI_ERROR (Status)) {
-    goto Failed;
-  }
-
+  // step 4b -- allocate request virtqueues
   //
-  // VirtioScsiPassThru() uses at most four descriptors
+  // The device numbers its request queues after the control queue and the
+  // event queue. Use as many of them as the platform allows, so that requests
+  // submitted back-to-back are processed in parallel by the host.
   //
-  if (QueueSize < 4) {
-    Status = EFI_UNSUPPORTED;
-    goto Failed;
-  }
-
-  Status = VirtioRingInit (Dev->VirtIo, QueueSize, &Dev->Ring);
-  if (EFI_ERROR (Status)) {
+  Dev->NumQueues = (UINT16)MIN (
+                             NumQueues,
+                             MAX (PcdGet16 (PcdVirtioScsiMaxRequestQueues), 1)
+                             );
+  Dev->Queues = AllocateZeroPool (Dev->NumQueues * sizeof *Dev->Queues);
+  if (Dev->Queues == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
     goto Failed;
   }
 
-  //
-  // If anything fails from here on, we must release the ring resources
-  //
-  Status = VirtioRingMap (
-             Dev->VirtIo,
-             &Dev->Ring,
-             &RingBaseShift,
-             &Dev->RingMap
-             );
-  if (EFI_ERROR (Status)) {
-    goto ReleaseQueue;
-  }
-
-  //
-  // Additional steps for MMIO: align the queue appropriately, and set the
-  // size. If anything fails from here on, we must unmap the ring resources.
-  //
-  Status = Dev->VirtIo->SetQueueNum (Dev->VirtIo, QueueSize);
-  if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+  for (QueueIdx = 0; QueueIdx < Dev->NumQueues; ++QueueIdx) {
+    Status = VirtioScsiInitQueue (
+               Dev,
+               &Dev->Queues[QueueIdx],
+               (UINT16)(VIRTIO_SCSI_REQUEST_QUEUE + QueueIdx),
+               Features
+               );
+    if (EFI_ERROR (Status)) {
+      goto UninitQueues;
+    }
   }
 
-  Status = Dev->VirtIo->SetQueueAlign (Dev->VirtIo, EFI_PAGE_SIZE);
-  if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
-  }
+  Dev->NextQueue    = 0;
+  Dev->AsyncPending = 0;
 
-  //
-  // step 4c -- Report GPFN (guest-physical frame number) of queue.
-  //
-  Status = Dev->VirtIo->SetQueueAddress (
-                          Dev->VirtIo,
-                          &Dev->Ring,
-                          RingBaseShift
-                          );
+  Status = gBS->CreateEvent (
+                  EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  &VirtioScsiPollTimer,
+                  Dev,
+                  &Dev->PollTimer
+                  );
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto UninitQueues;
   }
 
   //
   // step 5 -- Report understood features and guest-tuneables.
   //
   if (Dev->VirtIo->Revision < VIRTIO_SPEC_REVISION (1, 0, 0)) {
-    Features &= ~(UINT64)(VIRTIO_F_VERSION_1 | VIRTIO_F_IOMMU_PLATFORM);
+    Features &= ~(UINT64)(VIRTIO_F_VERSION_1 | VIRTIO_F_IOMMU_PLATFORM |
+                          VIRTIO_F_RING_PACKED);
     Status    = Dev->VirtIo->SetGuestFeatures (Dev->VirtIo, Features);
     if (EFI_ERROR (Status)) {
-      goto UnmapQueue;
+      goto ClosePollTimer;
     }
   }
 
@@ -1123,12 +1671,12 @@ VirtioScsiInit (
   //
   Status = VIRTIO_CFG_WRITE (Dev, CdbSize, VIRTIO_SCSI_CDB_SIZE);
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto ClosePollTimer;
   }
 
   Status = VIRTIO_CFG_WRITE (Dev, SenseSize, VIRTIO_SCSI_SENSE_SIZE);
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto ClosePollTimer;
   }
 
   //
@@ -1137,7 +1685,7 @@ VirtioScsiInit (
   NextDevStat |= VSTAT_DRIVER_OK;
   Status       = Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, NextDevStat);
   if (EFI_ERROR (Status)) {
-    goto UnmapQueue;
+    goto ClosePollTimer;
   }
 
   //
@@ -1164,20 +1712,40 @@ VirtioScsiInit (
   // SCSI Pass Thru Protocol.
   //
   Dev->PassThruMode.Attributes = EFI_EXT_SCSI_PASS_THRU_ATTRIBUTES_PHYSICAL |
-                                 EFI_EXT_SCSI_PASS_THRU_ATTRIBUTES_LOGICAL;
+                                 EFI_EXT_SCSI_PASS_THRU_ATTRIBUTES_LOGICAL |
+                                 EFI_EXT_SCSI_PASS_THRU_ATTRIBUTES_NONBLOCKIO;
 
   //
   // no restriction on transfer buffer alignment
   //
   Dev->PassThruMode.IoAlign = 0;
 
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: NumQueues=%d MaxPending=%d DescPerReq=%d\n",
+    __FUNCTION__,
+    Dev->NumQueues,
+    Dev->Queues[0].MaxPending,
+    Dev->Queues[0].DescPerReq
+    ));
   return EFI_SUCCESS;
 
-UnmapQueue:
-  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->RingMap);
+ClosePollTimer:
+  gBS->CloseEvent (Dev->PollTimer);
 
-ReleaseQueue:
-  VirtioRingUninit (Dev->VirtIo, &Dev->Ring);
+UninitQueues:
+  //
+  // No request has been submitted yet; QueueIdx is the number of request
+  // queues that have been set up.
+  //
+  while (QueueIdx > 0) {
+    --QueueIdx;
+    VirtioScsiUninitQueue (Dev, &Dev->Queues[QueueIdx]);
+  }
+
+  FreePool (Dev->Queues);
+  Dev->Queues    = NULL;
+  Dev->NumQueues = 0;
 
 Failed:
   //
@@ -1202,6 +1770,11 @@ VirtioScsiUninit (
   IN OUT VSCSI_DEV  *Dev
   )
 {
+  EFI_TPL      OldTpl;
+  VSCSI_QUEUE  *Queue;
+  UINT16       QueueIdx;
+  UINT16       ReqIdx;
+
   //
   // Reset the virtual device -- see virtio-0.9.5, 2.2.2.1 Device Status. When
   // VIRTIO_CFG_WRITE() returns, the host will have learned to stay away from
@@ -1209,13 +1782,41 @@ VirtioScsiUninit (
   //
   Dev->VirtIo->SetDeviceStatus (Dev->VirtIo, 0);
 
+  //
+  // The host has let go of the rings. Abort the requests still in flight,
+  // signaling the events of non-blocking callers with a host adapter error.
+  //
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  for (QueueIdx = 0; QueueIdx < Dev->NumQueues; ++QueueIdx) {
+    Queue = &Dev->Queues[QueueIdx];
+    for (ReqIdx = 0; ReqIdx < Queue->MaxPending; ++ReqIdx) {
+      if (Queue->Reqs[ReqIdx].InFlight) {
+        VirtioScsiCompleteRequest (
+          Dev,
+          Queue,
+          ReqIdx,
+          FALSE                         // HostComplete
+          );
+      }
+    }
+  }
+
+  gBS->RestoreTPL (OldTpl);
+
+  gBS->CloseEvent (Dev->PollTimer);
+
   Dev->InOutSupported = FALSE;
   Dev->MaxTarget      = 0;
   Dev->MaxLun         = 0;
   Dev->MaxSectors     = 0;
 
-  Dev->VirtIo->UnmapSharedBuffer (Dev->VirtIo, Dev->RingMap);
-  VirtioRingUninit (Dev->VirtIo, &Dev->Ring);
+  for (QueueIdx = 0; QueueIdx < Dev->NumQueues; ++QueueIdx) {
+    VirtioScsiUninitQueue (Dev, &Dev->Queues[QueueIdx]);
+  }
+
+  FreePool (Dev->Queues);
+  Dev->Queues    = NULL;
+  Dev->NumQueues = 0;
 
   SetMem (&Dev->PassThru, sizeof Dev->PassThru, 0x00);
   SetMem (&Dev->PassThruMode, sizeof Dev->PassThruMode, 0x00);
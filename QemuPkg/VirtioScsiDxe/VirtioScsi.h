@@ -17,6 +17,7 @@
 #include <Protocol/ScsiPassThruExt.h>
 
 #include <IndustryStandard/Virtio.h>
+#include <IndustryStandard/VirtioScsi.h>
 
 //
 // This driver supports 2-byte target identifiers and 4-byte LUN identifiers.
@@ -34,6 +35,86 @@
 
 #define VSCSI_SIG  SIGNATURE_32 ('V', 'S', 'C', 'S')
 
+//
+// maximum number of requests in flight per request queue, blocking and
+// non-blocking together
+//
+#define VSCSI_MAX_PENDING  32
+
+//
+// Every request owns a fixed group of consecutive descriptors in the ring:
+// request header, data-out buffer, response, data-in buffer. With indirect
+// descriptors, the group lives in the indirect table of the request, and the
+// request owns a single descriptor in the ring.
+//
+#define VSCSI_DESC_PER_REQ  4
+
+//
+// Period of the used ring poll that completes non-blocking requests, in 100ns
+// units.
+//
+#define VSCSI_ASYNC_POLL_PERIOD  EFI_TIMER_PERIOD_MILLISECONDS (1)
+
+//
+// Request header and response of a request slot. An array of these is
+// allocated and mapped as a common buffer once per request queue, and indexed
+// by request slot (that is, by head descriptor index / VSCSI_QUEUE.DescPerReq),
+// so that only the data buffers need to be mapped per request.
+//
+typedef struct {
+  VIRTIO_SCSI_REQ     Request;
+  VIRTIO_SCSI_RESP    Response;
+} VSCSI_SHARED_REQ;
+
+//
+// The result of a request, as collected by a blocking PassThru() call.
+//
+typedef struct {
+  BOOLEAN       Done;
+  EFI_STATUS    Status;
+} VSCSI_WAIT;
+
+//
+// Tracking structure for a request that has been submitted to the host.
+//
+// Non-blocking requests carry the caller's Event, blocking requests the
+// caller's VSCSI_WAIT. Async requests are reaped by the poll timer. A request
+// whose submission failed after the host could see it is abandoned: Packet,
+// Event and Wait are cleared, and it is reaped as an Async request.
+//
+typedef struct {
+  EFI_EXT_SCSI_PASS_THRU_SCSI_REQUEST_PACKET    *Packet;
+  EFI_EVENT                                     Event;
+  VSCSI_WAIT                                    *Wait;
+  BOOLEAN                                       Async;
+  VOID                                          *InDataBuffer;
+  UINTN                                         InDataNumPages;
+  VOID                                          *InDataMapping;
+  VOID                                          *OutDataMapping;
+  BOOLEAN                                       OutDataIsMapped;
+  BOOLEAN                                       InFlight;
+} VSCSI_REQ;
+
+//
+// A request virtqueue, with the request slots that track its requests in
+// flight. All fields are set up by VirtioScsiInitQueue().
+//
+typedef struct {
+  UINT16                       QueueIndex;
+  VRING                        Ring;
+  VOID                         *RingMap;
+  UINT16                       DescPerReq;
+  UINT16                       MaxPending;
+  UINT16                       CurPending;
+  UINT16                       *FreeStack;
+  VSCSI_REQ                    *Reqs;
+  volatile VSCSI_SHARED_REQ    *SharedReqs;
+  UINTN                        SharedReqsNrPages;
+  VOID                         *SharedReqsMap;
+  EFI_PHYSICAL_ADDRESS         SharedReqsBase;
+  UINT16                       LastUsed;
+} VSCSI_QUEUE;
+
 typedef struct {
   //
   // Parts of this structure are initialized / torn down in various functions
@@ -49,10 +130,13 @@ typedef struct {
   UINT16                             MaxTarget;      // VirtioScsiInit      1
   UINT32                             MaxLun;         // VirtioScsiInit      1
   UINT32                             MaxSectors;     // VirtioScsiInit      1
-  VRING                              Ring;           // VirtioRingInit      2
+  UINT16                             NumQueues;      // VirtioScsiInit      1
+  VSCSI_QUEUE                        *Queues;        // VirtioScsiInit      1
+  UINT16                             NextQueue;      // VirtioScsiInit      1
+  UINTN                              AsyncPending;   // VirtioScsiInit      1
+  EFI_EVENT                          PollTimer;      // VirtioScsiInit      1
   EFI_EXT_SCSI_PASS_THRU_PROTOCOL    PassThru;       // VirtioScsiInit      1
   EFI_EXT_SCSI_PASS_THRU_MODE        PassThruMode;   // VirtioScsiInit      1
-  VOID                               *RingMap;       // VirtioRingMap       2
 } VSCSI_DEV;
 
 #define VIRTIO_SCSI_FROM_PASS_THRU(PassThruPointer) \